@@ -8,10 +8,25 @@ volatile const u8 has_filter_sampling = 0;
 volatile const u8 trace_messages = 0;
 volatile const u8 enable_rtt = 0;
 volatile const u8 enable_pca = 0;
+volatile const u8 enable_pca_ringbuf = 0;
+volatile const u32 pca_snaplen = 0;
 volatile const u8 enable_dns_tracking = 0;
 volatile const u8 enable_flows_filtering = 0;
 volatile const u16 dns_port = 0;
 volatile const u8 enable_network_events_monitoring = 0;
 volatile const u8 network_events_monitoring_groupid = 0;
 volatile const u8 enable_pkt_translation_tracking = 0;
+volatile const u8 enable_percpu_aggregation = 0;
+volatile const u8 enable_flows_expiry = 0;
+volatile const u64 flows_expiry_period = 0;
+volatile const u64 flows_idle_timeout = 0;
+volatile const u64 dns_flows_timeout = 0;
+volatile const u8 track_flows_inserts = 0;
+volatile const u8 enable_compact_ipv4_keys = 0;
+volatile const u8 enable_flows_sketch = 0;
+volatile const u32 flows_sketch_slots = 1;
+volatile const u8 enable_adaptive_sampling = 0;
+volatile const u32 ringbuf_wakeup_threshold = 0;
+volatile const u8 enable_flow_latencies = 0;
+volatile const u64 rtt_sampling_interval = 0;
 #endif //__CONFIGS_H__
@@ -35,53 +35,61 @@ static inline void fill_dns_id(flow_id *id, dns_flow_id *dns_flow, u16 dns_id, b
     }
 }
 
-static __always_inline u8 calc_dns_header_offset(pkt_info *pkt, void *data_end) {
-    u8 len = 0;
-    switch (pkt->id->transport_protocol) {
-    case IPPROTO_TCP: {
-        struct tcphdr *tcp = (struct tcphdr *)pkt->l4_hdr;
-        if (!tcp || ((void *)tcp + sizeof(*tcp) > data_end)) {
-            return 0;
-        }
-        len = tcp->doff * sizeof(u32) + 2; // DNS over TCP has 2 bytes of length at the beginning
-        break;
+// dns_query_expired returns whether a query is too old to be answered, so that the stale queries
+// are ignored and replaced without waiting for them to be deleted
+static __always_inline bool dns_query_expired(u64 query_ts, u64 now) {
+    return dns_flows_timeout != 0 && query_ts < now && now - query_ts >= dns_flows_timeout;
+}
+
+// calc_dns_header_offset returns the offset of the DNS header from the transport header, from the
+// transport header length recorded by fill_l4info when it parsed it
+static __always_inline u8 calc_dns_header_offset(pkt_info *pkt) {
+    if (!pkt->l4_hdr) {
+        return 0;
     }
+    switch (pkt->id->transport_protocol) {
+    case IPPROTO_TCP:
+        // DNS over TCP has 2 bytes of length at the beginning
+        return pkt->l4_hdr_len + 2;
     case IPPROTO_UDP: {
+        // fill_l4info only sets l4_hdr once the whole UDP header is in the linear data
         struct udphdr *udp = (struct udphdr *)pkt->l4_hdr;
-        if (!udp || ((void *)udp + sizeof(*udp) > data_end)) {
-            return 0;
-        }
-        len = bpf_ntohs(udp->len);
+        u8 len = bpf_ntohs(udp->len);
         // make sure udp payload doesn't exceed max msg size
         if (len - sizeof(struct udphdr) > UDP_MAXMSG) {
             return 0;
         }
-        // set the length to udp hdr size as it will be used to locate dns header
-        len = sizeof(struct udphdr);
-        break;
+        return pkt->l4_hdr_len;
     }
     }
-    return len;
+    return 0;
 }
 
-static __always_inline int track_dns_packet(struct __sk_buff *skb, pkt_info *pkt) {
-    void *data_end = (void *)(long)skb->data_end;
+// track_dns_packet reuses the headers parsed by the flows program. The DNS header is read directly
+// from the packet when it is in its linear data, and otherwise copied from the socket buffer, if any.
+static __always_inline int track_dns_packet(struct __sk_buff *skb, pkt_info *pkt, void *data_end) {
     int ret = 0;
     if (pkt->id->dst_port == dns_port || pkt->id->src_port == dns_port ||
         pkt->id->dst_port == DNS_DEFAULT_PORT || pkt->id->src_port == DNS_DEFAULT_PORT) {
         dns_flow_id dns_req;
         __builtin_memset(&dns_req, 0, sizeof(dns_req));
 
-        u8 len = calc_dns_header_offset(pkt, data_end);
+        u8 len = calc_dns_header_offset(pkt);
         if (!len) {
             return EINVAL;
         }
 
         struct dns_header dns;
-        u32 dns_offset = (long)pkt->l4_hdr - (long)skb->data + len;
-
-        if ((ret = bpf_skb_load_bytes(skb, dns_offset, &dns, sizeof(dns))) < 0) {
-            return -ret;
+        void *dns_hdr = pkt->l4_hdr + len;
+        if (dns_hdr + sizeof(dns) <= data_end) {
+            __builtin_memcpy(&dns, dns_hdr, sizeof(dns));
+        } else if (skb != NULL) {
+            u32 dns_offset = (long)pkt->l4_hdr - (long)skb->data + len;
+            if ((ret = bpf_skb_load_bytes(skb, dns_offset, &dns, sizeof(dns))) < 0) {
+                return -ret;
+            }
+        } else {
+            return EINVAL;
         }
 
         u16 dns_id = bpf_ntohs(dns.id);
@@ -91,8 +99,14 @@ static __always_inline int track_dns_packet(struct __sk_buff *skb, pkt_info *pkt
         if ((flags & DNS_QR_FLAG) == 0) { /* dns query */
             fill_dns_id(pkt->id, &dns_req, dns_id, false);
             ret = bpf_map_update_elem(&dns_flows, &dns_req, &ts, BPF_NOEXIST);
-            if (ret != 0) {
-                if (trace_messages && ret != -EEXIST) {
+            if (ret == -EEXIST) {
+                // a retransmitted query keeps the time of the first one, unless it is stale
+                u64 *value = bpf_map_lookup_elem(&dns_flows, &dns_req);
+                if (value != NULL && dns_query_expired(*value, ts)) {
+                    *value = ts;
+                }
+            } else if (ret != 0) {
+                if (trace_messages) {
                     bpf_printk("error creating new dns entry %d\n", ret);
                 }
             }
@@ -100,7 +114,9 @@ static __always_inline int track_dns_packet(struct __sk_buff *skb, pkt_info *pkt
             fill_dns_id(pkt->id, &dns_req, dns_id, true);
             u64 *value = bpf_map_lookup_elem(&dns_flows, &dns_req);
             if (value != NULL) {
-                pkt->dns_latency = ts - *value;
+                if (!dns_query_expired(*value, ts)) {
+                    pkt->dns_latency = ts - *value;
+                }
                 bpf_map_delete_elem(&dns_flows, &dns_req);
             } else {
                 ret = ENOENT;
@@ -1,15 +1,17 @@
 /*
     Flows v2.
-    Flow monitor: A Flow-metric generator using TC.
+    Flow monitor: A Flow-metric generator using TC, or optionally XDP on ingress.
 
-    This program can be hooked on to TC ingress/egress hook to monitor packets
+    This program can be hooked on to TC ingress/egress hook, or XDP hook, to monitor packets
     to/from an interface.
 
     Logic:
         1) Store flow information in a hash map.
-        2) Periodically evict the entry from map from userspace.
+        2) Periodically evict the entry from map from userspace, or optionally expire the idle
+            entries from the kernel.
         3) When the map is full/busy, we send the new flow entry to userspace via ringbuffer,
-            until an entry is available.
+            until an entry is available. Optionally, the flow is aggregated instead in a
+            bounded sketch tier.
 */
 #include <vmlinux.h>
 #include <bpf_helpers.h>
@@ -51,6 +53,16 @@
  * Defines packets translation tracker
  */
 #include "pkt_translation.h"
+/*
+ * Defines the kernel-side expiry of idle flows,
+ * which is armed by flow_monitor. Is optional.
+ */
+#include "flows_expiry.h"
+/*
+ * Defines the sketch-based aggregation tier for the flows
+ * that can't be inserted in the flows map. Is optional.
+ */
+#include "flows_sketch.h"
 
 // return 0 on success, 1 if capacity reached
 static __always_inline int add_observed_intf(flow_metrics *value, pkt_info *pkt, u32 if_index,
@@ -75,26 +87,60 @@ static __always_inline int add_observed_intf(flow_metrics *value, pkt_info *pkt,
     return 0;
 }
 
-static __always_inline void update_existing_flow(flow_metrics *aggregate_flow, pkt_info *pkt,
-                                                 u64 len, u32 sampling, u32 if_index,
-                                                 u8 direction) {
+// add_sampled_packet counts a packet sampled at a rate that differs from the flow one, after an
+// adaptive sampling change. The counters are weighted to the lowest rate, so that the estimates
+// (counters * rate) remain right: either the packet is weighted to the flow rate, or the flow
+// counters are rescaled to the packet rate.
+static __always_inline void add_sampled_packet(flow_metrics *aggregate_flow, u64 len,
+                                               u32 sampling) {
+    u64 flow_rate = aggregate_flow->sampling > 1 ? aggregate_flow->sampling : 1;
+    u64 rate = sampling > 1 ? sampling : 1;
+    if (rate < flow_rate) {
+        aggregate_flow->packets = aggregate_flow->packets * flow_rate / rate + 1;
+        aggregate_flow->bytes = aggregate_flow->bytes * flow_rate / rate + len;
+        aggregate_flow->sampling = sampling;
+    } else {
+        aggregate_flow->packets += rate / flow_rate;
+        aggregate_flow->bytes += len * rate / flow_rate;
+    }
+}
+
+static __always_inline int update_flow_fields(flow_metrics *aggregate_flow, pkt_info *pkt,
+                                              u64 len, u32 sampling, u32 if_index, u8 direction) {
     // Count only packets seen from the same interface as previously to avoid duplicate counts
     int maxReached = 0;
-    bpf_spin_lock(&aggregate_flow->lock);
     if (aggregate_flow->if_index_first_seen == if_index) {
-        aggregate_flow->packets += 1;
-        aggregate_flow->bytes += len;
+        if (enable_adaptive_sampling && aggregate_flow->sampling != sampling) {
+            add_sampled_packet(aggregate_flow, len, sampling);
+        } else {
+            aggregate_flow->packets += 1;
+            aggregate_flow->bytes += len;
+            aggregate_flow->sampling = sampling;
+        }
         aggregate_flow->end_mono_time_ts = pkt->current_ts;
         aggregate_flow->flags |= pkt->flags;
         aggregate_flow->dscp = pkt->dscp;
-        aggregate_flow->sampling = sampling;
     } else if (if_index != 0) {
         // Only add info that we've seen this interface (we can also update end time & flags)
         aggregate_flow->end_mono_time_ts = pkt->current_ts;
         aggregate_flow->flags |= pkt->flags;
         maxReached = add_observed_intf(aggregate_flow, pkt, if_index, direction);
     }
-    bpf_spin_unlock(&aggregate_flow->lock);
+    return maxReached;
+}
+
+static __always_inline void update_existing_flow(flow_metrics *aggregate_flow, pkt_info *pkt,
+                                                 u64 len, u32 sampling, u32 if_index,
+                                                 u8 direction) {
+    int maxReached = 0;
+    if (enable_percpu_aggregation) {
+        // Per-CPU entries are never accessed concurrently: no lock needed
+        maxReached = update_flow_fields(aggregate_flow, pkt, len, sampling, if_index, direction);
+    } else {
+        bpf_spin_lock(&aggregate_flow->lock);
+        maxReached = update_flow_fields(aggregate_flow, pkt, len, sampling, if_index, direction);
+        bpf_spin_unlock(&aggregate_flow->lock);
+    }
     if (maxReached > 0) {
         BPF_PRINTK("observed interface missed (array capacity reached); ifindex=%d, eth_type=%d, "
                    "proto=%d, sport=%d, dport=%d\n",
@@ -107,6 +153,49 @@ static __always_inline void update_existing_flow(flow_metrics *aggregate_flow, p
     }
 }
 
+// set_flow_id_v4 fills the compact key of an IPv4 flow
+static __always_inline void set_flow_id_v4(flow_id_v4 *key, flow_id *id) {
+    __builtin_memset(key, 0, sizeof(*key));
+    __builtin_memcpy(key->src_ip, id->src_ip + sizeof(ip4in6), sizeof(key->src_ip));
+    __builtin_memcpy(key->dst_ip, id->dst_ip + sizeof(ip4in6), sizeof(key->dst_ip));
+    key->src_port = id->src_port;
+    key->dst_port = id->dst_port;
+    key->transport_protocol = id->transport_protocol;
+    key->icmp_type = id->icmp_type;
+    key->icmp_code = id->icmp_code;
+}
+
+// lookup_flow returns the flow metrics from the aggregation map in use. In per-CPU mode,
+// it points to the current CPU's value, which is zeroed if the flow was created from another CPU.
+// When compact is set, IPv4 flows are looked up by their compact key.
+static __always_inline flow_metrics *lookup_flow(flow_id *id, flow_id_v4 *key_v4, bool compact) {
+    if (enable_percpu_aggregation) {
+        return (flow_metrics *)bpf_map_lookup_elem(&aggregated_flows_percpu, id);
+    }
+    if (compact) {
+        return (flow_metrics *)bpf_map_lookup_elem(&aggregated_flows_v4, key_v4);
+    }
+    return (flow_metrics *)bpf_map_lookup_elem(&aggregated_flows, id);
+}
+
+static __always_inline long insert_flow(flow_id *id, flow_id_v4 *key_v4, bool compact,
+                                        flow_metrics *new_flow) {
+    if (enable_percpu_aggregation) {
+        return bpf_map_update_elem(&aggregated_flows_percpu, id, new_flow, BPF_NOEXIST);
+    }
+    if (compact) {
+        return bpf_map_update_elem(&aggregated_flows_v4, key_v4, new_flow, BPF_NOEXIST);
+    }
+    return bpf_map_update_elem(&aggregated_flows, id, new_flow, BPF_NOEXIST);
+}
+
+// is_unset_percpu_flow returns true when the flow exists in the per-CPU map, but
+// no packet has been accounted for it yet on the current CPU. It checks the end time, which is
+// always set, as it is part of the per-packet fields.
+static __always_inline bool is_unset_percpu_flow(flow_metrics *aggregate_flow) {
+    return enable_percpu_aggregation && aggregate_flow->end_mono_time_ts == 0;
+}
+
 static inline void update_dns(additional_metrics *extra_metrics, pkt_info *pkt, int dns_errno) {
     if (pkt->dns_id != 0) {
         extra_metrics->end_mono_time_ts = pkt->current_ts;
@@ -119,13 +208,79 @@ static inline void update_dns(additional_metrics *extra_metrics, pkt_info *pkt,
     }
 }
 
-static inline int flow_monitor(struct __sk_buff *skb, u8 direction) {
+// current_sampling returns the sampling rate to apply: the configured one, unless it has been
+// raised from userspace by the adaptive sampling. A rate of 1 is the same as no sampling (0), and
+// doesn't override it.
+static __always_inline u32 current_sampling() {
+    if (!enable_adaptive_sampling) {
+        return sampling;
+    }
+    u32 key = 0;
+    u32 *adaptive = bpf_map_lookup_elem(&adaptive_sampling, &key);
+    if (adaptive && *adaptive > 1 && *adaptive > sampling) {
+        return *adaptive;
+    }
+    return sampling;
+}
+
+// latency_bucket returns the histogram bucket of a processing time: the index of its highest bit
+// set, capped to the last bucket
+static __always_inline u32 latency_bucket(u64 ns) {
+    u32 bucket = 0;
+    if (ns >> 32) {
+        bucket += 32;
+        ns >>= 32;
+    }
+    if (ns >> 16) {
+        bucket += 16;
+        ns >>= 16;
+    }
+    if (ns >> 8) {
+        bucket += 8;
+        ns >>= 8;
+    }
+    if (ns >> 4) {
+        bucket += 4;
+        ns >>= 4;
+    }
+    if (ns >> 2) {
+        bucket += 2;
+        ns >>= 2;
+    }
+    if (ns >> 1) {
+        bucket += 1;
+    }
+    return bucket < FLOW_LATENCY_BUCKETS ? bucket : FLOW_LATENCY_BUCKETS - 1;
+}
+
+// record_flow_latency accounts the time spent since the start of the packet processing in the
+// histogram of its flow path
+static __always_inline void record_flow_latency(u32 path, u64 start_ts) {
+    flow_latency *latency = bpf_map_lookup_elem(&flow_latencies, &path);
+    if (!latency) {
+        return;
+    }
+    u64 elapsed = bpf_ktime_get_ns() - start_ts;
+    u32 bucket = latency_bucket(elapsed);
+    // per-CPU entry: no concurrent update
+    latency->buckets[bucket & (FLOW_LATENCY_BUCKETS - 1)] += 1;
+    latency->sum_ns += elapsed;
+}
+
+// monitor_packet parses a packet once, and accounts it in the flows maps along with its DNS
+// metrics. It is shared by the TC and XDP programs: skb is NULL when invoked from XDP.
+static __always_inline void monitor_packet(struct __sk_buff *skb, void *data, void *data_end,
+                                           u64 len, u32 if_index, u8 direction) {
+    if (enable_flows_expiry) {
+        arm_expiry_timer();
+    }
+    u32 flow_sampling = current_sampling();
     if (!has_filter_sampling) {
         // When no filter sampling is defined, run the sampling check at the earliest for better performances
         // If sampling is defined, will only parse 1 out of "sampling" flows
-        if (sampling > 1 && (bpf_get_prandom_u32() % sampling) != 0) {
+        if (flow_sampling > 1 && (bpf_get_prandom_u32() % flow_sampling) != 0) {
             do_sampling = 0;
-            return TC_ACT_OK;
+            return;
         }
         do_sampling = 1;
     }
@@ -140,13 +295,10 @@ static inline int flow_monitor(struct __sk_buff *skb, u8 direction) {
     pkt.current_ts = bpf_ktime_get_ns(); // Record the current time first.
     pkt.id = &id;
 
-    void *data_end = (void *)(long)skb->data_end;
-    void *data = (void *)(long)skb->data;
     struct ethhdr *eth = (struct ethhdr *)data;
-    u64 len = skb->len;
 
     if (fill_ethhdr(eth, data_end, &pkt, &eth_protocol) == DISCARD) {
-        return TC_ACT_OK;
+        return;
     }
 
     // check if this packet need to be filtered if filtering feature is enabled
@@ -155,31 +307,46 @@ static inline int flow_monitor(struct __sk_buff *skb, u8 direction) {
         check_and_do_flow_filtering(&id, pkt.flags, 0, eth_protocol, &filter_sampling, direction);
     if (has_filter_sampling) {
         if (filter_sampling == 0) {
-            filter_sampling = sampling;
+            filter_sampling = flow_sampling;
+        } else if (flow_sampling > sampling && filter_sampling < flow_sampling) {
+            // the adaptive sampling also raises the rules sampling
+            filter_sampling = flow_sampling;
         }
         // If sampling is defined, will only parse 1 out of "sampling" flows
         if (filter_sampling > 1 && (bpf_get_prandom_u32() % filter_sampling) != 0) {
             do_sampling = 0;
-            return TC_ACT_OK;
+            return;
         }
         do_sampling = 1;
     }
     if (skip) {
-        return TC_ACT_OK;
+        return;
+    }
+    if (enable_adaptive_sampling && filter_sampling == 0) {
+        // report the effective rate, which might differ from the configured one
+        filter_sampling = flow_sampling;
     }
 
     int dns_errno = 0;
     if (enable_dns_tracking) {
-        dns_errno = track_dns_packet(skb, &pkt);
+        dns_errno = track_dns_packet(skb, &pkt, data_end);
+    }
+    // IPv4 flows are hashed by their compact key, when enabled
+    flow_id_v4 id_v4;
+    bool compact = enable_compact_ipv4_keys && !enable_percpu_aggregation && eth_protocol == ETH_P_IP;
+    if (compact) {
+        set_flow_id_v4(&id_v4, &id);
     }
-    flow_metrics *aggregate_flow = (flow_metrics *)bpf_map_lookup_elem(&aggregated_flows, &id);
-    if (aggregate_flow != NULL) {
-        update_existing_flow(aggregate_flow, &pkt, len, filter_sampling, skb->ifindex, direction);
+    flow_metrics *aggregate_flow = lookup_flow(&id, &id_v4, compact);
+    u32 path = FLOW_PATH_EXISTING;
+    if (aggregate_flow != NULL && !is_unset_percpu_flow(aggregate_flow)) {
+        update_existing_flow(aggregate_flow, &pkt, len, filter_sampling, if_index, direction);
     } else {
+        path = FLOW_PATH_NEW;
         // Key does not exist in the map, and will need to create a new entry.
         flow_metrics new_flow;
         __builtin_memset(&new_flow, 0, sizeof(new_flow));
-        new_flow.if_index_first_seen = skb->ifindex;
+        new_flow.if_index_first_seen = if_index;
         new_flow.direction_first_seen = direction;
         new_flow.packets = 1;
         new_flow.bytes = len;
@@ -192,16 +359,28 @@ static inline int flow_monitor(struct __sk_buff *skb, u8 direction) {
         __builtin_memcpy(new_flow.dst_mac, eth->h_dest, ETH_ALEN);
         __builtin_memcpy(new_flow.src_mac, eth->h_source, ETH_ALEN);
 
-        long ret = bpf_map_update_elem(&aggregated_flows, &id, &new_flow, BPF_NOEXIST);
+        long ret = 0;
+        if (aggregate_flow != NULL) {
+            // Per-CPU mode: the entry was created from another CPU, initialize this CPU's value
+            __builtin_memcpy(aggregate_flow, &new_flow, sizeof(new_flow));
+        } else {
+            ret = insert_flow(&id, &id_v4, compact, &new_flow);
+            if (track_flows_inserts && ret == 0) {
+                // Used to estimate the flows silently evicted from LRU maps
+                increase_counter(HASHMAP_FLOWS_INSERTED);
+            }
+        }
         if (ret != 0) {
             if (trace_messages && ret != -EEXIST) {
                 bpf_printk("error adding flow %d\n", ret);
             }
             if (ret == -EEXIST) {
-                flow_metrics *aggregate_flow =
-                    (flow_metrics *)bpf_map_lookup_elem(&aggregated_flows, &id);
-                if (aggregate_flow != NULL) {
-                    update_existing_flow(aggregate_flow, &pkt, len, filter_sampling, skb->ifindex,
+                flow_metrics *aggregate_flow = lookup_flow(&id, &id_v4, compact);
+                if (aggregate_flow != NULL && is_unset_percpu_flow(aggregate_flow)) {
+                    // Concurrent creation from another CPU in per-CPU mode
+                    __builtin_memcpy(aggregate_flow, &new_flow, sizeof(new_flow));
+                } else if (aggregate_flow != NULL) {
+                    update_existing_flow(aggregate_flow, &pkt, len, filter_sampling, if_index,
                                          direction);
                 } else {
                     if (trace_messages) {
@@ -217,17 +396,22 @@ static inline int flow_monitor(struct __sk_buff *skb, u8 direction) {
                 // which can be re-aggregated at userpace.
                 // other possible values https://chromium.googlesource.com/chromiumos/docs/+/master/constants/errnos.md
                 new_flow.errno = -ret;
-                flow_record *record =
-                    (flow_record *)bpf_ringbuf_reserve(&direct_flows, sizeof(flow_record), 0);
-                if (!record) {
-                    if (trace_messages) {
-                        bpf_printk("couldn't reserve space in the ringbuf. Dropping flow");
+                if (enable_flows_sketch) {
+                    // Aggregate in the bounded sketch tier rather than one record per packet
+                    sketch_flow(&id, &new_flow, &pkt, len, if_index);
+                } else {
+                    flow_record *record =
+                        (flow_record *)bpf_ringbuf_reserve(&direct_flows, sizeof(flow_record), 0);
+                    if (!record) {
+                        if (trace_messages) {
+                            bpf_printk("couldn't reserve space in the ringbuf. Dropping flow");
+                        }
+                        return;
                     }
-                    return TC_ACT_OK;
+                    record->id = id;
+                    record->metrics = new_flow;
+                    bpf_ringbuf_submit(record, direct_flows_submit_flags());
                 }
-                record->id = id;
-                record->metrics = new_flow;
-                bpf_ringbuf_submit(record, 0);
             }
         }
     }
@@ -273,6 +457,14 @@ static inline int flow_monitor(struct __sk_buff *skb, u8 direction) {
         }
     }
 
+    if (enable_flow_latencies) {
+        record_flow_latency(path, pkt.current_ts);
+    }
+}
+
+static inline int flow_monitor(struct __sk_buff *skb, u8 direction) {
+    monitor_packet(skb, (void *)(long)skb->data, (void *)(long)skb->data_end, skb->len,
+                   skb->ifindex, direction);
     return TC_ACT_OK;
 }
 
@@ -300,4 +492,17 @@ int tcx_egress_flow_parse(struct __sk_buff *skb) {
     return TCX_NEXT;
 }
 
+// bpf_xdp_get_buff_len (Linux 5.18) is missing from the bundled bpf_helper_defs.h
+static __u64 (*bpf_xdp_get_buff_len)(struct xdp_md *xdp_md) = (void *)188;
+
+// The XDP program accounts the ingress traffic before the socket buffer allocation. The packet
+// length includes the fragments of multi-buffer packets, which are not in [data, data_end).
+SEC("xdp")
+int xdp_ingress_flow_parse(struct xdp_md *ctx) {
+    void *data_end = (void *)(long)ctx->data_end;
+    void *data = (void *)(long)ctx->data;
+    monitor_packet(NULL, data, data_end, bpf_xdp_get_buff_len(ctx), ctx->ingress_ifindex, INGRESS);
+    return XDP_PASS;
+}
+
 char _license[] SEC("license") = "GPL";
@@ -0,0 +1,169 @@
+/*
+ * Kernel-side expiry of idle flows and stale DNS queries, using a BPF timer. Is optional.
+ *
+ * The timer is armed by the first packet seen by flow_monitor. On each expiry period, its
+ * callback walks the aggregated_flows (and aggregated_flows_v4) and dns_flows maps: idle flows are sent to userspace
+ * via the direct_flows ringbuffer and deleted, with their additional metrics, and DNS queries without response are
+ * deleted.
+ * Per-CPU aggregated flows are not expired, as a single CPU value can't tell if a flow is idle.
+ */
+
+#ifndef __FLOWS_EXPIRY_H__
+#define __FLOWS_EXPIRY_H__
+
+#include "utils.h"
+
+#ifndef CLOCK_MONOTONIC
+#define CLOCK_MONOTONIC 1
+#endif
+
+struct expiry_ctx {
+    u64 now;
+};
+
+static __always_inline bool is_idle_flow(flow_metrics *flow, struct expiry_ctx *ctx) {
+    u64 end = flow->end_mono_time_ts;
+    return end < ctx->now && ctx->now - end >= flows_idle_timeout;
+}
+
+// copy_expired_flow fills the record of an expired flow. The spin lock can't be copied:
+// the fields are copied one by one. Must be called with the flow lock held.
+static __always_inline void copy_expired_flow(flow_record *record, flow_metrics *flow) {
+    record->metrics.start_mono_time_ts = flow->start_mono_time_ts;
+    record->metrics.end_mono_time_ts = flow->end_mono_time_ts;
+    record->metrics.bytes = flow->bytes;
+    record->metrics.packets = flow->packets;
+    record->metrics.eth_protocol = flow->eth_protocol;
+    record->metrics.flags = flow->flags;
+    __builtin_memcpy(record->metrics.src_mac, flow->src_mac, ETH_ALEN);
+    __builtin_memcpy(record->metrics.dst_mac, flow->dst_mac, ETH_ALEN);
+    record->metrics.if_index_first_seen = flow->if_index_first_seen;
+    record->metrics.sampling = flow->sampling;
+    record->metrics.direction_first_seen = flow->direction_first_seen;
+    record->metrics.errno = ETIME;
+    record->metrics.dscp = flow->dscp;
+    record->metrics.nb_observed_intf = flow->nb_observed_intf;
+    __builtin_memcpy(record->metrics.observed_direction, flow->observed_direction,
+                     sizeof(record->metrics.observed_direction));
+    __builtin_memcpy(record->metrics.observed_intf, flow->observed_intf,
+                     sizeof(record->metrics.observed_intf));
+}
+
+// copy_idle_flow copies the flow into the record if it is idle, while holding the flow lock
+static __always_inline bool copy_idle_flow(flow_record *record, flow_metrics *flow,
+                                           struct expiry_ctx *ctx) {
+    bool idle;
+    bpf_spin_lock(&flow->lock);
+    idle = is_idle_flow(flow, ctx);
+    if (idle) {
+        copy_expired_flow(record, flow);
+    }
+    bpf_spin_unlock(&flow->lock);
+    return idle;
+}
+
+// submit_expired_flow deletes the expired flow, with its additional metrics, and sends it to
+// userspace. The packets accounted between the copy and the deletion are copied again, so that
+// they are not lost: the packets coming after the deletion create a new flow.
+static __always_inline void submit_expired_flow(struct bpf_map *map, void *key, flow_id *id,
+                                                flow_metrics *flow, flow_record *record) {
+    bpf_map_delete_elem(map, key);
+    bpf_spin_lock(&flow->lock);
+    if (flow->end_mono_time_ts != record->metrics.end_mono_time_ts) {
+        copy_expired_flow(record, flow);
+    }
+    bpf_spin_unlock(&flow->lock);
+    bpf_map_delete_elem(&additional_flow_metrics, id);
+    bpf_ringbuf_submit(record, direct_flows_submit_flags());
+}
+
+static int expire_flow(struct bpf_map *map, flow_id *id, flow_metrics *flow,
+                       struct expiry_ctx *ctx) {
+    if (!is_idle_flow(flow, ctx)) {
+        return 0;
+    }
+    flow_record *record = (flow_record *)bpf_ringbuf_reserve(&direct_flows, sizeof(flow_record), 0);
+    if (!record) {
+        // keep the flow for the userspace eviction
+        return 0;
+    }
+    if (!copy_idle_flow(record, flow, ctx)) {
+        // updated since the unlocked check
+        bpf_ringbuf_discard(record, 0);
+        return 0;
+    }
+    record->id = *id;
+    submit_expired_flow(map, id, id, flow, record);
+    return 0;
+}
+
+// expire_flow_v4 expires the flows of the compact IPv4 map, which are sent to userspace with
+// their full flow identifier
+static int expire_flow_v4(struct bpf_map *map, flow_id_v4 *id, flow_metrics *flow,
+                          struct expiry_ctx *ctx) {
+    if (!is_idle_flow(flow, ctx)) {
+        return 0;
+    }
+    flow_record *record = (flow_record *)bpf_ringbuf_reserve(&direct_flows, sizeof(flow_record), 0);
+    if (!record) {
+        return 0;
+    }
+    if (!copy_idle_flow(record, flow, ctx)) {
+        bpf_ringbuf_discard(record, 0);
+        return 0;
+    }
+    flow_id full_id;
+    __builtin_memset(&full_id, 0, sizeof(full_id));
+    __builtin_memcpy(full_id.src_ip, ip4in6, sizeof(ip4in6));
+    __builtin_memcpy(full_id.src_ip + sizeof(ip4in6), id->src_ip, sizeof(id->src_ip));
+    __builtin_memcpy(full_id.dst_ip, ip4in6, sizeof(ip4in6));
+    __builtin_memcpy(full_id.dst_ip + sizeof(ip4in6), id->dst_ip, sizeof(id->dst_ip));
+    full_id.src_port = id->src_port;
+    full_id.dst_port = id->dst_port;
+    full_id.transport_protocol = id->transport_protocol;
+    full_id.icmp_type = id->icmp_type;
+    full_id.icmp_code = id->icmp_code;
+    record->id = full_id;
+    submit_expired_flow(map, id, &full_id, flow, record);
+    return 0;
+}
+
+static int expire_dns_query(struct bpf_map *map, dns_flow_id *id, u64 *ts, struct expiry_ctx *ctx) {
+    if (*ts < ctx->now && ctx->now - *ts >= dns_flows_timeout) {
+        bpf_map_delete_elem(map, id);
+    }
+    return 0;
+}
+
+static int expire_flows(void *map, u32 *key, struct expiry_timer_t *timer) {
+    struct expiry_ctx ctx = {.now = bpf_ktime_get_ns()};
+    if (!enable_percpu_aggregation) {
+        bpf_for_each_map_elem(&aggregated_flows, expire_flow, &ctx, 0);
+        if (enable_compact_ipv4_keys) {
+            bpf_for_each_map_elem(&aggregated_flows_v4, expire_flow_v4, &ctx, 0);
+        }
+    }
+    if (enable_dns_tracking) {
+        bpf_for_each_map_elem(&dns_flows, expire_dns_query, &ctx, 0);
+    }
+    bpf_timer_start(&timer->timer, flows_expiry_period, 0);
+    return 0;
+}
+
+// arm_expiry_timer starts the expiry timer, if it has not been started yet
+static __always_inline void arm_expiry_timer() {
+    u32 key = 0;
+    struct expiry_timer_t *timer = bpf_map_lookup_elem(&expiry_timer, &key);
+    if (!timer || timer->armed) {
+        return;
+    }
+    if (bpf_timer_init(&timer->timer, &expiry_timer, CLOCK_MONOTONIC) != 0) {
+        // -EBUSY: initialized concurrently from another CPU
+        return;
+    }
+    timer->armed = 1;
+    bpf_timer_set_callback(&timer->timer, expire_flows);
+    bpf_timer_start(&timer->timer, flows_expiry_period, 0);
+}
+
+#endif /* __FLOWS_EXPIRY_H__ */
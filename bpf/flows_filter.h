@@ -39,219 +39,191 @@ static __always_inline int flow_filter_setup_lookup_key(flow_id *id, struct filt
     return 0;
 }
 
-static __always_inline int do_flow_filter_lookup(flow_id *id, struct filter_key_t *key,
-                                                 filter_action *action, u8 len, u8 offset,
-                                                 u16 flags, u32 drop_reason, u32 *sampling,
-                                                 u8 direction, bool use_src_ip, u16 eth_protocol) {
-    int result = 0;
-
-    struct filter_value_t *rule = (struct filter_value_t *)bpf_map_lookup_elem(&filter_map, key);
+static __always_inline void filter_mask_and(filter_mask *dst, filter_mask *src) {
+#pragma unroll
+    for (int i = 0; i < FILTER_MASK_WORDS; i++) {
+        dst->bits[i] &= src->bits[i];
+    }
+}
 
-    if (rule) {
-        BPF_PRINTK("rule found drop_reason %d flags %d do_peerCIDR_lookup %d\n", drop_reason, flags,
-                   rule->do_peerCIDR_lookup);
-        result++;
-        if (rule->action != MAX_FILTER_ACTIONS) {
-            BPF_PRINTK("action matched: %d\n", rule->action);
-            *action = rule->action;
-            result++;
-        }
+static __always_inline bool filter_mask_empty(filter_mask *mask) {
+    u64 any = 0;
+#pragma unroll
+    for (int i = 0; i < FILTER_MASK_WORDS; i++) {
+        any |= mask->bits[i];
+    }
+    return any == 0;
+}
 
-        if (rule->do_peerCIDR_lookup) {
-            struct filter_key_t peerKey;
-            __builtin_memset(&peerKey, 0, sizeof(peerKey));
-            // PeerCIDR lookup will will target the opposite IP compared to original CIDR lookup
-            // In other words if cidr is using srcIP then peerCIDR will be the dstIP
-            if (flow_filter_setup_lookup_key(id, &peerKey, &len, &offset, use_src_ip,
-                                             eth_protocol) < 0) {
-                BPF_PRINTK("peerCIDR failed to setup lookup key\n");
-                result = 0;
-                goto end;
-            }
+// filter_dimension_lookup returns the rules matching the value of a dimension, or NULL when
+// none matches
+static __always_inline filter_mask *filter_dimension_lookup(filter_dimension dimension, u16 value) {
+    struct filter_dimension_key_t key;
+    __builtin_memset(&key, 0, sizeof(key));
+    key.prefix_len = 24;
+    key.dimension = dimension;
+    key.value[0] = value >> 8;
+    key.value[1] = value & 0xff;
+    return (filter_mask *)bpf_map_lookup_elem(&filter_masks, &key);
+}
 
-            u8 *peer_result = (u8 *)bpf_map_lookup_elem(&peer_filter_map, &peerKey);
-            if (peer_result) {
-                BPF_PRINTK("peerCIDR matched\n");
-                result++;
-            } else {
-                BPF_PRINTK("peerCIDR couldn't find a matching key\n");
-                result = 0;
-                goto end;
-            }
-        }
+// filter_by_dimension removes from the candidates the rules not matching the value of a dimension
+static __always_inline void filter_by_dimension(filter_mask *candidates, filter_dimension dimension,
+                                                u16 value) {
+    filter_mask *mask = filter_dimension_lookup(dimension, value);
+    if (!mask) {
+        __builtin_memset(candidates, 0, sizeof(*candidates));
+        return;
+    }
+    filter_mask_and(candidates, mask);
+}
 
-        if (rule->sample && sampling != NULL) {
-            BPF_PRINTK("sampling action is set to %d\n", rule->sample);
-            *sampling = rule->sample;
-            result++;
+// filter_by_any_port removes from the candidates the rules matching neither the source nor the
+// destination port
+static __always_inline void filter_by_any_port(filter_mask *candidates, u16 src_port,
+                                               u16 dst_port) {
+    filter_mask ports;
+    __builtin_memset(&ports, 0, sizeof(ports));
+    filter_mask *src = filter_dimension_lookup(FILTER_DIM_PORT, src_port);
+    filter_mask *dst = filter_dimension_lookup(FILTER_DIM_PORT, dst_port);
+#pragma unroll
+    for (int i = 0; i < FILTER_MASK_WORDS; i++) {
+        if (src) {
+            ports.bits[i] |= src->bits[i];
         }
-        // match specific rule protocol or use wildcard protocol
-        if (rule->protocol == id->transport_protocol || rule->protocol == 0) {
-            switch (id->transport_protocol) {
-            case IPPROTO_TCP:
-            case IPPROTO_UDP:
-            case IPPROTO_SCTP:
-                // dstPort matching
-                if ((rule->dstPortStart != 0 && rule->dstPortEnd == 0) || rule->dstPort1 != 0 ||
-                    rule->dstPort2 != 0) {
-                    if (rule->dstPortStart == id->dst_port || rule->dstPort1 == id->dst_port ||
-                        rule->dstPort2 == id->dst_port) {
-                        BPF_PRINTK("dstPort matched\n");
-                        result++;
-                    } else {
-                        result = 0;
-                        goto end;
-                    }
-                } else if (rule->dstPortStart != 0 && rule->dstPortEnd != 0) {
-                    if (rule->dstPortStart <= id->dst_port && id->dst_port <= rule->dstPortEnd) {
-                        BPF_PRINTK("dstPortStart and dstPortEnd matched\n");
-                        result++;
-                    } else {
-                        result = 0;
-                        goto end;
-                    }
-                }
-                // srcPort matching
-                if ((rule->srcPortStart != 0 && rule->srcPortEnd == 0) || rule->srcPort1 != 0 ||
-                    rule->srcPort2 != 0) {
-                    if (rule->srcPortStart == id->src_port || rule->srcPort1 == id->src_port ||
-                        rule->srcPort2 == id->src_port) {
-                        BPF_PRINTK("srcPort matched\n");
-                        result++;
-                    } else {
-                        result = 0;
-                        goto end;
-                    }
-                } else if (rule->srcPortStart != 0 && rule->srcPortEnd != 0) {
-                    if (rule->srcPortStart <= id->src_port && id->src_port <= rule->srcPortEnd) {
-                        BPF_PRINTK("srcPortStart and srcPortEnd matched\n");
-                        result++;
-                    } else {
-                        result = 0;
-                        goto end;
-                    }
-                }
-                // Generic port matching check for either src or dst port
-                if ((rule->portStart != 0 && rule->portEnd == 0) || rule->port1 != 0 ||
-                    rule->port2 != 0) {
-                    if (rule->portStart == id->src_port || rule->portStart == id->dst_port ||
-                        rule->port1 == id->src_port || rule->port1 == id->dst_port ||
-                        rule->port2 == id->src_port || rule->port2 == id->dst_port) {
-                        BPF_PRINTK("port matched\n");
-                        result++;
-                    } else {
-                        result = 0;
-                        goto end;
-                    }
-                } else if (rule->portStart != 0 && rule->portEnd != 0) {
-                    if ((rule->portStart <= id->src_port && id->src_port <= rule->portEnd) ||
-                        (rule->portStart <= id->dst_port && id->dst_port <= rule->portEnd)) {
-                        BPF_PRINTK("portStart and portEnd matched\n");
-                        result++;
-                    } else {
-                        result = 0;
-                        goto end;
-                    }
-                }
-                // for TCP only check TCP flags if its set
-                if (id->transport_protocol == IPPROTO_TCP) {
-                    if (rule->tcpFlags != 0) {
-                        if (rule->tcpFlags == flags) {
-                            BPF_PRINTK("tcpFlags matched\n");
-                            result++;
-                        } else {
-                            result = 0;
-                            goto end;
-                        }
-                    }
-                }
-                break;
-            case IPPROTO_ICMP:
-            case IPPROTO_ICMPV6:
-                if (rule->icmpType != 0) {
-                    if (rule->icmpType == id->icmp_type) {
-                        BPF_PRINTK("icmpType matched\n");
-                        result++;
-                    } else {
-                        result = 0;
-                        goto end;
-                    }
-                    if (rule->icmpCode != 0) {
-                        if (rule->icmpCode == id->icmp_code) {
-                            BPF_PRINTK("icmpCode matched\n");
-                            result++;
-                        } else {
-                            result = 0;
-                            goto end;
-                        }
-                    }
-                }
-                break;
-            }
-        } else {
-            result = 0;
-            goto end;
+        if (dst) {
+            ports.bits[i] |= dst->bits[i];
         }
+    }
+    filter_mask_and(candidates, &ports);
+}
 
-        if (rule->direction != MAX_DIRECTION) {
-            if (rule->direction == direction) {
-                BPF_PRINTK("direction matched\n");
-                result++;
-            } else {
-                result = 0;
-                goto end;
-            }
-        }
+// filter_by_cidr sets the candidates to the rules of which the CIDR contains one IP address of
+// the flow, and the peer CIDR (if any) contains the other one
+static __always_inline int filter_by_cidr(flow_id *id, filter_mask *candidates, bool use_src_ip,
+                                          u16 eth_protocol) {
+    struct filter_key_t key;
+    u8 len, offset;
+    __builtin_memset(&key, 0, sizeof(key));
+    __builtin_memset(candidates, 0, sizeof(*candidates));
+    if (flow_filter_setup_lookup_key(id, &key, &len, &offset, use_src_ip, eth_protocol) < 0) {
+        return -1;
+    }
+    filter_mask *cidr = (filter_mask *)bpf_map_lookup_elem(&filter_map, &key);
+    if (!cidr) {
+        return 0;
+    }
+    // PeerCIDR lookup will will target the opposite IP compared to original CIDR lookup
+    // In other words if cidr is using srcIP then peerCIDR will be the dstIP
+    __builtin_memset(&key, 0, sizeof(key));
+    flow_filter_setup_lookup_key(id, &key, &len, &offset, !use_src_ip, eth_protocol);
+    filter_mask *peer = (filter_mask *)bpf_map_lookup_elem(&peer_filter_map, &key);
+    if (!peer) {
+        return 0;
+    }
+    *candidates = *cidr;
+    filter_mask_and(candidates, peer);
+    return 0;
+}
 
-        if (rule->filter_drops) {
-            if (drop_reason != 0) {
-                BPF_PRINTK("drop filter matched\n");
-                result++;
-            } else {
-                result = 0;
-                goto end;
-            }
-        }
+// first_set_bit returns the index of the lowest bit set in a non-zero word
+static __always_inline u32 first_set_bit(u64 word) {
+    u32 n = 0;
+    if (!(word & 0xffffffff)) {
+        n += 32;
+        word >>= 32;
+    }
+    if (!(word & 0xffff)) {
+        n += 16;
+        word >>= 16;
     }
-end:
-    BPF_PRINTK("result: %d action %d\n", result, *action);
-    return result;
+    if (!(word & 0xff)) {
+        n += 8;
+        word >>= 8;
+    }
+    if (!(word & 0xf)) {
+        n += 4;
+        word >>= 4;
+    }
+    if (!(word & 0x3)) {
+        n += 2;
+        word >>= 2;
+    }
+    if (!(word & 0x1)) {
+        n += 1;
+    }
+    return n;
 }
 
 /*
  * check if the flow match filter rule and return >= 1 if the flow is to be dropped
+ * The rules matching each field of the flow are intersected: the first remaining rule is the
+ * matching rule. Otherwise, the action is the one of the flows not matching any rule.
  */
 static __always_inline int is_flow_filtered(flow_id *id, filter_action *action, u16 flags,
                                             u32 drop_reason, u16 eth_protocol, u32 *sampling,
                                             u8 direction) {
-    struct filter_key_t key;
-    u8 len, offset;
-    int result = 0;
-
-    __builtin_memset(&key, 0, sizeof(key));
+    filter_mask candidates, dst_candidates;
     *action = MAX_FILTER_ACTIONS;
 
-    // Lets do first CIDR match using srcIP.
-    result = flow_filter_setup_lookup_key(id, &key, &len, &offset, true, eth_protocol);
-    if (result < 0) {
-        return result;
+    // Lets do first CIDR match using srcIP, then using dstIP.
+    if (filter_by_cidr(id, &candidates, true, eth_protocol) < 0) {
+        return -1;
     }
-
-    result = do_flow_filter_lookup(id, &key, action, len, offset, flags, drop_reason, sampling,
-                                   direction, false, eth_protocol);
-    // we have a match so return
-    if (result > 0) {
-        return result;
+    filter_by_cidr(id, &dst_candidates, false, eth_protocol);
+#pragma unroll
+    for (int i = 0; i < FILTER_MASK_WORDS; i++) {
+        candidates.bits[i] |= dst_candidates.bits[i];
     }
 
-    // if we can't find a match then Lets do second CIDR match using dstIP.
-    result = flow_filter_setup_lookup_key(id, &key, &len, &offset, false, eth_protocol);
-    if (result < 0) {
-        return result;
+    if (!filter_mask_empty(&candidates)) {
+        // match specific rule protocol or use wildcard protocol
+        filter_by_dimension(&candidates, FILTER_DIM_PROTOCOL, id->transport_protocol);
+        switch (id->transport_protocol) {
+        case IPPROTO_TCP:
+        case IPPROTO_UDP:
+        case IPPROTO_SCTP:
+            filter_by_dimension(&candidates, FILTER_DIM_DST_PORT, id->dst_port);
+            filter_by_dimension(&candidates, FILTER_DIM_SRC_PORT, id->src_port);
+            filter_by_any_port(&candidates, id->src_port, id->dst_port);
+            // for TCP only check TCP flags if its set
+            if (id->transport_protocol == IPPROTO_TCP) {
+                filter_by_dimension(&candidates, FILTER_DIM_TCP_FLAGS, flags);
+            }
+            break;
+        case IPPROTO_ICMP:
+        case IPPROTO_ICMPV6:
+            filter_by_dimension(&candidates, FILTER_DIM_ICMP_TYPE, id->icmp_type);
+            filter_by_dimension(&candidates, FILTER_DIM_ICMP_CODE,
+                                (u16)id->icmp_type << 8 | id->icmp_code);
+            break;
+        }
+        filter_by_dimension(&candidates, FILTER_DIM_DIRECTION, direction);
+        filter_by_dimension(&candidates, FILTER_DIM_DROPS, drop_reason != 0);
     }
 
-    return do_flow_filter_lookup(id, &key, action, len, offset, flags, drop_reason, sampling,
-                                 direction, true, eth_protocol);
+    u32 index = MAX_FILTER_RULES;
+#pragma unroll
+    for (int i = FILTER_MASK_WORDS - 1; i >= 0; i--) {
+        if (candidates.bits[i]) {
+            index = i * 64 + first_set_bit(candidates.bits[i]);
+        }
+    }
+    struct filter_value_t *rule = (struct filter_value_t *)bpf_map_lookup_elem(&filter_rules, &index);
+    if (!rule) {
+        return 0;
+    }
+    *action = rule->action;
+    if (index == MAX_FILTER_RULES) {
+        BPF_PRINTK("no rule matched, action %d\n", *action);
+        return 0;
+    }
+    BPF_PRINTK("rule %d matched, action %d\n", index, *action);
+    if (rule->sample && sampling != NULL) {
+        BPF_PRINTK("sampling action is set to %d\n", rule->sample);
+        *sampling = rule->sample;
+    }
+    return 1;
 }
 
 #endif //__FLOWS_FILTER_H__
@@ -0,0 +1,114 @@
+/*
+ * Secondary aggregation tier for the flows that can't be inserted in the flows map, when it is
+ * full or busy. Is optional.
+ *
+ * Instead of sending each packet of these flows via the direct_flows ringbuffer, packets are
+ * counted in a count-min sketch, and their flows are aggregated in a fixed-size table of heavy
+ * hitters, where each flow hashes to a single slot. A flow takes over the slot of another one
+ * when its estimated number of packets exceeds by half the estimate of the slot owner, which is
+ * then sent via ringbuffer. The packets of the other flows are only counted.
+ * Both structures are per-CPU and double-buffered: flows_sketch_epoch selects the half used by
+ * the kernel, userspace flips it before reading and resetting the other half.
+ */
+
+#ifndef __FLOWS_SKETCH_H__
+#define __FLOWS_SKETCH_H__
+
+#include "utils.h"
+
+// sketch_hash returns a 32-bit hash of the flow identifier (FNV-1a over its words, with a final mix)
+static __always_inline u32 sketch_hash(flow_id *id, u32 seed) {
+    u32 *words = (u32 *)id;
+    u32 h = seed;
+#pragma unroll
+    for (int i = 0; i < sizeof(flow_id) / sizeof(u32); i++) {
+        h ^= words[i];
+        h *= 0x01000193;
+    }
+    h ^= h >> 16;
+    h *= 0x85ebca6b;
+    h ^= h >> 13;
+    return h;
+}
+
+static __always_inline bool same_flow_id(flow_id *a, flow_id *b) {
+    u32 *wa = (u32 *)a;
+    u32 *wb = (u32 *)b;
+#pragma unroll
+    for (int i = 0; i < sizeof(flow_id) / sizeof(u32); i++) {
+        if (wa[i] != wb[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// send_heavy_hitter sends via ringbuffer the flow of a slot that is taken over by another flow
+static __always_inline void send_heavy_hitter(heavy_hitter *hh) {
+    flow_record *record = (flow_record *)bpf_ringbuf_reserve(&direct_flows, sizeof(flow_record), 0);
+    if (!record) {
+        increase_counter(HASHMAP_FLOWS_DROPPED);
+        return;
+    }
+    record->id = hh->id;
+    __builtin_memcpy(&record->metrics, &hh->metrics, sizeof(record->metrics));
+    bpf_ringbuf_submit(record, direct_flows_submit_flags());
+}
+
+// sketch_flow accounts a packet of a flow that couldn't be inserted in the flows map. new_flow
+// holds the metrics of the packet, as they would have been inserted.
+static __always_inline void sketch_flow(flow_id *id, flow_metrics *new_flow, pkt_info *pkt,
+                                        u64 len, u32 if_index) {
+    u32 key = 0;
+    u32 *epoch = bpf_map_lookup_elem(&flows_sketch_epoch, &key);
+    if (!epoch) {
+        return;
+    }
+    u32 half = *epoch & 1;
+    count_min_sketch *sketch = bpf_map_lookup_elem(&flows_sketch, &half);
+    if (!sketch) {
+        return;
+    }
+    u32 h1 = sketch_hash(id, 0x811c9dc5);
+    // odd, so that the rows are probed at distinct columns
+    u32 h2 = sketch_hash(id, 0x9747b28c) | 1;
+    u32 estimate = 0xffffffff;
+#pragma unroll
+    for (int row = 0; row < SKETCH_DEPTH; row++) {
+        u32 *counter = &sketch->counters[row][(h1 + row * h2) & (SKETCH_WIDTH - 1)];
+        *counter += 1;
+        if (*counter < estimate) {
+            estimate = *counter;
+        }
+    }
+
+    u32 slot = half * flows_sketch_slots + h1 % flows_sketch_slots;
+    heavy_hitter *hh = bpf_map_lookup_elem(&heavy_hitters, &slot);
+    if (!hh) {
+        return;
+    }
+    if (hh->metrics.packets != 0 && same_flow_id(&hh->id, id)) {
+        hh->estimate = estimate;
+        hh->metrics.end_mono_time_ts = pkt->current_ts;
+        hh->metrics.flags |= pkt->flags;
+        // as in the flows map, only count the packets seen from the first interface
+        if (hh->metrics.if_index_first_seen == if_index) {
+            hh->metrics.packets += 1;
+            hh->metrics.bytes += len;
+            hh->metrics.dscp = pkt->dscp;
+        }
+        return;
+    }
+    if (hh->metrics.packets != 0) {
+        if (estimate <= hh->estimate + (hh->estimate >> 1)) {
+            increase_counter(FLOWS_SKETCH_UNTRACKED);
+            return;
+        }
+        send_heavy_hitter(hh);
+    }
+    hh->id = *id;
+    hh->estimate = estimate;
+    __builtin_memcpy(&hh->metrics, new_flow, sizeof(hh->metrics));
+}
+
+#endif /* __FLOWS_SKETCH_H__ */
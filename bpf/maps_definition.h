@@ -10,6 +10,9 @@ struct {
     __uint(pinning, LIBBPF_PIN_BY_NAME);
 } direct_flows SEC(".maps");
 
+// The flows maps are allocated on demand by default. The agent can also load them
+// preallocated, or as LRU maps (see configureMapsAllocation in pkg/tracer).
+
 // Key: the flow identifier. Value: the flow metrics for that identifier.
 struct {
     __uint(type, BPF_MAP_TYPE_HASH);
@@ -20,6 +23,28 @@ struct {
     __uint(pinning, LIBBPF_PIN_BY_NAME);
 } aggregated_flows SEC(".maps");
 
+// Key: the compact IPv4 flow identifier. Value: the flow metrics for that identifier.
+// Used instead of aggregated_flows for IPv4 flows when compact IPv4 keys are enabled.
+struct {
+    __uint(type, BPF_MAP_TYPE_HASH);
+    __type(key, flow_id_v4);
+    __type(value, flow_metrics);
+    __uint(max_entries, 1 << 24);
+    __uint(map_flags, BPF_F_NO_PREALLOC);
+    __uint(pinning, LIBBPF_PIN_BY_NAME);
+} aggregated_flows_v4 SEC(".maps");
+
+// Key: the flow identifier. Value: the per-CPU flow metrics for that identifier.
+// Used instead of aggregated_flows when per-CPU aggregation is enabled.
+struct {
+    __uint(type, BPF_MAP_TYPE_PERCPU_HASH);
+    __type(key, flow_id);
+    __type(value, flow_metrics_percpu);
+    __uint(max_entries, 1 << 24);
+    __uint(map_flags, BPF_F_NO_PREALLOC);
+    __uint(pinning, LIBBPF_PIN_BY_NAME);
+} aggregated_flows_percpu SEC(".maps");
+
 // Key: the flow identifier. Value: extra metrics for that identifier.
 struct {
     __uint(type, BPF_MAP_TYPE_PERCPU_HASH);
@@ -39,8 +64,26 @@ struct {
     __uint(pinning, LIBBPF_PIN_BY_NAME);
 } packet_record SEC(".maps");
 
+// Ringbuffer for Packet Payloads, used instead of packet_record in the ring buffer capture mode.
+// Shrunk from userspace to a single page when the ring buffer capture mode is not used.
+struct {
+    __uint(type, BPF_MAP_TYPE_RINGBUF);
+    __uint(max_entries, 1 << 24);
+} packet_ringbuf SEC(".maps");
+
+// Scratch buffer where the packets are copied before being submitted to packet_ringbuf, as
+// the ring buffer records can't be reserved with a variable size. Shrunk from userspace in
+// flows mode.
+struct {
+    __uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+    __type(key, u32);
+    __type(value, pca_record);
+    __uint(max_entries, 1);
+} pca_scratch SEC(".maps");
+
 // DNS tracking flow based hashmap used to correlate query and responses
-// to allow calculating latency in ebpf agent directly
+// to allow calculating latency in ebpf agent directly. The agent turns it into a bounded LRU
+// map when DNS_TRACKING_LRU_SIZE is set.
 struct {
     __uint(type, BPF_MAP_TYPE_HASH);
     __uint(max_entries, 1 << 20); // Will take around 64MB of space.
@@ -50,33 +93,147 @@ struct {
     __uint(pinning, LIBBPF_PIN_BY_NAME);
 } dns_flows SEC(".maps");
 
-// Global counter for hashmap update errors
+// Single-entry array holding the timer that expires idle flows in the kernel.
+// Not pinned, so that the timer is cancelled when the agent stops.
+struct {
+    __uint(type, BPF_MAP_TYPE_ARRAY);
+    __type(key, u32);
+    __type(value, struct expiry_timer_t);
+    __uint(max_entries, 1);
+} expiry_timer SEC(".maps");
+
+// Count-min sketches of the sketch tier: one per epoch
+struct {
+    __uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+    __type(key, u32);
+    __type(value, count_min_sketch);
+    __uint(max_entries, 2);
+} flows_sketch SEC(".maps");
+
+// Heavy hitters table of the sketch tier: the first half of the slots is used on even epochs,
+// the second half on odd epochs. Resized from userspace.
 struct {
     __uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
     __type(key, u32);
+    __type(value, heavy_hitter);
+    __uint(max_entries, 2);
+} heavy_hitters SEC(".maps");
+
+// Epoch of the sketch tier, incremented from userspace when reading it
+struct {
+    __uint(type, BPF_MAP_TYPE_ARRAY);
+    __type(key, u32);
+    __type(value, u32);
+    __uint(max_entries, 1);
+} flows_sketch_epoch SEC(".maps");
+
+// Sampling rate set from userspace when adaptive sampling is enabled. It only applies when it
+// is higher than the configured sampling.
+struct {
+    __uint(type, BPF_MAP_TYPE_ARRAY);
+    __type(key, u32);
     __type(value, u32);
+    __uint(max_entries, 1);
+} adaptive_sampling SEC(".maps");
+
+// Histograms of the flows processing time, by flow path. Only filled when enable_flow_latencies
+// is set.
+struct {
+    __uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+    __type(key, u32);
+    __type(value, flow_latency);
+    __uint(max_entries, MAX_FLOW_PATHS);
+} flow_latencies SEC(".maps");
+
+// Global counter for hashmap update errors. The counters are never reset.
+struct {
+    __uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+    __type(key, u32);
+    __type(value, u64);
     __uint(max_entries, MAX_COUNTERS);
     __uint(pinning, LIBBPF_PIN_BY_NAME);
 } global_counters SEC(".maps");
 
-// LPM trie map used to filter traffic by IP address CIDR
+// The flow filter rules are compiled from userspace into the following maps (see
+// pkg/tracer/flow_filter.go), so the cost of matching a packet doesn't depend on the number
+// of rules.
+
+// LPM trie map used to filter traffic by IP address CIDR. Value: the rules of which the CIDR
+// contains the prefix.
 struct {
     __uint(type, BPF_MAP_TYPE_LPM_TRIE);
     __type(key, struct filter_key_t);
-    __type(value, struct filter_value_t);
-    __uint(max_entries, MAX_FILTER_ENTRIES);
+    __type(value, filter_mask);
+    __uint(max_entries, MAX_FILTER_RULES);
     __uint(map_flags, BPF_F_NO_PREALLOC);
     __uint(pinning, LIBBPF_PIN_BY_NAME);
 } filter_map SEC(".maps");
 
-// LPM trie map used to filter traffic by peer IP address CIDR
+// LPM trie map used to filter traffic by peer IP address CIDR. Value: the rules of which the
+// peer CIDR contains the prefix, along with the rules without peer CIDR.
 struct {
     __uint(type, BPF_MAP_TYPE_LPM_TRIE);
     __type(key, struct filter_key_t);
-    __type(value, u8);
-    __uint(max_entries, MAX_FILTER_ENTRIES);
+    __type(value, filter_mask);
+    __uint(max_entries, MAX_FILTER_RULES + 1);
     __uint(map_flags, BPF_F_NO_PREALLOC);
     __uint(pinning, LIBBPF_PIN_BY_NAME);
 } peer_filter_map SEC(".maps");
 
+// LPM trie map used to filter traffic by the other fields. Value: the rules matching the value.
+struct {
+    __uint(type, BPF_MAP_TYPE_LPM_TRIE);
+    __type(key, struct filter_dimension_key_t);
+    __type(value, filter_mask);
+    __uint(max_entries, MAX_FILTER_MASKS);
+    __uint(map_flags, BPF_F_NO_PREALLOC);
+    __uint(pinning, LIBBPF_PIN_BY_NAME);
+} filter_masks SEC(".maps");
+
+// The filter rules, by priority order. The last entry holds the action of the flows not
+// matching any rule.
+struct {
+    __uint(type, BPF_MAP_TYPE_ARRAY);
+    __type(key, u32);
+    __type(value, struct filter_value_t);
+    __uint(max_entries, MAX_FILTER_RULES + 1);
+    __uint(pinning, LIBBPF_PIN_BY_NAME);
+} filter_rules SEC(".maps");
+
+// Generation of the programmed filter rules, for the filter verdicts cache
+struct {
+    __uint(type, BPF_MAP_TYPE_ARRAY);
+    __type(key, u32);
+    __type(value, filter_cache_config);
+    __uint(max_entries, 1);
+    __uint(pinning, LIBBPF_PIN_BY_NAME);
+} filter_generation SEC(".maps");
+
+// Per-CPU cache of the filter verdicts, so that only the first packet of a flow on each CPU
+// evaluates the filter rules. Resized from userspace to the flows cache size.
+struct {
+    __uint(type, BPF_MAP_TYPE_LRU_PERCPU_HASH);
+    __type(key, filter_verdict_key);
+    __type(value, filter_verdict);
+    __uint(max_entries, 1 << 24);
+} filter_verdicts SEC(".maps");
+
+// Time of the last RTT sample of each socket, for the fentry RTT hook. Only filled when
+// rtt_sampling_interval is set.
+struct {
+    __uint(type, BPF_MAP_TYPE_SK_STORAGE);
+    __type(key, int);
+    __type(value, u64);
+    __uint(map_flags, BPF_F_NO_PREALLOC);
+} rtt_sk_samples SEC(".maps");
+
+// Time of the last RTT sample of each socket, keyed by the socket address, for the kprobe RTT
+// hook which can't access the socket local storage. Only filled when rtt_sampling_interval is set.
+struct {
+    __uint(type, BPF_MAP_TYPE_LRU_HASH);
+    __type(key, u64);
+    __type(value, u64);
+    __uint(max_entries, MAX_RTT_SAMPLES);
+} rtt_samples SEC(".maps");
+
 #endif //__MAPS_DEFINITION_H__
@@ -22,7 +22,15 @@ struct rh_psample_metadata {
 
 static inline bool md_already_exists(u8 network_events[MAX_NETWORK_EVENTS][MAX_EVENT_MD], u8 *md) {
     for (u8 i = 0; i < MAX_NETWORK_EVENTS; i++) {
-        if (__builtin_memcmp(network_events[i], md, MAX_EVENT_MD) == 0) {
+        // compared byte by byte: older clang versions emit a call to memcmp
+        bool equal = true;
+        for (u8 j = 0; j < MAX_EVENT_MD; j++) {
+            if (network_events[i][j] != md[j]) {
+                equal = false;
+                break;
+            }
+        }
+        if (equal) {
             return true;
         }
     }
@@ -52,7 +60,7 @@ static inline int lookup_and_update_existing_flow_network_events(flow_id *id, u8
 }
 
 static inline int trace_network_events(struct sk_buff *skb, struct rh_psample_metadata *md) {
-    u8 dscp = 0, protocol = 0, md_len = 0;
+    u8 dscp = 0, md_len = 0;
     u16 family = 0, flags = 0, eth_protocol = 0;
     u8 *user_cookie = NULL;
     long ret = 0;
@@ -66,32 +74,8 @@ static inline int trace_network_events(struct sk_buff *skb, struct rh_psample_me
         return -1;
     }
 
-    // read L2 info
-    core_fill_in_l2(skb, &eth_protocol, &family);
-
-    // read L3 info
-    core_fill_in_l3(skb, &id, family, &protocol, &dscp);
-
-    // read L4 info
-    switch (protocol) {
-    case IPPROTO_TCP:
-        core_fill_in_tcp(skb, &id, &flags);
-        break;
-    case IPPROTO_UDP:
-        core_fill_in_udp(skb, &id);
-        break;
-    case IPPROTO_SCTP:
-        core_fill_in_sctp(skb, &id);
-        break;
-    case IPPROTO_ICMP:
-        core_fill_in_icmpv4(skb, &id);
-        break;
-    case IPPROTO_ICMPV6:
-        core_fill_in_icmpv6(skb, &id);
-        break;
-    default:
-        fill_in_others_protocol(&id, protocol);
-    }
+    // read L2, L3 and L4 info
+    core_fill_in_flow_id(skb, &id, &eth_protocol, &family, &flags, &dscp);
 
     // check if this packet need to be filtered if filtering feature is enabled
     bool skip = check_and_do_flow_filtering(&id, flags, 0, eth_protocol, NULL, 0);
@@ -3,63 +3,88 @@
 
 #include "utils.h"
 
-static int attach_packet_payload(void *data, void *data_end, struct __sk_buff *skb) {
-    payload_meta meta;
-    u64 flags = BPF_F_CURRENT_CPU;
-    // Enable the flag to add packet header
-    // Packet payload follows immediately after the meta struct
-    u32 packetSize = (u32)(data_end - data);
-
-    // Record the current time.
-    u64 current_time = bpf_ktime_get_ns();
-
-    // For packets which are allocated non-linearly struct __sk_buff does not necessarily
-    // has all data lined up in memory but instead can be part of scatter gather lists.
-    // This command pulls data from the buffer but incurs data copying penalty.
-    if (packetSize <= skb->len) {
-        packetSize = skb->len;
-        if (bpf_skb_pull_data(skb, skb->len)) {
-            return TC_ACT_UNSPEC;
-        };
+// pca_capture_len returns the number of bytes of the packet to capture, truncated to the snaplen
+static __always_inline u32 pca_capture_len(struct __sk_buff *skb) {
+    u32 len = skb->len;
+    if (pca_snaplen > 0 && len > pca_snaplen) {
+        len = pca_snaplen;
     }
-    // Set flag's upper 32 bits with the size of the paylaod and the bpf_perf_event_output will
-    // attach the specified amount of bytes from packet to the perf event
-    // https://github.com/xdp-project/xdp-tutorial/tree/9b25f0a039179aca1f66cba5492744d9f09662c1/tracing04-xdp-tcpdump
-    flags |= (u64)packetSize << 32;
+    return len;
+}
 
-    meta.if_index = skb->ifindex;
-    meta.pkt_len = packetSize;
-    meta.timestamp = current_time;
-    if (bpf_perf_event_output(skb, &packet_record, flags, &meta, sizeof(meta))) {
-        return TC_ACT_OK;
+// pca_ringbuf_submit_flags returns the flags submitting a packet to the packet_ringbuf ring
+// buffer, batching the wakeups as direct_flows_submit_flags
+static __always_inline u64 pca_ringbuf_submit_flags() {
+    if (ringbuf_wakeup_threshold == 0) {
+        return 0;
+    }
+    if (bpf_ringbuf_query(&packet_ringbuf, BPF_RB_AVAIL_DATA) >= ringbuf_wakeup_threshold) {
+        return BPF_RB_FORCE_WAKEUP;
     }
-    return TC_ACT_UNSPEC;
+    return BPF_RB_NO_WAKEUP;
 }
 
-static inline bool validate_pca_filter(struct __sk_buff *skb, direction dir) {
-    pkt_info pkt;
-    __builtin_memset(&pkt, 0, sizeof(pkt));
-    flow_id id;
-    __builtin_memset(&id, 0, sizeof(id));
-    u16 eth_protocol = 0;
-
-    pkt.id = &id;
+// output_packet_ringbuf copies the packet into the per-CPU scratch buffer, and submits the
+// captured bytes to the shared ring buffer
+static __always_inline int output_packet_ringbuf(struct __sk_buff *skb, payload_meta *meta) {
+    u32 key = 0;
+    pca_record *record = bpf_map_lookup_elem(&pca_scratch, &key);
+    if (!record) {
+        return TC_ACT_UNSPEC;
+    }
+    u32 len = meta->pkt_len;
+    if (len > PCA_MAX_SNAPLEN) {
+        len = PCA_MAX_SNAPLEN;
+    }
+    if (len == 0) {
+        return TC_ACT_UNSPEC;
+    }
+    // The compiler may fold the checks above so that the verifier loses the bounds of len:
+    // hide its value behind a barrier and bound it again to [1, PCA_MAX_SNAPLEN] with a mask
+    asm volatile("" : "+r"(len));
+    len = ((len - 1) & (PCA_MAX_SNAPLEN - 1)) + 1;
+    // bpf_skb_load_bytes reads the non-linear data as well, without pulling it
+    if (bpf_skb_load_bytes(skb, 0, record->data, len)) {
+        return TC_ACT_UNSPEC;
+    }
+    meta->pkt_len = len;
+    record->meta = *meta;
+    if (bpf_ringbuf_output(&packet_ringbuf, record, sizeof(payload_meta) + len,
+                           pca_ringbuf_submit_flags())) {
+        return TC_ACT_UNSPEC;
+    }
+    return TC_ACT_OK;
+}
 
-    void *data_end = (void *)(long)skb->data_end;
-    void *data = (void *)(long)skb->data;
-    struct ethhdr *eth = (struct ethhdr *)data;
+static int attach_packet_payload(struct __sk_buff *skb) {
+    payload_meta meta;
+    __builtin_memset(&meta, 0, sizeof(meta));
+    meta.if_index = skb->ifindex;
+    meta.pkt_len = pca_capture_len(skb);
+    meta.orig_len = skb->len;
+    // Record the current time.
+    meta.timestamp = bpf_ktime_get_ns();
 
-    if (fill_ethhdr(eth, data_end, &pkt, &eth_protocol) == DISCARD) {
-        return false;
+    if (enable_pca_ringbuf) {
+        return output_packet_ringbuf(skb, &meta);
     }
-
-    // check if this packet need to be filtered if filtering feature is enabled
-    bool skip = check_and_do_flow_filtering(&id, pkt.flags, 0, eth_protocol, NULL, dir);
-    if (skip) {
-        return false;
+    // Set flag's upper 32 bits with the size of the paylaod and the bpf_perf_event_output will
+    // attach the specified amount of bytes from packet to the perf event. The bytes are copied
+    // from the non-linear data as well, so the packet doesn't need to be pulled.
+    // Packet payload follows immediately after the meta struct
+    // https://github.com/xdp-project/xdp-tutorial/tree/9b25f0a039179aca1f66cba5492744d9f09662c1/tracing04-xdp-tcpdump
+    u64 flags = BPF_F_CURRENT_CPU | (u64)meta.pkt_len << 32;
+    if (bpf_perf_event_output(skb, &packet_record, flags, &meta, sizeof(meta))) {
+        return TC_ACT_UNSPEC;
     }
+    return TC_ACT_OK;
+}
 
-    return true;
+// pca_filter_accepts returns whether the packet, as parsed by export_packet_payload, is accepted
+// by the flow filter when it is enabled
+static __always_inline bool pca_filter_accepts(pkt_info *pkt, u16 eth_protocol, direction dir) {
+    bool skip = check_and_do_flow_filtering(pkt->id, pkt->flags, 0, eth_protocol, NULL, dir);
+    return !skip;
 }
 
 static inline int export_packet_payload(struct __sk_buff *skb, direction dir) {
@@ -71,8 +96,19 @@ static inline int export_packet_payload(struct __sk_buff *skb, direction dir) {
     void *data_end = (void *)(long)skb->data_end;
     void *data = (void *)(long)skb->data;
 
-    if (validate_pca_filter(skb, dir)) {
-        return attach_packet_payload(data, data_end, skb);
+    // the headers are parsed once, for the filter
+    pkt_info pkt;
+    __builtin_memset(&pkt, 0, sizeof(pkt));
+    flow_id id;
+    __builtin_memset(&id, 0, sizeof(id));
+    u16 eth_protocol = 0;
+    pkt.id = &id;
+    if (fill_ethhdr((struct ethhdr *)data, data_end, &pkt, &eth_protocol) == DISCARD) {
+        return 0;
+    }
+
+    if (pca_filter_accepts(&pkt, eth_protocol, dir)) {
+        return attach_packet_payload(skb);
     }
     return 0;
 }
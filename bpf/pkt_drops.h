@@ -28,7 +28,7 @@ static inline int trace_pkt_drop(void *ctx, u8 state, struct sk_buff *skb,
     __builtin_memset(&id, 0, sizeof(id));
     u16 eth_protocol = 0;
 
-    u8 protocol = 0, dscp = 0;
+    u8 dscp = 0;
     u16 family = 0, flags = 0;
 
     u32 if_index = BPF_CORE_READ(skb, skb_iif);
@@ -36,30 +36,8 @@ static inline int trace_pkt_drop(void *ctx, u8 state, struct sk_buff *skb,
     if (if_index == 0 || if_index == 1) {
         return 0;
     }
-    // read L2 info
-    core_fill_in_l2(skb, &eth_protocol, &family);
-
-    // read L3 info
-    core_fill_in_l3(skb, &id, family, &protocol, &dscp);
-
-    // read L4 info
-    switch (protocol) {
-    case IPPROTO_TCP:
-        core_fill_in_tcp(skb, &id, &flags);
-        break;
-    case IPPROTO_UDP:
-        core_fill_in_udp(skb, &id);
-        break;
-    case IPPROTO_SCTP:
-        core_fill_in_sctp(skb, &id);
-        break;
-    case IPPROTO_ICMP:
-        core_fill_in_icmpv4(skb, &id);
-        break;
-    case IPPROTO_ICMPV6:
-        core_fill_in_icmpv6(skb, &id);
-        break;
-    default:
+    // read L2, L3 and L4 info
+    if (core_fill_in_flow_id(skb, &id, &eth_protocol, &family, &flags, &dscp) != 0) {
         return 0;
     }
 
@@ -124,7 +124,7 @@ static inline int trace_nat_manip_pkt(struct nf_conn *ct, struct sk_buff *skb) {
     struct nf_conntrack_tuple_hash tuplehash[IP_CT_DIR_MAX];
     u16 family = 0, flags = 0, zone_id = 0, eth_protocol = 0;
     ;
-    u8 dscp = 0, protocol = 0;
+    u8 dscp = 0;
     long ret = 0;
     flow_id id;
 
@@ -141,32 +141,8 @@ static inline int trace_nat_manip_pkt(struct nf_conn *ct, struct sk_buff *skb) {
     struct nf_conntrack_tuple *orig_tuple = &tuplehash[IP_CT_DIR_ORIGINAL].tuple;
     struct nf_conntrack_tuple *reply_tuple = &tuplehash[IP_CT_DIR_REPLY].tuple;
 
-    // read L2 info
-    core_fill_in_l2(skb, &eth_protocol, &family);
-
-    // read L3 info
-    core_fill_in_l3(skb, &id, family, &protocol, &dscp);
-
-    // read L4 info
-    switch (protocol) {
-    case IPPROTO_TCP:
-        core_fill_in_tcp(skb, &id, &flags);
-        break;
-    case IPPROTO_UDP:
-        core_fill_in_udp(skb, &id);
-        break;
-    case IPPROTO_SCTP:
-        core_fill_in_sctp(skb, &id);
-        break;
-    case IPPROTO_ICMP:
-        core_fill_in_icmpv4(skb, &id);
-        break;
-    case IPPROTO_ICMPV6:
-        core_fill_in_icmpv6(skb, &id);
-        break;
-    default:
-        fill_in_others_protocol(&id, protocol);
-    }
+    // read L2, L3 and L4 info
+    core_fill_in_flow_id(skb, &id, &eth_protocol, &family, &flags, &dscp);
 
     // check if this packet need to be filtered if filtering feature is enabled
     bool skip = check_and_do_flow_filtering(&id, flags, 0, eth_protocol, NULL, 0);
@@ -174,7 +150,8 @@ static inline int trace_nat_manip_pkt(struct nf_conn *ct, struct sk_buff *skb) {
         return 0;
     }
 
-    BPF_PRINTK("Xlat: protocol %d flags 0x%x family %d dscp %d\n", protocol, flags, family, dscp);
+    BPF_PRINTK("Xlat: protocol %d flags 0x%x family %d dscp %d\n", id.transport_protocol, flags,
+               family, dscp);
 
     bpf_probe_read_kernel(&zone_id, sizeof(zone_id), &ct->zone.id);
     ret = translate_lookup_and_update_flow(&id, flags, orig_tuple, reply_tuple, zone_id, family,
@@ -21,8 +21,41 @@ static inline int rtt_lookup_and_update_flow(flow_id *id, u64 rtt) {
     return -1;
 }
 
-static inline int calculate_flow_rtt_tcp(struct sock *sk, struct sk_buff *skb) {
-    u8 dscp = 0, protocol = 0;
+// rtt_sample_due returns whether the RTT of a socket must be sampled, which happens at most once
+// per rtt_sampling_interval. This avoids deriving the flow id and updating its metrics on every
+// segment. A socket address reused after the socket is freed only delays its first sample.
+static __always_inline bool rtt_sample_due(struct sock *sk, bool sk_storage) {
+    if (rtt_sampling_interval == 0) {
+        return true;
+    }
+    u64 now = bpf_ktime_get_ns();
+    u64 *last_sample;
+    if (sk_storage) {
+        last_sample = bpf_sk_storage_get(&rtt_sk_samples, sk, 0, BPF_SK_STORAGE_GET_F_CREATE);
+    } else {
+        u64 key = (u64)sk;
+        last_sample = bpf_map_lookup_elem(&rtt_samples, &key);
+        if (last_sample == NULL) {
+            bpf_map_update_elem(&rtt_samples, &key, &now, BPF_ANY);
+            return true;
+        }
+    }
+    if (last_sample == NULL) {
+        // the storage can't be allocated: sample anyway
+        return true;
+    }
+    if (*last_sample != 0 && now - *last_sample < rtt_sampling_interval) {
+        return false;
+    }
+    *last_sample = now;
+    return true;
+}
+
+// calculate_flow_rtt_tcp accounts the RTT of a socket in its flow. sk_storage tells whether the
+// program can access the socket local storage (fentry), or not (kprobe).
+static __always_inline int calculate_flow_rtt_tcp(struct sock *sk, struct sk_buff *skb,
+                                                  bool sk_storage) {
+    u8 dscp = 0;
     struct tcp_sock *ts;
     u16 family = 0, flags = 0, eth_protocol = 0;
     u64 rtt = 0;
@@ -40,18 +73,15 @@ static inline int calculate_flow_rtt_tcp(struct sock *sk, struct sk_buff *skb) {
         return 0;
     }
 
-    // read L2 info
-    core_fill_in_l2(skb, &eth_protocol, &family);
-
-    // read L3 info
-    core_fill_in_l3(skb, &id, family, &protocol, &dscp);
-
-    if (protocol != IPPROTO_TCP) {
+    if (!rtt_sample_due(sk, sk_storage)) {
         return 0;
     }
 
-    // read TCP info
-    core_fill_in_tcp(skb, &id, &flags);
+    // read L2, L3 and TCP info
+    core_fill_in_flow_id(skb, &id, &eth_protocol, &family, &flags, &dscp);
+    if (id.transport_protocol != IPPROTO_TCP) {
+        return 0;
+    }
 
     // read TCP socket rtt and store it in nanoseconds
     ts = (struct tcp_sock *)(sk);
@@ -98,7 +128,7 @@ int BPF_PROG(tcp_rcv_fentry, struct sock *sk, struct sk_buff *skb) {
     if (sk == NULL || skb == NULL || do_sampling == 0) {
         return 0;
     }
-    return calculate_flow_rtt_tcp(sk, skb);
+    return calculate_flow_rtt_tcp(sk, skb, true);
 }
 
 SEC("kprobe/tcp_rcv_established")
@@ -106,7 +136,7 @@ int BPF_KPROBE(tcp_rcv_kprobe, struct sock *sk, struct sk_buff *skb) {
     if (sk == NULL || skb == NULL || do_sampling == 0) {
         return 0;
     }
-    return calculate_flow_rtt_tcp(sk, skb);
+    return calculate_flow_rtt_tcp(sk, skb, false);
 }
 
 #endif /* __RTT_TRACKER_H__ */
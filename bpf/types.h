@@ -12,6 +12,7 @@
 #define ENOENT 2
 #define EEXIST 17
 #define EINVAL 22
+#define ETIME 62
 
 // Flags according to RFC 9293 & https://www.iana.org/assignments/ipfix/ipfix.xhtml
 typedef enum tcp_flags_t {
@@ -63,10 +64,21 @@ typedef __u64 u64;
 #define DSCP_SHIFT 2
 #define DSCP_MASK 0x3F
 
-#define MAX_FILTER_ENTRIES 16
+// Maximum number of flow filter rules: the rules matching a packet are computed as a bitmask
+#define MAX_FILTER_RULES 256
+#define FILTER_MASK_WORDS (MAX_FILTER_RULES / 64)
+// Maximum number of entries of the compiled filter_masks trie
+#define MAX_FILTER_MASKS (1 << 16)
+// Maximum number of sockets of which the last RTT sample time is kept by the kprobe RTT hook
+#define MAX_RTT_SAMPLES (1 << 16)
+// Number of buckets of the flows processing time histograms: bucket i counts the packets
+// processed in [2^i, 2^(i+1)) ns, the last one counting any longer time
+#define FLOW_LATENCY_BUCKETS 16
 #define MAX_EVENT_MD 8
 #define MAX_NETWORK_EVENTS 4
 #define MAX_OBSERVED_INTERFACES 6
+// Maximum number of bytes of a packet copied by the ring buffer capture mode
+#define PCA_MAX_SNAPLEN 16384
 #define OBSERVED_DIRECTION_BOTH 3
 
 // according to field 61 in https://www.iana.org/assignments/ipfix/ipfix.xhtml
@@ -81,38 +93,73 @@ const static enum direction_t *unused1 __attribute__((unused));
 
 const static u8 ip4in6[] = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xff, 0xff};
 
+// The fields updated for every packet come first, in the 36 leading bytes, so that the
+// per-packet update touches a single cache line when the value does not cross a line boundary
+// there. The fields that are only written on flow creation, or when a flow is seen from other
+// interfaces, trail them.
 typedef struct flow_metrics_t {
-    // Flow start and end times as monotomic timestamps in nanoseconds
+    // Flow end time as monotomic timestamp in nanoseconds
     // as output from bpf_ktime_get_ns()
-    u64 start_mono_time_ts;
     u64 end_mono_time_ts;
     u64 bytes;
     u32 packets;
-    u16 eth_protocol;
     // TCP Flags from https://www.ietf.org/rfc/rfc793.txt
     u16 flags;
-    // L2 data link layer
-    u8 src_mac[ETH_ALEN];
-    u8 dst_mac[ETH_ALEN];
+    u8 dscp;
+    u8 direction_first_seen;
+    u32 sampling;
     // OS interface index
     u32 if_index_first_seen;
     struct bpf_spin_lock lock;
-    u32 sampling;
-    u8 direction_first_seen;
+    // End of the per-packet fields
+    u16 eth_protocol;
     // The positive errno of a failed map insertion that caused a flow
     // to be sent via ringbuffer.
     // 0 otherwise
     // https://chromium.googlesource.com/chromiumos/docs/+/master/constants/errnos.md
     u8 errno;
-    u8 dscp;
     u8 nb_observed_intf;
+    // Flow start time, as end_mono_time_ts
+    u64 start_mono_time_ts;
+    // L2 data link layer
+    u8 src_mac[ETH_ALEN];
+    u8 dst_mac[ETH_ALEN];
     u8 observed_direction[MAX_OBSERVED_INTERFACES];
     u32 observed_intf[MAX_OBSERVED_INTERFACES];
 } flow_metrics;
 
+_Static_assert(__builtin_offsetof(flow_metrics, eth_protocol) <= 64,
+               "the per-packet fields of flow_metrics must fit in a cache line");
+
 // Force emitting enums/structs into the ELF
 const static struct flow_metrics_t *unused2 __attribute__((unused));
 
+// Lock-free variant of flow_metrics, used as value of the per-CPU aggregation map
+// (bpf_spin_lock is not allowed in per-CPU maps). The layout must be kept identical to
+// flow_metrics, as both are decoded with the same type in userspace.
+typedef struct flow_metrics_percpu_t {
+    u64 end_mono_time_ts;
+    u64 bytes;
+    u32 packets;
+    u16 flags;
+    u8 dscp;
+    u8 direction_first_seen;
+    u32 sampling;
+    u32 if_index_first_seen;
+    u32 unused_lock;
+    u16 eth_protocol;
+    u8 errno;
+    u8 nb_observed_intf;
+    u64 start_mono_time_ts;
+    u8 src_mac[ETH_ALEN];
+    u8 dst_mac[ETH_ALEN];
+    u8 observed_direction[MAX_OBSERVED_INTERFACES];
+    u32 observed_intf[MAX_OBSERVED_INTERFACES];
+} flow_metrics_percpu;
+
+_Static_assert(sizeof(flow_metrics_percpu) == sizeof(flow_metrics),
+               "flow_metrics_percpu must have the same layout as flow_metrics");
+
 typedef struct additional_metrics_t {
     u64 start_mono_time_ts;
     u64 end_mono_time_ts;
@@ -168,6 +215,37 @@ typedef struct flow_id_t {
 // Force emitting enums/structs into the ELF
 const static struct flow_id_t *unused7 __attribute__((unused));
 
+// Compact flow identifier for IPv4 flows, used as key of the aggregated_flows_v4 map.
+// Must be zeroed before being filled, so that its padding doesn't change the key hash.
+typedef struct flow_id_v4_t {
+    u8 src_ip[4];
+    u8 dst_ip[4];
+    u16 src_port;
+    u16 dst_port;
+    u8 transport_protocol;
+    u8 icmp_type;
+    u8 icmp_code;
+} flow_id_v4;
+
+// Force emitting enums/structs into the ELF
+const static struct flow_id_v4_t *unused14 __attribute__((unused));
+
+// Count-min sketch of the packets of the flows that couldn't be inserted in the flows map
+#define SKETCH_DEPTH 4
+#define SKETCH_WIDTH 512 // must be a power of 2
+
+typedef struct count_min_sketch_t {
+    u32 counters[SKETCH_DEPTH][SKETCH_WIDTH];
+} count_min_sketch;
+
+// Slot of the heavy hitters table of the sketch tier
+typedef struct heavy_hitter_t {
+    flow_id id;
+    flow_metrics_percpu metrics;
+    // count-min estimate of the flow packets, when last updated
+    u32 estimate;
+} heavy_hitter;
+
 // Flow record is a tuple containing both flow identifier and metrics. It is used to send
 // a complete flow via ring buffer when only when the accounting hashmap is full.
 // Contents in this struct must match byte-by-byte with Go's pkc/flow/Record struct
@@ -185,6 +263,7 @@ typedef struct pkt_info_t {
     u64 current_ts; // ts recorded when pkt came.
     u16 flags;      // TCP specific
     void *l4_hdr;   // Stores the actual l4 header
+    u8 l4_hdr_len;  // Length of the l4 header, including the TCP options
     u8 dscp;        // IPv4/6 DSCP value
     u16 dns_id;
     u16 dns_flags;
@@ -194,10 +273,19 @@ typedef struct pkt_info_t {
 // Structure for payload metadata
 typedef struct payload_meta_t {
     u32 if_index;
-    u32 pkt_len;
+    u32 pkt_len;   // number of bytes captured, following the metadata
     u64 timestamp; // timestamp when packet received by ebpf
+    u32 orig_len;  // length of the packet, greater than pkt_len when truncated to the snaplen
+    u32 padding;
 } payload_meta;
 
+// Record of the ring buffer capture mode: only the meta and the pkt_len first bytes of data
+// are submitted
+typedef struct pca_record_t {
+    payload_meta meta;
+    u8 data[PCA_MAX_SNAPLEN];
+} pca_record;
+
 // DNS Flow record used as key to correlate DNS query and response
 typedef struct dns_flow_id_t {
     u16 src_port;
@@ -208,6 +296,12 @@ typedef struct dns_flow_id_t {
     u8 protocol;
 } dns_flow_id;
 
+// Timer used to expire idle flows in the kernel
+struct expiry_timer_t {
+    struct bpf_timer timer;
+    u32 armed;
+};
+
 // Enum to define global counters keys and share it with userspace
 typedef enum global_counters_key_t {
     HASHMAP_FLOWS_DROPPED,
@@ -220,6 +314,8 @@ typedef enum global_counters_key_t {
     NETWORK_EVENTS_ERR_UPDATE_MAP_FLOWS,
     NETWORK_EVENTS_GOOD,
     OBSERVED_INTF_MISSED,
+    HASHMAP_FLOWS_INSERTED,
+    FLOWS_SKETCH_UNTRACKED,
     MAX_COUNTERS,
 } global_counters_key;
 
@@ -273,4 +369,81 @@ struct filter_value_t {
 // Force emitting enums/structs into the ELF
 const static struct filter_value_t *unused12 __attribute__((unused));
 
+// Set of the filter rules matching a value of a filtered field: bit i is set when the rule at
+// index i of filter_rules matches
+typedef struct filter_mask_t {
+    u64 bits[FILTER_MASK_WORDS];
+} filter_mask;
+
+// Fields of the packets matched by the filter rules, besides the IP addresses
+typedef enum filter_dimension_t {
+    FILTER_DIM_PROTOCOL,
+    FILTER_DIM_SRC_PORT,
+    FILTER_DIM_DST_PORT,
+    FILTER_DIM_PORT,
+    FILTER_DIM_TCP_FLAGS,
+    FILTER_DIM_ICMP_TYPE,
+    // the ICMP code is matched along with the type: the value is (type << 8) | code
+    FILTER_DIM_ICMP_CODE,
+    FILTER_DIM_DIRECTION,
+    FILTER_DIM_DROPS,
+} filter_dimension;
+
+// Force emitting enums/structs into the ELF
+const enum filter_dimension_t *unused15 __attribute__((unused));
+
+// Key of the filter_masks trie. Exact values have a 24 bits prefix (dimension and value), port
+// ranges are split in shorter prefixes, and the dimension alone (8 bits) matches any other value.
+typedef struct filter_dimension_key_t {
+    u32 prefix_len;
+    u8 dimension;
+    u8 value[2]; // big endian
+    u8 padding;
+} filter_dimension_key;
+
+// State of the programmed filter rules, read before the filter verdicts cache. The generation
+// changes each time the rules are programmed, and invalidates the cached verdicts.
+typedef struct filter_cache_config_t {
+    u32 generation;
+    // whether the rules match the TCP flags or the drops, which can change from one packet of a
+    // flow to the next: they are then part of the cache key
+    u8 match_tcp_flags;
+    u8 match_drops;
+    u8 padding[2];
+} filter_cache_config;
+
+// Key of the filter verdicts cache. Must be zeroed before being filled, so that its padding
+// doesn't change the key hash.
+typedef struct filter_verdict_key_t {
+    flow_id id;
+    u16 flags;
+    u8 direction;
+    u8 drops;
+} filter_verdict_key;
+
+// Result of the evaluation of the filter rules for a flow
+typedef struct filter_verdict_t {
+    u32 generation;
+    // sampling of the matching rule, 0 if none
+    u32 sample;
+    u8 skip;
+    u8 padding[3];
+} filter_verdict;
+
+// Paths of a packet through the flows aggregation, for the processing time histograms
+typedef enum flow_path_t {
+    FLOW_PATH_NEW,
+    FLOW_PATH_EXISTING,
+    MAX_FLOW_PATHS,
+} flow_path;
+
+// Force emitting enums/structs into the ELF
+const enum flow_path_t *unused16 __attribute__((unused));
+
+// Histogram of the time spent processing the packets of a flow path
+typedef struct flow_latency_t {
+    u64 buckets[FLOW_LATENCY_BUCKETS];
+    u64 sum_ns;
+} flow_latency;
+
 #endif /* __TYPES_H__ */
@@ -8,16 +8,25 @@
 
 static u8 do_sampling = 0;
 
-// Update global counter for hashmap update errors
+// Update global counter for hashmap update errors. The counters are per-CPU and only read from
+// userspace, which computes the increments since its previous read: a plain increment is
+// enough.
 static inline void increase_counter(u32 key) {
-    u32 *error_counter_p = NULL;
-    u32 initVal = 1;
-    error_counter_p = bpf_map_lookup_elem(&global_counters, &key);
-    if (!error_counter_p) {
-        bpf_map_update_elem(&global_counters, &key, &initVal, BPF_ANY);
-    } else {
-        __sync_fetch_and_add(error_counter_p, 1);
+    u64 *counter = bpf_map_lookup_elem(&global_counters, &key);
+    if (counter) {
+        *counter += 1;
+    }
+}
+
+// returns the wakeup flags of the direct_flows ring buffer submissions, batched by threshold
+static __always_inline u64 direct_flows_submit_flags() {
+    if (ringbuf_wakeup_threshold == 0) {
+        return 0;
+    }
+    if (bpf_ringbuf_query(&direct_flows, BPF_RB_AVAIL_DATA) >= ringbuf_wakeup_threshold) {
+        return BPF_RB_FORCE_WAKEUP;
     }
+    return BPF_RB_NO_WAKEUP;
 }
 
 // sets the TCP header flags for connection information
@@ -62,6 +71,7 @@ static inline void fill_l4info(void *l4_hdr_start, void *data_end, u8 protocol,
             id->dst_port = bpf_ntohs(tcp->dest);
             set_flags(tcp, &pkt->flags);
             pkt->l4_hdr = (void *)tcp;
+            pkt->l4_hdr_len = tcp->doff * sizeof(u32);
         }
     } break;
     case IPPROTO_UDP: {
@@ -70,6 +80,7 @@ static inline void fill_l4info(void *l4_hdr_start, void *data_end, u8 protocol,
             id->src_port = bpf_ntohs(udp->source);
             id->dst_port = bpf_ntohs(udp->dest);
             pkt->l4_hdr = (void *)udp;
+            pkt->l4_hdr_len = sizeof(*udp);
         }
     } break;
     case IPPROTO_SCTP: {
@@ -174,182 +185,198 @@ static inline bool is_filter_enabled() {
 }
 
 /*
- * check if flow filter is enabled and if we need to continue processing the packet or not
+ * evaluate the filter rules for a flow, and return whether the packet must be skipped
  */
-static __always_inline bool check_and_do_flow_filtering(flow_id *id, u16 flags, u32 drop_reason,
-                                                        u16 eth_protocol, u32 *sampling,
-                                                        u8 direction) {
-    // check if this packet need to be filtered if filtering feature is enabled
-    if (is_filter_enabled()) {
-        filter_action action = ACCEPT;
-        if (is_flow_filtered(id, &action, flags, drop_reason, eth_protocol, sampling, direction) !=
-                0 &&
-            action != MAX_FILTER_ACTIONS) {
-            // we have matching rules follow through the actions to decide if we should accept or reject the flow
-            // and update global counter for both cases
-            bool skip = false;
-            u32 key = 0;
-
-            switch (action) {
-            case REJECT:
-                key = FILTER_REJECT;
-                skip = true;
-                break;
-            case ACCEPT:
-                key = FILTER_ACCEPT;
-                break;
-            // should never come here
-            case MAX_FILTER_ACTIONS:
-                return true;
-            }
+static __always_inline bool do_flow_filtering(flow_id *id, u16 flags, u32 drop_reason,
+                                              u16 eth_protocol, u32 *sampling, u8 direction) {
+    filter_action action = ACCEPT;
+    if (is_flow_filtered(id, &action, flags, drop_reason, eth_protocol, sampling, direction) != 0 &&
+        action != MAX_FILTER_ACTIONS) {
+        // we have matching rules follow through the actions to decide if we should accept or reject the flow
+        // and update global counter for both cases
+        bool skip = false;
+        u32 key = 0;
+
+        switch (action) {
+        case REJECT:
+            key = FILTER_REJECT;
+            skip = true;
+            break;
+        case ACCEPT:
+            key = FILTER_ACCEPT;
+            break;
+        // should never come here
+        case MAX_FILTER_ACTIONS:
+            return true;
+        }
 
-            // update global counter for flows dropped by filter
-            increase_counter(key);
-            if (skip) {
-                return true;
-            }
+        // update global counter for flows dropped by filter
+        increase_counter(key);
+        if (skip) {
+            return true;
+        }
+    } else {
+        // we have no matching rules so we update global counter for flows that are not matched by any rule
+        increase_counter(FILTER_NOMATCH);
+        // we have accept rule but no match so we can't let mismatched flows in the hashmap table or
+        // we have no match at all and the action is the default value MAX_FILTER_ACTIONS.
+        if (action == ACCEPT || action == MAX_FILTER_ACTIONS) {
+            return true;
         } else {
-            // we have no matching rules so we update global counter for flows that are not matched by any rule
-            increase_counter(FILTER_NOMATCH);
-            // we have accept rule but no match so we can't let mismatched flows in the hashmap table or
-            // we have no match at all and the action is the default value MAX_FILTER_ACTIONS.
-            if (action == ACCEPT || action == MAX_FILTER_ACTIONS) {
-                return true;
-            } else {
-                // we have reject rule and no match so we can add the flows to the hashmap table.
-            }
+            // we have reject rule and no match so we can add the flows to the hashmap table.
         }
     }
     return false;
 }
 
-static inline void core_fill_in_l2(struct sk_buff *skb, u16 *eth_protocol, u16 *family) {
-    struct ethhdr eth;
-
-    __builtin_memset(&eth, 0, sizeof(eth));
-
-    u8 *skb_head = BPF_CORE_READ(skb, head);
-    u16 skb_mac_header = BPF_CORE_READ(skb, mac_header);
-
-    bpf_probe_read_kernel(&eth, sizeof(eth), (struct ethhdr *)(skb_head + skb_mac_header));
-    *eth_protocol = bpf_ntohs(eth.h_proto);
-    if (*eth_protocol == ETH_P_IP) {
-        *family = AF_INET;
-    } else if (*eth_protocol == ETH_P_IPV6) {
-        *family = AF_INET6;
+/*
+ * check if flow filter is enabled and if we need to continue processing the packet or not.
+ * The verdict is cached per CPU, so the rules are evaluated again only for the first packet of
+ * a flow, or when the rules are programmed again. The global counters are only updated by the
+ * evaluations.
+ */
+static __always_inline bool check_and_do_flow_filtering(flow_id *id, u16 flags, u32 drop_reason,
+                                                        u16 eth_protocol, u32 *sampling,
+                                                        u8 direction) {
+    // check if this packet need to be filtered if filtering feature is enabled
+    if (!is_filter_enabled()) {
+        return false;
     }
-}
-
-static inline void core_fill_in_l3(struct sk_buff *skb, flow_id *id, u16 family, u8 *protocol,
-                                   u8 *dscp) {
-    u16 skb_network_header = BPF_CORE_READ(skb, network_header);
-    u8 *skb_head = BPF_CORE_READ(skb, head);
-
-    switch (family) {
-    case AF_INET: {
-        struct iphdr ip;
-        __builtin_memset(&ip, 0, sizeof(ip));
-        bpf_probe_read_kernel(&ip, sizeof(ip), (struct iphdr *)(skb_head + skb_network_header));
-        __builtin_memcpy(id->src_ip, ip4in6, sizeof(ip4in6));
-        __builtin_memcpy(id->dst_ip, ip4in6, sizeof(ip4in6));
-        __builtin_memcpy(id->src_ip + sizeof(ip4in6), &ip.saddr, sizeof(ip.saddr));
-        __builtin_memcpy(id->dst_ip + sizeof(ip4in6), &ip.daddr, sizeof(ip.daddr));
-        *dscp = ipv4_get_dscp(&ip);
-        *protocol = ip.protocol;
-        break;
+    u32 zero = 0;
+    filter_cache_config *config = bpf_map_lookup_elem(&filter_generation, &zero);
+    if (!config) {
+        return do_flow_filtering(id, flags, drop_reason, eth_protocol, sampling, direction);
     }
-    case AF_INET6: {
-        struct ipv6hdr ip;
-        __builtin_memset(&ip, 0, sizeof(ip));
-        bpf_probe_read_kernel(&ip, sizeof(ip), (struct ipv6hdr *)(skb_head + skb_network_header));
-        __builtin_memcpy(id->src_ip, ip.saddr.in6_u.u6_addr8, IP_MAX_LEN);
-        __builtin_memcpy(id->dst_ip, ip.daddr.in6_u.u6_addr8, IP_MAX_LEN);
-        *dscp = ipv6_get_dscp(&ip);
-        *protocol = ip.nexthdr;
-        break;
+    filter_verdict_key key;
+    __builtin_memset(&key, 0, sizeof(key));
+    key.id = *id;
+    key.direction = direction;
+    if (config->match_tcp_flags) {
+        key.flags = flags;
     }
-    default:
-        return;
+    if (config->match_drops) {
+        key.drops = drop_reason != 0;
+    }
+    filter_verdict *cached = bpf_map_lookup_elem(&filter_verdicts, &key);
+    if (cached && cached->generation == config->generation) {
+        if (cached->sample && sampling != NULL) {
+            *sampling = cached->sample;
+        }
+        return cached->skip;
     }
+    filter_verdict verdict;
+    __builtin_memset(&verdict, 0, sizeof(verdict));
+    verdict.generation = config->generation;
+    verdict.skip = do_flow_filtering(id, flags, drop_reason, eth_protocol, &verdict.sample,
+                                     direction);
+    bpf_map_update_elem(&filter_verdicts, &key, &verdict, BPF_ANY);
+    if (verdict.sample && sampling != NULL) {
+        *sampling = verdict.sample;
+    }
+    return verdict.skip;
 }
 
-static inline void core_fill_in_tcp(struct sk_buff *skb, flow_id *id, u16 *flags) {
-    u16 skb_transport_header = BPF_CORE_READ(skb, transport_header);
-    u8 *skb_head = BPF_CORE_READ(skb, head);
+// core_l4_hdr holds any of the transport headers read from a socket buffer
+union core_l4_hdr {
     struct tcphdr tcp;
-    u16 sport, dport;
-
-    __builtin_memset(&tcp, 0, sizeof(tcp));
-
-    bpf_probe_read_kernel(&tcp, sizeof(tcp), (struct tcphdr *)(skb_head + skb_transport_header));
-    sport = bpf_ntohs(tcp.source);
-    dport = bpf_ntohs(tcp.dest);
-    id->src_port = sport;
-    id->dst_port = dport;
-    set_flags(&tcp, flags);
-    id->transport_protocol = IPPROTO_TCP;
-}
-
-static inline void core_fill_in_udp(struct sk_buff *skb, flow_id *id) {
-    u16 skb_transport_header = BPF_CORE_READ(skb, transport_header);
-    u8 *skb_head = BPF_CORE_READ(skb, head);
     struct udphdr udp;
-    u16 sport, dport;
-
-    __builtin_memset(&udp, 0, sizeof(udp));
-
-    bpf_probe_read_kernel(&udp, sizeof(udp), (struct udphdr *)(skb_head + skb_transport_header));
-    sport = bpf_ntohs(udp.source);
-    dport = bpf_ntohs(udp.dest);
-    id->src_port = sport;
-    id->dst_port = dport;
-    id->transport_protocol = IPPROTO_UDP;
-}
-
-static inline void core_fill_in_sctp(struct sk_buff *skb, flow_id *id) {
-    u16 skb_transport_header = BPF_CORE_READ(skb, transport_header);
-    u8 *skb_head = BPF_CORE_READ(skb, head);
     struct sctphdr sctp;
-    u16 sport, dport;
-
-    __builtin_memset(&sctp, 0, sizeof(sctp));
+    struct icmphdr icmp;
+    struct icmp6hdr icmp6;
+};
 
-    bpf_probe_read_kernel(&sctp, sizeof(sctp), (struct sctphdr *)(skb_head + skb_transport_header));
-    sport = bpf_ntohs(sctp.source);
-    dport = bpf_ntohs(sctp.dest);
-    id->src_port = sport;
-    id->dst_port = dport;
-    id->transport_protocol = IPPROTO_SCTP;
+// core_fill_in_l4 fills the flow identifier from the transport header of a socket buffer. It returns
+// -1 if the transport protocol isn't parsed.
+static inline int core_fill_in_l4(union core_l4_hdr *l4, u8 protocol, flow_id *id, u16 *flags) {
+    id->transport_protocol = protocol;
+    switch (protocol) {
+    case IPPROTO_TCP:
+        id->src_port = bpf_ntohs(l4->tcp.source);
+        id->dst_port = bpf_ntohs(l4->tcp.dest);
+        set_flags(&l4->tcp, flags);
+        break;
+    case IPPROTO_UDP:
+        id->src_port = bpf_ntohs(l4->udp.source);
+        id->dst_port = bpf_ntohs(l4->udp.dest);
+        break;
+    case IPPROTO_SCTP:
+        id->src_port = bpf_ntohs(l4->sctp.source);
+        id->dst_port = bpf_ntohs(l4->sctp.dest);
+        break;
+    case IPPROTO_ICMP:
+        id->icmp_type = l4->icmp.type;
+        id->icmp_code = l4->icmp.code;
+        break;
+    case IPPROTO_ICMPV6:
+        id->icmp_type = l4->icmp6.icmp6_type;
+        id->icmp_code = l4->icmp6.icmp6_code;
+        break;
+    default:
+        return -1;
+    }
+    return 0;
 }
 
-static inline void core_fill_in_icmpv4(struct sk_buff *skb, flow_id *id) {
-    u16 skb_transport_header = BPF_CORE_READ(skb, transport_header);
+// core_fill_in_flow_id fills the flow identifier from the headers of a socket buffer, for the
+// kprobe and tracepoint hooks. The header offsets are read once, and the network and transport
+// headers are read with a single probe when they are contiguous. It returns -1 if the transport
+// protocol isn't parsed, in which case only the addresses and the protocol are filled.
+static __always_inline int core_fill_in_flow_id(struct sk_buff *skb, flow_id *id,
+                                                u16 *eth_protocol, u16 *family, u16 *flags,
+                                                u8 *dscp) {
     u8 *skb_head = BPF_CORE_READ(skb, head);
-    struct icmphdr icmph;
-    __builtin_memset(&icmph, 0, sizeof(icmph));
-
-    bpf_probe_read_kernel(&icmph, sizeof(icmph),
-                          (struct icmphdr *)(skb_head + skb_transport_header));
-    id->icmp_type = icmph.type;
-    id->icmp_code = icmph.code;
-    id->transport_protocol = IPPROTO_ICMP;
-}
-
-static inline void core_fill_in_icmpv6(struct sk_buff *skb, flow_id *id) {
+    u16 skb_mac_header = BPF_CORE_READ(skb, mac_header);
+    u16 skb_network_header = BPF_CORE_READ(skb, network_header);
     u16 skb_transport_header = BPF_CORE_READ(skb, transport_header);
-    u8 *skb_head = BPF_CORE_READ(skb, head);
-    struct icmp6hdr icmph;
-    __builtin_memset(&icmph, 0, sizeof(icmph));
-
-    bpf_probe_read_kernel(&icmph, sizeof(icmph),
-                          (struct icmp6hdr *)(skb_head + skb_transport_header));
-    id->icmp_type = icmph.icmp6_type;
-    id->icmp_code = icmph.icmp6_code;
-    id->transport_protocol = IPPROTO_ICMPV6;
-}
-
-static inline void fill_in_others_protocol(flow_id *id, u8 protocol) {
-    id->transport_protocol = protocol;
+    u16 l4_offset = skb_transport_header - skb_network_header;
+    __be16 h_proto = 0;
+
+    bpf_probe_read_kernel(&h_proto, sizeof(h_proto),
+                          skb_head + skb_mac_header + __builtin_offsetof(struct ethhdr, h_proto));
+    *eth_protocol = bpf_ntohs(h_proto);
+
+    switch (*eth_protocol) {
+    case ETH_P_IP: {
+        struct {
+            struct iphdr ip;
+            union core_l4_hdr l4;
+        } hdrs;
+        __builtin_memset(&hdrs, 0, sizeof(hdrs));
+        *family = AF_INET;
+        if (l4_offset != sizeof(hdrs.ip) ||
+            bpf_probe_read_kernel(&hdrs, sizeof(hdrs), skb_head + skb_network_header) != 0) {
+            // IP options, or headers at the end of the buffer
+            bpf_probe_read_kernel(&hdrs.ip, sizeof(hdrs.ip), skb_head + skb_network_header);
+            bpf_probe_read_kernel(&hdrs.l4, sizeof(hdrs.l4), skb_head + skb_transport_header);
+        }
+        __builtin_memcpy(id->src_ip, ip4in6, sizeof(ip4in6));
+        __builtin_memcpy(id->dst_ip, ip4in6, sizeof(ip4in6));
+        __builtin_memcpy(id->src_ip + sizeof(ip4in6), &hdrs.ip.saddr, sizeof(hdrs.ip.saddr));
+        __builtin_memcpy(id->dst_ip + sizeof(ip4in6), &hdrs.ip.daddr, sizeof(hdrs.ip.daddr));
+        *dscp = ipv4_get_dscp(&hdrs.ip);
+        return core_fill_in_l4(&hdrs.l4, hdrs.ip.protocol, id, flags);
+    }
+    case ETH_P_IPV6: {
+        struct {
+            struct ipv6hdr ip;
+            union core_l4_hdr l4;
+        } hdrs;
+        __builtin_memset(&hdrs, 0, sizeof(hdrs));
+        *family = AF_INET6;
+        if (l4_offset != sizeof(hdrs.ip) ||
+            bpf_probe_read_kernel(&hdrs, sizeof(hdrs), skb_head + skb_network_header) != 0) {
+            // extension headers, or headers at the end of the buffer
+            bpf_probe_read_kernel(&hdrs.ip, sizeof(hdrs.ip), skb_head + skb_network_header);
+            bpf_probe_read_kernel(&hdrs.l4, sizeof(hdrs.l4), skb_head + skb_transport_header);
+        }
+        __builtin_memcpy(id->src_ip, hdrs.ip.saddr.in6_u.u6_addr8, IP_MAX_LEN);
+        __builtin_memcpy(id->dst_ip, hdrs.ip.daddr.in6_u.u6_addr8, IP_MAX_LEN);
+        *dscp = ipv6_get_dscp(&hdrs.ip);
+        return core_fill_in_l4(&hdrs.l4, hdrs.ip.nexthdr, id, flags);
+    }
+    default:
+        return -1;
+    }
 }
 
 static inline bool is_transport_protocol(u8 protocol) {
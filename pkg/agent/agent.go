@@ -2,16 +2,19 @@ package agent
 
 import (
 	"context"
+	"encoding/binary"
 	"encoding/json"
 	"errors"
 	"fmt"
+	"hash/fnv"
 	"io"
 	"net"
 	"net/http"
+	"sync"
+	"sync/atomic"
 	"time"
 
 	"github.com/netobserv/gopipes/pkg/node"
-	"github.com/netobserv/netobserv-ebpf-agent/pkg/ebpf"
 	"github.com/netobserv/netobserv-ebpf-agent/pkg/exporter"
 	"github.com/netobserv/netobserv-ebpf-agent/pkg/flow"
 	"github.com/netobserv/netobserv-ebpf-agent/pkg/ifaces"
@@ -85,21 +88,101 @@ func configureInformer(cfg *Config, log *logrus.Entry) ifaces.Informer {
 
 }
 
-func interfaceListener(ctx context.Context, ifaceEvents <-chan ifaces.Event, slog *logrus.Entry, processEvent func(iface ifaces.Interface, add bool)) {
+// interfacesSyncIdle is the time without interface events after which the existing interfaces
+// are considered to have been sent by the informer
+var interfacesSyncIdle = 5 * time.Second
+
+// interfaceQueue returns the queue of the events of an interface, among queues. The interfaces are
+// identified by the inode of their network namespace and their index, since the indexes of the
+// interfaces of different namespaces overlap.
+func interfaceQueue(iface ifaces.Interface, queues int) int {
+	var key [16]byte
+	if ino, err := iface.NetNSInode(); err == nil {
+		binary.LittleEndian.PutUint64(key[:8], ino)
+	}
+	binary.LittleEndian.PutUint64(key[8:], uint64(iface.Index))
+	h := fnv.New64a()
+	_, _ = h.Write(key[:])
+	return int(h.Sum64() % uint64(queues))
+}
+
+// interfaceListener processes the interface events with a pool of workers, so that the existing
+// interfaces, sent as a burst by the informer when it starts, are attached concurrently. The
+// events of an interface are always processed by the same worker, in order. If onSynced isn't nil,
+// it is invoked once the existing interfaces have been processed, i.e. once all the events have
+// been processed and none has been received for interfacesSyncIdle. It returns when the context
+// is cancelled, once all the workers have returned.
+func interfaceListener(ctx context.Context, ifaceEvents <-chan ifaces.Event, slog *logrus.Entry, workers int, processEvent func(iface ifaces.Interface, add bool), onSynced func()) {
+	queues := make([]chan ifaces.Event, max(workers, 1))
+	var wg sync.WaitGroup
+	defer wg.Wait()
+	// events dispatched and not processed yet
+	var pending atomic.Int64
+	for i := range queues {
+		queues[i] = make(chan ifaces.Event, cap(ifaceEvents))
+		wg.Add(1)
+		go func(queue <-chan ifaces.Event) {
+			defer wg.Done()
+			for {
+				select {
+				case <-ctx.Done():
+					return
+				case event := <-queue:
+					if ctx.Err() != nil {
+						// both cases may be ready: don't process the pending events
+						return
+					}
+					slog.WithField("event", event).Debug("received event")
+					switch event.Type {
+					case ifaces.EventAdded:
+						processEvent(event.Interface, true)
+					case ifaces.EventDeleted:
+						processEvent(event.Interface, false)
+					default:
+						slog.WithField("event", event).Warn("unknown event type")
+					}
+					pending.Add(-1)
+				}
+			}
+		}(queues[i])
+	}
+	var syncTimer *time.Timer
+	var synced <-chan time.Time
+	if onSynced != nil {
+		syncTimer = time.NewTimer(interfacesSyncIdle)
+		defer syncTimer.Stop()
+		synced = syncTimer.C
+	}
 	for {
 		select {
 		case <-ctx.Done():
 			slog.Debug("stopping interfaces' listener")
 			return
+		case <-synced:
+			if pending.Load() > 0 {
+				syncTimer.Reset(interfacesSyncIdle)
+				continue
+			}
+			slog.Debug("existing interfaces processed")
+			synced = nil
+			onSynced()
 		case event := <-ifaceEvents:
-			slog.WithField("event", event).Debug("received event")
-			switch event.Type {
-			case ifaces.EventAdded:
-				processEvent(event.Interface, true)
-			case ifaces.EventDeleted:
-				processEvent(event.Interface, false)
-			default:
-				slog.WithField("event", event).Warn("unknown event type")
+			if synced != nil {
+				if !syncTimer.Stop() {
+					select {
+					case <-syncTimer.C:
+					default:
+					}
+				}
+				syncTimer.Reset(interfacesSyncIdle)
+			}
+			pending.Add(1)
+			queue := queues[interfaceQueue(event.Interface, len(queues))]
+			select {
+			case <-ctx.Done():
+				slog.Debug("stopping interfaces' listener")
+				return
+			case queue <- event:
 			}
 		}
 	}
@@ -121,9 +204,12 @@ type Flows struct {
 	limiter   *flow.CapacityLimiter
 	exporter  node.TerminalFunc[[]*model.Record]
 
+	metrics       *metrics.Metrics
 	status        Status
 	promoServer   *http.Server
 	sampleDecoder *ovnobserv.SampleDecoder
+	// running interface listeners, waited for before closing the eBPF fetcher
+	interfaceListeners sync.WaitGroup
 }
 
 // ebpfFlowFetcher abstracts the interface of ebpf.FlowFetcher to allow dependency injection in tests
@@ -134,9 +220,12 @@ type ebpfFlowFetcher interface {
 	AttachTCX(iface ifaces.Interface) error
 	DetachTCX(iface ifaces.Interface) error
 
-	LookupAndDeleteMap(*metrics.Metrics) map[ebpf.BpfFlowId]model.BpfFlowContent
+	LookupAndDeleteMap(*metrics.Metrics) []model.BpfFlowEntry
+	LookupAndDeleteExpired(met *metrics.Metrics, maxEntries int, idleTimeout, activeTimeout time.Duration) ([]model.BpfFlowEntry, int, bool)
+	IncrementalEvictionSupported() bool
 	DeleteMapsStaleEntries(timeOut time.Duration)
 	ReadRingBuf() (ringbuf.Record, error)
+	UnpinStaleTCXLinks()
 }
 
 // FlowsAgent instantiates a new agent, given a configuration.
@@ -193,6 +282,16 @@ func FlowsAgent(cfg *Config) (*Flows, error) {
 	}
 
 	ingress, egress := flowDirections(cfg)
+	preallocateMaps, lruMaps := flowsMapMode(cfg)
+	xdpIngress, xdpGenericMode := ingressAttachMode(cfg)
+	adaptiveSamplingMax := 0
+	if cfg.EnableAdaptiveSampling {
+		adaptiveSamplingMax = cfg.AdaptiveSamplingMax
+	}
+	flowsSketchSlots := 0
+	if cfg.EnableFlowsSketch {
+		flowsSketchSlots = cfg.FlowsSketchSlots
+	}
 	debug := false
 	if cfg.LogLevel == logrus.TraceLevel.String() || cfg.LogLevel == logrus.DebugLevel.String() {
 		debug = true
@@ -230,13 +329,31 @@ func FlowsAgent(cfg *Config) (*Flows, error) {
 		EnablePktDrops:                 cfg.EnablePktDrops,
 		EnableDNSTracker:               cfg.EnableDNSTracking,
 		DNSTrackerPort:                 cfg.DNSTrackingPort,
+		DNSTrackingLRUSize:             cfg.DNSTrackingLRUSize,
 		EnableRTT:                      cfg.EnableRTT,
+		RTTSamplingInterval:            cfg.RTTSamplingInterval,
 		EnableNetworkEventsMonitoring:  cfg.EnableNetworkEventsMonitoring,
 		NetworkEventsMonitoringGroupID: cfg.NetworkEventsMonitoringGroupID,
 		EnableFlowFilter:               cfg.EnableFlowFilter,
 		EnablePktTranslation:           cfg.EnablePktTranslationTracking,
+		EnablePerCPUAggregation:        cfg.EnablePerCPUAggregation,
+		EnableFlowsExpiry:              cfg.EnableKernelFlowsExpiry,
+		FlowsIdleTimeout:               cfg.CacheIdleTimeout,
+		DNSFlowsTimeout:                cfg.StaleEntriesEvictTimeout,
+		PreallocateMaps:                preallocateMaps,
+		LRUMaps:                        lruMaps,
+		XDPIngress:                     xdpIngress,
+		XDPGenericMode:                 xdpGenericMode,
+		EnableCompactIPv4Keys:          cfg.EnableCompactIPv4Keys,
+		FlowsSketchSlots:               flowsSketchSlots,
+		AdaptiveSamplingMax:            adaptiveSamplingMax,
+		RingbufWakeupBatch:             cfg.RingbufWakeupBatch,
+		RingbufFlushPeriod:             cfg.RingbufFlushPeriod,
+		EnableBpfStats:                 cfg.EnableBpfStats,
 		UseEbpfManager:                 cfg.EbpfProgramManagerMode,
 		BpfManBpfFSPath:                cfg.BpfManBpfFSPath,
+		HotRestart:                     cfg.HotRestart,
+		HotRestartPinPath:              cfg.HotRestartPinPath,
 		FilterConfig:                   filterRules,
 	}
 
@@ -298,9 +415,16 @@ func flowsAgent(cfg *Config, m *metrics.Metrics,
 	samplingGauge := m.CreateSamplingRate()
 	samplingGauge.Set(float64(cfg.Sampling))
 
-	mapTracer := flow.NewMapTracer(fetcher, cfg.CacheActiveTimeout, cfg.StaleEntriesEvictTimeout, m, s, cfg.EnableUDNMapping)
+	var incrementalEviction *flow.IncrementalEviction
+	if cfg.EnableIncrementalEviction {
+		incrementalEviction = &flow.IncrementalEviction{
+			IdleTimeout: cfg.CacheIdleTimeout,
+			Steps:       cfg.IncrementalEvictionSteps,
+		}
+	}
+	mapTracer := flow.NewMapTracer(fetcher, cfg.CacheActiveTimeout, cfg.StaleEntriesEvictTimeout, m, s, cfg.EnableUDNMapping, incrementalEviction)
 	rbTracer := flow.NewRingBufTracer(fetcher, mapTracer, cfg.CacheActiveTimeout, m)
-	accounter := flow.NewAccounter(cfg.CacheMaxFlows, cfg.CacheActiveTimeout, time.Now, monotime.Now, m, s, cfg.EnableUDNMapping)
+	accounter := flow.NewAccounter(cfg.CacheMaxFlows, cfg.CacheActiveTimeout, time.Now, monotime.Now, m, s, cfg.EnableUDNMapping, cfg.AccounterShards)
 	limiter := flow.NewCapacityLimiter(m)
 
 	return &Flows{
@@ -314,9 +438,38 @@ func flowsAgent(cfg *Config, m *metrics.Metrics,
 		accounter:   accounter,
 		limiter:     limiter,
 		promoServer: promoServer,
+		metrics:     m,
 	}, nil
 }
 
+func flowsMapMode(cfg *Config) (prealloc, lru bool) {
+	switch cfg.FlowsMapMode {
+	case FlowsMapModeDynamic:
+		return false, false
+	case FlowsMapModePrealloc:
+		return true, false
+	case FlowsMapModeLRU:
+		return false, true
+	default:
+		alog.Warnf("unknown FLOWS_MAP_MODE %q. Allocating flows map entries dynamically", cfg.FlowsMapMode)
+		return false, false
+	}
+}
+
+func ingressAttachMode(cfg *Config) (xdp, generic bool) {
+	switch cfg.IngressAttachMode {
+	case IngressAttachModeTC:
+		return false, false
+	case IngressAttachModeXDP:
+		return true, false
+	case IngressAttachModeXDPGeneric:
+		return true, true
+	default:
+		alog.Warnf("unknown INGRESS_ATTACH_MODE %q. Attaching the ingress flows program to TC", cfg.IngressAttachMode)
+		return false, false
+	}
+}
+
 func flowDirections(cfg *Config) (ingress, egress bool) {
 	switch cfg.Direction {
 	case DirectionIngress:
@@ -392,6 +545,10 @@ func buildKafkaExporter(cfg *Config, m *metrics.Metrics) (node.TerminalFunc[[]*m
 		}
 		transport.SASL = mechanism
 	}
+	batchTimeout := cfg.KafkaBatchLinger
+	if batchTimeout <= 0 {
+		batchTimeout = time.Nanosecond
+	}
 	return (&exporter.KafkaProto{
 		Writer: &kafkago.Writer{
 			Addr:      kafkago.TCP(cfg.KafkaBrokers...),
@@ -406,15 +563,18 @@ func buildKafkaExporter(cfg *Config, m *metrics.Metrics) (node.TerminalFunc[[]*m
 			// Segmentio's Kafka-go does not behave as standard Kafka library, and would
 			// throttle any Write invocation until reaching the timeout.
 			// Since we invoke write once each CacheActiveTimeout, we can safely disable this
-			// timeout throttling
+			// timeout throttling, unless a linger time is configured
 			// https://github.com/netobserv/flowlogs-pipeline/pull/233#discussion_r897830057
-			BatchTimeout: time.Nanosecond,
+			BatchTimeout: batchTimeout,
 			Async:        cfg.KafkaAsync,
 			Compression:  compression,
 			Transport:    &transport,
 			Balancer:     &kafkago.Hash{},
 		},
-		Metrics: m,
+		Metrics:           m,
+		RecordsPerMessage: cfg.KafkaRecordsPerMessage,
+		RecordsKeys:       cfg.KafkaRecordsKeys,
+		MaxMessageBytes:   cfg.KafkaBatchSize,
 	}).ExportFlows, nil
 }
 
@@ -423,7 +583,7 @@ func buildIPFIXExporter(cfg *Config, proto string) (node.TerminalFunc[[]*model.R
 		return nil, fmt.Errorf("missing target host or port: %s:%d",
 			cfg.TargetHost, cfg.TargetPort)
 	}
-	ipfix, err := exporter.StartIPFIXExporter(cfg.TargetHost, cfg.TargetPort, proto)
+	ipfix, err := exporter.StartIPFIXExporter(cfg.TargetHost, cfg.TargetPort, proto, cfg.IPFIXPathMTU)
 	if err != nil {
 		return nil, err
 	}
@@ -446,6 +606,8 @@ func (f *Flows) Run(ctx context.Context) error {
 
 	f.status = StatusStopping
 	alog.Info("stopping Flows agent")
+	alog.Debug("waiting for the interfaces being attached")
+	f.interfaceListeners.Wait()
 	if err := f.ebpf.Close(); err != nil {
 		alog.WithError(err).Warn("eBPF resources not correctly closed")
 	}
@@ -482,7 +644,11 @@ func (f *Flows) interfacesManager(ctx context.Context) error {
 		return fmt.Errorf("instantiating interfaces' informer: %w", err)
 	}
 
-	go interfaceListener(ctx, ifaceEvents, slog, f.onInterfaceEvent)
+	f.interfaceListeners.Add(1)
+	go func() {
+		defer f.interfaceListeners.Done()
+		interfaceListener(ctx, ifaceEvents, slog, f.cfg.InterfaceAttachWorkers, f.onInterfaceEvent, f.ebpf.UnpinStaleTCXLinks)
+	}()
 
 	return nil
 }
@@ -542,15 +708,19 @@ func (f *Flows) onInterfaceEvent(iface ifaces.Interface, add bool) {
 	}
 	if add {
 		alog.WithField("interface", iface).Info("interface detected. trying to attach TCX hook")
+		start := time.Now()
+		hook := "tcx"
 		if err := f.ebpf.AttachTCX(iface); err != nil {
 			alog.WithField("interface", iface).WithError(err).
 				Info("can't attach to TCx hook flow ebpfFetcher. fall back to use legacy TC hook")
+			hook = "tc"
 			if err := f.ebpf.Register(iface); err != nil {
 				alog.WithField("interface", iface).WithError(err).
 					Warn("can't register flow ebpfFetcher. Ignoring")
 				return
 			}
 		}
+		f.metrics.InterfaceAttachDuration.WithHook(hook).Observe(time.Since(start).Seconds())
 	} else {
 		alog.WithField("interface", iface).Info("interface deleted. trying to detach TCX hook")
 		if err := f.ebpf.DetachTCX(iface); err != nil {
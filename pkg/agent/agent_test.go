@@ -48,6 +48,26 @@ func TestFlowsAgent_InvalidConfigs(t *testing.T) {
 	}
 }
 
+func TestIngressAttachMode(t *testing.T) {
+	for _, tc := range []struct {
+		mode    string
+		xdp     bool
+		generic bool
+	}{
+		{mode: IngressAttachModeTC},
+		{mode: IngressAttachModeXDP, xdp: true},
+		{mode: IngressAttachModeXDPGeneric, xdp: true, generic: true},
+		// unknown modes fall back to TC
+		{mode: "foo"},
+	} {
+		t.Run(tc.mode, func(t *testing.T) {
+			xdp, generic := ingressAttachMode(&Config{IngressAttachMode: tc.mode})
+			assert.Equal(t, tc.xdp, xdp)
+			assert.Equal(t, tc.generic, generic)
+		})
+	}
+}
+
 var (
 	key1 = ebpf.BpfFlowId{
 		SrcPort: 123,
@@ -22,6 +22,17 @@ const (
 	IPIfaceExternal    = "external"
 	IPIfaceLocal       = "local"
 	IPIfaceNamedPrefix = "name:"
+
+	FlowsMapModeDynamic  = "dynamic"
+	FlowsMapModePrealloc = "prealloc"
+	FlowsMapModeLRU      = "lru"
+
+	IngressAttachModeTC         = "tc"
+	IngressAttachModeXDP        = "xdp"
+	IngressAttachModeXDPGeneric = "xdp-generic"
+
+	PCACaptureModePerf    = "perf"
+	PCACaptureModeRingbuf = "ringbuf"
 )
 
 type FlowFilter struct {
@@ -101,6 +112,9 @@ type Config struct {
 	TargetHost string `env:"TARGET_HOST"`
 	// Port is the port the flow or packet collector, when the EXPORT variable is set to "grpc"
 	TargetPort int `env:"TARGET_PORT"`
+	// IPFIXPathMTU is the MTU of the path to the IPFIX collector, when the EXPORT variable is set to
+	// "ipfix+udp". The flows are packed in IPFIX messages that fit in it.
+	IPFIXPathMTU int `env:"IPFIX_PATH_MTU" envDefault:"1500"`
 	// GRPCMessageMaxFlows specifies the limit, in number of flows, of each GRPC message. Messages
 	// larger than that number will be split and submitted sequentially.
 	GRPCMessageMaxFlows int `env:"GRPC_MESSAGE_MAX_FLOWS" envDefault:"10000"`
@@ -132,6 +146,10 @@ type Config struct {
 	// CacheActiveTimeout specifies the maximum duration that flows are kept in the accounting
 	// cache before being flushed for its later export
 	CacheActiveTimeout time.Duration `env:"CACHE_ACTIVE_TIMEOUT" envDefault:"5s"`
+	// AccounterShards specifies in how many shards the userspace accounting of the flows received
+	// via ring buffer is split, each one running in its own goroutine. The CACHE_MAX_FLOWS limit is
+	// shared among the shards.
+	AccounterShards int `env:"ACCOUNTER_SHARDS" envDefault:"1"`
 	// Direction allows selecting which flows to trace according to its direction. Accepted values
 	// are "ingress", "egress" or "both" (default).
 	Direction string `env:"DIRECTION" envDefault:"both"`
@@ -140,6 +158,12 @@ type Config struct {
 	// Sampling holds the rate at which packets should be sampled and sent to the target collector.
 	// E.g. if set to 100, one out of 100 packets, on average, will be sent to the target collector.
 	Sampling int `env:"SAMPLING" envDefault:"0"`
+	// EnableAdaptiveSampling raises the sampling rate, up to AdaptiveSamplingMax, when the eBPF flows map
+	// or ring buffer are under pressure, and lowers it back to Sampling when the load eases.
+	// The effective rate is reported in each flow. Default is false.
+	EnableAdaptiveSampling bool `env:"ENABLE_ADAPTIVE_SAMPLING" envDefault:"false"`
+	// AdaptiveSamplingMax is the highest sampling rate applied by the adaptive sampling, default is 1000.
+	AdaptiveSamplingMax int `env:"ADAPTIVE_SAMPLING_MAX" envDefault:"1000"`
 	// ListenInterfaces specifies the mechanism used by the agent to listen for added or removed
 	// network interfaces. Accepted values are "watch" (default) or "poll".
 	// If the value is "watch", interfaces are traced immediately after they are created. This is
@@ -149,6 +173,9 @@ type Config struct {
 	// ListenPollPeriod specifies the periodicity to query the network interfaces when the
 	// ListenInterfaces value is set to "poll".
 	ListenPollPeriod time.Duration `env:"LISTEN_POLL_PERIOD" envDefault:"10s"`
+	// InterfaceAttachWorkers is the number of interfaces to which the flows programs are attached
+	// concurrently, e.g. when the agent starts on a node with many interfaces
+	InterfaceAttachWorkers int `env:"INTERFACE_ATTACH_WORKERS" envDefault:"8"`
 	// KafkaBrokers is a comma-separated list of tha addresses of the brokers of the Kafka cluster
 	// that this agent is configured to send messages to.
 	KafkaBrokers []string `env:"KAFKA_BROKERS" envSeparator:","`
@@ -166,6 +193,15 @@ type Config struct {
 	// KafkaCompression sets the compression codec to be used to compress messages. The accepted
 	// values are: none (default), gzip, snappy, lz4, zstd.
 	KafkaCompression string `env:"KAFKA_COMPRESSION" envDefault:"none"`
+	// KafkaBatchLinger is the maximum time the messages are buffered before being sent to a
+	// partition, if the batch limits are not reached before. Zero sends them right away.
+	KafkaBatchLinger time.Duration `env:"KAFKA_BATCH_LINGER" envDefault:"0s"`
+	// KafkaRecordsPerMessage, when greater than 1, sends lists of up to that many flows in each
+	// Kafka message, encoded as a Records protobuf, instead of one Record per message.
+	KafkaRecordsPerMessage int `env:"KAFKA_RECORDS_PER_MESSAGE" envDefault:"1"`
+	// KafkaRecordsKeys is the number of distinct keys the lists of flows are spread among, when
+	// KafkaRecordsPerMessage is greater than 1. It should be at least the number of partitions.
+	KafkaRecordsKeys int `env:"KAFKA_RECORDS_KEYS" envDefault:"64"`
 	// KafkaEnableTLS set true to enable TLS
 	KafkaEnableTLS bool `env:"KAFKA_ENABLE_TLS" envDefault:"false"`
 	// KafkaTLSInsecureSkipVerify skips server certificate verification in TLS connections
@@ -194,6 +230,9 @@ type Config struct {
 	// This feature requires the flows agent to attach at both Ingress and Egress hookpoints.
 	// If both Ingress and Egress are not enabled then this feature will not be enabled even if set to true via env.
 	EnableRTT bool `env:"ENABLE_RTT" envDefault:"false"`
+	// RTTSamplingInterval is the minimum interval between two RTT samples of a TCP socket. By
+	// default (0) the RTT is sampled on every received segment.
+	RTTSamplingInterval time.Duration `env:"RTT_SAMPLING_INTERVAL" envDefault:"0s"`
 	// ForceGC enables forcing golang garbage collection run at the end of every map eviction, default is true
 	ForceGC bool `env:"FORCE_GARBAGE_COLLECTION" envDefault:"true"`
 	// EnablePktDrops enable Packet drops eBPF hook to account for dropped flows
@@ -203,11 +242,20 @@ type Config struct {
 	// DNSTrackingPort used to define which port the DNS service is mapped to at the pod level,
 	// so we can track DNS at the pod level
 	DNSTrackingPort uint16 `env:"DNS_TRACKING_PORT" envDefault:"53"`
+	// DNSTrackingLRUSize, when set, keeps the DNS queries waiting for a response in an LRU map of
+	// this size, aged in the kernel, instead of a dynamically allocated map swept by the agent.
+	DNSTrackingLRUSize int `env:"DNS_TRACKING_LRU_SIZE" envDefault:"0"`
 	// StaleEntriesEvictTimeout specifies the maximum duration that stale entries are kept
 	// before being deleted, default is 5 seconds.
 	StaleEntriesEvictTimeout time.Duration `env:"STALE_ENTRIES_EVICT_TIMEOUT" envDefault:"5s"`
 	// EnablePCA enables Packet Capture Agent (PCA). By default, PCA is off.
 	EnablePCA bool `env:"ENABLE_PCA" envDefault:"false"`
+	// PCACaptureMode defines how the captured packets are sent to the agent. Accepted values are "perf"
+	// (default, per-CPU perf event buffers) and "ringbuf" (a ring buffer shared by all the CPUs, with
+	// packets truncated to 16384 bytes). The ring buffer wakeups are batched as RingbufWakeupBatch.
+	PCACaptureMode string `env:"PCA_CAPTURE_MODE" envDefault:"perf"`
+	// PCASnaplen is the maximum number of bytes captured from each packet. Default is 0 (the whole packet).
+	PCASnaplen int `env:"PCA_SNAPLEN" envDefault:"0"`
 	// MetricsEnable enables http server to collect ebpf agent metrics, default is false.
 	MetricsEnable bool `env:"METRICS_ENABLE" envDefault:"false"`
 	// MetricsServerAddress is the address of the server that collects ebpf agent metrics.
@@ -234,8 +282,61 @@ type Config struct {
 	EbpfProgramManagerMode bool `env:"EBPF_PROGRAM_MANAGER_MODE" envDefault:"false"`
 	// BpfManBpfFSPath user configurable ebpf manager mount path
 	BpfManBpfFSPath string `env:"BPFMAN_BPF_FS_PATH" envDefault:"/run/netobserv/maps"`
+	// HotRestart keeps the flows maps and the TCX links pinned in HotRestartPinPath when the agent
+	// stops, so that the next agent continues from the flows accounted meanwhile. Default is false.
+	HotRestart bool `env:"HOT_RESTART" envDefault:"false"`
+	// HotRestartPinPath is the BPF filesystem directory where the flows state is pinned in hot
+	// restart mode
+	HotRestartPinPath string `env:"HOT_RESTART_PIN_PATH" envDefault:"/sys/fs/bpf/netobserv"`
 	// EnableUDNMapping to allow mapping pod's interface to udn label
 	EnableUDNMapping bool `env:"ENABLE_UDN_MAPPING" envDefault:"false"`
+	// EnablePerCPUAggregation aggregates flows in a lock-free per-CPU eBPF map instead of a shared
+	// map protected by a spin lock. Per-CPU values are merged in user space, default is false.
+	EnablePerCPUAggregation bool `env:"ENABLE_PERCPU_AGGREGATION" envDefault:"false"`
+	// EnableIncrementalEviction walks the eBPF flows map in slices, evicting only the flows that have been
+	// idle for CacheIdleTimeout or active for CacheActiveTimeout, instead of draining it every
+	// CacheActiveTimeout. It requires batch map operations (Kernel>=5.6), default is false.
+	EnableIncrementalEviction bool `env:"ENABLE_INCREMENTAL_EVICTION" envDefault:"false"`
+	// CacheIdleTimeout specifies, when EnableIncrementalEviction or EnableKernelFlowsExpiry is true, the
+	// duration after which a flow without new packets is evicted. It is also the duration of a walk
+	// through the whole eBPF map in incremental eviction mode.
+	CacheIdleTimeout time.Duration `env:"CACHE_IDLE_TIMEOUT" envDefault:"2s"`
+	// IncrementalEvictionSteps specifies, when EnableIncrementalEviction is true, the number of slices
+	// in which each walk through the eBPF map is split.
+	IncrementalEvictionSteps int `env:"INCREMENTAL_EVICTION_STEPS" envDefault:"10"`
+	// EnableKernelFlowsExpiry expires, from a BPF timer, the flows that have been idle for CacheIdleTimeout
+	// and the DNS queries without response for StaleEntriesEvictTimeout, without waiting for the eviction
+	// from userspace. Expired flows are forwarded via ring buffer. It requires Kernel>=5.14 and is not
+	// applied to flows aggregated per CPU, default is false.
+	EnableKernelFlowsExpiry bool `env:"ENABLE_KERNEL_FLOWS_EXPIRY" envDefault:"false"`
+	// FlowsMapMode defines how the memory of the eBPF flows maps is allocated. Accepted values are "dynamic"
+	// (default, entries are allocated when flows are created), "prealloc" (all entries are allocated when
+	// loading the maps) and "lru" (preallocated maps evicting the least recently used entries when full).
+	FlowsMapMode string `env:"FLOWS_MAP_MODE" envDefault:"dynamic"`
+	// IngressAttachMode defines how the ingress flows program is attached to the interfaces. Accepted values
+	// are "tc" (default, TCX or legacy TC hooks), "xdp" (XDP hook, in driver mode when supported by the
+	// interface) and "xdp-generic" (XDP hook in generic mode). XDP accounts the ingress packets before the
+	// socket buffer allocation. It falls back to TC when the XDP program can't be attached.
+	IngressAttachMode string `env:"INGRESS_ATTACH_MODE" envDefault:"tc"`
+	// RingbufWakeupBatch is the number of flows submitted to the ring buffer, e.g. when the flows map is full,
+	// before waking up the agent, which reduces the context switches when many flows are submitted.
+	// Pending flows are also read every RingbufFlushPeriod. Default is 0 (a wakeup per flow).
+	RingbufWakeupBatch int `env:"RINGBUF_WAKEUP_BATCH" envDefault:"0"`
+	// RingbufFlushPeriod is the period at which the ring buffer is read when RingbufWakeupBatch is set.
+	RingbufFlushPeriod time.Duration `env:"RINGBUF_FLUSH_PERIOD" envDefault:"100ms"`
+	// EnableCompactIPv4Keys aggregates the IPv4 flows in a separate eBPF map, keyed by a compact flow
+	// identifier that doesn't store the addresses as IPv6, reducing the hashing and memory cost of the
+	// map entries. It is ignored when ENABLE_PERCPU_AGGREGATION is true, default is false.
+	EnableCompactIPv4Keys bool `env:"ENABLE_COMPACT_IPV4_KEYS" envDefault:"false"`
+	// EnableFlowsSketch aggregates the flows that can't be inserted in the eBPF flows map, when it is full
+	// or busy, in a bounded count-min sketch and heavy hitters table, instead of sending each of their
+	// packets via ring buffer. Default is false.
+	EnableFlowsSketch bool `env:"ENABLE_FLOWS_SKETCH" envDefault:"false"`
+	// FlowsSketchSlots is the number of heavy hitter flows kept per CPU by the flows sketch, default is 1024.
+	FlowsSketchSlots int `env:"FLOWS_SKETCH_SLOTS" envDefault:"1024"`
+	// EnableBpfStats enables the kernel statistics of the eBPF programs, exported in the metrics along with
+	// histograms of the packets processing time computed by the flows programs. Default is false.
+	EnableBpfStats bool `env:"ENABLE_BPF_STATS" envDefault:"false"`
 	/* Deprecated configs are listed below this line
 	 * See manageDeprecatedConfigs function for details
 	 */
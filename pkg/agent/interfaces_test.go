@@ -0,0 +1,190 @@
+package agent
+
+import (
+	"context"
+	"sync"
+	"testing"
+	"time"
+
+	"github.com/netobserv/netobserv-ebpf-agent/pkg/ifaces"
+	"github.com/sirupsen/logrus"
+	"github.com/stretchr/testify/assert"
+	"github.com/stretchr/testify/require"
+	"github.com/vishvananda/netns"
+)
+
+// agent_test.go, defining timeout, is not built with -race
+const listenerTimeout = 2 * time.Second
+
+func TestInterfaceListener_Workers(t *testing.T) {
+	ctx, cancel := context.WithCancel(context.Background())
+	defer cancel()
+
+	var mutex sync.Mutex
+	added := map[int][]bool{}
+	var running, maxRunning int
+	// each event blocks until enough events run concurrently, or the timeout
+	release := make(chan struct{})
+	var releaseOnce sync.Once
+	// one interface per worker
+	var indexes []int
+	used := map[int]bool{}
+	for index := 1; len(indexes) < 4; index++ {
+		queue := interfaceQueue(ifaces.Interface{Index: index, NetNS: netns.None()}, 4)
+		if !used[queue] {
+			used[queue] = true
+			indexes = append(indexes, index)
+		}
+	}
+	events := make(chan ifaces.Event, 10)
+	go interfaceListener(ctx, events, logrus.WithField("test", t.Name()), 4, func(iface ifaces.Interface, add bool) {
+		mutex.Lock()
+		running++
+		maxRunning = max(maxRunning, running)
+		if running == 4 {
+			releaseOnce.Do(func() { close(release) })
+		}
+		mutex.Unlock()
+		select {
+		case <-release:
+		case <-time.After(listenerTimeout):
+		}
+		mutex.Lock()
+		running--
+		added[iface.Index] = append(added[iface.Index], add)
+		mutex.Unlock()
+	}, nil)
+	for _, index := range indexes {
+		events <- ifaces.Event{Type: ifaces.EventAdded, Interface: ifaces.Interface{Name: "veth", Index: index, NetNS: netns.None()}}
+	}
+	for _, index := range indexes {
+		events <- ifaces.Event{Type: ifaces.EventDeleted, Interface: ifaces.Interface{Name: "veth", Index: index, NetNS: netns.None()}}
+	}
+
+	assert.Eventually(t, func() bool {
+		mutex.Lock()
+		defer mutex.Unlock()
+		for _, index := range indexes {
+			if len(added[index]) != 2 {
+				return false
+			}
+		}
+		return true
+	}, listenerTimeout, 10*time.Millisecond)
+	mutex.Lock()
+	defer mutex.Unlock()
+	// the interfaces are attached concurrently, and the events of each interface are in order
+	assert.Equal(t, 4, maxRunning)
+	for _, index := range indexes {
+		assert.Equal(t, []bool{true, false}, added[index])
+	}
+}
+
+func TestInterfaceQueue(t *testing.T) {
+	// the namespace is identified by its inode, not by its handle
+	nsh, err := netns.Get()
+	require.NoError(t, err)
+	defer nsh.Close()
+	queues := map[int]bool{}
+	for index := 1; index <= 64; index++ {
+		queue := interfaceQueue(ifaces.Interface{Index: index, NetNS: netns.None()}, 4)
+		assert.Equal(t, queue, interfaceQueue(ifaces.Interface{Index: index, NetNS: nsh}, 4))
+		assert.Less(t, queue, 4)
+		queues[queue] = true
+	}
+	// the interfaces are spread among the queues
+	assert.Len(t, queues, 4)
+}
+
+func TestInterfaceListener_StopsOnCancel(t *testing.T) {
+	ctx, cancel := context.WithCancel(context.Background())
+
+	var mutex sync.Mutex
+	var processed int
+	release := make(chan struct{})
+	events := make(chan ifaces.Event, 10)
+	done := make(chan struct{})
+	go func() {
+		interfaceListener(ctx, events, logrus.WithField("test", t.Name()), 1, func(_ ifaces.Interface, _ bool) {
+			mutex.Lock()
+			processed++
+			mutex.Unlock()
+			<-release
+		}, nil)
+		close(done)
+	}()
+	for i := 0; i < 4; i++ {
+		events <- ifaces.Event{Type: ifaces.EventAdded, Interface: ifaces.Interface{Name: "veth", Index: i}}
+	}
+	assert.Eventually(t, func() bool {
+		mutex.Lock()
+		defer mutex.Unlock()
+		return processed == 1
+	}, listenerTimeout, 10*time.Millisecond)
+
+	// the listener waits for the running event, and then stops without draining the queue
+	cancel()
+	select {
+	case <-done:
+		t.Fatal("the listener returned before the running event")
+	case <-time.After(50 * time.Millisecond):
+	}
+	close(release)
+	select {
+	case <-done:
+	case <-time.After(listenerTimeout):
+		t.Fatal("the listener didn't stop")
+	}
+	mutex.Lock()
+	defer mutex.Unlock()
+	assert.Equal(t, 1, processed)
+}
+
+func TestInterfaceListener_Synced(t *testing.T) {
+	const idle = 50 * time.Millisecond
+	defaultIdle := interfacesSyncIdle
+	interfacesSyncIdle = idle
+	ctx, cancel := context.WithCancel(context.Background())
+	done := make(chan struct{})
+	defer func() {
+		cancel()
+		<-done
+		interfacesSyncIdle = defaultIdle
+	}()
+
+	var mutex sync.Mutex
+	var processed int
+	processedOnSync := make(chan int, 2)
+	events := make(chan ifaces.Event, 10)
+	go func() {
+		interfaceListener(ctx, events, logrus.WithField("test", t.Name()), 2, func(_ ifaces.Interface, _ bool) {
+			// the processing of an event lasts longer than the idle time
+			time.Sleep(2 * idle)
+			mutex.Lock()
+			processed++
+			mutex.Unlock()
+		}, func() {
+			mutex.Lock()
+			defer mutex.Unlock()
+			processedOnSync <- processed
+		})
+		close(done)
+	}()
+	for i := 0; i < 4; i++ {
+		events <- ifaces.Event{Type: ifaces.EventAdded, Interface: ifaces.Interface{Name: "veth", Index: i}}
+	}
+
+	// the listener is synced once, after all the existing interfaces have been processed
+	select {
+	case n := <-processedOnSync:
+		assert.Equal(t, 4, n)
+	case <-time.After(listenerTimeout):
+		t.Fatal("the listener wasn't synced")
+	}
+	events <- ifaces.Event{Type: ifaces.EventAdded, Interface: ifaces.Interface{Name: "veth", Index: 5}}
+	select {
+	case <-processedOnSync:
+		t.Fatal("the listener was synced twice")
+	case <-time.After(5 * idle):
+	}
+}
@@ -6,6 +6,7 @@ import (
 	"fmt"
 	"io"
 	"net"
+	"sync"
 
 	"github.com/netobserv/gopipes/pkg/node"
 	"github.com/netobserv/netobserv-ebpf-agent/pkg/exporter"
@@ -15,7 +16,6 @@ import (
 	"github.com/netobserv/netobserv-ebpf-agent/pkg/model"
 	"github.com/netobserv/netobserv-ebpf-agent/pkg/tracer"
 
-	"github.com/cilium/ebpf/perf"
 	"github.com/sirupsen/logrus"
 )
 
@@ -38,6 +38,8 @@ type Packets struct {
 	agentIP        net.IP
 
 	status Status
+	// running interface listeners, waited for before closing the eBPF fetcher
+	interfaceListeners sync.WaitGroup
 }
 
 type ebpfPacketFetcher interface {
@@ -47,7 +49,7 @@ type ebpfPacketFetcher interface {
 	AttachTCX(iface ifaces.Interface) error
 	DetachTCX(iface ifaces.Interface) error
 	LookupAndDeleteMap(*metrics.Metrics) map[int][]*byte
-	ReadPerf() (perf.Record, error)
+	ReadPacket() ([]byte, error)
 }
 
 // PacketsAgent instantiates a new agent, given a configuration.
@@ -100,14 +102,18 @@ func PacketsAgent(cfg *Config) (*Packets, error) {
 		})
 	}
 	ebpfConfig := &tracer.FlowFetcherConfig{
-		EnableIngress:  ingress,
-		EnableEgress:   egress,
-		Debug:          debug,
-		Sampling:       cfg.Sampling,
-		CacheMaxSize:   cfg.CacheMaxFlows,
-		EnablePCA:      cfg.EnablePCA,
-		UseEbpfManager: cfg.EbpfProgramManagerMode,
-		FilterConfig:   filterRules,
+		EnableIngress:      ingress,
+		EnableEgress:       egress,
+		Debug:              debug,
+		Sampling:           cfg.Sampling,
+		CacheMaxSize:       cfg.CacheMaxFlows,
+		EnablePCA:          cfg.EnablePCA,
+		PCARingbuf:         pcaRingbuf(cfg),
+		PCASnaplen:         cfg.PCASnaplen,
+		RingbufWakeupBatch: cfg.RingbufWakeupBatch,
+		RingbufFlushPeriod: cfg.RingbufFlushPeriod,
+		UseEbpfManager:     cfg.EbpfProgramManagerMode,
+		FilterConfig:       filterRules,
 	}
 
 	fetcher, err := tracer.NewPacketFetcher(ebpfConfig)
@@ -118,6 +124,18 @@ func PacketsAgent(cfg *Config) (*Packets, error) {
 	return packetsAgent(cfg, informer, fetcher, packetexportFunc, agentIP)
 }
 
+func pcaRingbuf(cfg *Config) bool {
+	switch cfg.PCACaptureMode {
+	case PCACaptureModePerf:
+		return false
+	case PCACaptureModeRingbuf:
+		return true
+	default:
+		plog.Warnf("unknown PCA_CAPTURE_MODE %q. Sending the captured packets via perf buffers", cfg.PCACaptureMode)
+		return false
+	}
+}
+
 // packetssAgent is a private constructor with injectable dependencies, usable for tests
 func packetsAgent(cfg *Config,
 	informer ifaces.Informer,
@@ -224,6 +242,8 @@ func (p *Packets) Run(ctx context.Context) error {
 
 	p.status = StatusStopping
 	plog.Info("stopping Packets agent")
+	plog.Debug("waiting for the interfaces being attached")
+	p.interfaceListeners.Wait()
 	if err := p.ebpf.Close(); err != nil {
 		plog.WithError(err).Warn("eBPF resources not correctly closed")
 	}
@@ -249,7 +269,12 @@ func (p *Packets) interfacesManager(ctx context.Context) error {
 		return fmt.Errorf("instantiating interfaces' informer: %w", err)
 	}
 
-	go interfaceListener(ctx, ifaceEvents, slog, p.onInterfaceAdded)
+	// a single worker: the packet fetcher doesn't support concurrent registrations
+	p.interfaceListeners.Add(1)
+	go func() {
+		defer p.interfaceListeners.Done()
+		interfaceListener(ctx, ifaceEvents, slog, 1, p.onInterfaceAdded, nil)
+	}()
 
 	return nil
 }
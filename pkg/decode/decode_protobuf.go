@@ -2,6 +2,8 @@ package decode
 
 import (
 	"fmt"
+	"net"
+	"sync/atomic"
 	"syscall"
 	"time"
 
@@ -49,6 +51,27 @@ func PBFlowToMap(pb *pbflow.Record) config.GenericMap {
 	return RecordToMap(flow)
 }
 
+// recordMapSize is the number of fields of a GenericMap converted from a flow with all the
+// features, so the map never grows while it is filled
+const recordMapSize = 40
+
+// agentIPString caches the string of the agent IP, which is the same for all the flows
+type agentIPString struct {
+	ip  net.IP
+	str string
+}
+
+var lastAgentIP atomic.Pointer[agentIPString]
+
+func agentIPToString(ip net.IP) string {
+	if last := lastAgentIP.Load(); last != nil && last.ip.Equal(ip) {
+		return last.str
+	}
+	last := agentIPString{ip: ip, str: ip.String()}
+	lastAgentIP.Store(&last)
+	return last.str
+}
+
 // RecordToMap converts the flow from Agent inner model into FLP GenericMap model
 // nolint:golint,cyclop
 func RecordToMap(fr *model.Record) config.GenericMap {
@@ -57,19 +80,23 @@ func RecordToMap(fr *model.Record) config.GenericMap {
 	}
 	srcMAC := model.MacAddr(fr.Metrics.SrcMac)
 	dstMAC := model.MacAddr(fr.Metrics.DstMac)
-	out := config.GenericMap{
-		"SrcMac":          srcMAC.String(),
-		"DstMac":          dstMAC.String(),
-		"Etype":           fr.Metrics.EthProtocol,
-		"TimeFlowStartMs": fr.TimeFlowStart.UnixMilli(),
-		"TimeFlowEndMs":   fr.TimeFlowEnd.UnixMilli(),
-		"TimeReceived":    time.Now().Unix(),
-		"AgentIP":         fr.AgentIP.String(),
-	}
+	out := make(config.GenericMap, recordMapSize)
+	out["SrcMac"] = srcMAC.String()
+	out["DstMac"] = dstMAC.String()
+	out["Etype"] = fr.Metrics.EthProtocol
+	out["TimeFlowStartMs"] = fr.TimeFlowStart.UnixMilli()
+	out["TimeFlowEndMs"] = fr.TimeFlowEnd.UnixMilli()
+	out["TimeReceived"] = time.Now().Unix()
+	out["AgentIP"] = agentIPToString(fr.AgentIP)
 
 	var directions []int
 	var interfaces []string
 	var udns []string
+	if len(fr.Interfaces) != 0 {
+		directions = make([]int, 0, len(fr.Interfaces))
+		interfaces = make([]string, 0, len(fr.Interfaces))
+		udns = make([]string, 0, len(fr.Interfaces))
+	}
 	for _, intf := range fr.Interfaces {
 		directions = append(directions, intf.Direction)
 		interfaces = append(interfaces, intf.Interface)
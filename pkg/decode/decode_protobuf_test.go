@@ -1,10 +1,13 @@
 package decode
 
 import (
+	"net"
 	"testing"
 	"time"
 
 	"github.com/netobserv/flowlogs-pipeline/pkg/config"
+	"github.com/netobserv/netobserv-ebpf-agent/pkg/ebpf"
+	"github.com/netobserv/netobserv-ebpf-agent/pkg/model"
 	"github.com/netobserv/netobserv-ebpf-agent/pkg/pbflow"
 
 	"github.com/stretchr/testify/assert"
@@ -153,3 +156,46 @@ func TestPBFlowToMap(t *testing.T) {
 		"ZoneId":      uint16(100),
 	}, out)
 }
+
+func TestRecordToMap_AgentIP(t *testing.T) {
+	// the cached agent IP string is only reused for the same IP
+	for _, ip := range []string{"10.9.8.7", "10.9.8.7", "fe80::1", "10.9.8.7"} {
+		out := RecordToMap(&model.Record{
+			Metrics:    model.BpfFlowContent{BpfFlowMetrics: &ebpf.BpfFlowMetrics{}},
+			AgentIP:    net.ParseIP(ip),
+			Interfaces: []model.IntfDirUdn{model.NewIntfDirUdn("eth0", 0, nil)},
+		})
+		assert.Equal(t, ip, out["AgentIP"])
+	}
+}
+
+func BenchmarkRecordToMap(b *testing.B) {
+	flow := &model.Record{
+		ID: ebpf.BpfFlowId{
+			SrcIp:             model.IPAddrFromNetIP(net.ParseIP("10.1.2.3")),
+			DstIp:             model.IPAddrFromNetIP(net.ParseIP("10.3.2.1")),
+			SrcPort:           23000,
+			DstPort:           443,
+			TransportProtocol: 6,
+		},
+		Metrics: model.BpfFlowContent{
+			BpfFlowMetrics: &ebpf.BpfFlowMetrics{
+				EthProtocol: 0x0800,
+				SrcMac:      [...]byte{0xaa, 0xbb, 0xcc, 0xdd, 0xee, 0xff},
+				DstMac:      [...]byte{0x11, 0x22, 0x33, 0x44, 0x55, 0x66},
+				Bytes:       456,
+				Packets:     3,
+				Flags:       1,
+			},
+		},
+		TimeFlowStart: time.Now(),
+		TimeFlowEnd:   time.Now(),
+		TimeFlowRtt:   time.Millisecond,
+		AgentIP:       net.ParseIP("10.11.12.13"),
+		Interfaces:    []model.IntfDirUdn{model.NewIntfDirUdn("eth0", 1, nil), model.NewIntfDirUdn("veth0", 0, nil)},
+	}
+	b.ReportAllocs()
+	for i := 0; i < b.N; i++ {
+		RecordToMap(flow)
+	}
+}
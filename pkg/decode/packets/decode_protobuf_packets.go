@@ -67,7 +67,8 @@ func PacketToMap(pr *model.PacketRecord) config.GenericMap {
 		//TODO: add DNS questions / answers / authorities
 	}
 
-	out["Bytes"] = len(pr.Stream)
+	// the stream might have been truncated to the capture snaplen
+	out["Bytes"] = max(pr.OrigLen, len(pr.Stream))
 	// Data is base64 encoded to avoid marshal / unmarshal issues
 	out["Data"] = base64.StdEncoding.EncodeToString(packet.Data())
 	out["Time"] = pr.Time.Unix()
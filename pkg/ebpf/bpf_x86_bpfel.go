@@ -25,6 +25,8 @@ type BpfAdditionalMetrics struct {
 	_                [7]byte
 }
 
+type BpfCountMinSketch struct{ Counters [4][512]uint32 }
+
 type BpfDirectionT uint32
 
 const (
@@ -51,6 +53,11 @@ type BpfDnsRecordT struct {
 	_       [3]byte
 }
 
+type BpfExpiryTimerT struct {
+	Timer struct{ _ [16]byte }
+	Armed uint32
+}
+
 type BpfFilterActionT uint32
 
 const (
@@ -59,11 +66,41 @@ const (
 	BpfFilterActionTMAX_FILTER_ACTIONS BpfFilterActionT = 2
 )
 
+type BpfFilterCacheConfig struct {
+	Generation    uint32
+	MatchTcpFlags uint8
+	MatchDrops    uint8
+	Padding       [2]uint8
+}
+
+type BpfFilterDimensionKeyT struct {
+	PrefixLen uint32
+	Dimension uint8
+	Value     [2]uint8
+	Padding   uint8
+}
+
+type BpfFilterDimensionT uint32
+
+const (
+	BpfFilterDimensionTFILTER_DIM_PROTOCOL  BpfFilterDimensionT = 0
+	BpfFilterDimensionTFILTER_DIM_SRC_PORT  BpfFilterDimensionT = 1
+	BpfFilterDimensionTFILTER_DIM_DST_PORT  BpfFilterDimensionT = 2
+	BpfFilterDimensionTFILTER_DIM_PORT      BpfFilterDimensionT = 3
+	BpfFilterDimensionTFILTER_DIM_TCP_FLAGS BpfFilterDimensionT = 4
+	BpfFilterDimensionTFILTER_DIM_ICMP_TYPE BpfFilterDimensionT = 5
+	BpfFilterDimensionTFILTER_DIM_ICMP_CODE BpfFilterDimensionT = 6
+	BpfFilterDimensionTFILTER_DIM_DIRECTION BpfFilterDimensionT = 7
+	BpfFilterDimensionTFILTER_DIM_DROPS     BpfFilterDimensionT = 8
+)
+
 type BpfFilterKeyT struct {
 	PrefixLen uint32
 	IpData    [16]uint8
 }
 
+type BpfFilterMask struct{ Bits [4]uint64 }
+
 type BpfFilterValueT struct {
 	Protocol          uint8
 	_                 [1]byte
@@ -91,6 +128,20 @@ type BpfFilterValueT struct {
 	_                 [3]byte
 }
 
+type BpfFilterVerdict struct {
+	Generation uint32
+	Sample     uint32
+	Skip       uint8
+	Padding    [3]uint8
+}
+
+type BpfFilterVerdictKey struct {
+	Id        BpfFlowId
+	Flags     uint16
+	Direction uint8
+	Drops     uint8
+}
+
 type BpfFlowId BpfFlowIdT
 
 type BpfFlowIdT struct {
@@ -104,30 +155,78 @@ type BpfFlowIdT struct {
 	_                 [1]byte
 }
 
+type BpfFlowIdV4 BpfFlowIdV4T
+
+type BpfFlowIdV4T struct {
+	SrcIp             [4]uint8
+	DstIp             [4]uint8
+	SrcPort           uint16
+	DstPort           uint16
+	TransportProtocol uint8
+	IcmpType          uint8
+	IcmpCode          uint8
+	_                 [1]byte
+}
+
+type BpfFlowLatency struct {
+	Buckets [16]uint64
+	SumNs   uint64
+}
+
 type BpfFlowMetrics BpfFlowMetricsT
 
-type BpfFlowMetricsT struct {
-	StartMonoTimeTs    uint64
+type BpfFlowMetricsPercpu struct {
 	EndMonoTimeTs      uint64
 	Bytes              uint64
 	Packets            uint32
-	EthProtocol        uint16
 	Flags              uint16
+	Dscp               uint8
+	DirectionFirstSeen uint8
+	Sampling           uint32
+	IfIndexFirstSeen   uint32
+	UnusedLock         uint32
+	EthProtocol        uint16
+	Errno              uint8
+	NbObservedIntf     uint8
+	StartMonoTimeTs    uint64
 	SrcMac             [6]uint8
 	DstMac             [6]uint8
+	ObservedDirection  [6]uint8
+	_                  [2]byte
+	ObservedIntf       [6]uint32
+	_                  [4]byte
+}
+
+type BpfFlowMetricsT struct {
+	EndMonoTimeTs      uint64
+	Bytes              uint64
+	Packets            uint32
+	Flags              uint16
+	Dscp               uint8
+	DirectionFirstSeen uint8
+	Sampling           uint32
 	IfIndexFirstSeen   uint32
 	Lock               struct{ Val uint32 }
-	Sampling           uint32
-	DirectionFirstSeen uint8
+	EthProtocol        uint16
 	Errno              uint8
-	Dscp               uint8
 	NbObservedIntf     uint8
+	StartMonoTimeTs    uint64
+	SrcMac             [6]uint8
+	DstMac             [6]uint8
 	ObservedDirection  [6]uint8
 	_                  [2]byte
 	ObservedIntf       [6]uint32
 	_                  [4]byte
 }
 
+type BpfFlowPathT uint32
+
+const (
+	BpfFlowPathTFLOW_PATH_NEW      BpfFlowPathT = 0
+	BpfFlowPathTFLOW_PATH_EXISTING BpfFlowPathT = 1
+	BpfFlowPathTMAX_FLOW_PATHS     BpfFlowPathT = 2
+)
+
 type BpfFlowRecordT struct {
 	Id      BpfFlowId
 	Metrics BpfFlowMetrics
@@ -146,9 +245,29 @@ const (
 	BpfGlobalCountersKeyTNETWORK_EVENTS_ERR_UPDATE_MAP_FLOWS BpfGlobalCountersKeyT = 7
 	BpfGlobalCountersKeyTNETWORK_EVENTS_GOOD                 BpfGlobalCountersKeyT = 8
 	BpfGlobalCountersKeyTOBSERVED_INTF_MISSED                BpfGlobalCountersKeyT = 9
-	BpfGlobalCountersKeyTMAX_COUNTERS                        BpfGlobalCountersKeyT = 10
+	BpfGlobalCountersKeyTHASHMAP_FLOWS_INSERTED              BpfGlobalCountersKeyT = 10
+	BpfGlobalCountersKeyTFLOWS_SKETCH_UNTRACKED              BpfGlobalCountersKeyT = 11
+	BpfGlobalCountersKeyTMAX_COUNTERS                        BpfGlobalCountersKeyT = 12
 )
 
+type BpfHeavyHitter struct {
+	Id       BpfFlowId
+	Metrics  BpfFlowMetricsPercpu
+	Estimate uint32
+	_        [4]byte
+}
+
+type BpfPcaRecord struct {
+	Meta struct {
+		IfIndex   uint32
+		PktLen    uint32
+		Timestamp uint64
+		OrigLen   uint32
+		Padding   uint32
+	}
+	Data [16384]uint8
+}
+
 type BpfPktDropsT struct {
 	Bytes           uint64
 	Packets         uint32
@@ -237,39 +356,73 @@ type BpfProgramSpecs struct {
 	TcxIngressFlowParse       *ebpf.ProgramSpec `ebpf:"tcx_ingress_flow_parse"`
 	TcxIngressPcaParse        *ebpf.ProgramSpec `ebpf:"tcx_ingress_pca_parse"`
 	TrackNatManipPkt          *ebpf.ProgramSpec `ebpf:"track_nat_manip_pkt"`
+	XdpIngressFlowParse       *ebpf.ProgramSpec `ebpf:"xdp_ingress_flow_parse"`
 }
 
 // BpfMapSpecs contains maps before they are loaded into the kernel.
 //
 // It can be passed ebpf.CollectionSpec.Assign.
 type BpfMapSpecs struct {
+	AdaptiveSampling      *ebpf.MapSpec `ebpf:"adaptive_sampling"`
 	AdditionalFlowMetrics *ebpf.MapSpec `ebpf:"additional_flow_metrics"`
 	AggregatedFlows       *ebpf.MapSpec `ebpf:"aggregated_flows"`
+	AggregatedFlowsPercpu *ebpf.MapSpec `ebpf:"aggregated_flows_percpu"`
+	AggregatedFlowsV4     *ebpf.MapSpec `ebpf:"aggregated_flows_v4"`
 	DirectFlows           *ebpf.MapSpec `ebpf:"direct_flows"`
 	DnsFlows              *ebpf.MapSpec `ebpf:"dns_flows"`
+	ExpiryTimer           *ebpf.MapSpec `ebpf:"expiry_timer"`
+	FilterGeneration      *ebpf.MapSpec `ebpf:"filter_generation"`
 	FilterMap             *ebpf.MapSpec `ebpf:"filter_map"`
+	FilterMasks           *ebpf.MapSpec `ebpf:"filter_masks"`
+	FilterRules           *ebpf.MapSpec `ebpf:"filter_rules"`
+	FilterVerdicts        *ebpf.MapSpec `ebpf:"filter_verdicts"`
+	FlowLatencies         *ebpf.MapSpec `ebpf:"flow_latencies"`
+	FlowsSketch           *ebpf.MapSpec `ebpf:"flows_sketch"`
+	FlowsSketchEpoch      *ebpf.MapSpec `ebpf:"flows_sketch_epoch"`
 	GlobalCounters        *ebpf.MapSpec `ebpf:"global_counters"`
+	HeavyHitters          *ebpf.MapSpec `ebpf:"heavy_hitters"`
 	PacketRecord          *ebpf.MapSpec `ebpf:"packet_record"`
+	PacketRingbuf         *ebpf.MapSpec `ebpf:"packet_ringbuf"`
+	PcaScratch            *ebpf.MapSpec `ebpf:"pca_scratch"`
 	PeerFilterMap         *ebpf.MapSpec `ebpf:"peer_filter_map"`
+	RttSamples            *ebpf.MapSpec `ebpf:"rtt_samples"`
+	RttSkSamples          *ebpf.MapSpec `ebpf:"rtt_sk_samples"`
 }
 
 // BpfVariableSpecs contains global variables before they are loaded into the kernel.
 //
 // It can be passed ebpf.CollectionSpec.Assign.
 type BpfVariableSpecs struct {
+	DnsFlowsTimeout                *ebpf.VariableSpec `ebpf:"dns_flows_timeout"`
 	DnsPort                        *ebpf.VariableSpec `ebpf:"dns_port"`
+	EnableAdaptiveSampling         *ebpf.VariableSpec `ebpf:"enable_adaptive_sampling"`
+	EnableCompactIpv4Keys          *ebpf.VariableSpec `ebpf:"enable_compact_ipv4_keys"`
 	EnableDnsTracking              *ebpf.VariableSpec `ebpf:"enable_dns_tracking"`
+	EnableFlowLatencies            *ebpf.VariableSpec `ebpf:"enable_flow_latencies"`
+	EnableFlowsExpiry              *ebpf.VariableSpec `ebpf:"enable_flows_expiry"`
 	EnableFlowsFiltering           *ebpf.VariableSpec `ebpf:"enable_flows_filtering"`
+	EnableFlowsSketch              *ebpf.VariableSpec `ebpf:"enable_flows_sketch"`
 	EnableNetworkEventsMonitoring  *ebpf.VariableSpec `ebpf:"enable_network_events_monitoring"`
 	EnablePca                      *ebpf.VariableSpec `ebpf:"enable_pca"`
+	EnablePcaRingbuf               *ebpf.VariableSpec `ebpf:"enable_pca_ringbuf"`
+	EnablePercpuAggregation        *ebpf.VariableSpec `ebpf:"enable_percpu_aggregation"`
 	EnablePktTranslationTracking   *ebpf.VariableSpec `ebpf:"enable_pkt_translation_tracking"`
 	EnableRtt                      *ebpf.VariableSpec `ebpf:"enable_rtt"`
 	FilterKey                      *ebpf.VariableSpec `ebpf:"filter_key"`
 	FilterValue                    *ebpf.VariableSpec `ebpf:"filter_value"`
+	FlowsExpiryPeriod              *ebpf.VariableSpec `ebpf:"flows_expiry_period"`
+	FlowsIdleTimeout               *ebpf.VariableSpec `ebpf:"flows_idle_timeout"`
+	FlowsSketchSlots               *ebpf.VariableSpec `ebpf:"flows_sketch_slots"`
 	HasFilterSampling              *ebpf.VariableSpec `ebpf:"has_filter_sampling"`
 	NetworkEventsMonitoringGroupid *ebpf.VariableSpec `ebpf:"network_events_monitoring_groupid"`
+	PcaSnaplen                     *ebpf.VariableSpec `ebpf:"pca_snaplen"`
+	RingbufWakeupThreshold         *ebpf.VariableSpec `ebpf:"ringbuf_wakeup_threshold"`
+	RttSamplingInterval            *ebpf.VariableSpec `ebpf:"rtt_sampling_interval"`
 	Sampling                       *ebpf.VariableSpec `ebpf:"sampling"`
 	TraceMessages                  *ebpf.VariableSpec `ebpf:"trace_messages"`
+	TrackFlowsInserts              *ebpf.VariableSpec `ebpf:"track_flows_inserts"`
+	Unused15                       *ebpf.VariableSpec `ebpf:"unused15"`
+	Unused16                       *ebpf.VariableSpec `ebpf:"unused16"`
 	Unused8                        *ebpf.VariableSpec `ebpf:"unused8"`
 	Unused9                        *ebpf.VariableSpec `ebpf:"unused9"`
 }
@@ -294,26 +447,58 @@ func (o *BpfObjects) Close() error {
 //
 // It can be passed to LoadBpfObjects or ebpf.CollectionSpec.LoadAndAssign.
 type BpfMaps struct {
+	AdaptiveSampling      *ebpf.Map `ebpf:"adaptive_sampling"`
 	AdditionalFlowMetrics *ebpf.Map `ebpf:"additional_flow_metrics"`
 	AggregatedFlows       *ebpf.Map `ebpf:"aggregated_flows"`
+	AggregatedFlowsPercpu *ebpf.Map `ebpf:"aggregated_flows_percpu"`
+	AggregatedFlowsV4     *ebpf.Map `ebpf:"aggregated_flows_v4"`
 	DirectFlows           *ebpf.Map `ebpf:"direct_flows"`
 	DnsFlows              *ebpf.Map `ebpf:"dns_flows"`
+	ExpiryTimer           *ebpf.Map `ebpf:"expiry_timer"`
+	FilterGeneration      *ebpf.Map `ebpf:"filter_generation"`
 	FilterMap             *ebpf.Map `ebpf:"filter_map"`
+	FilterMasks           *ebpf.Map `ebpf:"filter_masks"`
+	FilterRules           *ebpf.Map `ebpf:"filter_rules"`
+	FilterVerdicts        *ebpf.Map `ebpf:"filter_verdicts"`
+	FlowLatencies         *ebpf.Map `ebpf:"flow_latencies"`
+	FlowsSketch           *ebpf.Map `ebpf:"flows_sketch"`
+	FlowsSketchEpoch      *ebpf.Map `ebpf:"flows_sketch_epoch"`
 	GlobalCounters        *ebpf.Map `ebpf:"global_counters"`
+	HeavyHitters          *ebpf.Map `ebpf:"heavy_hitters"`
 	PacketRecord          *ebpf.Map `ebpf:"packet_record"`
+	PacketRingbuf         *ebpf.Map `ebpf:"packet_ringbuf"`
+	PcaScratch            *ebpf.Map `ebpf:"pca_scratch"`
 	PeerFilterMap         *ebpf.Map `ebpf:"peer_filter_map"`
+	RttSamples            *ebpf.Map `ebpf:"rtt_samples"`
+	RttSkSamples          *ebpf.Map `ebpf:"rtt_sk_samples"`
 }
 
 func (m *BpfMaps) Close() error {
 	return _BpfClose(
+		m.AdaptiveSampling,
 		m.AdditionalFlowMetrics,
 		m.AggregatedFlows,
+		m.AggregatedFlowsPercpu,
+		m.AggregatedFlowsV4,
 		m.DirectFlows,
 		m.DnsFlows,
+		m.ExpiryTimer,
+		m.FilterGeneration,
 		m.FilterMap,
+		m.FilterMasks,
+		m.FilterRules,
+		m.FilterVerdicts,
+		m.FlowLatencies,
+		m.FlowsSketch,
+		m.FlowsSketchEpoch,
 		m.GlobalCounters,
+		m.HeavyHitters,
 		m.PacketRecord,
+		m.PacketRingbuf,
+		m.PcaScratch,
 		m.PeerFilterMap,
+		m.RttSamples,
+		m.RttSkSamples,
 	)
 }
 
@@ -321,19 +506,36 @@ func (m *BpfMaps) Close() error {
 //
 // It can be passed to LoadBpfObjects or ebpf.CollectionSpec.LoadAndAssign.
 type BpfVariables struct {
+	DnsFlowsTimeout                *ebpf.Variable `ebpf:"dns_flows_timeout"`
 	DnsPort                        *ebpf.Variable `ebpf:"dns_port"`
+	EnableAdaptiveSampling         *ebpf.Variable `ebpf:"enable_adaptive_sampling"`
+	EnableCompactIpv4Keys          *ebpf.Variable `ebpf:"enable_compact_ipv4_keys"`
 	EnableDnsTracking              *ebpf.Variable `ebpf:"enable_dns_tracking"`
+	EnableFlowLatencies            *ebpf.Variable `ebpf:"enable_flow_latencies"`
+	EnableFlowsExpiry              *ebpf.Variable `ebpf:"enable_flows_expiry"`
 	EnableFlowsFiltering           *ebpf.Variable `ebpf:"enable_flows_filtering"`
+	EnableFlowsSketch              *ebpf.Variable `ebpf:"enable_flows_sketch"`
 	EnableNetworkEventsMonitoring  *ebpf.Variable `ebpf:"enable_network_events_monitoring"`
 	EnablePca                      *ebpf.Variable `ebpf:"enable_pca"`
+	EnablePcaRingbuf               *ebpf.Variable `ebpf:"enable_pca_ringbuf"`
+	EnablePercpuAggregation        *ebpf.Variable `ebpf:"enable_percpu_aggregation"`
 	EnablePktTranslationTracking   *ebpf.Variable `ebpf:"enable_pkt_translation_tracking"`
 	EnableRtt                      *ebpf.Variable `ebpf:"enable_rtt"`
 	FilterKey                      *ebpf.Variable `ebpf:"filter_key"`
 	FilterValue                    *ebpf.Variable `ebpf:"filter_value"`
+	FlowsExpiryPeriod              *ebpf.Variable `ebpf:"flows_expiry_period"`
+	FlowsIdleTimeout               *ebpf.Variable `ebpf:"flows_idle_timeout"`
+	FlowsSketchSlots               *ebpf.Variable `ebpf:"flows_sketch_slots"`
 	HasFilterSampling              *ebpf.Variable `ebpf:"has_filter_sampling"`
 	NetworkEventsMonitoringGroupid *ebpf.Variable `ebpf:"network_events_monitoring_groupid"`
+	PcaSnaplen                     *ebpf.Variable `ebpf:"pca_snaplen"`
+	RingbufWakeupThreshold         *ebpf.Variable `ebpf:"ringbuf_wakeup_threshold"`
+	RttSamplingInterval            *ebpf.Variable `ebpf:"rtt_sampling_interval"`
 	Sampling                       *ebpf.Variable `ebpf:"sampling"`
 	TraceMessages                  *ebpf.Variable `ebpf:"trace_messages"`
+	TrackFlowsInserts              *ebpf.Variable `ebpf:"track_flows_inserts"`
+	Unused15                       *ebpf.Variable `ebpf:"unused15"`
+	Unused16                       *ebpf.Variable `ebpf:"unused16"`
 	Unused8                        *ebpf.Variable `ebpf:"unused8"`
 	Unused9                        *ebpf.Variable `ebpf:"unused9"`
 }
@@ -355,6 +557,7 @@ type BpfPrograms struct {
 	TcxIngressFlowParse       *ebpf.Program `ebpf:"tcx_ingress_flow_parse"`
 	TcxIngressPcaParse        *ebpf.Program `ebpf:"tcx_ingress_pca_parse"`
 	TrackNatManipPkt          *ebpf.Program `ebpf:"track_nat_manip_pkt"`
+	XdpIngressFlowParse       *ebpf.Program `ebpf:"xdp_ingress_flow_parse"`
 }
 
 func (p *BpfPrograms) Close() error {
@@ -372,6 +575,7 @@ func (p *BpfPrograms) Close() error {
 		p.TcxIngressFlowParse,
 		p.TcxIngressPcaParse,
 		p.TrackNatManipPkt,
+		p.XdpIngressFlowParse,
 	)
 }
 
@@ -442,6 +442,8 @@ func TestConversions(t *testing.T) {
 		},
 	}
 
+	// the encoder is shared by all the tests, to verify that the reused messages are overwritten
+	var encoder pbflow.Encoder
 	for _, tt := range tests {
 		// Generate with direct conversion
 		outDirect := decode.RecordToMap(tt.flow)
@@ -460,6 +462,14 @@ func TestConversions(t *testing.T) {
 		// Make sure they're both equal
 		assert.Equalf(t, outPB, outDirect, "%s: direct conversion and protobuf conversion should be identical", tt.name)
 
+		// Generate the same using the reusable encoder
+		rawEncoded, err := encoder.Marshal(tt.flow)
+		require.NoError(t, err, tt.name)
+		outEncoded, err := decoder.Decode(rawEncoded)
+		require.NoError(t, err, tt.name)
+		delete(outEncoded, "TimeReceived")
+		assert.Equalf(t, outPB, outEncoded, "%s: encoder and protobuf conversion should be identical", tt.name)
+
 		// Check versus expected map
 		err = normalizeMap(outDirect)
 		require.NoError(t, err, tt.name)
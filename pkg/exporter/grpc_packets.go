@@ -2,7 +2,6 @@ package exporter
 
 import (
 	"context"
-	"time"
 
 	grpc "github.com/netobserv/netobserv-ebpf-agent/pkg/grpc/packet"
 	"github.com/netobserv/netobserv-ebpf-agent/pkg/model"
@@ -17,19 +16,22 @@ type GRPCPacketProto struct {
 	hostIP     string
 	hostPort   int
 	clientConn *grpc.ClientConnection
+	// buffer reused by the pcap encoding of the packets, as they are sent synchronously
+	buf []byte
 }
 
 var gplog = logrus.WithField("component", "packet/GRPCPackets")
 
-// WritePacket writes the given packet data out to gRPC.
-func writeGRPCPacket(time time.Time, data []byte, conn *grpc.ClientConnection) error {
-	bytes, err := packets.GetPacketBytesWithHeader(time, data)
+// writeGRPCPacket writes the given packet data out to gRPC.
+func (p *GRPCPacketProto) writeGRPCPacket(packet *model.PacketRecord) error {
+	var err error
+	p.buf, err = packets.AppendPacketWithHeader(p.buf[:0], packet.Time, packet.Stream, packet.OrigLen)
 	if err != nil {
 		return err
 	}
-	_, err = conn.Client().Send(context.TODO(), &pbpacket.Packet{
+	_, err = p.clientConn.Client().Send(context.TODO(), &pbpacket.Packet{
 		Pcap: &anypb.Any{
-			Value: bytes,
+			Value: p.buf,
 		},
 	})
 	return err
@@ -52,7 +54,7 @@ func (p *GRPCPacketProto) ExportGRPCPackets(in <-chan []*model.PacketRecord) {
 		var errs []error
 		for _, packet := range packetRecord {
 			if len(packet.Stream) != 0 {
-				if err := writeGRPCPacket(packet.Time, packet.Stream, p.clientConn); err != nil {
+				if err := p.writeGRPCPacket(packet); err != nil {
 					errs = append(errs, err)
 				}
 			}
@@ -30,6 +30,9 @@ type GRPCProto struct {
 	maxFlowsPerMessage int
 	metrics            *metrics.Metrics
 	batchCounter       prometheus.Counter
+	// encoder reuses the protobuf messages from one export to the next, as they are sent
+	// synchronously
+	encoder pbflow.Encoder
 }
 
 func StartGRPCProto(hostIP string, hostPort int, maxFlowsPerMessage int, m *metrics.Metrics) (*GRPCProto, error) {
@@ -54,7 +57,7 @@ func (g *GRPCProto) ExportFlows(input <-chan []*model.Record) {
 	log := glog.WithField("collector", socket)
 	for inputRecords := range input {
 		g.metrics.EvictionCounter.WithSource(componentGRPC).Inc()
-		for _, pbRecords := range pbflow.FlowsToPB(inputRecords, g.maxFlowsPerMessage) {
+		for _, pbRecords := range g.encoder.FlowsToPB(inputRecords, g.maxFlowsPerMessage) {
 			log.Debugf("sending %d records", len(pbRecords.Entries))
 			if _, err := g.clientConn.Client().Send(context.TODO(), pbRecords); err != nil {
 				g.metrics.Errors.WithErrorName(componentGRPC, "CannotWriteMessage", metrics.HighSeverity).Inc()
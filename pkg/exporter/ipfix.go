@@ -1,6 +1,7 @@
 package exporter
 
 import (
+	"bytes"
 	"net"
 
 	"github.com/netobserv/netobserv-ebpf-agent/pkg/model"
@@ -16,14 +17,29 @@ var ilog = logrus.WithField("component", "exporter/IPFIXProto")
 // TODO: encode also the equivalent of the Protobuf's AgentIP field in a format that is binary-
 // compatible with OVN-K.
 
+// IP and UDP headers lengths, subtracted from the path MTU to size the IPFIX messages sent over UDP
+const (
+	udpIPv4HeadersLen = 20 + 8
+	udpIPv6HeadersLen = 40 + 8
+)
+
 type IPFIX struct {
-	hostIP       string
-	hostPort     int
-	exporter     *ipfixExporter.ExportingProcess
-	templateIDv4 uint16
-	templateIDv6 uint16
-	entitiesV4   []entities.InfoElementWithValue
-	entitiesV6   []entities.InfoElementWithValue
+	hostIP     string
+	hostPort   int
+	exporter   *ipfixExporter.ExportingProcess
+	templateV4 ipfixTemplate
+	templateV6 ipfixTemplate
+	// buf is reused across the IPFIX messages
+	buf bytes.Buffer
+}
+
+// ipfixTemplate holds the elements of a template, which are overwritten by each data record,
+// along with the data records waiting to be sent
+type ipfixTemplate struct {
+	id       uint16
+	elements []entities.InfoElementWithValue
+	setters  []ieSetter
+	records  []entities.Record
 }
 
 func addElementToTemplate(log *logrus.Entry, elementName string, value []byte, elements *[]entities.InfoElementWithValue) error {
@@ -216,8 +232,9 @@ func SendTemplateRecordv6(log *logrus.Entry, exporter *ipfixExporter.ExportingPr
 	return templateID, elements, nil
 }
 
-// Sends out Template record to the IPFIX collector
-func StartIPFIXExporter(hostIP string, hostPort int, transportProto string) (*IPFIX, error) {
+// Sends out Template record to the IPFIX collector. Over UDP, the data records are packed in
+// messages that fit in the provided path MTU.
+func StartIPFIXExporter(hostIP string, hostPort int, transportProto string, pathMTU int) (*IPFIX, error) {
 	socket := utils.GetSocket(hostIP, hostPort)
 	log := ilog.WithField("collector", socket)
 
@@ -228,6 +245,7 @@ func StartIPFIXExporter(hostIP string, hostPort int, transportProto string) (*IP
 		CollectorProtocol:   transportProto,
 		ObservationDomainID: 1,
 		TempRefTimeout:      1,
+		MaxMsgSize:          ipfixMaxMsgSize(hostIP, transportProto, pathMTU),
 	}
 	exporter, err := ipfixExporter.InitExportingProcess(input)
 	if err != nil {
@@ -251,112 +269,160 @@ func StartIPFIXExporter(hostIP string, hostPort int, transportProto string) (*IP
 	log.Infof("entities v6 %+v", entitiesV6)
 
 	return &IPFIX{
-		hostIP:       hostIP,
-		hostPort:     hostPort,
-		exporter:     exporter,
-		templateIDv4: templateIDv4,
-		templateIDv6: templateIDv6,
-		entitiesV4:   entitiesV4,
-		entitiesV6:   entitiesV6,
+		hostIP:     hostIP,
+		hostPort:   hostPort,
+		exporter:   exporter,
+		templateV4: newIPFIXTemplate(templateIDv4, entitiesV4),
+		templateV6: newIPFIXTemplate(templateIDv6, entitiesV6),
 	}, nil
 }
 
-func setIPv4Address(ieValPtr *entities.InfoElementWithValue, ipAddress net.IP) {
-	ieVal := *ieValPtr
+// ipfixMaxMsgSize returns the maximum size of the IPFIX messages, or 0 for the default size
+func ipfixMaxMsgSize(hostIP, transportProto string, pathMTU int) int {
+	if transportProto != "udp" || pathMTU <= 0 {
+		return 0
+	}
+	if ip := net.ParseIP(hostIP); ip != nil && ip.To4() != nil {
+		return pathMTU - udpIPv4HeadersLen
+	}
+	return pathMTU - udpIPv6HeadersLen
+}
+
+func setIPv4Address(ieVal entities.InfoElementWithValue, ipAddress net.IP) {
 	if ipAddress == nil {
 		ieVal.SetIPAddressValue(net.ParseIP("0.0.0.0"))
 	} else {
 		ieVal.SetIPAddressValue(ipAddress)
 	}
 }
-func setIERecordValue(record *model.Record, ieValPtr *entities.InfoElementWithValue) {
-	ieVal := *ieValPtr
-	switch ieVal.GetName() {
-	case "octetDeltaCount":
-		ieVal.SetUnsigned64Value(record.Metrics.Bytes)
-	case "tcpControlBits":
-		ieVal.SetUnsigned16Value(record.Metrics.Flags)
-	case "flowStartSeconds":
-		ieVal.SetUnsigned32Value(uint32(record.TimeFlowStart.Unix()))
-	case "flowStartMilliseconds":
-		ieVal.SetUnsigned64Value(uint64(record.TimeFlowStart.UnixMilli()))
-	case "flowEndSeconds":
-		ieVal.SetUnsigned32Value(uint32(record.TimeFlowEnd.Unix()))
-	case "flowEndMilliseconds":
-		ieVal.SetUnsigned64Value(uint64(record.TimeFlowEnd.UnixMilli()))
-	case "packetDeltaCount":
-		ieVal.SetUnsigned64Value(uint64(record.Metrics.Packets))
-	case "interfaceName":
-		ieVal.SetStringValue(record.Interfaces[0].Interface)
-	}
-}
-func setIEValue(record *model.Record, ieValPtr *entities.InfoElementWithValue) {
-	ieVal := *ieValPtr
-	switch ieVal.GetName() {
+
+// ieSetter writes the value of an information element from a flow record
+type ieSetter func(record *model.Record, ieVal entities.InfoElementWithValue)
+
+// ieSetterFor returns the function writing the value of the named information element, or nil
+// if the element is not filled from the flow records
+func ieSetterFor(name string) ieSetter {
+	switch name {
 	case "ethernetType":
-		ieVal.SetUnsigned16Value(record.Metrics.EthProtocol)
+		return func(record *model.Record, ieVal entities.InfoElementWithValue) {
+			ieVal.SetUnsigned16Value(record.Metrics.EthProtocol)
+		}
 	case "flowDirection":
-		ieVal.SetUnsigned8Value(uint8(record.Interfaces[0].Direction))
+		return func(record *model.Record, ieVal entities.InfoElementWithValue) {
+			ieVal.SetUnsigned8Value(uint8(record.Interfaces[0].Direction))
+		}
 	case "sourceMacAddress":
-		ieVal.SetMacAddressValue(record.Metrics.SrcMac[:])
+		return func(record *model.Record, ieVal entities.InfoElementWithValue) {
+			ieVal.SetMacAddressValue(record.Metrics.SrcMac[:])
+		}
 	case "destinationMacAddress":
-		ieVal.SetMacAddressValue(record.Metrics.DstMac[:])
+		return func(record *model.Record, ieVal entities.InfoElementWithValue) {
+			ieVal.SetMacAddressValue(record.Metrics.DstMac[:])
+		}
 	case "sourceIPv4Address":
-		setIPv4Address(ieValPtr, model.IP(record.ID.SrcIp).To4())
+		return func(record *model.Record, ieVal entities.InfoElementWithValue) {
+			setIPv4Address(ieVal, model.IP(record.ID.SrcIp).To4())
+		}
 	case "destinationIPv4Address":
-		setIPv4Address(ieValPtr, model.IP(record.ID.DstIp).To4())
+		return func(record *model.Record, ieVal entities.InfoElementWithValue) {
+			setIPv4Address(ieVal, model.IP(record.ID.DstIp).To4())
+		}
 	case "sourceIPv6Address":
-		ieVal.SetIPAddressValue(record.ID.SrcIp[:])
+		return func(record *model.Record, ieVal entities.InfoElementWithValue) {
+			ieVal.SetIPAddressValue(record.ID.SrcIp[:])
+		}
 	case "destinationIPv6Address":
-		ieVal.SetIPAddressValue(record.ID.DstIp[:])
+		return func(record *model.Record, ieVal entities.InfoElementWithValue) {
+			ieVal.SetIPAddressValue(record.ID.DstIp[:])
+		}
 	case "protocolIdentifier", "nextHeaderIPv6":
-		ieVal.SetUnsigned8Value(record.ID.TransportProtocol)
+		return func(record *model.Record, ieVal entities.InfoElementWithValue) {
+			ieVal.SetUnsigned8Value(record.ID.TransportProtocol)
+		}
 	case "sourceTransportPort":
-		ieVal.SetUnsigned16Value(record.ID.SrcPort)
+		return func(record *model.Record, ieVal entities.InfoElementWithValue) {
+			ieVal.SetUnsigned16Value(record.ID.SrcPort)
+		}
 	case "destinationTransportPort":
-		ieVal.SetUnsigned16Value(record.ID.DstPort)
+		return func(record *model.Record, ieVal entities.InfoElementWithValue) {
+			ieVal.SetUnsigned16Value(record.ID.DstPort)
+		}
 	case "icmpTypeIPv4", "icmpTypeIPv6":
-		ieVal.SetUnsigned8Value(record.ID.IcmpType)
+		return func(record *model.Record, ieVal entities.InfoElementWithValue) {
+			ieVal.SetUnsigned8Value(record.ID.IcmpType)
+		}
 	case "icmpCodeIPv4", "icmpCodeIPv6":
-		ieVal.SetUnsigned8Value(record.ID.IcmpCode)
+		return func(record *model.Record, ieVal entities.InfoElementWithValue) {
+			ieVal.SetUnsigned8Value(record.ID.IcmpCode)
+		}
+	case "octetDeltaCount":
+		return func(record *model.Record, ieVal entities.InfoElementWithValue) {
+			ieVal.SetUnsigned64Value(record.Metrics.Bytes)
+		}
+	case "tcpControlBits":
+		return func(record *model.Record, ieVal entities.InfoElementWithValue) {
+			ieVal.SetUnsigned16Value(record.Metrics.Flags)
+		}
+	case "flowStartSeconds":
+		return func(record *model.Record, ieVal entities.InfoElementWithValue) {
+			ieVal.SetUnsigned32Value(uint32(record.TimeFlowStart.Unix()))
+		}
+	case "flowStartMilliseconds":
+		return func(record *model.Record, ieVal entities.InfoElementWithValue) {
+			ieVal.SetUnsigned64Value(uint64(record.TimeFlowStart.UnixMilli()))
+		}
+	case "flowEndSeconds":
+		return func(record *model.Record, ieVal entities.InfoElementWithValue) {
+			ieVal.SetUnsigned32Value(uint32(record.TimeFlowEnd.Unix()))
+		}
+	case "flowEndMilliseconds":
+		return func(record *model.Record, ieVal entities.InfoElementWithValue) {
+			ieVal.SetUnsigned64Value(uint64(record.TimeFlowEnd.UnixMilli()))
+		}
+	case "packetDeltaCount":
+		return func(record *model.Record, ieVal entities.InfoElementWithValue) {
+			ieVal.SetUnsigned64Value(uint64(record.Metrics.Packets))
+		}
+	case "interfaceName":
+		return func(record *model.Record, ieVal entities.InfoElementWithValue) {
+			ieVal.SetStringValue(record.Interfaces[0].Interface)
+		}
 	}
+	return nil
 }
-func setEntities(record *model.Record, elements *[]entities.InfoElementWithValue) {
-	for _, ieVal := range *elements {
-		setIEValue(record, &ieVal)
-		setIERecordValue(record, &ieVal)
+
+// newIPFIXTemplate resolves, once for all the data records, the setters of the template elements
+func newIPFIXTemplate(id uint16, elements []entities.InfoElementWithValue) ipfixTemplate {
+	t := ipfixTemplate{id: id, elements: elements, setters: make([]ieSetter, len(elements))}
+	for i := range elements {
+		t.setters[i] = ieSetterFor(elements[i].GetName())
 	}
+	return t
 }
-func (ipf *IPFIX) sendDataRecord(_ *logrus.Entry, record *model.Record, v6 bool) error {
-	dataSet := entities.NewSet(false)
-	var templateID uint16
-	if v6 {
-		templateID = ipf.templateIDv6
-		setEntities(record, &ipf.entitiesV6)
-	} else {
-		templateID = ipf.templateIDv4
-		setEntities(record, &ipf.entitiesV4)
-	}
-	err := dataSet.PrepareSet(entities.Data, templateID)
-	if err != nil {
-		return err
-	}
-	if v6 {
-		err = dataSet.AddRecord(ipf.entitiesV6, templateID)
-		if err != nil {
-			return err
-		}
-	} else {
-		err = dataSet.AddRecord(ipf.entitiesV4, templateID)
-		if err != nil {
-			return err
+
+// addDataRecord writes the flow into the template elements and stores it as a data record
+func (t *ipfixTemplate) addDataRecord(record *model.Record) {
+	for i, set := range t.setters {
+		if set != nil {
+			set(record, t.elements[i])
 		}
 	}
-	_, err = ipf.exporter.SendSet(dataSet)
-	if err != nil {
-		return err
-	}
-	return nil
+	dataRecord := entities.NewDataRecordFromElements(t.id, t.elements, false)
+	// encodes the values right away, as the elements are overwritten by the next flow
+	dataRecord.GetBuffer()
+	t.records = append(t.records, dataRecord)
+}
+
+// sendDataRecords sends the data records added since the last invocation, packing as many of them
+// as possible in each IPFIX message
+func (ipf *IPFIX) sendDataRecords(t *ipfixTemplate) error {
+	if len(t.records) == 0 {
+		return nil
+	}
+	_, _, err := ipf.exporter.SendDataRecords(t.id, t.records, &ipf.buf)
+	clear(t.records)
+	t.records = t.records[:0]
+	return err
 }
 
 // ExportFlows accepts slices of *model.Record by its input channel, converts them
@@ -367,17 +433,17 @@ func (ipf *IPFIX) ExportFlows(input <-chan []*model.Record) {
 	for inputRecords := range input {
 		for _, record := range inputRecords {
 			if record.Metrics.EthProtocol == model.IPv6Type {
-				err := ipf.sendDataRecord(log, record, true)
-				if err != nil {
-					log.WithError(err).Error("Failed in send IPFIX data record")
-				}
+				ipf.templateV6.addDataRecord(record)
 			} else {
-				err := ipf.sendDataRecord(log, record, false)
-				if err != nil {
-					log.WithError(err).Error("Failed in send IPFIX data record")
-				}
+				ipf.templateV4.addDataRecord(record)
 			}
 		}
+		if err := ipf.sendDataRecords(&ipf.templateV4); err != nil {
+			log.WithError(err).Error("Failed in send IPFIX data records")
+		}
+		if err := ipf.sendDataRecords(&ipf.templateV6); err != nil {
+			log.WithError(err).Error("Failed in send IPFIX data records")
+		}
 	}
 	ipf.exporter.CloseConnToCollector()
 }
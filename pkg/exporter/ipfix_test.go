@@ -0,0 +1,69 @@
+package exporter
+
+import (
+	"encoding/binary"
+	"net"
+	"testing"
+	"time"
+
+	"github.com/netobserv/netobserv-ebpf-agent/pkg/ebpf"
+	"github.com/netobserv/netobserv-ebpf-agent/pkg/model"
+
+	"github.com/stretchr/testify/assert"
+	"github.com/stretchr/testify/require"
+)
+
+func TestIPFIX_PacksDataRecords(t *testing.T) {
+	collector, err := net.ListenPacket("udp", "127.0.0.1:0")
+	require.NoError(t, err)
+	defer collector.Close()
+	port := collector.LocalAddr().(*net.UDPAddr).Port
+
+	const pathMTU = 600
+	ipf, err := StartIPFIXExporter("127.0.0.1", port, "udp", pathMTU)
+	require.NoError(t, err)
+
+	var records []*model.Record
+	for i := 0; i < 50; i++ {
+		records = append(records, &model.Record{
+			ID: ebpf.BpfFlowId{
+				SrcIp:   model.IPAddrFromNetIP(net.ParseIP("10.0.0.1")),
+				DstIp:   model.IPAddrFromNetIP(net.ParseIP("10.0.0.2")),
+				SrcPort: uint16(i),
+				DstPort: 443,
+			},
+			Metrics: model.BpfFlowContent{
+				BpfFlowMetrics: &ebpf.BpfFlowMetrics{EthProtocol: 0x0800, Bytes: 100, Packets: 1},
+			},
+			TimeFlowStart: time.Now(),
+			TimeFlowEnd:   time.Now(),
+			Interfaces:    []model.IntfDirUdn{model.NewIntfDirUdn("eth0", 0, nil)},
+		})
+	}
+	input := make(chan []*model.Record, 1)
+	input <- records
+	close(input)
+	ipf.ExportFlows(input)
+
+	// the v4 and v6 templates are sent first, then the 50 flows in a few messages fitting in the MTU
+	buf := make([]byte, 65535)
+	templateMessages, dataMessages := 0, 0
+	for {
+		require.NoError(t, collector.SetReadDeadline(time.Now().Add(500*time.Millisecond)))
+		n, _, err := collector.ReadFrom(buf)
+		if err != nil {
+			break
+		}
+		assert.LessOrEqual(t, n, pathMTU-udpIPv4HeadersLen)
+		assert.Equal(t, uint16(n), binary.BigEndian.Uint16(buf[2:4]), "IPFIX message length")
+		// set ID 2 is a template set, IDs >= 256 are data sets
+		if binary.BigEndian.Uint16(buf[16:18]) >= 256 {
+			dataMessages++
+		} else {
+			templateMessages++
+		}
+	}
+	assert.Equal(t, 2, templateMessages)
+	assert.Greater(t, dataMessages, 1)
+	assert.Less(t, dataMessages, 10)
+}
@@ -2,6 +2,8 @@ package exporter
 
 import (
 	"context"
+	"encoding/binary"
+	"net"
 
 	"github.com/netobserv/netobserv-ebpf-agent/pkg/metrics"
 	"github.com/netobserv/netobserv-ebpf-agent/pkg/model"
@@ -25,6 +27,21 @@ type kafkaWriter interface {
 type KafkaProto struct {
 	Writer  kafkaWriter
 	Metrics *metrics.Metrics
+	// RecordsPerMessage, when greater than 1, makes the exporter send lists of up to that many
+	// flows in each message, encoded as a pbflow.Records protobuf, instead of one pbflow.Record
+	// per message.
+	RecordsPerMessage int
+	// RecordsKeys is the number of distinct keys the lists of flows are sent with. The flows are
+	// spread among them by hashing their flow key, so all the flows between two IPs are always
+	// sent with the same key, hence to the same partition.
+	RecordsKeys int
+	// MaxMessageBytes limits the size of the lists of flows
+	MaxMessageBytes int
+	encoder         pbflow.Encoder
+	// average size of the messages and keys of the last batch, used to size the next one
+	entrySize int
+	// flows of the current batch, grouped by the key they are sent with
+	keyGroups [][]*model.Record
 }
 
 func (kp *KafkaProto) ExportFlows(input <-chan []*model.Record) {
@@ -34,37 +51,124 @@ func (kp *KafkaProto) ExportFlows(input <-chan []*model.Record) {
 	}
 }
 
-func getFlowKey(record *model.Record) []byte {
+// appendFlowKey appends the Kafka key of the flow to the provided buffer
+func appendFlowKey(buf []byte, record *model.Record) []byte {
 	// We are sorting IP address so flows from on ip to a second IP get the same key whatever the direction is
 	for k := range record.ID.SrcIp {
 		if record.ID.SrcIp[k] < record.ID.DstIp[k] {
-			return append(record.ID.SrcIp[:], record.ID.DstIp[:]...)
+			return append(append(buf, record.ID.SrcIp[:]...), record.ID.DstIp[:]...)
 		} else if record.ID.SrcIp[k] > record.ID.DstIp[k] {
-			return append(record.ID.DstIp[:], record.ID.SrcIp[:]...)
+			return append(append(buf, record.ID.DstIp[:]...), record.ID.SrcIp[:]...)
 		}
 	}
-	return append(record.ID.SrcIp[:], record.ID.DstIp[:]...)
+	return append(append(buf, record.ID.SrcIp[:]...), record.ID.DstIp[:]...)
 }
 
 func (kp *KafkaProto) batchAndSubmit(records []*model.Record) {
 	klog.Debugf("sending %d records", len(records))
+	var msgs []kafkago.Message
+	if kp.RecordsPerMessage > 1 {
+		msgs = kp.recordListsMessages(records)
+	} else {
+		msgs = kp.recordMessages(records)
+	}
+
+	if err := kp.Writer.WriteMessages(context.TODO(), msgs...); err != nil {
+		klog.WithError(err).Error("can't write messages into Kafka")
+		kp.Metrics.Errors.WithErrorName(componentKafka, "CannotWriteMessage", metrics.HighSeverity).Inc()
+	}
+	kp.Metrics.EvictionCounter.WithSource(componentKafka).Inc()
+	kp.Metrics.EvictedFlowsCounter.WithSource(componentKafka).Add(float64(len(records)))
+}
+
+// recordMessages encodes each flow into its own message
+func (kp *KafkaProto) recordMessages(records []*model.Record) []kafkago.Message {
 	msgs := make([]kafkago.Message, 0, len(records))
+	// The messages and keys of a batch are encoded into a single buffer. It isn't reused by the
+	// next batch, as an async writer still references it after WriteMessages returns.
+	buf := make([]byte, 0, len(records)*kp.entrySize)
 	for _, record := range records {
-		pbBytes, err := proto.Marshal(pbflow.FlowToPB(record))
+		start := len(buf)
+		encoded, err := kp.encoder.AppendMarshal(buf, record)
 		if err != nil {
 			klog.WithError(err).Debug("can't encode protobuf message. Ignoring")
 			kp.Metrics.Errors.WithErrorName(componentKafka, "CannotEncodeMessage", metrics.HighSeverity).Inc()
 			continue
 		}
-		msgs = append(msgs, kafkago.Message{Value: pbBytes, Key: getFlowKey(record)})
+		valueEnd := len(encoded)
+		buf = appendFlowKey(encoded, record)
+		msgs = append(msgs, kafkago.Message{
+			Value: buf[start:valueEnd:valueEnd],
+			Key:   buf[valueEnd:len(buf):len(buf)],
+		})
 	}
+	if len(records) > 0 {
+		kp.entrySize = len(buf)/len(records) + 1
+	}
+	return msgs
+}
 
-	if err := kp.Writer.WriteMessages(context.TODO(), msgs...); err != nil {
-		klog.WithError(err).Error("can't write messages into Kafka")
-		kp.Metrics.Errors.WithErrorName(componentKafka, "CannotWriteMessage", metrics.HighSeverity).Inc()
+// recordListsMessages groups the flows by key, and encodes each group into messages holding lists
+// of up to RecordsPerMessage flows, and up to MaxMessageBytes
+func (kp *KafkaProto) recordListsMessages(records []*model.Record) []kafkago.Message {
+	nKeys := max(kp.RecordsKeys, 1)
+	if len(kp.keyGroups) != nKeys {
+		kp.keyGroups = make([][]*model.Record, nKeys)
 	}
-	kp.Metrics.EvictionCounter.WithSource(componentKafka).Inc()
-	kp.Metrics.EvictedFlowsCounter.WithSource(componentKafka).Add(float64(len(records)))
+	var key [2 * net.IPv6len]byte
+	for _, record := range records {
+		k := fnv32a(appendFlowKey(key[:0], record)) % uint32(nKeys)
+		kp.keyGroups[k] = append(kp.keyGroups[k], record)
+	}
+	var msgs []kafkago.Message
+	// as for recordMessages, the buffer isn't reused by the next batch
+	buf := make([]byte, 0, len(records)*kp.entrySize)
+	for k, group := range kp.keyGroups {
+		if len(group) == 0 {
+			continue
+		}
+		keyStart := len(buf)
+		buf = binary.BigEndian.AppendUint32(buf, uint32(k))
+		msgKey := buf[keyStart:len(buf):len(buf)]
+		for _, list := range kp.encoder.FlowsToPB(group, kp.RecordsPerMessage) {
+			msgs = kp.appendRecordList(msgs, &buf, msgKey, list.Entries)
+		}
+		clear(group)
+		kp.keyGroups[k] = group[:0]
+	}
+	if len(records) > 0 {
+		kp.entrySize = len(buf)/len(records) + 1
+	}
+	return msgs
+}
+
+// appendRecordList encodes a list of flows into a message, splitting it if it exceeds MaxMessageBytes
+func (kp *KafkaProto) appendRecordList(msgs []kafkago.Message, buf *[]byte, key []byte, entries []*pbflow.Record) []kafkago.Message {
+	list := pbflow.Records{Entries: entries}
+	if kp.MaxMessageBytes > 0 && len(entries) > 1 && proto.Size(&list) > kp.MaxMessageBytes {
+		half := len(entries) / 2
+		msgs = kp.appendRecordList(msgs, buf, key, entries[:half])
+		return kp.appendRecordList(msgs, buf, key, entries[half:])
+	}
+	start := len(*buf)
+	encoded, err := proto.MarshalOptions{}.MarshalAppend(*buf, &list)
+	if err != nil {
+		klog.WithError(err).Debug("can't encode protobuf message. Ignoring")
+		kp.Metrics.Errors.WithErrorName(componentKafka, "CannotEncodeMessage", metrics.HighSeverity).Inc()
+		return msgs
+	}
+	*buf = encoded
+	return append(msgs, kafkago.Message{Value: encoded[start:len(encoded):len(encoded)], Key: key})
+}
+
+// fnv32a returns the 32-bit FNV-1a hash of the provided bytes
+func fnv32a(b []byte) uint32 {
+	h := uint32(2166136261)
+	for _, c := range b {
+		h ^= uint32(c)
+		h *= 16777619
+	}
+	return h
 }
 
 type JSONRecord struct {
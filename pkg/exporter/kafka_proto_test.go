@@ -2,6 +2,7 @@ package exporter
 
 import (
 	"context"
+	"fmt"
 	"net"
 	"testing"
 	"time"
@@ -110,17 +111,69 @@ func TestIdenticalKeys(t *testing.T) {
 		},
 		Interfaces: []model.IntfDirUdn{model.NewIntfDirUdn("veth0", 0, nil), model.NewIntfDirUdn("abcde", 1, nil)},
 	}
-	key1 := getFlowKey(&record)
+	key1 := appendFlowKey(nil, &record)
 
 	record.ID.SrcIp = model.IPAddrFromNetIP(net.ParseIP("127.3.2.1"))
 	record.ID.DstIp = model.IPAddrFromNetIP(net.ParseIP("192.1.2.3"))
-	key2 := getFlowKey(&record)
+	key2 := appendFlowKey(nil, &record)
 
 	// Both keys should be identical
 	assert.Equal(t, key1, key2)
 
 }
 
+func TestRecordListsConversion(t *testing.T) {
+	wc := writerCapturer{}
+	kj := KafkaProto{Writer: &wc, Metrics: metrics.NewMetrics(&metrics.Settings{}), RecordsPerMessage: 3, RecordsKeys: 4}
+	input := make(chan []*model.Record, 1)
+	var records []*model.Record
+	for i := 0; i < 20; i++ {
+		// 10 flows between each couple of IPs, in both directions
+		src, dst := "10.0.0.1", "10.0.0.2"
+		if i%2 == 1 {
+			src, dst = "10.0.0.3", "10.0.0.1"
+		}
+		if i%4 == 3 {
+			src, dst = dst, src
+		}
+		records = append(records, &model.Record{
+			ID: ebpf.BpfFlowId{
+				SrcIp:   model.IPAddrFromNetIP(net.ParseIP(src)),
+				DstIp:   model.IPAddrFromNetIP(net.ParseIP(dst)),
+				SrcPort: uint16(i),
+			},
+			Metrics: model.BpfFlowContent{BpfFlowMetrics: &ebpf.BpfFlowMetrics{Packets: 1}},
+		})
+	}
+	input <- records
+	close(input)
+	kj.ExportFlows(input)
+
+	// the flows between two IPs are always sent with the same key, in lists of up to 3 flows
+	keys := map[string]string{}
+	ports := map[uint32]struct{}{}
+	for _, msg := range wc.messages {
+		var list pbflow.Records
+		require.NoError(t, proto.Unmarshal(msg.Value, &list))
+		require.NotEmpty(t, list.Entries)
+		assert.LessOrEqual(t, len(list.Entries), 3)
+		for _, r := range list.Entries {
+			ips := []uint32{r.Network.SrcAddr.GetIpv4(), r.Network.DstAddr.GetIpv4()}
+			if ips[0] > ips[1] {
+				ips[0], ips[1] = ips[1], ips[0]
+			}
+			couple := fmt.Sprint(ips)
+			if key, ok := keys[couple]; ok {
+				assert.Equal(t, key, string(msg.Key))
+			}
+			keys[couple] = string(msg.Key)
+			ports[r.Transport.SrcPort] = struct{}{}
+		}
+	}
+	assert.Len(t, keys, 2)
+	assert.Len(t, ports, 20)
+}
+
 type writerCapturer struct {
 	messages []kafkago.Message
 }
@@ -1,8 +1,12 @@
 package flow
 
 import (
+	"hash/maphash"
 	"maps"
+	"sync"
+	"sync/atomic"
 	"time"
+	"unsafe"
 
 	"github.com/netobserv/netobserv-ebpf-agent/pkg/ebpf"
 	"github.com/netobserv/netobserv-ebpf-agent/pkg/metrics"
@@ -16,10 +20,14 @@ import (
 // The accounting process is usually done at kernel-space. This type reimplements it at userspace
 // for the edge case where packets are submitted directly via ring-buffer because the kernel-side
 // accounting map is full.
+// The accounting can be split in several shards, each one accumulating a subset of the flows
+// in its own goroutine.
 type Accounter struct {
 	maxEntries   int
 	evictTimeout time.Duration
-	entries      map[ebpf.BpfFlowId]*ebpf.BpfFlowMetrics
+	shards       int
+	seed         maphash.Seed
+	nbEntries    atomic.Int64
 	clock        func() time.Time
 	monoClock    func() time.Duration
 	metrics      *metrics.Metrics
@@ -27,10 +35,14 @@ type Accounter struct {
 	udnEnabled   bool
 }
 
+// length of the input channel of each accounter shard
+const accounterShardBuffer = 256
+
 var alog = logrus.WithField("component", "flow/Accounter")
 
 // NewAccounter creates a new Accounter.
 // The cache has no limit and it's assumed that eviction is done by the caller.
+// When shards > 1, the flows are spread among that many shards, sharing the maxEntries limit.
 func NewAccounter(
 	maxEntries int, evictTimeout time.Duration,
 	clock func() time.Time,
@@ -38,11 +50,17 @@ func NewAccounter(
 	m *metrics.Metrics,
 	s *ovnobserv.SampleDecoder,
 	udnEnabled bool,
+	shards int,
 ) *Accounter {
+	// each shard must hold at least one flow
+	if maxEntries > 0 && shards > maxEntries {
+		shards = maxEntries
+	}
 	acc := Accounter{
 		maxEntries:   maxEntries,
 		evictTimeout: evictTimeout,
-		entries:      map[ebpf.BpfFlowId]*ebpf.BpfFlowMetrics{},
+		shards:       shards,
+		seed:         maphash.MakeSeed(),
 		clock:        clock,
 		monoClock:    monoClock,
 		metrics:      m,
@@ -56,16 +74,61 @@ func NewAccounter(
 // and accumulate their metrics internally. Once the metrics have reached their max size
 // or the eviction times out, it evicts all the accumulated flows by the returned channel.
 func (c *Accounter) Account(in <-chan *model.RawRecord, out chan<- []*model.Record) {
+	if c.shards <= 1 {
+		c.accountShard(in, out, c.maxEntries)
+		return
+	}
+	// records of a same flow are always dispatched to the same shard
+	shardsIn := make([]chan *model.RawRecord, c.shards)
+	wg := sync.WaitGroup{}
+	for i := range shardsIn {
+		shardsIn[i] = make(chan *model.RawRecord, accounterShardBuffer)
+		wg.Add(1)
+		go func(shardIn <-chan *model.RawRecord, maxEntries int) {
+			defer wg.Done()
+			c.accountShard(shardIn, out, maxEntries)
+		}(shardsIn[i], shardEntries(c.maxEntries, c.shards, i))
+	}
+	for record := range in {
+		shardsIn[c.shardOf(&record.Id)] <- record
+	}
+	alog.Debug("input channel closed. Closing shards")
+	for _, shardIn := range shardsIn {
+		close(shardIn)
+	}
+	// wait for all the shards to evict their entries before returning
+	wg.Wait()
+}
+
+// shardEntries returns the max number of flows of a shard, so that the shards capacities add up
+// to maxEntries
+func shardEntries(maxEntries, shards, shard int) int {
+	entries := maxEntries / shards
+	if shard < maxEntries%shards {
+		entries++
+	}
+	return entries
+}
+
+// shardOf returns the shard accounting the provided flow
+func (c *Accounter) shardOf(id *ebpf.BpfFlowId) uint64 {
+	return maphash.Bytes(c.seed, unsafe.Slice((*byte)(unsafe.Pointer(id)), unsafe.Sizeof(*id))) % uint64(c.shards)
+}
+
+// accountShard accumulates the records of the input channel until it is closed, evicting them
+// once maxEntries flows are accumulated or the eviction times out.
+func (c *Accounter) accountShard(in <-chan *model.RawRecord, out chan<- []*model.Record, maxEntries int) {
+	entries := map[ebpf.BpfFlowId]*model.RawRecord{}
 	evictTick := time.NewTicker(c.evictTimeout)
 	defer evictTick.Stop()
 	for {
 		select {
 		case <-evictTick.C:
-			if len(c.entries) == 0 {
+			if len(entries) == 0 {
 				break
 			}
-			evictingEntries := c.entries
-			c.entries = map[ebpf.BpfFlowId]*ebpf.BpfFlowMetrics{}
+			evictingEntries := entries
+			entries = map[ebpf.BpfFlowId]*model.RawRecord{}
 			logrus.WithField("flows", len(evictingEntries)).
 				Debug("evicting flows from userspace accounter on timeout")
 			c.evict(evictingEntries, out, "timeout")
@@ -75,16 +138,17 @@ func (c *Accounter) Account(in <-chan *model.RawRecord, out chan<- []*model.Reco
 				// if the records channel is closed, we evict the entries in the
 				// same goroutine to wait for all the entries to be sent before
 				// closing the channel
-				c.evict(c.entries, out, "closing")
+				c.evict(entries, out, "closing")
 				alog.Debug("exiting account routine")
 				return
 			}
-			if stored, ok := c.entries[record.Id]; ok {
-				model.AccumulateBase(stored, &record.Metrics)
+			if stored, ok := entries[record.Id]; ok {
+				model.AccumulateBase(&stored.Metrics, &record.Metrics)
+				model.ReleaseRawRecord(record)
 			} else {
-				if len(c.entries) >= c.maxEntries {
-					evictingEntries := c.entries
-					c.entries = map[ebpf.BpfFlowId]*ebpf.BpfFlowMetrics{}
+				if len(entries) >= maxEntries {
+					evictingEntries := entries
+					entries = map[ebpf.BpfFlowId]*model.RawRecord{}
 					logrus.WithField("flows", len(evictingEntries)).
 						Debug("evicting flows from userspace accounter after reaching cache max length")
 					c.evict(evictingEntries, out, "full")
@@ -92,14 +156,15 @@ func (c *Accounter) Account(in <-chan *model.RawRecord, out chan<- []*model.Reco
 					// evictTimer to avoid unnecessary another eviction when timer expires.
 					evictTick.Reset(c.evictTimeout)
 				}
-				c.entries[record.Id] = &record.Metrics
+				entries[record.Id] = record
+				c.nbEntries.Add(1)
 			}
 		}
-		c.metrics.BufferSizeGauge.WithBufferName("accounter-entries").Set(float64(len(c.entries)))
+		c.metrics.BufferSizeGauge.WithBufferName("accounter-entries").Set(float64(c.nbEntries.Load()))
 	}
 }
 
-func (c *Accounter) evict(entries map[ebpf.BpfFlowId]*ebpf.BpfFlowMetrics, evictor chan<- []*model.Record, reason string) {
+func (c *Accounter) evict(entries map[ebpf.BpfFlowId]*model.RawRecord, evictor chan<- []*model.Record, reason string) {
 	now := c.clock()
 	monotonicNow := uint64(c.monoClock())
 	records := make([]*model.Record, 0, len(entries))
@@ -113,10 +178,12 @@ func (c *Accounter) evict(entries map[ebpf.BpfFlowId]*ebpf.BpfFlowMetrics, evict
 			alog.Tracef("GetInterfaceUDNS map: %v", udnCache)
 		}
 	}
-	for key, metrics := range entries {
-		flowContent := model.NewBpfFlowContent(*metrics)
+	for key, record := range entries {
+		flowContent := model.NewBpfFlowContent(record.Metrics)
+		model.ReleaseRawRecord(record)
 		records = append(records, model.NewRecord(key, &flowContent, now, monotonicNow, c.s, udnCache))
 	}
+	c.nbEntries.Add(-int64(len(entries)))
 	c.metrics.EvictionCounter.WithSourceAndReason("accounter", reason).Inc()
 	c.metrics.EvictedFlowsCounter.WithSourceAndReason("accounter", reason).Add(float64(len(records)))
 	alog.WithField("numEntries", len(records)).Debug("records evicted from userspace accounter")
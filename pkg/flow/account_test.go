@@ -51,7 +51,7 @@ func TestEvict_MaxEntries(t *testing.T) {
 		return now
 	}, func() time.Duration {
 		return 1000
-	}, metrics.NewMetrics(&metrics.Settings{}), nil, false)
+	}, metrics.NewMetrics(&metrics.Settings{}), nil, false, 1)
 
 	// WHEN it starts accounting new records
 	inputs := make(chan *model.RawRecord, 20)
@@ -134,7 +134,7 @@ func TestEvict_Period(t *testing.T) {
 		return now
 	}, func() time.Duration {
 		return 1000
-	}, metrics.NewMetrics(&metrics.Settings{}), nil, false)
+	}, metrics.NewMetrics(&metrics.Settings{}), nil, false, 1)
 
 	// WHEN it starts accounting new records
 	inputs := make(chan *model.RawRecord, 20)
@@ -216,6 +216,66 @@ func TestEvict_Period(t *testing.T) {
 	requireNoEviction(t, evictor)
 }
 
+func TestEvict_Shards(t *testing.T) {
+	// GIVEN an accounter split in several shards
+	now := time.Date(2022, 8, 23, 16, 33, 22, 0, time.UTC)
+	acc := NewAccounter(200, time.Hour, func() time.Time {
+		return now
+	}, func() time.Duration {
+		return 1000
+	}, metrics.NewMetrics(&metrics.Settings{}), nil, false, 4)
+
+	// WHEN it accounts records from many flows
+	inputs := make(chan *model.RawRecord, 20)
+	evictor := make(chan []*model.Record, 20)
+	done := make(chan struct{})
+	go func() {
+		acc.Account(inputs, evictor)
+		close(done)
+	}()
+	for _, k := range []ebpf.BpfFlowId{k1, k2, k3, k1, k2, k1} {
+		inputs <- &model.RawRecord{
+			Id:      k,
+			Metrics: ebpf.BpfFlowMetrics{Bytes: 10, Packets: 1, StartMonoTimeTs: 123, EndMonoTimeTs: 123},
+		}
+	}
+	close(inputs)
+
+	// THEN the records of each flow are accumulated by the same shard, and all the shards
+	// evict their entries before the accounter exits
+	select {
+	case <-done:
+	case <-time.After(timeout):
+		require.Fail(t, "timeout while waiting for the accounter to exit")
+	}
+	close(evictor)
+	packets := map[ebpf.BpfFlowId]uint32{}
+	for records := range evictor {
+		for _, r := range records {
+			assert.NotContains(t, packets, r.ID)
+			packets[r.ID] = r.Metrics.Packets
+		}
+	}
+	assert.Equal(t, map[ebpf.BpfFlowId]uint32{k1: 3, k2: 2, k3: 1}, packets)
+}
+
+func TestShardEntries(t *testing.T) {
+	for _, tc := range []struct {
+		maxEntries, shards int
+		expected           []int
+	}{
+		{maxEntries: 200, shards: 4, expected: []int{50, 50, 50, 50}},
+		{maxEntries: 10, shards: 4, expected: []int{3, 3, 2, 2}},
+		{maxEntries: 3, shards: 3, expected: []int{1, 1, 1}},
+	} {
+		var entries []int
+		for i := 0; i < tc.shards; i++ {
+			entries = append(entries, shardEntries(tc.maxEntries, tc.shards, i))
+		}
+		assert.Equal(t, tc.expected, entries, "maxEntries: %d, shards: %d", tc.maxEntries, tc.shards)
+	}
+}
+
 func receiveTimeout(t *testing.T, evictor <-chan []*model.Record) []*model.Record {
 	t.Helper()
 	select {
@@ -54,17 +54,15 @@ func (c *PerfBuffer) PBuffer(in <-chan *model.PacketRecord, out chan<- []*model.
 					Debug("evicting packets from userspace accounter after reaching cache max length")
 				c.evict(evictingEntries, out)
 			}
-			c.entries = append(c.entries, model.NewPacketRecord(packet.Stream, (uint32)(len(packet.Stream)), packet.Time))
+			// the packets point to their own sample buffers: they are forwarded without copy
+			c.entries = append(c.entries, packet)
 			ind++
 		}
 	}
 }
 
+// evict forwards the entries, which are not reused by the buffer afterwards
 func (c *PerfBuffer) evict(entries [](*model.PacketRecord), evictor chan<- []*model.PacketRecord) {
-	packets := make([]*model.PacketRecord, 0, len(entries))
-	for _, payload := range entries {
-		packets = append(packets, model.NewPacketRecord(payload.Stream, (uint32)(len(payload.Stream)), payload.Time))
-	}
-	alog.WithField("numEntries", len(packets)).Debug("packets evicted from userspace accounter")
-	evictor <- packets
+	alog.WithField("numEntries", len(entries)).Debug("packets evicted from userspace accounter")
+	evictor <- entries
 }
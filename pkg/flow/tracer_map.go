@@ -7,7 +7,6 @@ import (
 	"sync"
 	"time"
 
-	"github.com/netobserv/netobserv-ebpf-agent/pkg/ebpf"
 	"github.com/netobserv/netobserv-ebpf-agent/pkg/metrics"
 	"github.com/netobserv/netobserv-ebpf-agent/pkg/model"
 
@@ -32,15 +31,41 @@ type MapTracer struct {
 	timeSpentinLookupAndDelete prometheus.Histogram
 	s                          *ovnobserv.SampleDecoder
 	udnEnabled                 bool
+	incremental                *IncrementalEviction
+	// number of map entries visited by the current and the last complete incremental walks
+	walkedEntries     int
+	lastWalkedEntries int
+}
+
+// IncrementalEviction configures the MapTracer to walk the eBPF map in slices spread across the
+// idle timeout, evicting only the idle flows and the flows that have been active for longer than
+// the eviction timeout, instead of draining the whole map on each eviction.
+type IncrementalEviction struct {
+	// IdleTimeout is the duration without packets after which a flow is evicted
+	IdleTimeout time.Duration
+	// Steps is the number of slices in which each walk through the map is split
+	Steps int
 }
 
 type mapFetcher interface {
-	LookupAndDeleteMap(*metrics.Metrics) map[ebpf.BpfFlowId]model.BpfFlowContent
+	LookupAndDeleteMap(*metrics.Metrics) []model.BpfFlowEntry
+	LookupAndDeleteExpired(met *metrics.Metrics, maxEntries int, idleTimeout, activeTimeout time.Duration) ([]model.BpfFlowEntry, int, bool)
+	IncrementalEvictionSupported() bool
 	DeleteMapsStaleEntries(timeOut time.Duration)
 }
 
+// NewMapTracer creates a MapTracer. If incremental is nil, or if the fetcher doesn't support it, the
+// whole map is evicted every evictionTimeout.
 func NewMapTracer(fetcher mapFetcher, evictionTimeout, staleEntriesEvictTimeout time.Duration, m *metrics.Metrics,
-	s *ovnobserv.SampleDecoder, udnEnabled bool) *MapTracer {
+	s *ovnobserv.SampleDecoder, udnEnabled bool, incremental *IncrementalEviction) *MapTracer {
+	if incremental != nil {
+		if incremental.IdleTimeout <= 0 {
+			incremental.IdleTimeout = evictionTimeout
+		}
+		if incremental.Steps < 1 {
+			incremental.Steps = 1
+		}
+	}
 	return &MapTracer{
 		mapFetcher:                 fetcher,
 		evictionTimeout:            evictionTimeout,
@@ -50,6 +75,7 @@ func NewMapTracer(fetcher mapFetcher, evictionTimeout, staleEntriesEvictTimeout
 		timeSpentinLookupAndDelete: m.CreateTimeSpendInLookupAndDelete(),
 		s:                          s,
 		udnEnabled:                 udnEnabled,
+		incremental:                incremental,
 	}
 }
 
@@ -61,8 +87,15 @@ func (m *MapTracer) Flush() {
 
 func (m *MapTracer) TraceLoop(ctx context.Context, forceGC bool) node.StartFunc[[]*model.Record] {
 	return func(out chan<- []*model.Record) {
-		evictionTicker := time.NewTicker(m.evictionTimeout)
 		go m.evictionSynchronization(ctx, forceGC, out)
+		if m.incremental != nil {
+			m.incrementalEvictionLoop(ctx, forceGC, out)
+			if ctx.Err() != nil {
+				return
+			}
+			mtlog.Info("incremental eviction not supported: evicting the whole map on each eviction timeout")
+		}
+		evictionTicker := time.NewTicker(m.evictionTimeout)
 		for {
 			select {
 			case <-ctx.Done():
@@ -100,14 +133,94 @@ func (m *MapTracer) evictionSynchronization(ctx context.Context, forceGC bool, o
 	}
 }
 
+// incrementalEvictionLoop evicts a slice of the map on each step, so a whole walk through the
+// map takes about the idle timeout. Full evictions can still be triggered via Flush. It returns
+// when the context is cancelled, or when the fetcher turns out not to support the incremental
+// eviction.
+func (m *MapTracer) incrementalEvictionLoop(ctx context.Context, forceGC bool, out chan<- []*model.Record) {
+	stepTicker := time.NewTicker(m.incremental.IdleTimeout / time.Duration(m.incremental.Steps))
+	for {
+		select {
+		case <-ctx.Done():
+			stepTicker.Stop()
+			mtlog.Debug("exiting incremental eviction loop due to context cancellation")
+			return
+		case <-stepTicker.C:
+			m.evictionCond.L.Lock()
+			m.evictExpiredFlows(ctx, forceGC, out)
+			m.evictionCond.L.Unlock()
+			if !m.mapFetcher.IncrementalEvictionSupported() {
+				stepTicker.Stop()
+				return
+			}
+		}
+	}
+}
+
+func (m *MapTracer) evictExpiredFlows(ctx context.Context, forceGC bool, forwardFlows chan<- []*model.Record) {
+	monotonicTimeNow := monotime.Now()
+	currentTime := time.Now()
+
+	// size the slices from the previous walk, so the next one is spread across all the steps
+	maxEntries := m.lastWalkedEntries/m.incremental.Steps + 1
+	flows, walked, wrapped := m.mapFetcher.LookupAndDeleteExpired(m.metrics, maxEntries, m.incremental.IdleTimeout, m.evictionTimeout)
+	elapsed := time.Since(currentTime)
+	m.walkedEntries += walked
+	if wrapped {
+		m.lastWalkedEntries = m.walkedEntries
+		m.walkedEntries = 0
+		m.mapFetcher.DeleteMapsStaleEntries(m.staleEntriesEvictTimeout)
+	}
+	forwardingFlows := m.newRecords(flows, currentTime, monotonicTimeNow)
+	if len(forwardingFlows) > 0 {
+		select {
+		case <-ctx.Done():
+			mtlog.Debug("skipping flow eviction as agent is being stopped")
+		default:
+			forwardFlows <- forwardingFlows
+		}
+	}
+
+	if wrapped && forceGC {
+		runtime.GC()
+	}
+	m.metrics.EvictionCounter.WithSource("hashmap-incremental").Inc()
+	m.metrics.EvictedFlowsCounter.WithSource("hashmap-incremental").Add(float64(len(forwardingFlows)))
+	m.timeSpentinLookupAndDelete.Observe(elapsed.Seconds())
+	mtlog.Debugf("%d expired flows evicted from %d map entries", len(forwardingFlows), walked)
+}
+
 func (m *MapTracer) evictFlows(ctx context.Context, forceGC bool, forwardFlows chan<- []*model.Record) {
 	// it's important that this monotonic timer reports same or approximate values as kernel-side bpf_ktime_get_ns()
 	monotonicTimeNow := monotime.Now()
 	currentTime := time.Now()
 
-	var forwardingFlows []*model.Record
 	flows := m.mapFetcher.LookupAndDeleteMap(m.metrics)
 	elapsed := time.Since(currentTime)
+	forwardingFlows := m.newRecords(flows, currentTime, monotonicTimeNow)
+	m.mapFetcher.DeleteMapsStaleEntries(m.staleEntriesEvictTimeout)
+	select {
+	case <-ctx.Done():
+		mtlog.Debug("skipping flow eviction as agent is being stopped")
+	default:
+		forwardFlows <- forwardingFlows
+	}
+
+	if forceGC {
+		runtime.GC()
+	}
+	m.metrics.EvictionCounter.WithSource("hashmap").Inc()
+	m.metrics.EvictedFlowsCounter.WithSource("hashmap").Add(float64(len(forwardingFlows)))
+	m.timeSpentinLookupAndDelete.Observe(elapsed.Seconds())
+	mtlog.Debugf("%d flows evicted", len(forwardingFlows))
+}
+
+// newRecords converts the flows read from the eBPF map into records
+func (m *MapTracer) newRecords(flows []model.BpfFlowEntry, currentTime time.Time, monotonicTimeNow time.Duration) []*model.Record {
+	if len(flows) == 0 {
+		return nil
+	}
+	forwardingFlows := make([]*model.Record, 0, len(flows))
 	udnCache := make(map[string]string)
 	if m.s != nil && m.udnEnabled {
 		udnsMap, err := m.s.GetInterfaceUDNs()
@@ -118,29 +231,15 @@ func (m *MapTracer) evictFlows(ctx context.Context, forceGC bool, forwardFlows c
 			mtlog.Tracef("GetInterfaceUDNS map: %v", udnCache)
 		}
 	}
-	for flowKey, flowMetrics := range flows {
+	for i := range flows {
 		forwardingFlows = append(forwardingFlows, model.NewRecord(
-			flowKey,
-			&flowMetrics,
+			flows[i].ID,
+			&flows[i].Metrics,
 			currentTime,
 			uint64(monotonicTimeNow),
 			m.s,
 			udnCache,
 		))
 	}
-	m.mapFetcher.DeleteMapsStaleEntries(m.staleEntriesEvictTimeout)
-	select {
-	case <-ctx.Done():
-		mtlog.Debug("skipping flow eviction as agent is being stopped")
-	default:
-		forwardFlows <- forwardingFlows
-	}
-
-	if forceGC {
-		runtime.GC()
-	}
-	m.metrics.EvictionCounter.WithSource("hashmap").Inc()
-	m.metrics.EvictedFlowsCounter.WithSource("hashmap").Add(float64(len(forwardingFlows)))
-	m.timeSpentinLookupAndDelete.Observe(elapsed.Seconds())
-	mtlog.Debugf("%d flows evicted", len(forwardingFlows))
+	return forwardingFlows
 }
@@ -0,0 +1,107 @@
+package flow
+
+import (
+	"context"
+	"sync"
+	"testing"
+	"time"
+
+	"github.com/netobserv/netobserv-ebpf-agent/pkg/ebpf"
+	"github.com/netobserv/netobserv-ebpf-agent/pkg/metrics"
+	"github.com/netobserv/netobserv-ebpf-agent/pkg/model"
+	"github.com/stretchr/testify/assert"
+	"github.com/stretchr/testify/require"
+)
+
+// walkingFetcher simulates a map of mapSize entries, walked in slices
+type walkingFetcher struct {
+	mapSize      int
+	position     int
+	maxEntries   []int
+	staleDeletes int
+	// unsupported simulates a kernel without batch operations
+	unsupported   bool
+	mutex         sync.Mutex
+	fullEvictions int
+}
+
+func (f *walkingFetcher) LookupAndDeleteMap(_ *metrics.Metrics) []model.BpfFlowEntry {
+	f.mutex.Lock()
+	defer f.mutex.Unlock()
+	f.fullEvictions++
+	return nil
+}
+
+func (f *walkingFetcher) LookupAndDeleteExpired(_ *metrics.Metrics, maxEntries int, _, _ time.Duration) ([]model.BpfFlowEntry, int, bool) {
+	f.maxEntries = append(f.maxEntries, maxEntries)
+	walked := min(maxEntries, f.mapSize-f.position)
+	f.position += walked
+	// one flow expired per slice
+	flows := []model.BpfFlowEntry{{
+		ID:      ebpf.BpfFlowId{SrcPort: uint16(f.position)},
+		Metrics: model.BpfFlowContent{BpfFlowMetrics: &ebpf.BpfFlowMetrics{Packets: 1}},
+	}}
+	if f.position == f.mapSize {
+		f.position = 0
+		return flows, walked, true
+	}
+	return flows, walked, false
+}
+
+func (f *walkingFetcher) IncrementalEvictionSupported() bool {
+	return !f.unsupported
+}
+
+func (f *walkingFetcher) DeleteMapsStaleEntries(_ time.Duration) {
+	f.staleDeletes++
+}
+
+func TestMapTracer_IncrementalEviction(t *testing.T) {
+	fetcher := &walkingFetcher{mapSize: 100}
+	tracer := NewMapTracer(fetcher, 5*time.Second, 5*time.Second, metrics.NewMetrics(&metrics.Settings{}),
+		nil, false, &IncrementalEviction{IdleTimeout: time.Second, Steps: 4})
+	out := make(chan []*model.Record, 200)
+
+	// WHEN the first walk, without any previous size estimation, reaches the end of the map
+	for i := 0; i < 100; i++ {
+		tracer.evictExpiredFlows(context.Background(), false, out)
+		if fetcher.staleDeletes > 0 {
+			break
+		}
+	}
+	// THEN the next walk is split in the configured number of steps
+	fetcher.maxEntries = nil
+	for i := 0; i < 4; i++ {
+		tracer.evictExpiredFlows(context.Background(), false, out)
+	}
+	assert.Equal(t, []int{26, 26, 26, 26}, fetcher.maxEntries)
+	assert.Equal(t, 2, fetcher.staleDeletes)
+
+	// AND the expired flows of each step are forwarded
+	require.Len(t, out, 104)
+	records := <-out
+	require.Len(t, records, 1)
+	assert.Equal(t, uint32(1), records[0].Metrics.Packets)
+}
+
+func TestMapTracer_IncrementalEvictionUnsupported(t *testing.T) {
+	fetcher := &walkingFetcher{mapSize: 100, unsupported: true}
+	tracer := NewMapTracer(fetcher, 10*time.Millisecond, time.Minute, metrics.NewMetrics(&metrics.Settings{}),
+		nil, false, &IncrementalEviction{IdleTimeout: 10 * time.Millisecond, Steps: 1})
+	out := make(chan []*model.Record, 100)
+	ctx, cancel := context.WithCancel(context.Background())
+	defer cancel()
+
+	// WHEN the fetcher doesn't support the incremental eviction
+	go tracer.TraceLoop(ctx, false)(out)
+
+	// THEN the tracer falls back to the periodic eviction of the whole map after the first step
+	assert.Eventually(t, func() bool {
+		fetcher.mutex.Lock()
+		defer fetcher.mutex.Unlock()
+		return fetcher.fullEvictions >= 2
+	}, 5*time.Second, 10*time.Millisecond)
+	tracer.evictionCond.L.Lock()
+	defer tracer.evictionCond.L.Unlock()
+	assert.Equal(t, []int{1}, fetcher.maxEntries)
+}
@@ -1,10 +1,10 @@
 package flow
 
 import (
-	"bytes"
 	"context"
 	"errors"
 	"fmt"
+	"os"
 	"time"
 
 	"github.com/cilium/ebpf/perf"
@@ -19,20 +19,22 @@ var pblog = logrus.WithField("component", "flow.PerfTracer")
 // added in the eBPF kernel space due to the map being full or busy) and submits them to the
 // userspace Aggregator map
 type PerfTracer struct {
-	perfArray perfReader
-	stats     stats
+	packets packetReader
+	stats   stats
 }
 
-type perfReader interface {
-	ReadPerf() (perf.Record, error)
+// packetReader reads the raw samples of the captured packets, from the perf event array or
+// the ring buffer
+type packetReader interface {
+	ReadPacket() ([]byte, error)
 }
 
 func NewPerfTracer(
-	reader perfReader, logTimeout time.Duration,
+	reader packetReader, logTimeout time.Duration,
 ) *PerfTracer {
 	return &PerfTracer{
-		perfArray: reader,
-		stats:     stats{loggingTimeout: logTimeout},
+		packets: reader,
+		stats:   stats{loggingTimeout: logTimeout},
 	}
 }
 
@@ -59,14 +61,18 @@ func (m *PerfTracer) TraceLoop(ctx context.Context) node.StartFunc[*model.Packet
 }
 
 func (m *PerfTracer) listenAndForwardPerf(forwardCh chan<- *model.PacketRecord) error {
-	event, err := m.perfArray.ReadPerf()
+	sample, err := m.packets.ReadPacket()
+	if errors.Is(err, os.ErrDeadlineExceeded) {
+		// the ring buffer wakeups are batched, and no packets have been captured during the flush period
+		return nil
+	}
 	if err != nil {
-		return fmt.Errorf("reading from perf event array: %w", err)
+		return fmt.Errorf("reading captured packet: %w", err)
 	}
 	// Parses the perf event entry into an Event structure.
-	readFlow, err := model.ReadRawPacket(bytes.NewBuffer(event.RawSample))
+	readFlow, err := model.DecodeRawPacket(sample)
 	if err != nil {
-		return fmt.Errorf("parsing data received from the perf event array: %w", err)
+		return fmt.Errorf("parsing captured packet: %w", err)
 	}
 	forwardCh <- readFlow
 	return nil
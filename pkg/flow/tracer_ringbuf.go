@@ -1,10 +1,10 @@
 package flow
 
 import (
-	"bytes"
 	"context"
 	"errors"
 	"fmt"
+	"os"
 	"sync/atomic"
 	"syscall"
 	"time"
@@ -78,12 +78,16 @@ func (m *RingBufTracer) TraceLoop(ctx context.Context) node.StartFunc[*model.Raw
 
 func (m *RingBufTracer) listenAndForwardRingBuffer(debugging bool, forwardCh chan<- *model.RawRecord) error {
 	event, err := m.ringBuffer.ReadRingBuf()
+	if errors.Is(err, os.ErrDeadlineExceeded) {
+		// the wakeups are batched, and no flows have been submitted during the flush period
+		return nil
+	}
 	if err != nil {
 		m.metrics.Errors.WithErrorName("ringbuffer", "CannotReadRingbuffer", metrics.HighSeverity).Inc()
 		return fmt.Errorf("reading from ring buffer: %w", err)
 	}
 	// Parses the ringbuf event entry into an Event structure.
-	readFlow, err := model.ReadFrom(bytes.NewBuffer(event.RawSample))
+	readFlow, err := model.DecodeRawRecord(event.RawSample)
 	if err != nil {
 		m.metrics.Errors.WithErrorName("ringbuffer", "CannotParseRingbuffer", metrics.HighSeverity).Inc()
 		return fmt.Errorf("parsing data received from the ring buffer: %w", err)
@@ -93,8 +97,13 @@ func (m *RingBufTracer) listenAndForwardRingBuffer(debugging bool, forwardCh cha
 		m.stats.logRingBufferFlows(mapFullError)
 	}
 	errno := syscall.Errno(readFlow.Metrics.Errno)
-	// In ringbuffer, a "flow" is a 1-packet flow, it hasn't gone through aggregation yet. So we use the packet counter metric.
-	m.metrics.EvictedPacketsCounter.WithSourceAndReason("ringbuffer", errno.Error()).Inc()
+	if errno == syscall.ETIME {
+		// Flows expired by the kernel have already been aggregated
+		m.metrics.EvictedPacketsCounter.WithSourceAndReason("ringbuffer", errno.Error()).Add(float64(readFlow.Metrics.Packets))
+	} else {
+		// In ringbuffer, a "flow" is a 1-packet flow, it hasn't gone through aggregation yet. So we use the packet counter metric.
+		m.metrics.EvictedPacketsCounter.WithSourceAndReason("ringbuffer", errno.Error()).Inc()
+	}
 	// Will need to send it to accounter anyway to account regardless of complete/ongoing flow
 	forwardCh <- readFlow
 	return nil
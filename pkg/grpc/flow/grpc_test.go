@@ -2,14 +2,18 @@ package flowgrpc
 
 import (
 	"context"
+	"net"
 	"testing"
 	"time"
 
 	"github.com/mariomac/guara/pkg/test"
+	"github.com/netobserv/netobserv-ebpf-agent/pkg/ebpf"
+	"github.com/netobserv/netobserv-ebpf-agent/pkg/model"
 	"github.com/netobserv/netobserv-ebpf-agent/pkg/pbflow"
 	"github.com/stretchr/testify/assert"
 	"github.com/stretchr/testify/require"
 	"google.golang.org/grpc"
+	"google.golang.org/protobuf/proto"
 	"google.golang.org/protobuf/types/known/timestamppb"
 )
 
@@ -249,3 +253,90 @@ func BenchmarkIPv6GRPCCommunication(b *testing.B) {
 		<-serverOut
 	}
 }
+
+func benchmarkRecords() []*model.Record {
+	records := make([]*model.Record, 0, 1000)
+	for i := 0; i < cap(records); i++ {
+		records = append(records, &model.Record{
+			ID: ebpf.BpfFlowId{
+				SrcIp:             model.IPAddrFromNetIP(net.ParseIP("10.1.2.3")),
+				DstIp:             model.IPAddrFromNetIP(net.ParseIP("10.3.2.1")),
+				SrcPort:           uint16(i),
+				DstPort:           443,
+				TransportProtocol: 6,
+			},
+			Metrics: model.BpfFlowContent{
+				BpfFlowMetrics: &ebpf.BpfFlowMetrics{
+					EthProtocol: 2048,
+					SrcMac:      [...]byte{0xaa, 0xbb, 0xcc, 0xdd, 0xee, 0xff},
+					DstMac:      [...]byte{0x11, 0x22, 0x33, 0x44, 0x55, 0x66},
+					Bytes:       456,
+					Packets:     3,
+					Flags:       1,
+				},
+				AdditionalMetrics: &ebpf.BpfAdditionalMetrics{
+					DnsRecord: ebpf.BpfDnsRecordT{Id: 1, Flags: 100, Latency: 1000},
+				},
+			},
+			TimeFlowStart: time.Now(),
+			TimeFlowEnd:   time.Now(),
+			TimeFlowRtt:   time.Millisecond,
+			DNSLatency:    time.Millisecond,
+			AgentIP:       net.ParseIP("10.11.12.13"),
+			Interfaces:    []model.IntfDirUdn{model.NewIntfDirUdn("eth0", 1, nil)},
+		})
+	}
+	return records
+}
+
+func BenchmarkFlowsToPB(b *testing.B) {
+	records := benchmarkRecords()
+	b.ReportAllocs()
+	for i := 0; i < b.N; i++ {
+		for _, msg := range pbflow.FlowsToPB(records, 100) {
+			if _, err := proto.Marshal(msg); err != nil {
+				require.Fail(b, "error", err)
+			}
+		}
+	}
+}
+
+func BenchmarkEncoderFlowsToPB(b *testing.B) {
+	records := benchmarkRecords()
+	var encoder pbflow.Encoder
+	var buf []byte
+	b.ReportAllocs()
+	for i := 0; i < b.N; i++ {
+		for _, msg := range encoder.FlowsToPB(records, 100) {
+			var err error
+			if buf, err = (proto.MarshalOptions{}).MarshalAppend(buf[:0], msg); err != nil {
+				require.Fail(b, "error", err)
+			}
+		}
+	}
+}
+
+func BenchmarkFlowToPB(b *testing.B) {
+	records := benchmarkRecords()
+	b.ReportAllocs()
+	for i := 0; i < b.N; i++ {
+		for _, record := range records {
+			if _, err := proto.Marshal(pbflow.FlowToPB(record)); err != nil {
+				require.Fail(b, "error", err)
+			}
+		}
+	}
+}
+
+func BenchmarkEncoderMarshal(b *testing.B) {
+	records := benchmarkRecords()
+	var encoder pbflow.Encoder
+	b.ReportAllocs()
+	for i := 0; i < b.N; i++ {
+		for _, record := range records {
+			if _, err := encoder.Marshal(record); err != nil {
+				require.Fail(b, "error", err)
+			}
+		}
+	}
+}
@@ -6,6 +6,7 @@ import (
 	"github.com/sirupsen/logrus"
 	"github.com/vishvananda/netlink"
 	"github.com/vishvananda/netns"
+	"golang.org/x/sys/unix"
 )
 
 // EventType for an interface: added, deleted
@@ -41,6 +42,20 @@ type Interface struct {
 	NetNS netns.NsHandle
 }
 
+// NetNSInode returns the inode of the network namespace of the interface, which unlike the
+// namespace handle identifies it for all the processes
+func (i Interface) NetNSInode() (uint64, error) {
+	var st unix.Stat_t
+	if i.NetNS == netns.None() {
+		if err := unix.Stat("/proc/self/ns/net", &st); err != nil {
+			return 0, err
+		}
+	} else if err := unix.Fstat(int(i.NetNS), &st); err != nil {
+		return 0, err
+	}
+	return uint64(st.Ino), nil
+}
+
 // Informer provides notifications about each network interface that is added or removed
 // from the host. Production implementations: Poller and Watcher.
 type Informer interface {
@@ -3,6 +3,8 @@ package metrics
 import (
 	"errors"
 	"strconv"
+	"strings"
+	"sync"
 
 	"github.com/prometheus/client_golang/prometheus"
 	"github.com/sirupsen/logrus"
@@ -79,6 +81,11 @@ var (
 		"Lookup and delete map duration in seconds",
 		TypeHistogram,
 	)
+	lookupAndDeleteMapAllocations = defineMetric(
+		"lookup_and_delete_map_allocations",
+		"Number of buffer allocations made by each lookup and delete map",
+		TypeHistogram,
+	)
 	droppedFlows = defineMetric(
 		"dropped_flows_total",
 		"Number of dropped flows",
@@ -86,6 +93,11 @@ var (
 		"source",
 		"reason",
 	)
+	sketchUntrackedPackets = defineMetric(
+		"sketch_untracked_packets_total",
+		"Number of packets of the flows that could be inserted neither in the flows map nor in the flows sketch heavy hitters",
+		TypeCounter,
+	)
 	filterFlows = defineMetric(
 		"filtered_flows_total",
 		"Number of filtered flows",
@@ -117,6 +129,11 @@ var (
 		"Sampling rate",
 		TypeGauge,
 	)
+	adaptiveSamplingRate = defineMetric(
+		"adaptive_sampling_rate",
+		"Sampling rate applied by the adaptive sampling",
+		TypeGauge,
+	)
 	errorsCounter = defineMetric(
 		"errors_total",
 		"Errors counter",
@@ -125,6 +142,30 @@ var (
 		"error",
 		"severity",
 	)
+	bpfProgramRuns = defineMetric(
+		"bpf_program_runs_total",
+		"Number of runs of the eBPF programs, when the BPF stats are enabled",
+		TypeCounter,
+		"program",
+	)
+	bpfProgramRunTime = defineMetric(
+		"bpf_program_run_time_seconds_total",
+		"Time spent running the eBPF programs, when the BPF stats are enabled",
+		TypeCounter,
+		"program",
+	)
+	bpfFlowLatency = defineMetric(
+		"bpf_flow_processing_duration_seconds",
+		"Time spent by the eBPF programs processing a packet, for the new flows and the existing flows paths",
+		TypeHistogram,
+		"path",
+	)
+	interfaceAttachDuration = defineMetric(
+		"interface_attach_duration_seconds",
+		"Time spent attaching the flows programs to a network interface, by hook",
+		TypeHistogram,
+		"hook",
+	)
 	flowEnrichmentCounterCounter = defineMetric(
 		"flows_enrichment_total",
 		"Statistics on flows enrichment",
@@ -167,6 +208,19 @@ type Metrics struct {
 	BufferSizeGauge       *BufferSizeGauge
 	Errors                *ErrorCounter
 	FlowEnrichmentCounter *FlowEnrichmentCounter
+	// LookupAndDeleteAllocations tracks the buffer allocations made by each flows eviction
+	LookupAndDeleteAllocations prometheus.Histogram
+	// SketchUntrackedPackets counts the packets of the flows dropped by the flows sketch
+	SketchUntrackedPackets prometheus.Counter
+	// AdaptiveSamplingRate tracks the sampling rate set by the adaptive sampling
+	AdaptiveSamplingRate prometheus.Gauge
+	// BpfProgramRuns and BpfProgramRunTime track the kernel statistics of the eBPF programs
+	BpfProgramRuns    *BpfProgramCounter
+	BpfProgramRunTime *BpfProgramCounter
+	// BpfFlowLatency exposes the processing time histograms computed by the eBPF programs
+	BpfFlowLatency *ConstHistogramVec
+	// InterfaceAttachDuration tracks the time spent attaching the programs to each interface
+	InterfaceAttachDuration *InterfaceAttachHistogram
 }
 
 func NewMetrics(settings *Settings) *Metrics {
@@ -182,6 +236,15 @@ func NewMetrics(settings *Settings) *Metrics {
 	m.BufferSizeGauge = &BufferSizeGauge{vec: m.NewGaugeVec(&bufferSize)}
 	m.Errors = &ErrorCounter{vec: m.NewCounterVec(&errorsCounter)}
 	m.FlowEnrichmentCounter = &FlowEnrichmentCounter{vec: m.NewCounterVec(&flowEnrichmentCounterCounter)}
+	m.LookupAndDeleteAllocations = m.NewHistogram(&lookupAndDeleteMapAllocations, []float64{0, 1, 2, 5, 10, 100, 1000})
+	m.SketchUntrackedPackets = m.NewCounter(&sketchUntrackedPackets)
+	m.AdaptiveSamplingRate = m.NewGauge(&adaptiveSamplingRate)
+	m.BpfProgramRuns = &BpfProgramCounter{vec: m.NewCounterVec(&bpfProgramRuns)}
+	m.BpfProgramRunTime = &BpfProgramCounter{vec: m.NewCounterVec(&bpfProgramRunTime)}
+	m.BpfFlowLatency = m.NewConstHistogramVec(&bpfFlowLatency)
+	m.InterfaceAttachDuration = &InterfaceAttachHistogram{
+		vec: m.NewHistogramVec(&interfaceAttachDuration, []float64{.001, .005, .01, .05, .1, .5, 1, 5}),
+	}
 	return m
 }
 
@@ -256,6 +319,31 @@ func (m *Metrics) NewHistogram(def *MetricDefinition, buckets []float64, labels
 	return c
 }
 
+func (m *Metrics) NewHistogramVec(def *MetricDefinition, buckets []float64) *prometheus.HistogramVec {
+	verifyMetricType(def, TypeHistogram)
+	fullName := m.Settings.Prefix + def.Name
+	h := prometheus.NewHistogramVec(prometheus.HistogramOpts{
+		Name:    fullName,
+		Help:    def.Help,
+		Buckets: buckets,
+	}, def.Labels)
+	m.register(h, fullName)
+	return h
+}
+
+// NewConstHistogramVec creates a histogram of which the buckets are computed elsewhere, e.g. by
+// the eBPF programs
+func (m *Metrics) NewConstHistogramVec(def *MetricDefinition) *ConstHistogramVec {
+	verifyMetricType(def, TypeHistogram)
+	fullName := m.Settings.Prefix + def.Name
+	h := &ConstHistogramVec{
+		desc:       prometheus.NewDesc(fullName, def.Help, def.Labels, nil),
+		histograms: map[string]*constHistogram{},
+	}
+	m.register(h, fullName)
+	return h
+}
+
 // EvictionCounter provides syntactic sugar hidding prom's counter for eviction purpose
 type EvictionCounter struct {
 	vec *prometheus.CounterVec
@@ -269,6 +357,65 @@ func (c *EvictionCounter) WithSource(source string) prometheus.Counter {
 	return c.vec.WithLabelValues(source, "")
 }
 
+// BpfProgramCounter provides syntactic sugar hidding prom's counter for the eBPF programs stats
+type BpfProgramCounter struct {
+	vec *prometheus.CounterVec
+}
+
+func (c *BpfProgramCounter) WithProgram(program string) prometheus.Counter {
+	return c.vec.WithLabelValues(program)
+}
+
+// InterfaceAttachHistogram provides syntactic sugar hidding prom's histogram for the interfaces
+// attachment duration
+type InterfaceAttachHistogram struct {
+	vec *prometheus.HistogramVec
+}
+
+func (h *InterfaceAttachHistogram) WithHook(hook string) prometheus.Observer {
+	return h.vec.WithLabelValues(hook)
+}
+
+type constHistogram struct {
+	labels  []string
+	count   uint64
+	sum     float64
+	buckets map[float64]uint64
+}
+
+// ConstHistogramVec is a prometheus collector exposing histograms of which the cumulative
+// buckets are provided as a whole, instead of observing each value
+type ConstHistogramVec struct {
+	desc       *prometheus.Desc
+	mu         sync.Mutex
+	histograms map[string]*constHistogram
+}
+
+// Set replaces the content of the histogram with the provided labels. The buckets map the upper
+// bounds to the cumulative counts of observations.
+func (h *ConstHistogramVec) Set(count uint64, sum float64, buckets map[float64]uint64, labels ...string) {
+	h.mu.Lock()
+	defer h.mu.Unlock()
+	h.histograms[strings.Join(labels, ",")] = &constHistogram{labels: labels, count: count, sum: sum, buckets: buckets}
+}
+
+func (h *ConstHistogramVec) Describe(ch chan<- *prometheus.Desc) {
+	ch <- h.desc
+}
+
+func (h *ConstHistogramVec) Collect(ch chan<- prometheus.Metric) {
+	h.mu.Lock()
+	defer h.mu.Unlock()
+	for _, hist := range h.histograms {
+		m, err := prometheus.NewConstHistogram(h.desc, hist.count, hist.sum, hist.buckets, hist.labels...)
+		if err != nil {
+			logrus.WithError(err).Warn("couldn't collect histogram")
+			continue
+		}
+		ch <- m
+	}
+}
+
 type FlowEnrichmentCounter struct {
 	vec *prometheus.CounterVec
 }
@@ -3,6 +3,7 @@ package metrics
 import (
 	"testing"
 
+	"github.com/prometheus/client_golang/prometheus"
 	"github.com/stretchr/testify/assert"
 )
 
@@ -67,3 +68,22 @@ func TestVerifyMetricType(t *testing.T) {
 
 	verifyMetricType(&metric, TypeGauge)
 }
+
+func TestConstHistogramVec(t *testing.T) {
+	metrics := NewMetrics(&Settings{Prefix: "test_const_histogram_"})
+	metrics.BpfFlowLatency.Set(3, 0.5, map[float64]uint64{0.1: 1, 1: 3}, "new")
+	// the histogram is replaced as a whole
+	metrics.BpfFlowLatency.Set(5, 1.5, map[float64]uint64{0.1: 2, 1: 4}, "new")
+
+	reg := prometheus.NewPedanticRegistry()
+	assert.NoError(t, reg.Register(metrics.BpfFlowLatency))
+	families, err := reg.Gather()
+	assert.NoError(t, err)
+	assert.Len(t, families, 1)
+	collected := families[0].GetMetric()
+	assert.Len(t, collected, 1)
+	assert.Equal(t, "new", collected[0].GetLabel()[0].GetValue())
+	assert.Equal(t, uint64(5), collected[0].GetHistogram().GetSampleCount())
+	assert.Equal(t, 1.5, collected[0].GetHistogram().GetSampleSum())
+	assert.Equal(t, uint64(4), collected[0].GetHistogram().GetBucket()[1].GetCumulativeCount())
+}
@@ -9,6 +9,12 @@ type BpfFlowContent struct {
 	AdditionalMetrics *ebpf.BpfAdditionalMetrics
 }
 
+// BpfFlowEntry is a flow identifier along with its content, as evicted from the eBPF maps
+type BpfFlowEntry struct {
+	ID      ebpf.BpfFlowId
+	Metrics BpfFlowContent
+}
+
 // nolint:gocritic // hugeParam: metric is reported as heavy; but it needs to be copied anyway, we don't want a pointer here
 func NewBpfFlowContent(metrics ebpf.BpfFlowMetrics) BpfFlowContent {
 	return BpfFlowContent{BpfFlowMetrics: &metrics}
@@ -32,8 +38,7 @@ func AccumulateBase(p *ebpf.BpfFlowMetrics, other *ebpf.BpfFlowMetrics) *ebpf.Bp
 	if p.EndMonoTimeTs == 0 || p.EndMonoTimeTs < other.EndMonoTimeTs {
 		p.EndMonoTimeTs = other.EndMonoTimeTs
 	}
-	p.Bytes += other.Bytes
-	p.Packets += other.Packets
+	accumulateSampled(p, other)
 	p.Flags |= other.Flags
 	if other.EthProtocol != 0 {
 		p.EthProtocol = other.EthProtocol
@@ -47,10 +52,95 @@ func AccumulateBase(p *ebpf.BpfFlowMetrics, other *ebpf.BpfFlowMetrics) *ebpf.Bp
 	if other.Dscp != 0 {
 		p.Dscp = other.Dscp
 	}
-	if other.Sampling != 0 {
+	return p
+}
+
+// accumulateSampled adds the packets and bytes of other into p. When both are sampled at
+// different rates, e.g. after an adaptive sampling change, the counts are weighted to the lowest
+// rate, so that the estimates (counts * rate) remain right.
+func accumulateSampled(p, other *ebpf.BpfFlowMetrics) {
+	switch {
+	case p.Sampling == 0 || other.Sampling == 0 || p.Sampling == other.Sampling:
+		p.Packets += other.Packets
+		p.Bytes += other.Bytes
+		if other.Sampling != 0 {
+			p.Sampling = other.Sampling
+		}
+	case other.Sampling < p.Sampling:
+		p.Packets = uint32(uint64(p.Packets)*uint64(p.Sampling)/uint64(other.Sampling)) + other.Packets
+		p.Bytes = p.Bytes*uint64(p.Sampling)/uint64(other.Sampling) + other.Bytes
 		p.Sampling = other.Sampling
+	default:
+		p.Packets += uint32(uint64(other.Packets) * uint64(other.Sampling) / uint64(p.Sampling))
+		p.Bytes += other.Bytes * uint64(other.Sampling) / uint64(p.Sampling)
 	}
-	return p
+}
+
+// AccumulatePerCPU merges into dst the per-CPU values of a flow, as read from the per-CPU
+// aggregation map. Values that have not been set on a CPU (zero start time) are ignored. The
+// earliest value defines the first-seen interface and direction: only packets and bytes counted on
+// that interface are summed, to avoid duplicate counts. Interfaces first seen on other CPUs are
+// merged into the observed interfaces. Values sampled at different rates are weighted to the
+// lowest one. Returns false, leaving dst untouched, if no CPU value is set.
+func AccumulatePerCPU(dst *ebpf.BpfFlowMetrics, values []ebpf.BpfFlowMetrics) bool {
+	var first *ebpf.BpfFlowMetrics
+	for i := range values {
+		if values[i].StartMonoTimeTs == 0 {
+			continue
+		}
+		if first == nil || values[i].StartMonoTimeTs < first.StartMonoTimeTs {
+			first = &values[i]
+		}
+	}
+	if first == nil {
+		return false
+	}
+	*dst = *first
+	lastCounted := first.EndMonoTimeTs
+	for i := range values {
+		other := &values[i]
+		if other == first || other.StartMonoTimeTs == 0 {
+			continue
+		}
+		if dst.EndMonoTimeTs < other.EndMonoTimeTs {
+			dst.EndMonoTimeTs = other.EndMonoTimeTs
+		}
+		dst.Flags |= other.Flags
+		if other.IfIndexFirstSeen == dst.IfIndexFirstSeen {
+			accumulateSampled(dst, other)
+			if lastCounted < other.EndMonoTimeTs {
+				lastCounted = other.EndMonoTimeTs
+				dst.Dscp = other.Dscp
+			}
+		} else {
+			addObservedIntf(dst, other.IfIndexFirstSeen, other.DirectionFirstSeen)
+		}
+		for j := uint8(0); j < other.NbObservedIntf && j < MaxObservedInterfaces; j++ {
+			addObservedIntf(dst, other.ObservedIntf[j], other.ObservedDirection[j])
+		}
+	}
+	return true
+}
+
+// addObservedIntf mirrors add_observed_intf from bpf/flows.c
+func addObservedIntf(p *ebpf.BpfFlowMetrics, ifIndex uint32, direction uint8) {
+	if ifIndex == 0 || ifIndex == p.IfIndexFirstSeen {
+		return
+	}
+	for i := uint8(0); i < p.NbObservedIntf; i++ {
+		if p.ObservedIntf[i] == ifIndex {
+			if p.ObservedDirection[i] != direction {
+				p.ObservedDirection[i] = ObservedDirectionBoth
+			}
+			return
+		}
+	}
+	if p.NbObservedIntf >= MaxObservedInterfaces {
+		return
+	}
+	p.ObservedIntf[p.NbObservedIntf] = ifIndex
+	p.ObservedDirection[p.NbObservedIntf] = direction
+	p.NbObservedIntf++
 }
 
 func (p *BpfFlowContent) buildBaseFromAdditional(add *ebpf.BpfAdditionalMetrics) {
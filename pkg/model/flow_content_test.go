@@ -215,3 +215,82 @@ func TestAccumulate(t *testing.T) {
 		})
 	}
 }
+
+func TestAccumulateBase_Sampling(t *testing.T) {
+	// flows sampled at different rates are weighted to the lowest rate
+	p := &ebpf.BpfFlowMetrics{Packets: 2, Bytes: 200, Sampling: 100}
+	AccumulateBase(p, &ebpf.BpfFlowMetrics{Packets: 3, Bytes: 150, Sampling: 50})
+	assert.Equal(t, &ebpf.BpfFlowMetrics{Packets: 7, Bytes: 550, Sampling: 50}, p)
+	AccumulateBase(p, &ebpf.BpfFlowMetrics{Packets: 1, Bytes: 10, Sampling: 200})
+	assert.Equal(t, &ebpf.BpfFlowMetrics{Packets: 11, Bytes: 590, Sampling: 50}, p)
+
+	// unknown rates are summed as is
+	AccumulateBase(p, &ebpf.BpfFlowMetrics{Packets: 1, Bytes: 10})
+	assert.Equal(t, &ebpf.BpfFlowMetrics{Packets: 12, Bytes: 600, Sampling: 50}, p)
+}
+
+func TestAccumulatePerCPU(t *testing.T) {
+	type testCase struct {
+		name     string
+		input    []ebpf.BpfFlowMetrics
+		expected *ebpf.BpfFlowMetrics
+	}
+	tcs := []testCase{{
+		name:     "no value set",
+		input:    []ebpf.BpfFlowMetrics{{}, {}},
+		expected: nil,
+	}, {
+		name: "single CPU",
+		input: []ebpf.BpfFlowMetrics{
+			{},
+			{Packets: 3, Bytes: 300, StartMonoTimeTs: 10, EndMonoTimeTs: 20, Flags: 1, IfIndexFirstSeen: 2},
+		},
+		expected: &ebpf.BpfFlowMetrics{Packets: 3, Bytes: 300, StartMonoTimeTs: 10, EndMonoTimeTs: 20, Flags: 1, IfIndexFirstSeen: 2},
+	}, {
+		name: "same interface on several CPUs",
+		input: []ebpf.BpfFlowMetrics{
+			{Packets: 3, Bytes: 300, StartMonoTimeTs: 15, EndMonoTimeTs: 40, Flags: 0x10, IfIndexFirstSeen: 2, Sampling: 50, Dscp: 4},
+			{},
+			{Packets: 2, Bytes: 100, StartMonoTimeTs: 10, EndMonoTimeTs: 30, Flags: 0x02, IfIndexFirstSeen: 2, Sampling: 50},
+		},
+		expected: &ebpf.BpfFlowMetrics{Packets: 5, Bytes: 400, StartMonoTimeTs: 10, EndMonoTimeTs: 40, Flags: 0x12, IfIndexFirstSeen: 2, Sampling: 50, Dscp: 4},
+	}, {
+		name: "different sampling rates on several CPUs",
+		input: []ebpf.BpfFlowMetrics{
+			{Packets: 3, Bytes: 300, StartMonoTimeTs: 10, EndMonoTimeTs: 40, IfIndexFirstSeen: 2, Sampling: 100},
+			{Packets: 2, Bytes: 100, StartMonoTimeTs: 15, EndMonoTimeTs: 30, IfIndexFirstSeen: 2, Sampling: 50},
+			{Packets: 1, Bytes: 50, StartMonoTimeTs: 20, EndMonoTimeTs: 25, IfIndexFirstSeen: 2, Sampling: 200},
+		},
+		// weighted to the lowest rate
+		expected: &ebpf.BpfFlowMetrics{Packets: 12, Bytes: 900, StartMonoTimeTs: 10, EndMonoTimeTs: 40, IfIndexFirstSeen: 2, Sampling: 50},
+	}, {
+		name: "different interfaces on several CPUs",
+		input: []ebpf.BpfFlowMetrics{
+			{
+				Packets: 3, Bytes: 300, StartMonoTimeTs: 10, EndMonoTimeTs: 20, IfIndexFirstSeen: 2, DirectionFirstSeen: 0,
+				NbObservedIntf: 1, ObservedIntf: [MaxObservedInterfaces]uint32{5}, ObservedDirection: [MaxObservedInterfaces]uint8{1},
+			},
+			{
+				Packets: 4, Bytes: 400, StartMonoTimeTs: 12, EndMonoTimeTs: 50, IfIndexFirstSeen: 7, DirectionFirstSeen: 1,
+				NbObservedIntf: 2, ObservedIntf: [MaxObservedInterfaces]uint32{2, 5}, ObservedDirection: [MaxObservedInterfaces]uint8{0, 0},
+			},
+		},
+		expected: &ebpf.BpfFlowMetrics{
+			Packets: 3, Bytes: 300, StartMonoTimeTs: 10, EndMonoTimeTs: 50, IfIndexFirstSeen: 2, DirectionFirstSeen: 0,
+			NbObservedIntf:    2,
+			ObservedIntf:      [MaxObservedInterfaces]uint32{5, 7},
+			ObservedDirection: [MaxObservedInterfaces]uint8{ObservedDirectionBoth, 1},
+		},
+	}}
+	for _, tc := range tcs {
+		t.Run(tc.name, func(t *testing.T) {
+			var merged ebpf.BpfFlowMetrics
+			if tc.expected == nil {
+				assert.False(t, AccumulatePerCPU(&merged, tc.input))
+				return
+			}
+			assert.True(t, AccumulatePerCPU(&merged, tc.input))
+			assert.Equal(t, *tc.expected, merged)
+		})
+	}
+}
@@ -0,0 +1,46 @@
+package model
+
+import (
+	"net"
+
+	"github.com/netobserv/netobserv-ebpf-agent/pkg/ebpf"
+)
+
+// ip4in6Prefix is the ::ffff/96 prefix of the IPv4 addresses encoded as IPv6
+var ip4in6Prefix = [net.IPv6len - net.IPv4len]uint8{10: 0xff, 11: 0xff}
+
+// NewFlowIDFromV4 returns the flow identifier of a compact IPv4 flow key, as read from the
+// aggregated_flows_v4 map, so flows from both maps share the same representation
+func NewFlowIDFromV4(key *ebpf.BpfFlowIdV4) ebpf.BpfFlowId {
+	id := ebpf.BpfFlowId{
+		SrcPort:           key.SrcPort,
+		DstPort:           key.DstPort,
+		TransportProtocol: key.TransportProtocol,
+		IcmpType:          key.IcmpType,
+		IcmpCode:          key.IcmpCode,
+	}
+	copy(id.SrcIp[:], ip4in6Prefix[:])
+	copy(id.SrcIp[len(ip4in6Prefix):], key.SrcIp[:])
+	copy(id.DstIp[:], ip4in6Prefix[:])
+	copy(id.DstIp[len(ip4in6Prefix):], key.DstIp[:])
+	return id
+}
+
+// FlowIDToV4 returns the compact IPv4 flow key of a flow identifier, and false if the flow
+// addresses are not IPv4
+func FlowIDToV4(id *ebpf.BpfFlowId) (ebpf.BpfFlowIdV4, bool) {
+	if [len(ip4in6Prefix)]uint8(id.SrcIp[:len(ip4in6Prefix)]) != ip4in6Prefix ||
+		[len(ip4in6Prefix)]uint8(id.DstIp[:len(ip4in6Prefix)]) != ip4in6Prefix {
+		return ebpf.BpfFlowIdV4{}, false
+	}
+	key := ebpf.BpfFlowIdV4{
+		SrcPort:           id.SrcPort,
+		DstPort:           id.DstPort,
+		TransportProtocol: id.TransportProtocol,
+		IcmpType:          id.IcmpType,
+		IcmpCode:          id.IcmpCode,
+	}
+	copy(key.SrcIp[:], id.SrcIp[len(ip4in6Prefix):])
+	copy(key.DstIp[:], id.DstIp[len(ip4in6Prefix):])
+	return key, true
+}
@@ -0,0 +1,35 @@
+package model
+
+import (
+	"net"
+	"testing"
+
+	"github.com/netobserv/netobserv-ebpf-agent/pkg/ebpf"
+	"github.com/stretchr/testify/assert"
+	"github.com/stretchr/testify/require"
+)
+
+func TestFlowIDV4Conversion(t *testing.T) {
+	key := ebpf.BpfFlowIdV4{
+		SrcIp:             [4]uint8{10, 0, 0, 1},
+		DstIp:             [4]uint8{192, 168, 1, 2},
+		SrcPort:           23000,
+		DstPort:           443,
+		TransportProtocol: 6,
+	}
+	id := NewFlowIDFromV4(&key)
+	assert.Equal(t, "10.0.0.1", IP(id.SrcIp).String())
+	assert.Equal(t, "192.168.1.2", IP(id.DstIp).String())
+	assert.Equal(t, uint16(23000), id.SrcPort)
+	assert.Equal(t, uint16(443), id.DstPort)
+	assert.Equal(t, uint8(6), id.TransportProtocol)
+
+	back, ok := FlowIDToV4(&id)
+	require.True(t, ok)
+	assert.Equal(t, key, back)
+
+	// IPv6 flows don't have a compact key
+	id.DstIp = IPAddrFromNetIP(net.ParseIP("fe80::1"))
+	_, ok = FlowIDToV4(&id)
+	assert.False(t, ok)
+}
@@ -2,17 +2,23 @@ package model
 
 import (
 	"encoding/binary"
-	"io"
+	"fmt"
 	"time"
 
 	"github.com/gavv/monotime"
 )
 
+// PacketMetaSize is the size of the metadata preceding each captured packet (payload_meta in bpf/types.h)
+const PacketMetaSize = 24
+
 type RawByte byte
 
 type PacketRecord struct {
 	Stream []byte
-	Time   time.Time
+	// OrigLen is the length of the packet, which is greater than the length of Stream when
+	// the packet has been truncated to the capture snaplen
+	OrigLen int
+	Time    time.Time
 }
 
 // NewPacketRecord contains packet bytes
@@ -21,32 +27,35 @@ func NewPacketRecord(
 	len uint32,
 	ts time.Time,
 ) *PacketRecord {
-	pr := PacketRecord{}
-	pr.Time = ts
-	pr.Stream = make([]byte, len)
-	pr.Stream = stream
-	return &pr
+	return &PacketRecord{
+		Stream:  stream,
+		OrigLen: int(len),
+		Time:    ts,
+	}
 }
 
-// ReadRawPacket reads a PacketRecord from a binary source, in LittleEndian order
-func ReadRawPacket(reader io.Reader) (*PacketRecord, error) {
-	var pr PacketRecord
-	currentTime := time.Now()
-	monotonicTimeNow := monotime.Now()
-	getLen := make([]byte, 4)
-	packetTimestamp := make([]byte, 8)
-	// Read IfIndex and discard it: To be used in other usecases
-	_ = binary.Read(reader, binary.LittleEndian, make([]byte, 4))
-	// Read Length of packet
-	_ = binary.Read(reader, binary.LittleEndian, getLen)
-	pr.Stream = make([]byte, binary.LittleEndian.Uint32(getLen))
-	// Read TimeStamp of packet
-	_ = binary.Read(reader, binary.LittleEndian, packetTimestamp)
+// DecodeRawPacket decodes a PacketRecord from a raw sample of the perf event array or the ring
+// buffer, in LittleEndian order. The returned record points to the packet bytes in the sample,
+// without copying them.
+func DecodeRawPacket(raw []byte) (*PacketRecord, error) {
+	if len(raw) < PacketMetaSize {
+		return nil, fmt.Errorf("packet sample too short: %d bytes", len(raw))
+	}
+	// IfIndex is discarded: To be used in other usecases
+	pktLen := int(binary.LittleEndian.Uint32(raw[4:8]))
+	if len(raw)-PacketMetaSize < pktLen {
+		return nil, fmt.Errorf("packet sample of %d bytes can't hold %d bytes of packet", len(raw), pktLen)
+	}
+	pr := PacketRecord{
+		Stream:  raw[PacketMetaSize : PacketMetaSize+pktLen : PacketMetaSize+pktLen],
+		OrigLen: int(binary.LittleEndian.Uint32(raw[16:20])),
+	}
+	if pr.OrigLen < pktLen {
+		pr.OrigLen = pktLen
+	}
 	// The assumption is monotonic time should be as close to time recorded by ebpf.
 	// The difference is considered the delta time from current time.
-	tsDelta := time.Duration(uint64(monotonicTimeNow) - binary.LittleEndian.Uint64(packetTimestamp))
-	pr.Time = currentTime.Add(-tsDelta)
-
-	err := binary.Read(reader, binary.LittleEndian, &pr.Stream)
-	return &pr, err
+	tsDelta := time.Duration(uint64(monotime.Now()) - binary.LittleEndian.Uint64(raw[8:16]))
+	pr.Time = time.Now().Add(-tsDelta)
+	return &pr, nil
 }
@@ -0,0 +1,42 @@
+package model
+
+import (
+	"encoding/binary"
+	"testing"
+	"time"
+
+	"github.com/gavv/monotime"
+	"github.com/stretchr/testify/assert"
+	"github.com/stretchr/testify/require"
+)
+
+func TestDecodeRawPacket(t *testing.T) {
+	// Makes sure that we read the payload_meta structure according to the order defined in
+	// bpf/types.h, followed by the captured bytes
+	ts := uint64(monotime.Now() - time.Second)
+	raw := []byte{
+		0x03, 0x00, 0x00, 0x00, // u32 if_index
+		0x04, 0x00, 0x00, 0x00, // u32 pkt_len
+		0, 0, 0, 0, 0, 0, 0, 0, // u64 timestamp
+		0xdc, 0x05, 0x00, 0x00, // u32 orig_len
+		0x00, 0x00, 0x00, 0x00, // u32 padding
+		0x01, 0x02, 0x03, 0x04, // captured bytes
+		0x00, 0x00, 0x00, 0x00, // perf sample padding
+	}
+	binary.LittleEndian.PutUint64(raw[8:16], ts)
+
+	pr, err := DecodeRawPacket(raw)
+	require.NoError(t, err)
+	assert.Equal(t, []byte{0x01, 0x02, 0x03, 0x04}, pr.Stream)
+	assert.Equal(t, 1500, pr.OrigLen)
+	assert.WithinDuration(t, time.Now().Add(-time.Second), pr.Time, 100*time.Millisecond)
+	// the packet bytes are not copied
+	raw[PacketMetaSize] = 0xff
+	assert.Equal(t, byte(0xff), pr.Stream[0])
+
+	// the captured length can't exceed the sample
+	_, err = DecodeRawPacket(raw[:PacketMetaSize+2])
+	require.Error(t, err)
+	_, err = DecodeRawPacket(raw[:8])
+	require.Error(t, err)
+}
@@ -6,7 +6,9 @@ import (
 	"io"
 	"net"
 	"reflect"
+	"sync"
 	"time"
+	"unsafe"
 
 	"github.com/netobserv/netobserv-ebpf-agent/pkg/ebpf"
 	"github.com/netobserv/netobserv-ebpf-agent/pkg/utils"
@@ -19,7 +21,9 @@ import (
 const (
 	DirectionIngress = 0
 	DirectionEgress  = 1
-	MacLen           = 6
+	// ObservedDirectionBoth as defined in bpf/types.h (OBSERVED_DIRECTION_BOTH)
+	ObservedDirectionBoth = 3
+	MacLen                = 6
 	// IPv4Type / IPv6Type value as defined in IEEE 802: https://www.iana.org/assignments/ieee-802-numbers/ieee-802-numbers.xhtml
 	IPv6Type                 = 0x86DD
 	NetworkEventsMaxEventsMD = 8
@@ -185,7 +189,16 @@ func (ia *IPAddr) MarshalJSON() ([]byte, error) {
 }
 
 func (m *MacAddr) String() string {
-	return fmt.Sprintf("%02X:%02X:%02X:%02X:%02X:%02X", m[0], m[1], m[2], m[3], m[4], m[5])
+	const hexDigits = "0123456789ABCDEF"
+	var buf [3*MacLen - 1]byte
+	for i, b := range m {
+		if i > 0 {
+			buf[3*i-1] = ':'
+		}
+		buf[3*i] = hexDigits[b>>4]
+		buf[3*i+1] = hexDigits[b&0xF]
+	}
+	return string(buf[:])
 }
 
 func (m *MacAddr) MarshalJSON() ([]byte, error) {
@@ -199,6 +212,26 @@ func ReadFrom(reader io.Reader) (*RawRecord, error) {
 	return &fr, err
 }
 
+var rawRecordsPool = sync.Pool{New: func() any { return &RawRecord{} }}
+
+// DecodeRawRecord copies a Record, as written by the kernel in the host byte order, into a pooled
+// RawRecord. Unlike ReadFrom, it doesn't decode the fields one by one. The returned record should be
+// released with ReleaseRawRecord once it isn't referenced anymore.
+func DecodeRawRecord(raw []byte) (*RawRecord, error) {
+	size := int(unsafe.Sizeof(RawRecord{}))
+	if len(raw) < size {
+		return nil, fmt.Errorf("flow record of %d bytes, expected %d: %w", len(raw), size, io.ErrUnexpectedEOF)
+	}
+	fr := rawRecordsPool.Get().(*RawRecord)
+	copy(unsafe.Slice((*byte)(unsafe.Pointer(fr)), size), raw)
+	return fr, nil
+}
+
+// ReleaseRawRecord returns a record to the pool used by DecodeRawRecord
+func ReleaseRawRecord(fr *RawRecord) {
+	rawRecordsPool.Put(fr)
+}
+
 func AllZerosMetaData(s [NetworkEventsMaxEventsMD]uint8) bool {
 	for _, v := range s {
 		if v != 0 {
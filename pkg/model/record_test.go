@@ -3,10 +3,14 @@ package model
 import (
 	"bytes"
 	"encoding/binary"
+	"io"
+	"reflect"
+	"strings"
 	"sync"
 	"testing"
 	"time"
 
+	"github.com/cilium/ebpf/btf"
 	"github.com/gavv/monotime"
 	"github.com/stretchr/testify/assert"
 	"github.com/stretchr/testify/require"
@@ -28,21 +32,21 @@ func TestRecordBinaryEncoding(t *testing.T) {
 		0x00, // icmp: u8 icmp_code
 		0x00, // 1 byte padding
 		// Metrics
-		0x13, 0x14, 0x15, 0x16, 0x17, 0x18, 0x19, 0x1a, // u64 flow_start_time
 		0x13, 0x14, 0x15, 0x16, 0x17, 0x18, 0x19, 0x1a, // u64 flow_end_time
 		0x13, 0x14, 0x15, 0x16, 0x17, 0x18, 0x19, 0x1a, // u64 bytes
 		0x06, 0x07, 0x08, 0x09, // u32 packets
-		0x01, 0x02, // u16 eth_protocol
 		0x13, 0x14, // flags
-		0x04, 0x05, 0x06, 0x07, 0x08, 0x09, // data_link: u8[6] src_mac
-		0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f, // data_link: u8[6] dst_mac
+		0x60,                   // u8 dscp
+		0x03,                   // u8 direction_first_seen
+		0x02, 0x00, 0x00, 0x00, // u32 sampling
 		0x13, 0x14, 0x15, 0x16, // u32 if_index_first_seen
 		0x00, 0x00, 0x00, 0x00, // u32 lock
-		0x02, 0x00, 0x00, 0x00, // u32 sampling
-		0x03,                               // u8 direction_first_seen
-		0x33,                               // u8 errno
-		0x60,                               // u8 dscp
-		0x02,                               // u8 nb_observed_intf
+		0x01, 0x02, // u16 eth_protocol
+		0x33,                                           // u8 errno
+		0x02,                                           // u8 nb_observed_intf
+		0x13, 0x14, 0x15, 0x16, 0x17, 0x18, 0x19, 0x1a, // u64 flow_start_time
+		0x04, 0x05, 0x06, 0x07, 0x08, 0x09, // data_link: u8[6] src_mac
+		0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f, // data_link: u8[6] dst_mac
 		0x01, 0x00, 0x00, 0x00, 0x00, 0x00, // observed_direction[6]
 		0x00, 0x00, // 2 bytes padding
 		// observed_intf[6]
@@ -90,6 +94,43 @@ func TestRecordBinaryEncoding(t *testing.T) {
 	assert.Equal(t, "10.11.12.13", IP(fr.Id.DstIp).String())
 }
 
+func TestDecodeRawRecord(t *testing.T) {
+	// the kernel writes the records in the host byte order
+	expected := RawRecord{
+		Id: ebpf.BpfFlowId{SrcPort: 0x0f0e, DstPort: 0x1110, TransportProtocol: 0x12},
+		Metrics: ebpf.BpfFlowMetrics{
+			IfIndexFirstSeen: 0x16151413,
+			Packets:          0x09080706,
+			Bytes:            0x1a19181716151413,
+			Sampling:         0x02,
+			ObservedIntf:     [MaxObservedInterfaces]uint32{7, 8},
+		},
+	}
+	buf := bytes.Buffer{}
+	require.NoError(t, binary.Write(&buf, binary.NativeEndian, &expected))
+
+	fr, err := DecodeRawRecord(buf.Bytes())
+	require.NoError(t, err)
+	assert.Equal(t, expected, *fr)
+	ReleaseRawRecord(fr)
+
+	// pooled records are entirely overwritten
+	expected.Metrics.Bytes = 0
+	buf.Reset()
+	require.NoError(t, binary.Write(&buf, binary.NativeEndian, &expected))
+	fr, err = DecodeRawRecord(buf.Bytes())
+	require.NoError(t, err)
+	assert.Equal(t, expected, *fr)
+
+	_, err = DecodeRawRecord(buf.Bytes()[:10])
+	require.ErrorIs(t, err, io.ErrUnexpectedEOF)
+}
+
+func TestMacAddrString(t *testing.T) {
+	mac := MacAddr{0x0a, 0x1b, 0x2c, 0xd3, 0xe4, 0xff}
+	assert.Equal(t, "0A:1B:2C:D3:E4:FF", mac.String())
+}
+
 func TestParallelNewRecord(t *testing.T) {
 	wg := sync.WaitGroup{}
 	for i := 0; i < 10; i++ {
@@ -175,3 +216,63 @@ func TestAdditionalMetricsBinaryEncoding(t *testing.T) {
 		},
 	}, addmet)
 }
+
+func TestFlowLayoutMatchesBTF(t *testing.T) {
+	// Makes sure that the Go types decoding the kernel flows follow the C structures as compiled
+	// into the embedded eBPF object, and not only the byte layouts written down in these tests
+	spec, err := ebpf.LoadBpf()
+	require.NoError(t, err)
+	for _, tc := range []struct {
+		cType  string
+		goType reflect.Type
+	}{
+		{cType: "flow_id_t", goType: reflect.TypeOf(ebpf.BpfFlowId{})},
+		{cType: "flow_id_v4_t", goType: reflect.TypeOf(ebpf.BpfFlowIdV4{})},
+		{cType: "flow_metrics_t", goType: reflect.TypeOf(ebpf.BpfFlowMetrics{})},
+		{cType: "flow_metrics_percpu_t", goType: reflect.TypeOf(ebpf.BpfFlowMetricsPercpu{})},
+		{cType: "additional_metrics_t", goType: reflect.TypeOf(ebpf.BpfAdditionalMetrics{})},
+		{cType: "flow_record_t", goType: reflect.TypeOf(RawRecord{})},
+	} {
+		t.Run(tc.cType, func(t *testing.T) {
+			var st *btf.Struct
+			require.NoError(t, spec.Types.TypeByName(tc.cType, &st))
+			assertStructLayout(t, tc.cType, st, tc.goType)
+		})
+	}
+}
+
+// assertStructLayout checks the size of a Go struct, and the offset and size of the fields named
+// after the members of the BTF struct, recursing into the nested structs
+func assertStructLayout(t *testing.T, path string, st *btf.Struct, goType reflect.Type) {
+	t.Helper()
+	require.Equal(t, reflect.Struct, goType.Kind(), path)
+	assert.EqualValues(t, st.Size, goType.Size(), "size of %s", path)
+	for _, member := range st.Members {
+		if member.Name == "" {
+			continue
+		}
+		memberPath := path + "." + member.Name
+		field, ok := goType.FieldByName(goFieldName(member.Name))
+		if !assert.True(t, ok, "missing Go field for %s", memberPath) {
+			continue
+		}
+		assert.EqualValues(t, member.Offset.Bytes(), field.Offset, "offset of %s", memberPath)
+		size, err := btf.Sizeof(member.Type)
+		require.NoError(t, err, memberPath)
+		assert.EqualValues(t, size, field.Type.Size(), "size of %s", memberPath)
+		if nested, ok := btf.UnderlyingType(member.Type).(*btf.Struct); ok {
+			assertStructLayout(t, memberPath, nested, field.Type)
+		}
+	}
+}
+
+// goFieldName returns the Go name that bpf2go gives to a C member name, e.g. l4_protocol -> L4Protocol
+func goFieldName(cName string) string {
+	var name strings.Builder
+	for _, part := range strings.Split(cName, "_") {
+		if part != "" {
+			name.WriteString(strings.ToUpper(part[:1]) + part[1:])
+		}
+	}
+	return name.String()
+}
@@ -0,0 +1,233 @@
+package pbflow
+
+import (
+	"encoding/binary"
+	"net"
+	"time"
+
+	"github.com/netobserv/netobserv-ebpf-agent/pkg/model"
+	"google.golang.org/protobuf/proto"
+	"google.golang.org/protobuf/types/known/durationpb"
+	"google.golang.org/protobuf/types/known/timestamppb"
+)
+
+// recordArena holds a protobuf Record along with all its nested messages, so a flow can be
+// converted with a single allocation, or without any allocation when the arena is reused.
+type recordArena struct {
+	record        Record
+	dataLink      DataLink
+	network       Network
+	transport     Transport
+	timeFlowStart timestamppb.Timestamp
+	timeFlowEnd   timestamppb.Timestamp
+	timeFlowRtt   durationpb.Duration
+	dnsLatency    durationpb.Duration
+	xlat          Xlat
+	// source, destination, agent, translated source and translated destination addresses
+	ips   [5]IP
+	ipsV4 [5]IP_Ipv4
+	ipsV6 [5]IP_Ipv6
+	// the slices are reused, along with the entries they point to
+	dupList       []*DupMapEntry
+	dups          []DupMapEntry
+	networkEvents []*NetworkEvent
+	events        []NetworkEvent
+}
+
+const (
+	ipSrc = iota
+	ipDst
+	ipAgent
+	ipXlatSrc
+	ipXlatDst
+)
+
+// fill converts the flow record into the arena messages, overwriting any previous content
+func (a *recordArena) fill(fr *model.Record) *Record {
+	a.dataLink = DataLink{
+		SrcMac: macToUint64(&fr.Metrics.SrcMac),
+		DstMac: macToUint64(&fr.Metrics.DstMac),
+	}
+	a.network = Network{
+		Dscp: uint32(fr.Metrics.Dscp),
+	}
+	a.transport = Transport{
+		Protocol: uint32(fr.ID.TransportProtocol),
+		SrcPort:  uint32(fr.ID.SrcPort),
+		DstPort:  uint32(fr.ID.DstPort),
+	}
+	a.timeFlowStart = timestamppb.Timestamp{
+		Seconds: fr.TimeFlowStart.Unix(),
+		Nanos:   int32(fr.TimeFlowStart.Nanosecond()),
+	}
+	a.timeFlowEnd = timestamppb.Timestamp{
+		Seconds: fr.TimeFlowEnd.Unix(),
+		Nanos:   int32(fr.TimeFlowEnd.Nanosecond()),
+	}
+	a.record = Record{
+		EthProtocol:   uint32(fr.Metrics.EthProtocol),
+		Direction:     Direction(fr.Metrics.DirectionFirstSeen),
+		DataLink:      &a.dataLink,
+		Network:       &a.network,
+		Transport:     &a.transport,
+		IcmpType:      uint32(fr.ID.IcmpType),
+		IcmpCode:      uint32(fr.ID.IcmpCode),
+		Bytes:         fr.Metrics.Bytes,
+		TimeFlowStart: &a.timeFlowStart,
+		TimeFlowEnd:   &a.timeFlowEnd,
+		Packets:       uint64(fr.Metrics.Packets),
+		AgentIp:       a.agentIP(fr.AgentIP),
+		Flags:         uint32(fr.Metrics.Flags),
+		TimeFlowRtt:   setDuration(&a.timeFlowRtt, fr.TimeFlowRtt),
+		Sampling:      fr.Metrics.Sampling,
+	}
+	pb := &a.record
+	if fr.Metrics.AdditionalMetrics != nil {
+		pb.PktDropBytes = fr.Metrics.AdditionalMetrics.PktDrops.Bytes
+		pb.PktDropPackets = uint64(fr.Metrics.AdditionalMetrics.PktDrops.Packets)
+		pb.PktDropLatestFlags = uint32(fr.Metrics.AdditionalMetrics.PktDrops.LatestFlags)
+		pb.PktDropLatestState = uint32(fr.Metrics.AdditionalMetrics.PktDrops.LatestState)
+		pb.PktDropLatestDropCause = fr.Metrics.AdditionalMetrics.PktDrops.LatestDropCause
+		pb.DnsId = uint32(fr.Metrics.AdditionalMetrics.DnsRecord.Id)
+		pb.DnsFlags = uint32(fr.Metrics.AdditionalMetrics.DnsRecord.Flags)
+		pb.DnsErrno = uint32(fr.Metrics.AdditionalMetrics.DnsRecord.Errno)
+		if fr.Metrics.AdditionalMetrics.DnsRecord.Latency != 0 {
+			pb.DnsLatency = setDuration(&a.dnsLatency, fr.DNSLatency)
+		}
+		a.xlat = Xlat{
+			SrcPort: uint32(fr.Metrics.AdditionalMetrics.TranslatedFlow.Sport),
+			DstPort: uint32(fr.Metrics.AdditionalMetrics.TranslatedFlow.Dport),
+			ZoneId:  uint32(fr.Metrics.AdditionalMetrics.TranslatedFlow.ZoneId),
+		}
+		pb.Xlat = &a.xlat
+	}
+
+	if cap(a.dups) < len(fr.Interfaces) {
+		a.dups = make([]DupMapEntry, len(fr.Interfaces))
+		a.dupList = make([]*DupMapEntry, 0, len(fr.Interfaces))
+	}
+	a.dupList = a.dupList[:0]
+	for i, intf := range fr.Interfaces {
+		a.dups[i] = DupMapEntry{
+			Interface: intf.Interface,
+			Direction: Direction(intf.Direction),
+			Udn:       intf.Udn,
+		}
+		a.dupList = append(a.dupList, &a.dups[i])
+	}
+	pb.DupList = a.dupList
+
+	if fr.Metrics.EthProtocol == model.IPv6Type {
+		pb.Network.SrcAddr = a.ipv6(ipSrc, fr.ID.SrcIp[:])
+		pb.Network.DstAddr = a.ipv6(ipDst, fr.ID.DstIp[:])
+		if fr.Metrics.AdditionalMetrics != nil {
+			pb.Xlat.SrcAddr = a.ipv6(ipXlatSrc, fr.Metrics.AdditionalMetrics.TranslatedFlow.Saddr[:])
+			pb.Xlat.DstAddr = a.ipv6(ipXlatDst, fr.Metrics.AdditionalMetrics.TranslatedFlow.Daddr[:])
+		}
+	} else {
+		pb.Network.SrcAddr = a.ipv4(ipSrc, model.IntEncodeV4(fr.ID.SrcIp))
+		pb.Network.DstAddr = a.ipv4(ipDst, model.IntEncodeV4(fr.ID.DstIp))
+		if fr.Metrics.AdditionalMetrics != nil {
+			pb.Xlat.SrcAddr = a.ipv4(ipXlatSrc, model.IntEncodeV4(fr.Metrics.AdditionalMetrics.TranslatedFlow.Saddr))
+			pb.Xlat.DstAddr = a.ipv4(ipXlatDst, model.IntEncodeV4(fr.Metrics.AdditionalMetrics.TranslatedFlow.Daddr))
+		}
+	}
+
+	if len(fr.NetworkMonitorEventsMD) != 0 {
+		if cap(a.events) < len(fr.NetworkMonitorEventsMD) {
+			a.events = make([]NetworkEvent, len(fr.NetworkMonitorEventsMD))
+			a.networkEvents = make([]*NetworkEvent, 0, len(fr.NetworkMonitorEventsMD))
+		}
+		a.networkEvents = a.networkEvents[:0]
+		for i, networkEvent := range fr.NetworkMonitorEventsMD {
+			a.events[i] = NetworkEvent{Events: networkEvent}
+			a.networkEvents = append(a.networkEvents, &a.events[i])
+		}
+		pb.NetworkEventsMetadata = a.networkEvents
+	}
+	return pb
+}
+
+func (a *recordArena) ipv4(i int, ip uint32) *IP {
+	a.ipsV4[i] = IP_Ipv4{Ipv4: ip}
+	a.ips[i] = IP{IpFamily: &a.ipsV4[i]}
+	return &a.ips[i]
+}
+
+func (a *recordArena) ipv6(i int, ip []byte) *IP {
+	a.ipsV6[i] = IP_Ipv6{Ipv6: ip}
+	a.ips[i] = IP{IpFamily: &a.ipsV6[i]}
+	return &a.ips[i]
+}
+
+func (a *recordArena) agentIP(nip net.IP) *IP {
+	if ip := nip.To4(); ip != nil {
+		return a.ipv4(ipAgent, binary.BigEndian.Uint32(ip))
+	}
+	// IPv6 address
+	return a.ipv6(ipAgent, nip)
+}
+
+// setDuration fills the provided message as durationpb.New does
+func setDuration(pb *durationpb.Duration, d time.Duration) *durationpb.Duration {
+	nanos := d.Nanoseconds()
+	secs := nanos / 1e9
+	*pb = durationpb.Duration{Seconds: secs, Nanos: int32(nanos - secs*1e9)}
+	return pb
+}
+
+// Encoder converts flow records into protobuf messages as FlowsToPB and FlowToPB, but reusing
+// the messages and the wire buffers from one invocation to the next, so the encoding of the
+// flows doesn't allocate memory once the encoder has grown to the size of the biggest batch.
+// The messages and bytes returned by an invocation are only valid until the next one. An Encoder
+// can't be used concurrently.
+type Encoder struct {
+	arenas  []recordArena
+	entries []*Record
+	records []Records
+	batches []*Records
+	buf     []byte
+}
+
+// FlowsToPB converts the flow records into messages of at most maxLen entries, ready to be sent
+// to the collector via GRPC
+func (e *Encoder) FlowsToPB(inputRecords []*model.Record, maxLen int) []*Records {
+	if cap(e.arenas) < len(inputRecords) {
+		e.arenas = make([]recordArena, len(inputRecords))
+		e.entries = make([]*Record, 0, len(inputRecords))
+	}
+	e.entries = e.entries[:0]
+	for i, record := range inputRecords {
+		e.entries = append(e.entries, e.arenas[i].fill(record))
+	}
+	nBatches := (len(e.entries) + maxLen - 1) / maxLen
+	if cap(e.records) < nBatches {
+		e.records = make([]Records, nBatches)
+		e.batches = make([]*Records, 0, nBatches)
+	}
+	e.batches = e.batches[:0]
+	entries := e.entries
+	for i := 0; len(entries) > 0; i++ {
+		end := min(len(entries), maxLen)
+		e.records[i] = Records{Entries: entries[:end:end]}
+		e.batches = append(e.batches, &e.records[i])
+		entries = entries[end:]
+	}
+	return e.batches
+}
+
+// Marshal encodes a single flow record into a protobuf message ready to be sent to the collector
+// via kafka. The returned bytes are overwritten by the next invocation.
+func (e *Encoder) Marshal(fr *model.Record) ([]byte, error) {
+	var err error
+	e.buf, err = e.AppendMarshal(e.buf[:0], fr)
+	return e.buf, err
+}
+
+// AppendMarshal appends the protobuf encoding of a single flow record to the provided buffer
+func (e *Encoder) AppendMarshal(buf []byte, fr *model.Record) ([]byte, error) {
+	if len(e.arenas) == 0 {
+		e.arenas = make([]recordArena, 1)
+	}
+	return proto.MarshalOptions{}.MarshalAppend(buf, e.arenas[0].fill(fr))
+}
@@ -1,20 +1,18 @@
 package pbflow
 
 import (
-	"encoding/binary"
 	"net"
 
 	"github.com/netobserv/netobserv-ebpf-agent/pkg/ebpf"
 	"github.com/netobserv/netobserv-ebpf-agent/pkg/model"
 	"github.com/sirupsen/logrus"
-	"google.golang.org/protobuf/types/known/durationpb"
-	"google.golang.org/protobuf/types/known/timestamppb"
 )
 
 var protoLog = logrus.WithField("component", "pbflow")
 
 // FlowsToPB is an auxiliary function to convert flow records, as returned by the eBPF agent,
-// into protobuf-encoded messages ready to be sent to the collector via GRPC
+// into protobuf-encoded messages ready to be sent to the collector via GRPC. The Encoder type
+// provides the same conversion without allocating new messages on each invocation.
 func FlowsToPB(inputRecords []*model.Record, maxLen int) []*Records {
 	entries := make([]*Record, 0, len(inputRecords))
 	for _, record := range inputRecords {
@@ -35,89 +33,7 @@ func FlowsToPB(inputRecords []*model.Record, maxLen int) []*Records {
 // FlowToPB is an auxiliary function to convert a single flow record, as returned by the eBPF agent,
 // into a protobuf-encoded message ready to be sent to the collector via kafka
 func FlowToPB(fr *model.Record) *Record {
-	var pbflowRecord = Record{
-		EthProtocol: uint32(fr.Metrics.EthProtocol),
-		Direction:   Direction(fr.Metrics.DirectionFirstSeen),
-		DataLink: &DataLink{
-			SrcMac: macToUint64(&fr.Metrics.SrcMac),
-			DstMac: macToUint64(&fr.Metrics.DstMac),
-		},
-		Network: &Network{
-			Dscp: uint32(fr.Metrics.Dscp),
-		},
-		Transport: &Transport{
-			Protocol: uint32(fr.ID.TransportProtocol),
-			SrcPort:  uint32(fr.ID.SrcPort),
-			DstPort:  uint32(fr.ID.DstPort),
-		},
-		IcmpType: uint32(fr.ID.IcmpType),
-		IcmpCode: uint32(fr.ID.IcmpCode),
-		Bytes:    fr.Metrics.Bytes,
-		TimeFlowStart: &timestamppb.Timestamp{
-			Seconds: fr.TimeFlowStart.Unix(),
-			Nanos:   int32(fr.TimeFlowStart.Nanosecond()),
-		},
-		TimeFlowEnd: &timestamppb.Timestamp{
-			Seconds: fr.TimeFlowEnd.Unix(),
-			Nanos:   int32(fr.TimeFlowEnd.Nanosecond()),
-		},
-		Packets:     uint64(fr.Metrics.Packets),
-		AgentIp:     agentIP(fr.AgentIP),
-		Flags:       uint32(fr.Metrics.Flags),
-		TimeFlowRtt: durationpb.New(fr.TimeFlowRtt),
-		Sampling:    fr.Metrics.Sampling,
-	}
-	if fr.Metrics.AdditionalMetrics != nil {
-		pbflowRecord.PktDropBytes = fr.Metrics.AdditionalMetrics.PktDrops.Bytes
-		pbflowRecord.PktDropPackets = uint64(fr.Metrics.AdditionalMetrics.PktDrops.Packets)
-		pbflowRecord.PktDropLatestFlags = uint32(fr.Metrics.AdditionalMetrics.PktDrops.LatestFlags)
-		pbflowRecord.PktDropLatestState = uint32(fr.Metrics.AdditionalMetrics.PktDrops.LatestState)
-		pbflowRecord.PktDropLatestDropCause = fr.Metrics.AdditionalMetrics.PktDrops.LatestDropCause
-		pbflowRecord.DnsId = uint32(fr.Metrics.AdditionalMetrics.DnsRecord.Id)
-		pbflowRecord.DnsFlags = uint32(fr.Metrics.AdditionalMetrics.DnsRecord.Flags)
-		pbflowRecord.DnsErrno = uint32(fr.Metrics.AdditionalMetrics.DnsRecord.Errno)
-		if fr.Metrics.AdditionalMetrics.DnsRecord.Latency != 0 {
-			pbflowRecord.DnsLatency = durationpb.New(fr.DNSLatency)
-		}
-		pbflowRecord.Xlat = &Xlat{
-			SrcPort: uint32(fr.Metrics.AdditionalMetrics.TranslatedFlow.Sport),
-			DstPort: uint32(fr.Metrics.AdditionalMetrics.TranslatedFlow.Dport),
-			ZoneId:  uint32(fr.Metrics.AdditionalMetrics.TranslatedFlow.ZoneId),
-		}
-	}
-	pbflowRecord.DupList = make([]*DupMapEntry, 0)
-	for _, intf := range fr.Interfaces {
-		pbflowRecord.DupList = append(pbflowRecord.DupList, &DupMapEntry{
-			Interface: intf.Interface,
-			Direction: Direction(intf.Direction),
-			Udn:       intf.Udn,
-		})
-	}
-	if fr.Metrics.EthProtocol == model.IPv6Type {
-		pbflowRecord.Network.SrcAddr = &IP{IpFamily: &IP_Ipv6{Ipv6: fr.ID.SrcIp[:]}}
-		pbflowRecord.Network.DstAddr = &IP{IpFamily: &IP_Ipv6{Ipv6: fr.ID.DstIp[:]}}
-		if fr.Metrics.AdditionalMetrics != nil {
-			pbflowRecord.Xlat.SrcAddr = &IP{IpFamily: &IP_Ipv6{Ipv6: fr.Metrics.AdditionalMetrics.TranslatedFlow.Saddr[:]}}
-			pbflowRecord.Xlat.DstAddr = &IP{IpFamily: &IP_Ipv6{Ipv6: fr.Metrics.AdditionalMetrics.TranslatedFlow.Daddr[:]}}
-		}
-	} else {
-		pbflowRecord.Network.SrcAddr = &IP{IpFamily: &IP_Ipv4{Ipv4: model.IntEncodeV4(fr.ID.SrcIp)}}
-		pbflowRecord.Network.DstAddr = &IP{IpFamily: &IP_Ipv4{Ipv4: model.IntEncodeV4(fr.ID.DstIp)}}
-		if fr.Metrics.AdditionalMetrics != nil {
-			pbflowRecord.Xlat.SrcAddr = &IP{IpFamily: &IP_Ipv4{Ipv4: model.IntEncodeV4(fr.Metrics.AdditionalMetrics.TranslatedFlow.Saddr)}}
-			pbflowRecord.Xlat.DstAddr = &IP{IpFamily: &IP_Ipv4{Ipv4: model.IntEncodeV4(fr.Metrics.AdditionalMetrics.TranslatedFlow.Daddr)}}
-		}
-	}
-
-	if len(fr.NetworkMonitorEventsMD) != 0 {
-		pbflowRecord.NetworkEventsMetadata = make([]*NetworkEvent, 0)
-		for _, networkEvent := range fr.NetworkMonitorEventsMD {
-			pbflowRecord.NetworkEventsMetadata = append(pbflowRecord.NetworkEventsMetadata, &NetworkEvent{
-				Events: networkEvent,
-			})
-		}
-	}
-	return &pbflowRecord
+	return new(recordArena).fill(fr)
 }
 
 func PBToFlow(pb *Record) *model.Record {
@@ -206,14 +122,6 @@ func macToUint64(m *[model.MacLen]uint8) uint64 {
 		(uint64(m[0]) << 40)
 }
 
-func agentIP(nip net.IP) *IP {
-	if ip := nip.To4(); ip != nil {
-		return &IP{IpFamily: &IP_Ipv4{Ipv4: binary.BigEndian.Uint32(ip)}}
-	}
-	// IPv6 address
-	return &IP{IpFamily: &IP_Ipv6{Ipv6: nip}}
-}
-
 func pbIPToNetIP(ip *IP) net.IP {
 	if ip.GetIpv6() != nil {
 		return net.IP(ip.GetIpv6())
@@ -49,15 +49,30 @@ func (m *TracerFake) DetachTCX(_ ifaces.Interface) error {
 	return nil
 }
 
-func (m *TracerFake) LookupAndDeleteMap(_ *metrics.Metrics) map[ebpf.BpfFlowId]model.BpfFlowContent {
+func (m *TracerFake) UnpinStaleTCXLinks() {}
+
+func (m *TracerFake) LookupAndDeleteMap(_ *metrics.Metrics) []model.BpfFlowEntry {
 	select {
 	case r := <-m.mapLookups:
-		return r
+		entries := make([]model.BpfFlowEntry, 0, len(r))
+		for id, metrics := range r {
+			entries = append(entries, model.BpfFlowEntry{ID: id, Metrics: metrics})
+		}
+		return entries
 	default:
-		return map[ebpf.BpfFlowId]model.BpfFlowContent{}
+		return nil
 	}
 }
 
+func (m *TracerFake) LookupAndDeleteExpired(met *metrics.Metrics, _ int, _, _ time.Duration) ([]model.BpfFlowEntry, int, bool) {
+	flows := m.LookupAndDeleteMap(met)
+	return flows, len(flows), true
+}
+
+func (m *TracerFake) IncrementalEvictionSupported() bool {
+	return true
+}
+
 func (m *TracerFake) DeleteMapsStaleEntries(_ time.Duration) {
 }
 
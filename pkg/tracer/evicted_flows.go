@@ -0,0 +1,174 @@
+package tracer
+
+import (
+	"github.com/netobserv/netobserv-ebpf-agent/pkg/ebpf"
+	"github.com/netobserv/netobserv-ebpf-agent/pkg/model"
+)
+
+// minArenaChunkSize is the minimum number of metrics allocated at once by the evictedFlows arenas
+const minArenaChunkSize = 1024
+
+// evictedFlows joins the flows read from the aggregated flows and additional metrics maps
+// during an eviction into a flat slice.
+// The entries slice and the index are reused across evictions, so the result of an eviction is
+// only valid until the next one starts. The metrics pointed by the entries are stored in arenas
+// that are allocated once per eviction but never reused, as the exported records keep
+// referencing them.
+type evictedFlows struct {
+	entries    []model.BpfFlowEntry
+	index      map[ebpf.BpfFlowId]int
+	metrics    []ebpf.BpfFlowMetrics
+	additional []ebpf.BpfAdditionalMetrics
+	// chunk sizes of the arenas, based on the number of entries of the previous eviction
+	chunkSize           int
+	additionalChunkSize int
+	nbAdditional        int
+	// initial size of the index, and its largest size since it was created
+	cacheMaxSize int
+	indexSize    int
+	// number of flows read from the aggregated flows map during the current eviction
+	nbFlows int
+	// allocations made during the current eviction
+	allocations int
+}
+
+func newEvictedFlows(cacheMaxSize int) *evictedFlows {
+	return &evictedFlows{
+		index:               make(map[ebpf.BpfFlowId]int, cacheMaxSize),
+		chunkSize:           minArenaChunkSize,
+		additionalChunkSize: minArenaChunkSize,
+		cacheMaxSize:        cacheMaxSize,
+	}
+}
+
+// reset prepares the buffers for a new eviction, invalidating the results of the previous one.
+// The arenas are sized from the previous eviction, and the buffers grown by a burst of flows
+// are released once the evictions get smaller again.
+func (e *evictedFlows) reset() {
+	e.chunkSize = max(len(e.entries), minArenaChunkSize)
+	e.additionalChunkSize = max(e.nbAdditional, minArenaChunkSize)
+	e.nbAdditional = 0
+	e.nbFlows = 0
+	if cap(e.entries) > 2*e.chunkSize {
+		e.entries = nil
+	} else {
+		clear(e.entries)
+		e.entries = e.entries[:0]
+	}
+	// maps never shrink: the index is replaced
+	e.indexSize = max(e.indexSize, len(e.index))
+	if e.indexSize > 2*max(e.chunkSize, e.cacheMaxSize) {
+		e.index = make(map[ebpf.BpfFlowId]int, e.cacheMaxSize)
+		e.indexSize = 0
+	} else {
+		clear(e.index)
+	}
+	e.metrics = nil
+	e.additional = nil
+	e.allocations = 0
+}
+
+// newMetrics returns a zeroed metrics slot from the current arena
+func (e *evictedFlows) newMetrics() *ebpf.BpfFlowMetrics {
+	if len(e.metrics) == cap(e.metrics) {
+		e.metrics = make([]ebpf.BpfFlowMetrics, 0, e.chunkSize)
+		e.allocations++
+	}
+	e.metrics = e.metrics[:len(e.metrics)+1]
+	return &e.metrics[len(e.metrics)-1]
+}
+
+// newAdditional returns a zeroed additional metrics slot from the current arena
+func (e *evictedFlows) newAdditional() *ebpf.BpfAdditionalMetrics {
+	if len(e.additional) == cap(e.additional) {
+		e.additional = make([]ebpf.BpfAdditionalMetrics, 0, e.additionalChunkSize)
+		e.allocations++
+	}
+	e.nbAdditional++
+	e.additional = e.additional[:len(e.additional)+1]
+	return &e.additional[len(e.additional)-1]
+}
+
+// add a new entry for the flow and returns its content
+func (e *evictedFlows) add(id *ebpf.BpfFlowId, metrics *ebpf.BpfFlowMetrics) *model.BpfFlowContent {
+	if len(e.entries) == cap(e.entries) {
+		e.allocations++
+	}
+	e.index[*id] = len(e.entries)
+	e.entries = append(e.entries, model.BpfFlowEntry{ID: *id, Metrics: model.BpfFlowContent{BpfFlowMetrics: metrics}})
+	return &e.entries[len(e.entries)-1].Metrics
+}
+
+// addBase copies the flow base metrics into the arena
+func (e *evictedFlows) addBase(id *ebpf.BpfFlowId, base *ebpf.BpfFlowMetrics) {
+	metrics := e.newMetrics()
+	*metrics = *base
+	e.nbFlows++
+	e.add(id, metrics)
+}
+
+// addBaseV4 copies the base metrics of a flow read from the compact IPv4 flows map into the arena
+func (e *evictedFlows) addBaseV4(key *ebpf.BpfFlowIdV4, base *ebpf.BpfFlowMetrics) {
+	id := model.NewFlowIDFromV4(key)
+	e.addBase(&id, base)
+}
+
+// merge accumulates the base metrics of a flow into its entry, or copies them into a new entry.
+// Unlike addBase, the flow is not counted in nbFlows, as it has not been read from a flows map.
+func (e *evictedFlows) merge(id *ebpf.BpfFlowId, base *ebpf.BpfFlowMetrics) {
+	if i, found := e.index[*id]; found {
+		e.entries[i].Metrics.AccumulateBase(base)
+		return
+	}
+	metrics := e.newMetrics()
+	*metrics = *base
+	e.add(id, metrics)
+}
+
+// remove the entry of the flow, if any. The order of the entries is not preserved.
+func (e *evictedFlows) remove(id *ebpf.BpfFlowId) {
+	i, found := e.index[*id]
+	if !found {
+		return
+	}
+	last := len(e.entries) - 1
+	e.entries[i] = e.entries[last]
+	e.index[e.entries[i].ID] = i
+	e.entries = e.entries[:last]
+	delete(e.index, *id)
+}
+
+// addPerCPU merges the per-CPU flow base metrics into the arena
+func (e *evictedFlows) addPerCPU(id *ebpf.BpfFlowId, values []ebpf.BpfFlowMetrics) {
+	metrics := e.newMetrics()
+	if !model.AccumulatePerCPU(metrics, values) {
+		// no value set, give the slot back
+		e.metrics = e.metrics[:len(e.metrics)-1]
+		return
+	}
+	e.nbFlows++
+	e.add(id, metrics)
+}
+
+// addAdditional joins the per-CPU additional metrics of a flow with its base metrics, creating
+// the flow entry if it was not found in the aggregated flows map. The values slice is not
+// retained, so that the caller can reuse it.
+func (e *evictedFlows) addAdditional(id *ebpf.BpfFlowId, values []ebpf.BpfAdditionalMetrics) *model.BpfFlowContent {
+	var flow *model.BpfFlowContent
+	if i, found := e.index[*id]; found {
+		flow = &e.entries[i].Metrics
+	} else {
+		flow = e.add(id, e.newMetrics())
+	}
+	for i := range values {
+		if flow.AdditionalMetrics == nil {
+			// the first accumulated metrics are kept by reference
+			first := e.newAdditional()
+			*first = values[i]
+			flow.AccumulateAdditional(first)
+			continue
+		}
+		flow.AccumulateAdditional(&values[i])
+	}
+	return flow
+}
@@ -0,0 +1,94 @@
+package tracer
+
+import (
+	"testing"
+
+	"github.com/netobserv/netobserv-ebpf-agent/pkg/ebpf"
+	"github.com/stretchr/testify/assert"
+	"github.com/stretchr/testify/require"
+)
+
+func TestEvictedFlowsJoin(t *testing.T) {
+	flows := newEvictedFlows(10)
+	id1 := ebpf.BpfFlowId{SrcPort: 1}
+	id2 := ebpf.BpfFlowId{SrcPort: 2}
+
+	base := ebpf.BpfFlowMetrics{Packets: 3, Bytes: 30}
+	flows.addBase(&id1, &base)
+	// the buffer provided by the caller is not retained
+	base.Packets = 100
+
+	additional := []ebpf.BpfAdditionalMetrics{
+		{FlowRtt: 10},
+		{FlowRtt: 20},
+	}
+	flow := flows.addAdditional(&id1, additional)
+	assert.Equal(t, uint64(20), flow.AdditionalMetrics.FlowRtt)
+	// additional metrics without base metrics create a new entry
+	flows.addAdditional(&id2, additional[:1])
+	additional[0].FlowRtt = 100
+
+	require.Len(t, flows.entries, 2)
+	assert.Equal(t, id1, flows.entries[0].ID)
+	assert.Equal(t, uint32(3), flows.entries[0].Metrics.Packets)
+	assert.Equal(t, uint64(20), flows.entries[0].Metrics.AdditionalMetrics.FlowRtt)
+	assert.Equal(t, id2, flows.entries[1].ID)
+	assert.Equal(t, uint32(0), flows.entries[1].Metrics.Packets)
+	assert.Equal(t, uint64(10), flows.entries[1].Metrics.AdditionalMetrics.FlowRtt)
+	// the entries slice growing twice, the metrics arena and the additional metrics arena
+	assert.Equal(t, 4, flows.allocations)
+
+	// the content of the previous eviction is preserved, as records keep pointing to it
+	firstMetrics := flows.entries[0].Metrics.BpfFlowMetrics
+	flows.reset()
+	assert.Empty(t, flows.entries)
+	assert.Empty(t, flows.index)
+	flows.addBase(&id2, &ebpf.BpfFlowMetrics{Packets: 5})
+	assert.Equal(t, uint32(3), firstMetrics.Packets)
+	assert.Equal(t, uint32(5), flows.entries[0].Metrics.Packets)
+	// the entries slice is reused
+	assert.Equal(t, 1, flows.allocations)
+}
+
+func TestEvictedFlowsReset(t *testing.T) {
+	flows := newEvictedFlows(10)
+	burst := 4 * minArenaChunkSize
+	for i := 0; i < burst; i++ {
+		flows.addBase(&ebpf.BpfFlowId{SrcPort: uint16(i)}, &ebpf.BpfFlowMetrics{Packets: 1})
+	}
+
+	// the arenas of the next eviction are sized from the burst
+	flows.reset()
+	assert.Equal(t, burst, flows.chunkSize)
+	flows.addBase(&ebpf.BpfFlowId{SrcPort: 1}, &ebpf.BpfFlowMetrics{Packets: 1})
+	assert.Equal(t, burst, cap(flows.metrics))
+
+	// once the evictions get smaller, the arenas, the entries slice and the index shrink back
+	flows.reset()
+	assert.Equal(t, minArenaChunkSize, flows.chunkSize)
+	assert.Nil(t, flows.entries)
+	assert.Zero(t, flows.indexSize)
+	flows.addBase(&ebpf.BpfFlowId{SrcPort: 1}, &ebpf.BpfFlowMetrics{Packets: 1})
+	assert.Equal(t, minArenaChunkSize, cap(flows.metrics))
+}
+
+func TestEvictedFlowsMerge(t *testing.T) {
+	flows := newEvictedFlows(10)
+	id1 := ebpf.BpfFlowId{SrcPort: 1}
+	id2 := ebpf.BpfFlowId{SrcPort: 2}
+
+	flows.addBase(&id1, &ebpf.BpfFlowMetrics{Packets: 3, Bytes: 30, StartMonoTimeTs: 20, EndMonoTimeTs: 30})
+	// a heavy hitter of a flow also read from the flows map is accumulated into it
+	flows.merge(&id1, &ebpf.BpfFlowMetrics{Packets: 2, Bytes: 20, StartMonoTimeTs: 10, EndMonoTimeTs: 40, Errno: 16})
+	// other heavy hitters create new entries, not counted as read from the flows map
+	flows.merge(&id2, &ebpf.BpfFlowMetrics{Packets: 1, Bytes: 10, Errno: 16})
+
+	require.Len(t, flows.entries, 2)
+	assert.Equal(t, uint32(5), flows.entries[0].Metrics.Packets)
+	assert.Equal(t, uint64(50), flows.entries[0].Metrics.Bytes)
+	assert.Equal(t, uint64(10), flows.entries[0].Metrics.StartMonoTimeTs)
+	assert.Equal(t, uint64(40), flows.entries[0].Metrics.EndMonoTimeTs)
+	assert.Equal(t, id2, flows.entries[1].ID)
+	assert.Equal(t, uint8(16), flows.entries[1].Metrics.Errno)
+	assert.Equal(t, 1, flows.nbFlows)
+}
@@ -38,36 +38,61 @@ func NewFilter(cfg []*FilterConfig) *Filter {
 }
 
 func (f *Filter) ProgramFilter(objects *ebpf.BpfObjects) error {
-	for _, config := range f.config {
-		log.Infof("Flow filter config: %v", f.config)
-		key, err := f.getFilterKey(config)
-		if err != nil {
-			return fmt.Errorf("failed to get filter key: %w", err)
+	log.Infof("Flow filter config: %v", f.config)
+	c, err := f.compile()
+	if err != nil {
+		return err
+	}
+	for i := range c.rules {
+		if err := objects.FilterRules.Update(uint32(i), &c.rules[i], cilium.UpdateAny); err != nil {
+			return fmt.Errorf("failed to update filter rules map: %w", err)
 		}
-
-		val, err := f.getFilterValue(config)
-		if err != nil {
-			return fmt.Errorf("failed to get filter value: %w", err)
+		log.Infof("Programmed filter rule %d: %v", i, c.rules[i])
+	}
+	noMatch := ebpf.BpfFilterValueT{Action: c.noMatchAction}
+	if err := objects.FilterRules.Update(uint32(maxFilterRules), &noMatch, cilium.UpdateAny); err != nil {
+		return fmt.Errorf("failed to update filter rules map: %w", err)
+	}
+	for key, mask := range c.cidrs {
+		if err := objects.FilterMap.Update(key, mask, cilium.UpdateAny); err != nil {
+			return fmt.Errorf("failed to update filter map: %w", err)
 		}
-
-		if val.DoPeerCIDR_lookup == 1 {
-			peerVal := uint8(1)
-			peerKey, err := f.getPeerFilterKey(config)
-			if err != nil {
-				return fmt.Errorf("failed to get peer filter key: %w", err)
-			}
-			err = objects.PeerFilterMap.Update(peerKey, peerVal, cilium.UpdateAny)
-			if err != nil {
-				return fmt.Errorf("failed to update peer filter map: %w", err)
-			}
-			log.Infof("Programmed filter with PeerCIDR: %v", peerKey)
+	}
+	for key, mask := range c.peers {
+		if err := objects.PeerFilterMap.Update(key, mask, cilium.UpdateAny); err != nil {
+			return fmt.Errorf("failed to update peer filter map: %w", err)
 		}
-		err = objects.FilterMap.Update(key, val, cilium.UpdateAny)
-		if err != nil {
-			return fmt.Errorf("failed to update filter map: %w", err)
+	}
+	for key, mask := range c.dimensions {
+		if err := objects.FilterMasks.Update(key, mask, cilium.UpdateAny); err != nil {
+			return fmt.Errorf("failed to update filter masks map: %w", err)
 		}
+	}
+	if err := invalidateFilterVerdicts(objects.FilterGeneration, c); err != nil {
+		return err
+	}
+	log.Infof("Programmed %d filter rules with %d CIDRs, %d peer CIDRs and %d field masks",
+		len(c.rules), len(c.cidrs), len(c.peers), len(c.dimensions))
+	return nil
+}
 
-		log.Infof("Programmed filter with key: %v, value: %v", key, val)
+// invalidateFilterVerdicts bumps the generation of the filter rules, so that the eBPF code
+// evaluates them again instead of using its cached verdicts
+func invalidateFilterVerdicts(generations *cilium.Map, c *compiledFilter) error {
+	var config ebpf.BpfFilterCacheConfig
+	if err := generations.Lookup(uint32(0), &config); err != nil {
+		return fmt.Errorf("failed to read filter generation: %w", err)
+	}
+	config.Generation++
+	config.MatchTcpFlags, config.MatchDrops = 0, 0
+	if c.matchTCPFlags {
+		config.MatchTcpFlags = 1
+	}
+	if c.matchDrops {
+		config.MatchDrops = 1
+	}
+	if err := generations.Update(uint32(0), &config, cilium.UpdateAny); err != nil {
+		return fmt.Errorf("failed to update filter generation: %w", err)
 	}
 	return nil
 }
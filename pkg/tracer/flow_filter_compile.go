@@ -0,0 +1,273 @@
+package tracer
+
+import (
+	"fmt"
+	"math/bits"
+	"sort"
+
+	"github.com/netobserv/netobserv-ebpf-agent/pkg/ebpf"
+)
+
+// This file contains the compilation of the flow filter rules into the eBPF lookup tables. For
+// each field of a packet, a table returns the set of the rules matching the field value, as a
+// bitmask. The kernel intersects the masks of all the fields and picks the first remaining
+// rule, so the cost of filtering a packet doesn't depend on the number of rules.
+
+const (
+	// maximum number of flow filter rules, as MAX_FILTER_RULES in bpf/types.h
+	maxFilterRules = 256
+	// prefix length of the dimension in the filter_masks keys
+	dimensionPrefixLen = 8
+	// number of bits of the values in the filter_masks keys
+	dimensionValueBits = 16
+	// number of dimensions, as in the filter_dimension_t enum
+	filterDimensions = int(ebpf.BpfFilterDimensionTFILTER_DIM_DROPS) + 1
+)
+
+// filterMask is the set of the rules matching a field value: bit i is set for rule i
+type filterMask = ebpf.BpfFilterMask
+
+func maskSet(m *filterMask, rule int) {
+	m.Bits[rule/64] |= 1 << (rule % 64)
+}
+
+// valueRange is an inclusive range of the values of a dimension matched by a rule
+type valueRange struct {
+	lo, hi uint32
+}
+
+// compiledFilter holds the content of the eBPF filter maps
+type compiledFilter struct {
+	rules         []ebpf.BpfFilterValueT
+	noMatchAction ebpf.BpfFilterActionT
+	cidrs         map[ebpf.BpfFilterKeyT]filterMask
+	peers         map[ebpf.BpfFilterKeyT]filterMask
+	dimensions    map[ebpf.BpfFilterDimensionKeyT]filterMask
+	// whether some rules match the TCP flags or the drops, which are then part of the key of the
+	// filter verdicts cache
+	matchTCPFlags bool
+	matchDrops    bool
+}
+
+// compile converts the filter rules into the eBPF maps content. The rules are matched by
+// order of configuration: the first matching rule applies.
+func (f *Filter) compile() (*compiledFilter, error) {
+	if len(f.config) > maxFilterRules {
+		return nil, fmt.Errorf("too many flow filter rules: %d, the maximum is %d", len(f.config), maxFilterRules)
+	}
+	c := &compiledFilter{
+		noMatchAction: ebpf.BpfFilterActionTMAX_FILTER_ACTIONS,
+		cidrs:         map[ebpf.BpfFilterKeyT]filterMask{},
+		peers:         map[ebpf.BpfFilterKeyT]filterMask{},
+		dimensions:    map[ebpf.BpfFilterDimensionKeyT]filterMask{},
+	}
+	cidrs := make([]*ebpf.BpfFilterKeyT, len(f.config))
+	peers := make([]*ebpf.BpfFilterKeyT, len(f.config))
+	var dimensions [filterDimensions][][]valueRange
+	for dim := range dimensions {
+		dimensions[dim] = make([][]valueRange, len(f.config))
+	}
+	for i, config := range f.config {
+		key, err := f.getFilterKey(config)
+		if err != nil {
+			return nil, fmt.Errorf("failed to get filter key: %w", err)
+		}
+		val, err := f.getFilterValue(config)
+		if err != nil {
+			return nil, fmt.Errorf("failed to get filter value: %w", err)
+		}
+		cidrs[i] = &key
+		if val.DoPeerCIDR_lookup == 1 {
+			peerKey, err := f.getPeerFilterKey(config)
+			if err != nil {
+				return nil, fmt.Errorf("failed to get peer filter key: %w", err)
+			}
+			peers[i] = &peerKey
+		}
+		for dim, ranges := range ruleDimensions(&val) {
+			dimensions[dim][i] = ranges
+		}
+		c.rules = append(c.rules, val)
+		c.matchTCPFlags = c.matchTCPFlags || val.TcpFlags != 0
+		c.matchDrops = c.matchDrops || val.FilterDrops != 0
+		// Flows not matching any rule are only kept when all the rules reject flows
+		switch {
+		case val.Action == ebpf.BpfFilterActionTACCEPT:
+			c.noMatchAction = ebpf.BpfFilterActionTACCEPT
+		case val.Action == ebpf.BpfFilterActionTREJECT && c.noMatchAction != ebpf.BpfFilterActionTACCEPT:
+			c.noMatchAction = ebpf.BpfFilterActionTREJECT
+		}
+	}
+
+	// The most specific CIDR matched by the LPM trie must also hold the rules of the CIDRs
+	// containing it
+	for _, key := range cidrs {
+		c.cidrs[*key] = cidrMask(key, cidrs, filterMask{})
+	}
+	// The rules without peer CIDR match any peer, including the addresses out of all the peer
+	// CIDRs via a /0 entry
+	var anyPeer filterMask
+	for i := range peers {
+		if peers[i] == nil {
+			maskSet(&anyPeer, i)
+		}
+	}
+	c.peers[ebpf.BpfFilterKeyT{}] = cidrMask(&ebpf.BpfFilterKeyT{}, peers, anyPeer)
+	for _, key := range peers {
+		if key != nil {
+			c.peers[*key] = cidrMask(key, peers, anyPeer)
+		}
+	}
+
+	for dim, ranges := range dimensions {
+		compileDimension(c.dimensions, ebpf.BpfFilterDimensionT(dim), ranges)
+	}
+	return c, nil
+}
+
+// ruleDimensions returns the values of the fields matched by a rule. Fields without constraint
+// are omitted.
+func ruleDimensions(val *ebpf.BpfFilterValueT) map[ebpf.BpfFilterDimensionT][]valueRange {
+	dims := map[ebpf.BpfFilterDimensionT][]valueRange{}
+	exact := func(dim ebpf.BpfFilterDimensionT, v uint32) {
+		dims[dim] = []valueRange{{lo: v, hi: v}}
+	}
+	if val.Protocol != 0 {
+		exact(ebpf.BpfFilterDimensionTFILTER_DIM_PROTOCOL, uint32(val.Protocol))
+	}
+	if r := portRanges(val.SrcPortStart, val.SrcPortEnd, val.SrcPort1, val.SrcPort2); r != nil {
+		dims[ebpf.BpfFilterDimensionTFILTER_DIM_SRC_PORT] = r
+	}
+	if r := portRanges(val.DstPortStart, val.DstPortEnd, val.DstPort1, val.DstPort2); r != nil {
+		dims[ebpf.BpfFilterDimensionTFILTER_DIM_DST_PORT] = r
+	}
+	if r := portRanges(val.PortStart, val.PortEnd, val.Port1, val.Port2); r != nil {
+		dims[ebpf.BpfFilterDimensionTFILTER_DIM_PORT] = r
+	}
+	if val.TcpFlags != 0 {
+		exact(ebpf.BpfFilterDimensionTFILTER_DIM_TCP_FLAGS, uint32(val.TcpFlags))
+	}
+	if val.IcmpType != 0 {
+		exact(ebpf.BpfFilterDimensionTFILTER_DIM_ICMP_TYPE, uint32(val.IcmpType))
+		if val.IcmpCode != 0 {
+			exact(ebpf.BpfFilterDimensionTFILTER_DIM_ICMP_CODE, uint32(val.IcmpType)<<8|uint32(val.IcmpCode))
+		}
+	}
+	if val.Direction != ebpf.BpfDirectionTMAX_DIRECTION {
+		exact(ebpf.BpfFilterDimensionTFILTER_DIM_DIRECTION, uint32(val.Direction))
+	}
+	if val.FilterDrops != 0 {
+		exact(ebpf.BpfFilterDimensionTFILTER_DIM_DROPS, 1)
+	}
+	return dims
+}
+
+// portRanges returns the ports matched by a rule: either a range, or up to three single ports
+func portRanges(start, end, port1, port2 uint16) []valueRange {
+	if start != 0 && end != 0 {
+		return []valueRange{{lo: uint32(start), hi: uint32(end)}}
+	}
+	var ranges []valueRange
+	for _, p := range []uint16{start, port1, port2} {
+		if p != 0 {
+			ranges = append(ranges, valueRange{lo: uint32(p), hi: uint32(p)})
+		}
+	}
+	return ranges
+}
+
+// cidrMask adds to the base mask the rules of which the CIDR contains the key. The CIDRs are
+// indexed by rule, and nil for the rules without CIDR.
+func cidrMask(key *ebpf.BpfFilterKeyT, cidrs []*ebpf.BpfFilterKeyT, base filterMask) filterMask {
+	for i, cidr := range cidrs {
+		if cidr != nil && cidrContains(cidr, key) {
+			maskSet(&base, i)
+		}
+	}
+	return base
+}
+
+// cidrContains returns whether the prefix of the outer key contains the prefix of the inner key
+func cidrContains(outer, inner *ebpf.BpfFilterKeyT) bool {
+	if outer.PrefixLen > inner.PrefixLen {
+		return false
+	}
+	full := outer.PrefixLen / 8
+	for i := uint32(0); i < full; i++ {
+		if outer.IpData[i] != inner.IpData[i] {
+			return false
+		}
+	}
+	if rem := outer.PrefixLen % 8; rem != 0 {
+		m := byte(0xff) << (8 - rem)
+		return outer.IpData[full]&m == inner.IpData[full]&m
+	}
+	return true
+}
+
+// compileDimension adds to the entries the masks of the values of a dimension, given the value
+// ranges of each rule (nil for the rules matching any value). The values are split into
+// segments where the same rules match, each segment being stored as prefixes of the LPM trie.
+// The values out of any segment match the dimension entry itself.
+func compileDimension(entries map[ebpf.BpfFilterDimensionKeyT]filterMask, dim ebpf.BpfFilterDimensionT, rules [][]valueRange) {
+	var wildcard filterMask
+	bounds := []uint32{0, 1 << dimensionValueBits}
+	for i, ranges := range rules {
+		if ranges == nil {
+			maskSet(&wildcard, i)
+		}
+		for _, r := range ranges {
+			bounds = append(bounds, r.lo, r.hi+1)
+		}
+	}
+	entries[ebpf.BpfFilterDimensionKeyT{PrefixLen: dimensionPrefixLen, Dimension: uint8(dim)}] = wildcard
+	sort.Slice(bounds, func(i, j int) bool { return bounds[i] < bounds[j] })
+	for b := 0; b < len(bounds)-1; b++ {
+		if bounds[b] == bounds[b+1] {
+			// duplicated bound
+			continue
+		}
+		lo, hi := bounds[b], bounds[b+1]-1
+		mask := wildcard
+		for i, ranges := range rules {
+			for _, r := range ranges {
+				if r.lo <= lo && lo <= r.hi {
+					maskSet(&mask, i)
+				}
+			}
+		}
+		if mask == wildcard {
+			continue
+		}
+		for _, p := range valuePrefixes(lo, hi) {
+			entries[ebpf.BpfFilterDimensionKeyT{
+				PrefixLen: dimensionPrefixLen + p.len,
+				Dimension: uint8(dim),
+				Value:     [2]uint8{uint8(p.value >> 8), uint8(p.value)},
+			}] = mask
+		}
+	}
+}
+
+type valuePrefix struct {
+	value uint32
+	len   uint32
+}
+
+// valuePrefixes splits an inclusive range of 16-bit values into the minimal set of prefixes
+func valuePrefixes(lo, hi uint32) []valuePrefix {
+	var prefixes []valuePrefix
+	for lo <= hi {
+		// largest block aligned on lo and not exceeding hi
+		size := uint32(dimensionValueBits)
+		if lo != 0 {
+			size = uint32(bits.TrailingZeros32(lo))
+		}
+		for size > 0 && lo+(1<<size)-1 > hi {
+			size--
+		}
+		prefixes = append(prefixes, valuePrefix{value: lo, len: dimensionValueBits - size})
+		lo += 1 << size
+	}
+	return prefixes
+}
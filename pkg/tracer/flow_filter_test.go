@@ -274,3 +274,168 @@ func TestBuildFilterKey(t *testing.T) {
 		})
 	}
 }
+
+func TestValuePrefixes(t *testing.T) {
+	assert.Equal(t, []valuePrefix{{value: 80, len: 16}}, valuePrefixes(80, 80))
+	assert.Equal(t, []valuePrefix{{value: 0, len: 0}}, valuePrefixes(0, 65535))
+	// 80-90: 80-87, 88-89, 90
+	assert.Equal(t, []valuePrefix{{value: 80, len: 13}, {value: 88, len: 15}, {value: 90, len: 16}}, valuePrefixes(80, 90))
+	assert.Equal(t, []valuePrefix{{value: 1, len: 16}, {value: 2, len: 15}, {value: 4, len: 14}}, valuePrefixes(1, 7))
+}
+
+// lookupCompiled mimics the lookup of the compiled filter by the kernel in is_flow_filtered, and
+// returns the index of the matching rule, or -1
+func lookupCompiled(c *compiledFilter, src, dst string, proto uint8, srcPort, dstPort uint16, icmpType uint8, dir ebpf.BpfDirectionT) int {
+	f := Filter{}
+	lpm := func(entries map[ebpf.BpfFilterKeyT]filterMask, ip string) (filterMask, bool) {
+		addr, _ := f.buildFilterKey("", ip)
+		var best *ebpf.BpfFilterKeyT
+		for key := range entries {
+			if cidrContains(&key, &addr) && (best == nil || key.PrefixLen > best.PrefixLen) {
+				best = &key
+			}
+		}
+		if best == nil {
+			return filterMask{}, false
+		}
+		return entries[*best], true
+	}
+	side := func(ip, peer string) filterMask {
+		cidr, ok := lpm(c.cidrs, ip)
+		if !ok {
+			return filterMask{}
+		}
+		peerMask, _ := lpm(c.peers, peer)
+		for i := range cidr.Bits {
+			cidr.Bits[i] &= peerMask.Bits[i]
+		}
+		return cidr
+	}
+	dimension := func(dim ebpf.BpfFilterDimensionT, value uint16) filterMask {
+		for plen := uint32(dimensionValueBits); ; plen-- {
+			v := uint32(value) &^ (1<<(dimensionValueBits-plen) - 1)
+			key := ebpf.BpfFilterDimensionKeyT{PrefixLen: dimensionPrefixLen + plen, Dimension: uint8(dim), Value: [2]uint8{uint8(v >> 8), uint8(v)}}
+			if mask, ok := c.dimensions[key]; ok {
+				return mask
+			}
+			if plen == 0 {
+				return filterMask{}
+			}
+		}
+	}
+	candidates := side(src, dst)
+	dstSide := side(dst, src)
+	masks := []filterMask{dstSide, dimension(ebpf.BpfFilterDimensionTFILTER_DIM_PROTOCOL, uint16(proto))}
+	switch proto {
+	case syscall.IPPROTO_TCP, syscall.IPPROTO_UDP:
+		anyPort := dimension(ebpf.BpfFilterDimensionTFILTER_DIM_PORT, srcPort)
+		dstAnyPort := dimension(ebpf.BpfFilterDimensionTFILTER_DIM_PORT, dstPort)
+		for i := range anyPort.Bits {
+			anyPort.Bits[i] |= dstAnyPort.Bits[i]
+		}
+		masks = append(masks,
+			dimension(ebpf.BpfFilterDimensionTFILTER_DIM_SRC_PORT, srcPort),
+			dimension(ebpf.BpfFilterDimensionTFILTER_DIM_DST_PORT, dstPort),
+			anyPort)
+	case syscall.IPPROTO_ICMP:
+		masks = append(masks, dimension(ebpf.BpfFilterDimensionTFILTER_DIM_ICMP_TYPE, uint16(icmpType)),
+			dimension(ebpf.BpfFilterDimensionTFILTER_DIM_ICMP_CODE, uint16(icmpType)<<8))
+	}
+	masks = append(masks,
+		dimension(ebpf.BpfFilterDimensionTFILTER_DIM_DIRECTION, uint16(dir)),
+		dimension(ebpf.BpfFilterDimensionTFILTER_DIM_DROPS, 0))
+	for i := range candidates.Bits {
+		candidates.Bits[i] |= dstSide.Bits[i]
+		for _, m := range masks[1:] {
+			candidates.Bits[i] &= m.Bits[i]
+		}
+	}
+	for i, word := range candidates.Bits {
+		if word != 0 {
+			for r := 0; r < 64; r++ {
+				if word&(1<<r) != 0 {
+					return i*64 + r
+				}
+			}
+		}
+	}
+	return -1
+}
+
+func TestFilterCompile(t *testing.T) {
+	f := NewFilter([]*FilterConfig{
+		{FilterIPCIDR: "10.0.0.0/8", FilterProtocol: "TCP", FilterDestinationPort: intstr.FromString("80-90"), FilterAction: "Accept"},
+		{FilterIPCIDR: "10.1.0.0/16", FilterAction: "Reject"},
+		{FilterProtocol: "UDP", FilterPort: intstr.FromInt32(53), FilterPeerCIDR: "192.168.0.0/16", FilterAction: "Accept"},
+		{FilterProtocol: "ICMP", FilterIcmpType: 8, FilterDirection: "Ingress", FilterAction: "Accept"},
+	})
+	c, err := f.compile()
+	require.NoError(t, err)
+	require.Len(t, c.rules, 4)
+	// some rules accept flows: the flows not matching any rule are not kept
+	assert.Equal(t, ebpf.BpfFilterActionTACCEPT, c.noMatchAction)
+	// 10.0.0.0/8 also holds the rules of 0.0.0.0/0, 10.1.0.0/16 holds all the rules
+	assert.Equal(t, uint64(0b1101), c.cidrs[ebpf.BpfFilterKeyT{PrefixLen: 8, IpData: [16]byte{10}}].Bits[0])
+	assert.Equal(t, uint64(0b1111), c.cidrs[ebpf.BpfFilterKeyT{PrefixLen: 16, IpData: [16]byte{10, 1}}].Bits[0])
+	// the verdicts of the flows don't depend on the TCP flags or the drops
+	assert.False(t, c.matchTCPFlags)
+	assert.False(t, c.matchDrops)
+	// the rules without peer match any peer
+	assert.Equal(t, uint64(0b1011), c.peers[ebpf.BpfFilterKeyT{}].Bits[0])
+	assert.Equal(t, uint64(0b1111), c.peers[ebpf.BpfFilterKeyT{PrefixLen: 16, IpData: [16]byte{192, 168}}].Bits[0])
+
+	tcp, udp, icmp := uint8(syscall.IPPROTO_TCP), uint8(syscall.IPPROTO_UDP), uint8(syscall.IPPROTO_ICMP)
+	in, out := ebpf.BpfDirectionTINGRESS, ebpf.BpfDirectionTEGRESS
+	// the first matching rule applies
+	assert.Equal(t, 0, lookupCompiled(c, "10.1.2.3", "1.1.1.1", tcp, 1234, 85, 0, in))
+	assert.Equal(t, 1, lookupCompiled(c, "10.1.2.3", "1.1.1.1", tcp, 1234, 22, 0, in))
+	assert.Equal(t, 1, lookupCompiled(c, "1.1.1.1", "10.1.2.3", tcp, 85, 1234, 0, in))
+	assert.Equal(t, 0, lookupCompiled(c, "10.2.0.1", "1.1.1.1", tcp, 1234, 90, 0, in))
+	assert.Equal(t, -1, lookupCompiled(c, "10.2.0.1", "1.1.1.1", tcp, 1234, 91, 0, in))
+	// the peer CIDR is matched against the other address
+	assert.Equal(t, 2, lookupCompiled(c, "192.168.1.1", "8.8.8.8", udp, 1234, 53, 0, out))
+	assert.Equal(t, 2, lookupCompiled(c, "8.8.8.8", "192.168.1.1", udp, 53, 1234, 0, out))
+	assert.Equal(t, -1, lookupCompiled(c, "172.16.0.1", "8.8.8.8", udp, 53, 1234, 0, out))
+	assert.Equal(t, 3, lookupCompiled(c, "1.2.3.4", "5.6.7.8", icmp, 0, 0, 8, in))
+	assert.Equal(t, -1, lookupCompiled(c, "1.2.3.4", "5.6.7.8", icmp, 0, 0, 8, out))
+	assert.Equal(t, -1, lookupCompiled(c, "1.2.3.4", "5.6.7.8", icmp, 0, 0, 0, in))
+}
+
+func TestFilterCompile_ManyRules(t *testing.T) {
+	var rules []*FilterConfig
+	for i := 0; i < maxFilterRules; i++ {
+		rules = append(rules, &FilterConfig{
+			FilterIPCIDR:          fmt.Sprintf("10.%d.0.0/16", i),
+			FilterProtocol:        "TCP",
+			FilterDestinationPort: intstr.FromInt32(int32(1000 + i)),
+			FilterAction:          "Reject",
+		})
+	}
+	c, err := NewFilter(rules).compile()
+	require.NoError(t, err)
+	// all the rules reject flows: the flows not matching any rule are kept
+	assert.Equal(t, ebpf.BpfFilterActionTREJECT, c.noMatchAction)
+	tcp := uint8(syscall.IPPROTO_TCP)
+	assert.Equal(t, 200, lookupCompiled(c, "10.200.0.1", "1.1.1.1", tcp, 5000, 1200, 0, ebpf.BpfDirectionTINGRESS))
+	assert.Equal(t, 255, lookupCompiled(c, "10.255.0.1", "1.1.1.1", tcp, 5000, 1255, 0, ebpf.BpfDirectionTINGRESS))
+	assert.Equal(t, -1, lookupCompiled(c, "10.200.0.1", "1.1.1.1", tcp, 5000, 1201, 0, ebpf.BpfDirectionTINGRESS))
+
+	_, err = NewFilter(append(rules, &FilterConfig{})).compile()
+	require.Error(t, err)
+}
+
+func TestFilterCompile_VerdictCacheKey(t *testing.T) {
+	c, err := NewFilter([]*FilterConfig{
+		{FilterIPCIDR: "0.0.0.0/0", FilterProtocol: "TCP", FilterTCPFlags: "SYN", FilterAction: "Accept"},
+	}).compile()
+	require.NoError(t, err)
+	assert.True(t, c.matchTCPFlags)
+	assert.False(t, c.matchDrops)
+
+	c, err = NewFilter([]*FilterConfig{
+		{FilterIPCIDR: "0.0.0.0/0", FilterDrops: true, FilterAction: "Accept"},
+	}).compile()
+	require.NoError(t, err)
+	assert.False(t, c.matchTCPFlags)
+	assert.True(t, c.matchDrops)
+}
@@ -6,8 +6,11 @@ import (
 	"io/fs"
 	"os"
 	"path"
+	"runtime"
 	"strings"
+	"sync"
 	"time"
+	"unsafe"
 
 	"github.com/netobserv/netobserv-ebpf-agent/pkg/ebpf"
 	"github.com/netobserv/netobserv-ebpf-agent/pkg/ifaces"
@@ -33,14 +36,28 @@ import (
 const (
 	qdiscType = "clsact"
 	// ebpf map names as defined in bpf/maps_definition.h
-	aggregatedFlowsMap    = "aggregated_flows"
-	additionalFlowMetrics = "additional_flow_metrics"
-	directFlowsMap        = "direct_flows"
-	dnsLatencyMap         = "dns_flows"
-	filterMap             = "filter_map"
-	peerFilterMap         = "peer_filter_map"
-	globalCountersMap     = "global_counters"
-	pcaRecordsMap         = "packet_record"
+	aggregatedFlowsMap       = "aggregated_flows"
+	aggregatedFlowsPerCPUMap = "aggregated_flows_percpu"
+	aggregatedFlowsV4Map     = "aggregated_flows_v4"
+	additionalFlowMetrics    = "additional_flow_metrics"
+	directFlowsMap           = "direct_flows"
+	dnsLatencyMap            = "dns_flows"
+	filterMap                = "filter_map"
+	peerFilterMap            = "peer_filter_map"
+	filterMasksMap           = "filter_masks"
+	filterRulesMap           = "filter_rules"
+	filterGenerationMap      = "filter_generation"
+	filterVerdictsMap        = "filter_verdicts"
+	globalCountersMap        = "global_counters"
+	pcaRecordsMap            = "packet_record"
+	pcaRingbufMap            = "packet_ringbuf"
+	pcaScratchMap            = "pca_scratch"
+	expiryTimerMap           = "expiry_timer"
+	flowsSketchMap           = "flows_sketch"
+	heavyHittersMap          = "heavy_hitters"
+	flowLatenciesMap         = "flow_latencies"
+	rttSamplesMap            = "rtt_samples"
+	rttSkSamplesMap          = "rtt_sk_samples"
 	// constants defined in flows.c as "volatile const"
 	constSampling                       = "sampling"
 	constHasFilterSampling              = "has_filter_sampling"
@@ -53,8 +70,23 @@ const (
 	constEnableNetworkEventsMonitoring  = "enable_network_events_monitoring"
 	constNetworkEventsMonitoringGroupID = "network_events_monitoring_groupid"
 	constEnablePktTranslation           = "enable_pkt_translation_tracking"
+	constEnablePerCPUAggregation        = "enable_percpu_aggregation"
+	constEnableFlowsExpiry              = "enable_flows_expiry"
+	constFlowsExpiryPeriod              = "flows_expiry_period"
+	constFlowsIdleTimeout               = "flows_idle_timeout"
+	constDNSFlowsTimeout                = "dns_flows_timeout"
+	constTrackFlowsInserts              = "track_flows_inserts"
+	constEnableCompactIPv4Keys          = "enable_compact_ipv4_keys"
+	constEnableFlowsSketch              = "enable_flows_sketch"
+	constFlowsSketchSlots               = "flows_sketch_slots"
+	constEnableAdaptiveSampling         = "enable_adaptive_sampling"
+	constRingbufWakeupThreshold         = "ringbuf_wakeup_threshold"
+	constEnableFlowLatencies            = "enable_flow_latencies"
+	constRTTSamplingInterval            = "rtt_sampling_interval"
 	pktDropHook                         = "kfree_skb"
 	constPcaEnable                      = "enable_pca"
+	constPcaRingbuf                     = "enable_pca_ringbuf"
+	constPcaSnaplen                     = "pca_snaplen"
 	tcEgressFilterName                  = "tc/tc_egress_flow_parse"
 	tcIngressFilterName                 = "tc/tc_ingress_flow_parse"
 	tcpFentryHook                       = "tcp_rcv_fentry"
@@ -62,6 +94,12 @@ const (
 	rhNetworkEventsMonitoringHook       = "rh_psample_sample_packet"
 	networkEventsMonitoringHook         = "psample_sample_packet"
 	defaultNetworkEventsGroupID         = 10
+
+	// size of the header preceding each record in the ring buffer
+	ringbufRecordHeaderSize = 8
+	// maximum number of bytes of a packet captured in the ring buffer mode, as PCA_MAX_SNAPLEN
+	// in bpf/types.h
+	pcaMaxSnaplen = 16384
 )
 
 var log = logrus.WithField("component", "ebpf.FlowFetcher")
@@ -72,24 +110,55 @@ var plog = logrus.WithField("component", "ebpf.PacketFetcher")
 // and to flows that are forwarded by the kernel via ringbuffer because could not be aggregated
 // in the map
 type FlowFetcher struct {
-	objects                     *ebpf.BpfObjects
-	qdiscs                      map[ifaces.Interface]*netlink.GenericQdisc
-	egressFilters               map[ifaces.Interface]*netlink.BpfFilter
-	ingressFilters              map[ifaces.Interface]*netlink.BpfFilter
-	ringbufReader               *ringbuf.Reader
-	cacheMaxSize                int
-	enableIngress               bool
-	enableEgress                bool
-	pktDropsTracePoint          link.Link
-	rttFentryLink               link.Link
-	rttKprobeLink               link.Link
-	egressTCXLink               map[ifaces.Interface]link.Link
-	ingressTCXLink              map[ifaces.Interface]link.Link
+	objects            *ebpf.BpfObjects
+	qdiscs             map[ifaces.Interface]*netlink.GenericQdisc
+	egressFilters      map[ifaces.Interface]*netlink.BpfFilter
+	ingressFilters     map[ifaces.Interface]*netlink.BpfFilter
+	ringbufReader      *ringbuf.Reader
+	ringbufRecord      ringbuf.Record
+	ringbufFlushPeriod time.Duration
+	cacheMaxSize       int
+	enableIngress      bool
+	enableEgress       bool
+	pktDropsTracePoint link.Link
+	rttFentryLink      link.Link
+	rttKprobeLink      link.Link
+	egressTCXLink      map[ifaces.Interface]link.Link
+	ingressTCXLink     map[ifaces.Interface]link.Link
+	ingressXDPLink     map[ifaces.Interface]link.Link
+	// pins of the TCX links attached or adopted in hot restart mode
+	tcxLinkPins map[string]struct{}
+	// linksMutex protects the links, filters and qdiscs maps from the concurrent attachments
+	linksMutex                  sync.Mutex
+	xdpIngress                  bool
+	xdpFlags                    link.XDPAttachFlags
 	networkEventsMonitoringLink link.Link
 	nfNatManIPLink              link.Link
 	lookupAndDeleteSupported    bool
-	useEbpfManager              bool
-	pinDir                      string
+	batchLookupSupported        bool
+	batch                       *flowsBatch
+	expiredWalk                 expiredFlowsWalk
+	flows                       *evictedFlows
+	perCPUAggregation           bool
+	compactIPv4Keys             bool
+	sketch                      *flowsSketch
+	sampling                    *adaptiveSampling
+	flowsExpiry                 bool
+	dnsQueriesLRU               bool
+	trackLRUEvictions           bool
+	flowsInserted               uint64
+	flowsDrained                uint64
+	flowsDropped                uint64
+	// totals of the global counters at the previous read, and the buffers to read them. They are
+	// seeded at startup when the counters may outlive the agent (i.e. bpfman pinned maps).
+	globalCounters      [ebpf.BpfGlobalCountersKeyTMAX_COUNTERS]uint64
+	globalCountersBatch *perCPUBatch[uint32, uint64]
+	// nil unless the eBPF programs runtime statistics are enabled
+	bpfStats       *bpfStats
+	useEbpfManager bool
+	pinDir         string
+	// hotRestart keeps the flows maps and the TCX links pinned on Close
+	hotRestart bool
 }
 
 type FlowFetcherConfig struct {
@@ -101,12 +170,32 @@ type FlowFetcherConfig struct {
 	EnablePktDrops                 bool
 	EnableDNSTracker               bool
 	DNSTrackerPort                 uint16
+	DNSTrackingLRUSize             int
 	EnableRTT                      bool
+	RTTSamplingInterval            time.Duration
 	EnableNetworkEventsMonitoring  bool
 	NetworkEventsMonitoringGroupID int
 	EnableFlowFilter               bool
 	EnablePCA                      bool
+	PCARingbuf                     bool
+	PCASnaplen                     int
 	EnablePktTranslation           bool
+	EnablePerCPUAggregation        bool
+	EnableFlowsExpiry              bool
+	FlowsIdleTimeout               time.Duration
+	DNSFlowsTimeout                time.Duration
+	PreallocateMaps                bool
+	LRUMaps                        bool
+	XDPIngress                     bool
+	XDPGenericMode                 bool
+	EnableCompactIPv4Keys          bool
+	FlowsSketchSlots               int
+	AdaptiveSamplingMax            int
+	RingbufWakeupBatch             int
+	RingbufFlushPeriod             time.Duration
+	EnableBpfStats                 bool
+	HotRestart                     bool
+	HotRestartPinPath              string
 	UseEbpfManager                 bool
 	BpfManBpfFSPath                string
 	FilterConfig                   []*FilterConfig
@@ -141,21 +230,46 @@ func NewFlowFetcher(cfg *FlowFetcherConfig) (*FlowFetcher, error) {
 
 		// Resize maps according to user-provided configuration
 		spec.Maps[aggregatedFlowsMap].MaxEntries = uint32(cfg.CacheMaxSize)
+		spec.Maps[aggregatedFlowsPerCPUMap].MaxEntries = uint32(cfg.CacheMaxSize)
+		spec.Maps[aggregatedFlowsV4Map].MaxEntries = uint32(cfg.CacheMaxSize)
 		spec.Maps[additionalFlowMetrics].MaxEntries = uint32(cfg.CacheMaxSize)
-
-		// remove pinning from all maps
+		spec.Maps[filterVerdictsMap].MaxEntries = uint32(cfg.CacheMaxSize)
+
+		// remove pinning from all maps, except the flows maps in hot restart mode
+		hotRestart := hotRestartEnabled(cfg)
+		if hotRestart {
+			pinDir = cfg.HotRestartPinPath
+			if err := prepareHotRestartPins(pinDir); err != nil {
+				return nil, err
+			}
+		}
 		for _, m := range []string{
 			aggregatedFlowsMap,
+			aggregatedFlowsPerCPUMap,
+			aggregatedFlowsV4Map,
 			additionalFlowMetrics,
 			directFlowsMap,
 			dnsLatencyMap,
 			filterMap,
 			peerFilterMap,
+			filterMasksMap,
+			filterRulesMap,
+			filterGenerationMap,
 			globalCountersMap,
 			pcaRecordsMap} {
-			spec.Maps[m].Pinning = 0
+			if !hotRestart || !isHotRestartMap(m) {
+				spec.Maps[m].Pinning = 0
+			}
 		}
 
+		configureMapsAllocation(spec, cfg)
+		configureDNSQueriesMap(spec, cfg)
+
+		if cfg.EnableFlowsExpiry && kernel.IsKernelOlderThan("5.14.0") {
+			// BPF timers and bpf_for_each_map_elem are not available
+			log.Warn("kernel older than 5.14.0 detected: flows expiry in the kernel is disabled")
+			cfg.EnableFlowsExpiry = false
+		}
 		if err := configureFlowSpecVariables(spec, cfg, filter); err != nil {
 			return nil, fmt.Errorf("loading flow spec variables: %w", err)
 		}
@@ -169,20 +283,28 @@ func NewFlowFetcher(cfg *FlowFetcherConfig) (*FlowFetcher, error) {
 			log.Infof("kernel is realtime and older than 5.14.0-292 not all hooks are supported")
 		}
 		supportNetworkEvents := !kernel.IsKernelOlderThan("5.14.0-427")
-		objects, err = kernelSpecificLoadAndAssign(oldKernel, rtOldKernel, supportNetworkEvents, spec, pinDir)
+		// Always set pcaRecordsMap to the minimum in FlowFetcher - PCA and Flow Fetcher are mutually exclusive.
+		// The PCA programs are not loaded.
+		spec.Maps[pcaRecordsMap].MaxEntries = 1
+		spec.Maps[pcaRingbufMap].MaxEntries = uint32(os.Getpagesize())
+		shrinkMapValue(spec.Maps[pcaScratchMap])
+		var mapsPinDir string
+		if hotRestart {
+			if mapsPinDir, err = hotRestartMapsPinDir(pinDir, spec); err != nil {
+				return nil, err
+			}
+		}
+		objects, err = kernelSpecificLoadAndAssign(oldKernel, rtOldKernel, supportNetworkEvents, spec, mapsPinDir, cfg)
+		if hotRestart && errors.Is(err, cilium.ErrMapIncompatible) {
+			// e.g. the configuration of the previous agent was different
+			log.WithError(err).Warn("the pinned flows maps can't be adopted. Creating new maps")
+			removeHotRestartMapsPins(mapsPinDir)
+			objects, err = kernelSpecificLoadAndAssign(oldKernel, rtOldKernel, supportNetworkEvents, spec, mapsPinDir, cfg)
+		}
 		if err != nil {
 			return nil, err
 		}
 
-		log.Debugf("Deleting specs for PCA")
-		// Deleting specs for PCA
-		// Always set pcaRecordsMap to the minimum in FlowFetcher - PCA and Flow Fetcher are mutually exclusive.
-		spec.Maps[pcaRecordsMap].MaxEntries = 1
-
-		objects.TcxEgressPcaParse = nil
-		objects.TcIngressPcaParse = nil
-		delete(spec.Programs, constPcaEnable)
-
 		if cfg.EnablePktDrops && !oldKernel && !rtOldKernel {
 			pktDropsLink, err = link.Tracepoint("skb", pktDropHook, objects.KfreeSkb, nil)
 			if err != nil {
@@ -257,6 +379,14 @@ func NewFlowFetcher(cfg *FlowFetcherConfig) (*FlowFetcher, error) {
 		if err != nil {
 			return nil, fmt.Errorf("failed to load %s: %w", mPath, err)
 		}
+		if cfg.EnablePerCPUAggregation {
+			log.Info("BPFManager mode: loading per-CPU aggregated flows pinned maps")
+			mPath = path.Join(pinDir, aggregatedFlowsPerCPUMap)
+			objects.BpfMaps.AggregatedFlowsPercpu, err = cilium.LoadPinnedMap(mPath, opts)
+			if err != nil {
+				return nil, fmt.Errorf("failed to load %s: %w", mPath, err)
+			}
+		}
 		log.Info("BPFManager mode: loading additional flow metrics pinned maps")
 		mPath = path.Join(pinDir, additionalFlowMetrics)
 		objects.BpfMaps.AdditionalFlowMetrics, err = cilium.LoadPinnedMap(mPath, opts)
@@ -287,6 +417,21 @@ func NewFlowFetcher(cfg *FlowFetcherConfig) (*FlowFetcher, error) {
 		if err != nil {
 			return nil, fmt.Errorf("failed to load %s: %w", mPath, err)
 		}
+		mPath = path.Join(pinDir, filterMasksMap)
+		objects.BpfMaps.FilterMasks, err = cilium.LoadPinnedMap(mPath, opts)
+		if err != nil {
+			return nil, fmt.Errorf("failed to load %s: %w", mPath, err)
+		}
+		mPath = path.Join(pinDir, filterRulesMap)
+		objects.BpfMaps.FilterRules, err = cilium.LoadPinnedMap(mPath, opts)
+		if err != nil {
+			return nil, fmt.Errorf("failed to load %s: %w", mPath, err)
+		}
+		mPath = path.Join(pinDir, filterGenerationMap)
+		objects.BpfMaps.FilterGeneration, err = cilium.LoadPinnedMap(mPath, opts)
+		if err != nil {
+			return nil, fmt.Errorf("failed to load %s: %w", mPath, err)
+		}
 		log.Infof("BPFManager mode: loading global counters pinned maps")
 		mPath = path.Join(pinDir, globalCountersMap)
 		objects.BpfMaps.GlobalCounters, err = cilium.LoadPinnedMap(mPath, opts)
@@ -312,13 +457,34 @@ func NewFlowFetcher(cfg *FlowFetcherConfig) (*FlowFetcher, error) {
 		return nil, fmt.Errorf("accessing to ringbuffer: %w", err)
 	}
 
-	return &FlowFetcher{
+	var sampling *adaptiveSampling
+	if adaptiveSamplingEnabled(cfg) {
+		sampling = newAdaptiveSampling(cfg.Sampling, cfg.AdaptiveSamplingMax)
+	}
+
+	var sketch *flowsSketch
+	if flowsSketchEnabled(cfg) {
+		if sketch, err = newFlowsSketch(uint32(cfg.FlowsSketchSlots)); err != nil {
+			return nil, fmt.Errorf("creating flows sketch buffers: %w", err)
+		}
+	}
+
+	var stats *bpfStats
+	if cfg.EnableBpfStats {
+		if stats, err = newBpfStats(); err != nil {
+			return nil, fmt.Errorf("enabling BPF stats: %w", err)
+		}
+	}
+
+	fetcher := &FlowFetcher{
 		objects:                     &objects,
 		ringbufReader:               flows,
+		ringbufFlushPeriod:          ringbufFlushPeriod(cfg),
 		egressFilters:               map[ifaces.Interface]*netlink.BpfFilter{},
 		ingressFilters:              map[ifaces.Interface]*netlink.BpfFilter{},
 		qdiscs:                      map[ifaces.Interface]*netlink.GenericQdisc{},
 		cacheMaxSize:                cfg.CacheMaxSize,
+		flows:                       newEvictedFlows(cfg.CacheMaxSize),
 		enableIngress:               cfg.EnableIngress,
 		enableEgress:                cfg.EnableEgress,
 		pktDropsTracePoint:          pktDropsLink,
@@ -327,37 +493,42 @@ func NewFlowFetcher(cfg *FlowFetcherConfig) (*FlowFetcher, error) {
 		nfNatManIPLink:              nfNatManIPLink,
 		egressTCXLink:               map[ifaces.Interface]link.Link{},
 		ingressTCXLink:              map[ifaces.Interface]link.Link{},
+		ingressXDPLink:              map[ifaces.Interface]link.Link{},
+		tcxLinkPins:                 map[string]struct{}{},
+		xdpIngress:                  cfg.XDPIngress && !cfg.UseEbpfManager,
+		xdpFlags:                    xdpAttachFlags(cfg),
 		networkEventsMonitoringLink: networkEventsMonitoringLink,
 		lookupAndDeleteSupported:    true, // this will be turned off later if found to be not supported
+		batchLookupSupported:        true, // this will be turned off later if found to be not supported
+		perCPUAggregation:           cfg.EnablePerCPUAggregation,
+		compactIPv4Keys:             compactIPv4Keys(cfg),
+		sketch:                      sketch,
+		sampling:                    sampling,
+		flowsExpiry:                 cfg.EnableFlowsExpiry && !cfg.UseEbpfManager,
+		dnsQueriesLRU:               dnsQueriesLRU(cfg),
+		trackLRUEvictions:           trackLRUEvictions(cfg),
+		bpfStats:                    stats,
 		useEbpfManager:              cfg.UseEbpfManager,
 		pinDir:                      pinDir,
-	}, nil
+		hotRestart:                  hotRestartEnabled(cfg),
+	}
+	if cfg.UseEbpfManager {
+		// the pinned counters were increased before the agent started
+		fetcher.seedGlobalCounters()
+	}
+	return fetcher, nil
 }
 
+// AttachTCX attaches the flows programs to the TCX hooks of the interface, from its network
+// namespace. It can be invoked concurrently for different interfaces.
 func (m *FlowFetcher) AttachTCX(iface ifaces.Interface) error {
-	ilog := log.WithField("iface", iface)
-	if iface.NetNS != netns.None() {
-		originalNs, err := netns.Get()
-		if err != nil {
-			return fmt.Errorf("failed to get current netns: %w", err)
-		}
-		defer func() {
-			if err := netns.Set(originalNs); err != nil {
-				ilog.WithError(err).Error("failed to set netns back")
-			}
-			originalNs.Close()
-		}()
-		if err := unix.Setns(int(iface.NetNS), unix.CLONE_NEWNET); err != nil {
-			return fmt.Errorf("failed to setns to %s: %w", iface.NetNS, err)
-		}
-	}
+	return inNetNS(iface, func() error { return m.attachTCX(iface) })
+}
 
+func (m *FlowFetcher) attachTCX(iface ifaces.Interface) error {
+	ilog := log.WithField("iface", iface)
 	if m.enableEgress {
-		egrLink, err := link.AttachTCX(link.TCXOptions{
-			Program:   m.objects.BpfPrograms.TcxEgressFlowParse,
-			Attach:    cilium.AttachTCXEgress,
-			Interface: iface.Index,
-		})
+		egrLink, err := m.attachTCXHook(iface, tcxEgress, m.objects.BpfPrograms.TcxEgressFlowParse, cilium.AttachTCXEgress)
 		if err != nil {
 			if errors.Is(err, fs.ErrExist) {
 				// The interface already has a TCX egress hook
@@ -383,16 +554,18 @@ func (m *FlowFetcher) AttachTCX(iface ifaces.Interface) error {
 				return fmt.Errorf("failed to attach TCX egress: %w", err)
 			}
 		}
+		m.linksMutex.Lock()
 		m.egressTCXLink[iface] = egrLink
+		m.linksMutex.Unlock()
 		ilog.WithField("interface", iface.Name).Debugf("successfully attach egressTCX hook link: %v", egrLink)
 	}
 
+	if m.enableIngress && m.attachXDP(iface) {
+		return nil
+	}
+
 	if m.enableIngress {
-		ingLink, err := link.AttachTCX(link.TCXOptions{
-			Program:   m.objects.BpfPrograms.TcxIngressFlowParse,
-			Attach:    cilium.AttachTCXIngress,
-			Interface: iface.Index,
-		})
+		ingLink, err := m.attachTCXHook(iface, tcxIngress, m.objects.BpfPrograms.TcxIngressFlowParse, cilium.AttachTCXIngress)
 		if err != nil {
 			if errors.Is(err, fs.ErrExist) {
 				// The interface already has a TCX ingress hook
@@ -418,49 +591,64 @@ func (m *FlowFetcher) AttachTCX(iface ifaces.Interface) error {
 				return fmt.Errorf("failed to attach TCX ingress: %w", err)
 			}
 		}
+		m.linksMutex.Lock()
 		m.ingressTCXLink[iface] = ingLink
+		m.linksMutex.Unlock()
 		ilog.WithField("interface", iface.Name).Debugf("successfully attach ingressTCX hook link: %v", ingLink)
 	}
 
 	return nil
 }
 
+// attachTCXHook attaches the program to a TCX hook of the interface, unless it can adopt the link
+// pinned by a previous agent in hot restart mode
+func (m *FlowFetcher) attachTCXHook(iface ifaces.Interface, direction string, prog *cilium.Program, attach cilium.AttachType) (link.Link, error) {
+	if l := m.adoptTCXLink(iface, direction, prog); l != nil {
+		return l, nil
+	}
+	l, err := link.AttachTCX(link.TCXOptions{
+		Program:   prog,
+		Attach:    attach,
+		Interface: iface.Index,
+	})
+	if err != nil {
+		return nil, err
+	}
+	m.pinTCXLink(iface, direction, l)
+	return l, nil
+}
+
+// DetachTCX detaches the flows programs from the TCX hooks of the interface, from its network
+// namespace
 func (m *FlowFetcher) DetachTCX(iface ifaces.Interface) error {
+	return inNetNS(iface, func() error { return m.detachTCX(iface) })
+}
+
+func (m *FlowFetcher) detachTCX(iface ifaces.Interface) error {
 	ilog := log.WithField("iface", iface)
-	if iface.NetNS != netns.None() {
-		originalNs, err := netns.Get()
-		if err != nil {
-			return fmt.Errorf("failed to get current netns: %w", err)
-		}
-		defer func() {
-			if err := netns.Set(originalNs); err != nil {
-				ilog.WithError(err).Error("failed to set netns back")
-			}
-			originalNs.Close()
-		}()
-		if err := unix.Setns(int(iface.NetNS), unix.CLONE_NEWNET); err != nil {
-			return fmt.Errorf("failed to setns to %s: %w", iface.NetNS, err)
-		}
-	}
 	if m.enableEgress {
-		if l := m.egressTCXLink[iface]; l != nil {
+		if l := m.tcxLink(m.egressTCXLink, iface); l != nil {
+			_ = l.Unpin()
 			if err := l.Close(); err != nil {
 				return fmt.Errorf("TCX: failed to close egress link: %w", err)
 			}
-			ilog.WithField("interface", iface.Name).Debugf("successfully detach egressTCX hook link: %v",
-				m.egressTCXLink[iface])
+			ilog.WithField("interface", iface.Name).Debugf("successfully detach egressTCX hook link: %v", l)
 		} else {
 			return fmt.Errorf("egress link does not have a TCX egress hook")
 		}
 	}
 
+	if m.enableIngress && m.detachXDP(iface) {
+		return nil
+	}
+
 	if m.enableIngress {
-		if l := m.ingressTCXLink[iface]; l != nil {
+		if l := m.tcxLink(m.ingressTCXLink, iface); l != nil {
+			_ = l.Unpin()
 			if err := l.Close(); err != nil {
 				return fmt.Errorf("TCX: failed to close ingress link: %w", err)
 			}
-			ilog.WithField("interface", iface.Name).Debugf("successfully detach ingressTCX hook link: %v",
-				m.ingressTCXLink[iface])
+			ilog.WithField("interface", iface.Name).Debugf("successfully detach ingressTCX hook link: %v", l)
 		} else {
 			return fmt.Errorf("ingress link does not have a TCX ingress hook")
 		}
@@ -469,6 +657,99 @@ func (m *FlowFetcher) DetachTCX(iface ifaces.Interface) error {
 	return nil
 }
 
+// tcxLink returns the TCX link of the interface in links, nil if none
+func (m *FlowFetcher) tcxLink(links map[ifaces.Interface]link.Link, iface ifaces.Interface) link.Link {
+	m.linksMutex.Lock()
+	defer m.linksMutex.Unlock()
+	return links[iface]
+}
+
+// inNetNS runs fn from the network namespace of the interface. The goroutine is locked to its
+// thread while it is in another namespace, so that concurrent attachments don't interfere.
+func inNetNS(iface ifaces.Interface, fn func() error) error {
+	if iface.NetNS == netns.None() {
+		return fn()
+	}
+	runtime.LockOSThread()
+	originalNs, err := netns.Get()
+	if err != nil {
+		runtime.UnlockOSThread()
+		return fmt.Errorf("failed to get current netns: %w", err)
+	}
+	defer func() {
+		if err := netns.Set(originalNs); err != nil {
+			// keep the thread locked, so that no other goroutine runs in the wrong namespace
+			log.WithField("iface", iface).WithError(err).Error("failed to set netns back")
+		} else {
+			runtime.UnlockOSThread()
+		}
+		originalNs.Close()
+	}()
+	if err := unix.Setns(int(iface.NetNS), unix.CLONE_NEWNET); err != nil {
+		return fmt.Errorf("failed to setns to %s: %w", iface.NetNS, err)
+	}
+	return fn()
+}
+
+// attachXDP attaches the ingress flows program to the XDP hook of the interface, when enabled, from
+// the interface network namespace. It returns false if the TC ingress hook must be used instead.
+func (m *FlowFetcher) attachXDP(iface ifaces.Interface) bool {
+	if !m.xdpIngress {
+		return false
+	}
+	ilog := log.WithField("iface", iface)
+	xdpLink, err := link.AttachXDP(link.XDPOptions{
+		Program:   m.objects.BpfPrograms.XdpIngressFlowParse,
+		Interface: iface.Index,
+		Flags:     m.xdpFlags,
+	})
+	if err != nil {
+		// e.g. another XDP program is already attached
+		ilog.WithError(err).Warn("can't attach ingress XDP hook. Falling back to TC")
+		return false
+	}
+	m.linksMutex.Lock()
+	m.ingressXDPLink[iface] = xdpLink
+	m.linksMutex.Unlock()
+	ilog.WithField("interface", iface.Name).Debugf("successfully attach ingressXDP hook link: %v", xdpLink)
+	return true
+}
+
+// attachXDPInNetNS runs attachXDP from the network namespace of the interface, for the legacy TC
+// registration, which doesn't switch namespaces
+func (m *FlowFetcher) attachXDPInNetNS(iface ifaces.Interface) (bool, error) {
+	attached := false
+	err := inNetNS(iface, func() error {
+		attached = m.attachXDP(iface)
+		return nil
+	})
+	return attached, err
+}
+
+// detachXDP detaches the ingress XDP hook of the interface, returning false if it has none
+func (m *FlowFetcher) detachXDP(iface ifaces.Interface) bool {
+	m.linksMutex.Lock()
+	l := m.ingressXDPLink[iface]
+	delete(m.ingressXDPLink, iface)
+	m.linksMutex.Unlock()
+	if l == nil {
+		return false
+	}
+	if err := l.Close(); err != nil {
+		log.WithField("iface", iface).WithError(err).Warn("XDP: failed to close ingress link")
+	}
+	return true
+}
+
+// xdpAttachFlags returns the XDP attachment mode. By default, the kernel selects the driver mode
+// when supported by the interface, and the generic mode otherwise.
+func xdpAttachFlags(cfg *FlowFetcherConfig) link.XDPAttachFlags {
+	if cfg.XDPGenericMode {
+		return link.XDPGenericMode
+	}
+	return 0
+}
+
 func removeTCFilters(ifName string, tcDir uint32) error {
 	link, err := netlink.LinkByName(ifName)
 	if err != nil {
@@ -489,6 +770,31 @@ func removeTCFilters(ifName string, tcDir uint32) error {
 	return kerrors.NewAggregate(errs)
 }
 
+// removeStaleFilters removes from the interface the flows filters installed by a previous run of
+// the agent. Unlike unregister, it only lists the filters of this interface.
+func removeStaleFilters(handle *netlink.Handle, ipvlan netlink.Link) error {
+	for _, dir := range []struct {
+		parent uint32
+		name   string
+	}{
+		{parent: netlink.HANDLE_MIN_INGRESS, name: tcIngressFilterName},
+		{parent: netlink.HANDLE_MIN_EGRESS, name: tcEgressFilterName},
+	} {
+		filters, err := handle.FilterList(ipvlan, dir.parent)
+		if err != nil {
+			return fmt.Errorf("listing filters: %w", err)
+		}
+		for _, filter := range filters {
+			if bpfFilter, ok := filter.(*netlink.BpfFilter); ok && strings.HasPrefix(bpfFilter.Name, dir.name) {
+				if err := handle.FilterDel(filter); err != nil {
+					return fmt.Errorf("removing filter %s: %w", bpfFilter.Name, err)
+				}
+			}
+		}
+	}
+	return nil
+}
+
 func unregister(iface ifaces.Interface) error {
 	ilog := log.WithField("iface", iface)
 	ilog.Debugf("looking for previously installed TC filters on %s", iface.Name)
@@ -550,6 +856,7 @@ func unregister(iface ifaces.Interface) error {
 func (m *FlowFetcher) UnRegister(iface ifaces.Interface) error {
 	// qdiscs, ingress and egress filters are automatically deleted so we don't need to
 	// specifically detach them from the ebpfFetcher
+	m.detachXDP(iface)
 	return unregister(iface)
 }
 
@@ -587,10 +894,12 @@ func (m *FlowFetcher) Register(iface ifaces.Interface) error {
 			return fmt.Errorf("failed to create clsact qdisc on %d (%s): %w", iface.Index, iface.Name, err)
 		}
 	}
+	m.linksMutex.Lock()
 	m.qdiscs[iface] = qdisc
+	m.linksMutex.Unlock()
 
 	// Remove previously installed filters
-	if err := unregister(iface); err != nil {
+	if err := removeStaleFilters(handle, ipvlan); err != nil {
 		return fmt.Errorf("failed to remove previous filters: %w", err)
 	}
 
@@ -598,6 +907,13 @@ func (m *FlowFetcher) Register(iface ifaces.Interface) error {
 		return err
 	}
 
+	if m.enableIngress && m.xdpIngress {
+		if attached, err := m.attachXDPInNetNS(iface); err != nil {
+			return err
+		} else if attached {
+			return nil
+		}
+	}
 	return m.registerIngress(iface, ipvlan, handle)
 }
 
@@ -631,7 +947,9 @@ func (m *FlowFetcher) registerEgress(iface ifaces.Interface, ipvlan netlink.Link
 			return fmt.Errorf("failed to create egress filter: %w", err)
 		}
 	}
+	m.linksMutex.Lock()
 	m.egressFilters[iface] = egressFilter
+	m.linksMutex.Unlock()
 	return nil
 }
 
@@ -665,7 +983,9 @@ func (m *FlowFetcher) registerIngress(iface ifaces.Interface, ipvlan netlink.Lin
 			return fmt.Errorf("failed to create ingress filter: %w", err)
 		}
 	}
+	m.linksMutex.Lock()
 	m.ingressFilters[iface] = ingressFilter
+	m.linksMutex.Unlock()
 	return nil
 }
 
@@ -703,6 +1023,11 @@ func (m *FlowFetcher) Close() error {
 			errs = append(errs, err)
 		}
 	}
+	if m.bpfStats != nil {
+		if err := m.bpfStats.Close(); err != nil {
+			errs = append(errs, err)
+		}
+	}
 	// m.ringbufReader.Read is a blocking operation, so we need to close the ring buffer
 	// from another goroutine to avoid the system not being able to exit if there
 	// isn't traffic in a given interface
@@ -724,13 +1049,32 @@ func (m *FlowFetcher) Close() error {
 		if err := m.objects.TcxIngressFlowParse.Close(); err != nil {
 			errs = append(errs, err)
 		}
-		if err := m.objects.AggregatedFlows.Unpin(); err != nil {
+		if err := m.objects.XdpIngressFlowParse.Close(); err != nil {
+			errs = append(errs, err)
+		}
+		if err := m.unpinFlowsMap(m.objects.AggregatedFlows); err != nil {
 			errs = append(errs, err)
 		}
 		if err := m.objects.AggregatedFlows.Close(); err != nil {
 			errs = append(errs, err)
 		}
-		if err := m.objects.AdditionalFlowMetrics.Unpin(); err != nil {
+		if m.objects.AggregatedFlowsPercpu != nil {
+			if err := m.unpinFlowsMap(m.objects.AggregatedFlowsPercpu); err != nil {
+				errs = append(errs, err)
+			}
+			if err := m.objects.AggregatedFlowsPercpu.Close(); err != nil {
+				errs = append(errs, err)
+			}
+		}
+		if m.objects.AggregatedFlowsV4 != nil {
+			if err := m.unpinFlowsMap(m.objects.AggregatedFlowsV4); err != nil {
+				errs = append(errs, err)
+			}
+			if err := m.objects.AggregatedFlowsV4.Close(); err != nil {
+				errs = append(errs, err)
+			}
+		}
+		if err := m.unpinFlowsMap(m.objects.AdditionalFlowMetrics); err != nil {
 			errs = append(errs, err)
 		}
 		if err := m.objects.AdditionalFlowMetrics.Close(); err != nil {
@@ -742,7 +1086,7 @@ func (m *FlowFetcher) Close() error {
 		if err := m.objects.DirectFlows.Close(); err != nil {
 			errs = append(errs, err)
 		}
-		if err := m.objects.DnsFlows.Unpin(); err != nil {
+		if err := m.unpinFlowsMap(m.objects.DnsFlows); err != nil {
 			errs = append(errs, err)
 		}
 		if err := m.objects.DnsFlows.Close(); err != nil {
@@ -754,6 +1098,19 @@ func (m *FlowFetcher) Close() error {
 		if err := m.objects.GlobalCounters.Close(); err != nil {
 			errs = append(errs, err)
 		}
+		if m.objects.ExpiryTimer != nil {
+			if err := m.objects.ExpiryTimer.Close(); err != nil {
+				errs = append(errs, err)
+			}
+		}
+		for _, unpinned := range []*cilium.Map{m.objects.FlowsSketch, m.objects.FlowsSketchEpoch, m.objects.HeavyHitters, m.objects.AdaptiveSampling} {
+			if unpinned == nil {
+				continue
+			}
+			if err := unpinned.Close(); err != nil {
+				errs = append(errs, err)
+			}
+		}
 		if err := m.objects.FilterMap.Unpin(); err != nil {
 			errs = append(errs, err)
 		}
@@ -766,11 +1123,20 @@ func (m *FlowFetcher) Close() error {
 		if err := m.objects.PeerFilterMap.Close(); err != nil {
 			errs = append(errs, err)
 		}
+		for _, compiledFilterMap := range []*cilium.Map{m.objects.FilterMasks, m.objects.FilterRules, m.objects.FilterGeneration, m.objects.FilterVerdicts} {
+			if err := compiledFilterMap.Unpin(); err != nil {
+				errs = append(errs, err)
+			}
+			if err := compiledFilterMap.Close(); err != nil {
+				errs = append(errs, err)
+			}
+		}
 		if len(errs) == 0 {
 			m.objects = nil
 		}
 	}
 
+	m.linksMutex.Lock()
 	for iface, ef := range m.egressFilters {
 		log := log.WithField("interface", iface)
 		log.Debug("deleting egress filter")
@@ -808,9 +1174,18 @@ func (m *FlowFetcher) Close() error {
 		l.Close()
 	}
 	m.ingressTCXLink = map[ifaces.Interface]link.Link{}
+	for iface, l := range m.ingressXDPLink {
+		log := log.WithField("interface", iface)
+		log.Debug("detach ingress XDP hook")
+		l.Close()
+	}
+	m.ingressXDPLink = map[ifaces.Interface]link.Link{}
+	m.linksMutex.Unlock()
 
-	if err := m.removeAllPins(); err != nil {
-		errs = append(errs, err)
+	if !m.hotRestart {
+		if err := m.removeAllPins(); err != nil {
+			errs = append(errs, err)
+		}
 	}
 
 	if len(errs) == 0 {
@@ -824,6 +1199,13 @@ func (m *FlowFetcher) Close() error {
 	return errors.New(`errors: "` + strings.Join(errStrings, `", "`) + `"`)
 }
 
+// shrinkMapValue reduces the values of a map that is not used by the loaded programs to the minimum,
+// e.g. the per-CPU packet buffers in flows mode. Its BTF is dropped, as it doesn't match the new size.
+func shrinkMapValue(spec *cilium.MapSpec) {
+	spec.Key, spec.Value = nil, nil
+	spec.ValueSize = 8
+}
+
 // removeAllPins removes all pins.
 func (m *FlowFetcher) removeAllPins() error {
 	files, err := os.ReadDir(m.pinDir)
@@ -845,6 +1227,15 @@ func (m *FlowFetcher) removeAllPins() error {
 	return nil
 }
 
+// unpinFlowsMap removes the pin of a flows map, unless it is kept for the next agent in hot
+// restart mode
+func (m *FlowFetcher) unpinFlowsMap(flowsMap *cilium.Map) error {
+	if m.hotRestart {
+		return nil
+	}
+	return flowsMap.Unpin()
+}
+
 // doIgnoreNoDev runs the provided syscall over the provided device and ignores the error
 // if the cause is a non-existing device (just logs the error as debug).
 // If the agent is deployed as part of the Network Observability pipeline, normally
@@ -867,27 +1258,68 @@ func doIgnoreNoDev[T any](sysCall func(T) error, dev T, log *logrus.Entry) error
 	return nil
 }
 
+// ReadRingBuf reads the next record of the direct flows ring buffer. When the ring buffer wakeups
+// are batched, it returns os.ErrDeadlineExceeded if no records have been submitted during the
+// flush period. The returned record is overwritten by the next invocation.
 func (m *FlowFetcher) ReadRingBuf() (ringbuf.Record, error) {
-	return m.ringbufReader.Read()
+	if m.ringbufFlushPeriod > 0 {
+		m.ringbufReader.SetDeadline(time.Now().Add(m.ringbufFlushPeriod))
+	}
+	err := m.ringbufReader.ReadInto(&m.ringbufRecord)
+	return m.ringbufRecord, err
 }
 
 // LookupAndDeleteMap reads all the entries from the eBPF map and removes them from it.
-// TODO: detect whether BatchLookupAndDelete is supported (Kernel>=5.6) and use it selectively
+// BatchLookupAndDelete is used when supported (Kernel>=5.6), otherwise it falls back to
+// a per-entry LookupAndDelete (Kernel>=4.20), then to the legacy mode.
 // Supported Lookup/Delete operations by kernel: https://github.com/iovisor/bcc/blob/master/docs/kernel-versions.md
-func (m *FlowFetcher) LookupAndDeleteMap(met *metrics.Metrics) map[ebpf.BpfFlowId]model.BpfFlowContent {
+// The returned slice is reused by the next invocation.
+func (m *FlowFetcher) LookupAndDeleteMap(met *metrics.Metrics) []model.BpfFlowEntry {
+	m.flows.reset()
+	m.lookupAndDeleteMap(met)
+	if m.sketch != nil {
+		m.drainFlowsSketch(met)
+	}
+	if m.sampling != nil {
+		m.adaptSampling(met, m.flows.nbFlows)
+	}
+	met.LookupAndDeleteAllocations.Observe(float64(m.flows.allocations))
+	if m.trackLRUEvictions {
+		m.countLRUEvictions(met)
+	}
+	if m.bpfStats != nil {
+		m.readBpfStats(met)
+	}
+	return m.flows.entries
+}
+
+func (m *FlowFetcher) lookupAndDeleteMap(met *metrics.Metrics) []model.BpfFlowEntry {
+	if m.batchLookupSupported {
+		err := m.batchLookupAndDeleteMap(met)
+		if err == nil {
+			return m.flows.entries
+		}
+		log.WithError(err).Warnf("switching to non-batched lookup and delete mode")
+		m.batchLookupSupported = false
+	}
 	if !m.lookupAndDeleteSupported {
 		return m.legacyLookupAndDeleteMap(met)
 	}
 
 	flowMap := m.objects.AggregatedFlows
-	var flows = make(map[ebpf.BpfFlowId]model.BpfFlowContent, m.cacheMaxSize)
 	var ids []ebpf.BpfFlowId
 	var id ebpf.BpfFlowId
 	var baseMetrics ebpf.BpfFlowMetrics
+	var perCPUMetrics []ebpf.BpfFlowMetrics
+	var flowValue interface{} = &baseMetrics
+	if m.perCPUAggregation {
+		flowMap = m.objects.AggregatedFlowsPercpu
+		flowValue = &perCPUMetrics
+	}
 
 	// First, get all ids and don't care about metrics (we need lookup+delete to be atomic)
 	iterator := flowMap.Iterate()
-	for iterator.Next(&id, &baseMetrics) {
+	for iterator.Next(&id, flowValue) {
 		ids = append(ids, id)
 	}
 
@@ -895,7 +1327,7 @@ func (m *FlowFetcher) LookupAndDeleteMap(met *metrics.Metrics) map[ebpf.BpfFlowI
 	// Run the atomic Lookup+Delete; if new ids have been inserted in the meantime, they'll be fetched next time
 	for i, id := range ids {
 		countMain++
-		if err := flowMap.LookupAndDelete(&id, &baseMetrics); err != nil {
+		if err := flowMap.LookupAndDelete(&id, flowValue); err != nil {
 			if i == 0 && errors.Is(err, cilium.ErrNotSupported) {
 				log.WithError(err).Warnf("switching to legacy mode")
 				m.lookupAndDeleteSupported = false
@@ -905,12 +1337,17 @@ func (m *FlowFetcher) LookupAndDeleteMap(met *metrics.Metrics) map[ebpf.BpfFlowI
 			met.Errors.WithErrorName("flow-fetcher", "CannotDeleteFlows", metrics.HighSeverity).Inc()
 			continue
 		}
-		flows[id] = model.NewBpfFlowContent(baseMetrics)
+		if m.perCPUAggregation {
+			m.flows.addPerCPU(&id, perCPUMetrics)
+		} else {
+			m.flows.addBase(&id, &baseMetrics)
+		}
 	}
+	countMain += m.lookupAndDeleteV4Map(met)
 
 	// Reiterate on additional metrics
 	var additionalMetrics []ebpf.BpfAdditionalMetrics
-	ids = []ebpf.BpfFlowId{}
+	ids = ids[:0]
 	addtlIterator := m.objects.AdditionalFlowMetrics.Iterate()
 	for addtlIterator.Next(&id, &additionalMetrics) {
 		ids = append(ids, id)
@@ -929,22 +1366,42 @@ func (m *FlowFetcher) LookupAndDeleteMap(met *metrics.Metrics) map[ebpf.BpfFlowI
 			met.Errors.WithErrorName("flow-fetcher", "CannotDeleteAdditionalMetric", metrics.HighSeverity).Inc()
 			continue
 		}
-		flow, found := flows[id]
-		if !found {
-			flow = model.BpfFlowContent{BpfFlowMetrics: &ebpf.BpfFlowMetrics{}}
-		}
-		for iMet := range additionalMetrics {
-			flow.AccumulateAdditional(&additionalMetrics[iMet])
-		}
-		m.increaseEnrichmentStats(met, &flow)
-		flows[id] = flow
+		m.increaseEnrichmentStats(met, m.flows.addAdditional(&id, additionalMetrics))
 	}
 	met.BufferSizeGauge.WithBufferName("additionalmap").Set(float64(countAdditional))
 	met.BufferSizeGauge.WithBufferName("flowmap").Set(float64(countMain))
-	met.BufferSizeGauge.WithBufferName("merged-maps").Set(float64(len(flows)))
+	met.BufferSizeGauge.WithBufferName("merged-maps").Set(float64(len(m.flows.entries)))
 
 	m.ReadGlobalCounter(met)
-	return flows
+	return m.flows.entries
+}
+
+// lookupAndDeleteV4Map reads and removes all the entries from the compact IPv4 flows map into
+// m.flows, and returns the number of entries read
+func (m *FlowFetcher) lookupAndDeleteV4Map(met *metrics.Metrics) int {
+	if !m.compactIPv4Keys {
+		return 0
+	}
+	if !m.lookupAndDeleteSupported {
+		return m.legacyLookupAndDeleteV4Map(met)
+	}
+	flowMap := m.objects.AggregatedFlowsV4
+	var keys []ebpf.BpfFlowIdV4
+	var key ebpf.BpfFlowIdV4
+	var baseMetrics ebpf.BpfFlowMetrics
+	iterator := flowMap.Iterate()
+	for iterator.Next(&key, &baseMetrics) {
+		keys = append(keys, key)
+	}
+	for i := range keys {
+		if err := flowMap.LookupAndDelete(&keys[i], &baseMetrics); err != nil {
+			log.WithError(err).WithField("flowId", keys[i]).Warnf("couldn't lookup/delete flow entry")
+			met.Errors.WithErrorName("flow-fetcher", "CannotDeleteFlows", metrics.HighSeverity).Inc()
+			continue
+		}
+		m.flows.addBaseV4(&keys[i], &baseMetrics)
+	}
+	return len(keys)
 }
 
 func (m *FlowFetcher) increaseEnrichmentStats(met *metrics.Metrics, flow *model.BpfFlowContent) {
@@ -961,9 +1418,9 @@ func (m *FlowFetcher) increaseEnrichmentStats(met *metrics.Metrics, flow *model.
 	}
 }
 
-// ReadGlobalCounter reads the global counter and updates drop flows counter metrics
+// ReadGlobalCounter reads the global counter and updates drop flows counter metrics. The eBPF
+// counters are never reset: the metrics are increased by the difference with the previous read.
 func (m *FlowFetcher) ReadGlobalCounter(met *metrics.Metrics) {
-	var allCPUValue []uint32
 	globalCounters := map[ebpf.BpfGlobalCountersKeyT]prometheus.Counter{
 		ebpf.BpfGlobalCountersKeyTHASHMAP_FLOWS_DROPPED:               met.DroppedFlowsCounter.WithSourceAndReason("flow-fetcher", "CannotUpdateFlowsHashMap"),
 		ebpf.BpfGlobalCountersKeyTHASHMAP_FAIL_UPDATE_DNS:             met.DroppedFlowsCounter.WithSourceAndReason("flow-fetcher", "CannotUpdateDNSHashMap"),
@@ -975,30 +1432,103 @@ func (m *FlowFetcher) ReadGlobalCounter(met *metrics.Metrics) {
 		ebpf.BpfGlobalCountersKeyTNETWORK_EVENTS_ERR_UPDATE_MAP_FLOWS: met.NetworkEventsCounter.WithSourceAndReason("network-events", "NetworkEventsErrorsFlowMapUpdate"),
 		ebpf.BpfGlobalCountersKeyTNETWORK_EVENTS_GOOD:                 met.NetworkEventsCounter.WithSourceAndReason("network-events", "NetworkEventsGoodEvent"),
 		ebpf.BpfGlobalCountersKeyTOBSERVED_INTF_MISSED:                met.Errors.WithErrorName("flow-fetcher", "MaxObservedInterfacesReached", metrics.LowSeverity),
+		ebpf.BpfGlobalCountersKeyTFLOWS_SKETCH_UNTRACKED:              met.SketchUntrackedPackets,
 	}
-	zeroCounters := make([]uint32, cilium.MustPossibleCPU())
+	values, err := m.readGlobalCounters()
+	if err != nil {
+		log.WithError(err).Warnf("couldn't read global counter")
+		return
+	}
+	totals := globalCountersTotals(values)
 	for key := ebpf.BpfGlobalCountersKeyT(0); key < ebpf.BpfGlobalCountersKeyTMAX_COUNTERS; key++ {
-		if err := m.objects.GlobalCounters.Lookup(key, &allCPUValue); err != nil {
-			log.WithError(err).Warnf("couldn't read global counter")
-			return
-		}
-		metric := globalCounters[key]
-		if metric != nil {
-			// aggregate all the counters
-			for _, counter := range allCPUValue {
-				metric.Add(float64(counter))
-			}
+		delta := totals[key] - m.globalCounters[key]
+		if delta == 0 {
+			continue
 		}
-		// reset the global counter-map entry
-		if err := m.objects.GlobalCounters.Put(key, zeroCounters); err != nil {
-			log.WithError(err).Warnf("coudn't reset global counter")
-			return
+		switch key {
+		case ebpf.BpfGlobalCountersKeyTHASHMAP_FLOWS_INSERTED:
+			m.flowsInserted += delta
+		case ebpf.BpfGlobalCountersKeyTHASHMAP_FLOWS_DROPPED, ebpf.BpfGlobalCountersKeyTFLOWS_SKETCH_UNTRACKED:
+			// feeds the adaptive sampling
+			m.flowsDropped += delta
 		}
+		if metric := globalCounters[key]; metric != nil {
+			metric.Add(float64(delta))
+		}
+	}
+	m.globalCounters = totals
+}
+
+// seedGlobalCounters sets the totals of the previous read to the current values of the global
+// counters, so that the values counted before the agent started aren't reported by the next read
+func (m *FlowFetcher) seedGlobalCounters() {
+	values, err := m.readGlobalCounters()
+	if err != nil {
+		log.WithError(err).Warn("couldn't seed the global counters")
+		return
 	}
+	m.globalCounters = globalCountersTotals(values)
+}
+
+// globalCountersTotals aggregates the per-CPU values of the global counters, as returned by
+// readGlobalCounters
+func globalCountersTotals(values []uint64) [ebpf.BpfGlobalCountersKeyTMAX_COUNTERS]uint64 {
+	var totals [ebpf.BpfGlobalCountersKeyTMAX_COUNTERS]uint64
+	nCPU := len(values) / int(ebpf.BpfGlobalCountersKeyTMAX_COUNTERS)
+	for key := range totals {
+		for _, counter := range values[key*nCPU : (key+1)*nCPU] {
+			totals[key] += counter
+		}
+	}
+	return totals
+}
+
+// readGlobalCounters returns the per-CPU values of all the global counters, by key then CPU. They
+// are read with a single syscall when the kernel supports batch lookups.
+func (m *FlowFetcher) readGlobalCounters() ([]uint64, error) {
+	if m.globalCountersBatch == nil {
+		nCPU, err := cilium.PossibleCPU()
+		if err != nil {
+			return nil, err
+		}
+		batch := newPerCPUBatch[uint32, uint64](int(ebpf.BpfGlobalCountersKeyTMAX_COUNTERS), nCPU)
+		m.globalCountersBatch = &batch
+	}
+	b := m.globalCountersBatch
+	if m.batchLookupSupported {
+		var cursor perCPUBatchCursor
+		n, err := b.next(m.objects.GlobalCounters, unix.BPF_MAP_LOOKUP_BATCH, &cursor)
+		if n == len(b.keys) && (err == nil || errors.Is(err, cilium.ErrKeyNotExist)) {
+			return b.values, nil
+		}
+		log.WithError(err).Debug("couldn't batch lookup global counters, reading them one by one")
+	}
+	for key := range b.keys {
+		if err := m.objects.GlobalCounters.Lookup(uint32(key), b.valuesOf(key)); err != nil {
+			return nil, err
+		}
+	}
+	return b.values, nil
+}
+
+// countLRUEvictions estimates, once the flows map has been drained, the number of flows that have
+// been silently evicted from the LRU maps since the previous drain: they have been inserted by
+// the kernel, but never read.
+func (m *FlowFetcher) countLRUEvictions(met *metrics.Metrics) {
+	drained := m.flowsDrained + uint64(m.flows.nbFlows)
+	if m.flowsInserted > drained {
+		met.DroppedFlowsCounter.WithSourceAndReason("flow-fetcher", "EvictedFromLRUMap").Add(float64(m.flowsInserted - drained))
+	}
+	m.flowsInserted = 0
+	m.flowsDrained = 0
 }
 
 // DeleteMapsStaleEntries Look for any stale entries in the features maps and delete them
 func (m *FlowFetcher) DeleteMapsStaleEntries(timeOut time.Duration) {
+	if m.flowsExpiry || m.dnsQueriesLRU {
+		// stale DNS entries are deleted or aged by the kernel
+		return
+	}
 	m.lookupAndDeleteDNSMap(timeOut)
 }
 
@@ -1028,243 +1558,66 @@ func (m *FlowFetcher) lookupAndDeleteDNSMap(timeOut time.Duration) {
 	}
 }
 
-// kernelSpecificLoadAndAssign based on a kernel version, it will load only the supported eBPF hooks
-func kernelSpecificLoadAndAssign(oldKernel, rtKernel, supportNetworkEvents bool, spec *cilium.CollectionSpec, pinDir string) (ebpf.BpfObjects, error) {
+// kernelSpecificLoadAndAssign based on a kernel version and on the enabled features, it will load only
+// the supported eBPF hooks that are attached by the agent. The programs of the disabled features are
+// removed from the spec, so they are neither verified nor loaded into the kernel.
+func kernelSpecificLoadAndAssign(oldKernel, rtKernel, supportNetworkEvents bool, spec *cilium.CollectionSpec, pinDir string, cfg *FlowFetcherConfig) (ebpf.BpfObjects, error) {
 	objects := ebpf.BpfObjects{}
-
-	// Helper to remove common hooks
-	removeCommonHooks := func() {
-		delete(spec.Programs, pktDropHook)
-		delete(spec.Programs, rhNetworkEventsMonitoringHook)
+	p := &objects.BpfPrograms
+	programs := map[string]**cilium.Program{}
+	if cfg.EnableEgress {
+		programs["tc_egress_flow_parse"] = &p.TcEgressFlowParse
+		programs["tcx_egress_flow_parse"] = &p.TcxEgressFlowParse
 	}
-
-	// Helper to load and assign BPF objects
-	loadAndAssign := func(objects interface{}) error {
-		if err := spec.LoadAndAssign(objects, &cilium.CollectionOptions{Maps: cilium.MapOptions{PinPath: pinDir}}); err != nil {
-			var ve *cilium.VerifierError
-			if errors.As(err, &ve) {
-				log.Infof("Verifier error: %+v", ve)
-			}
-			return fmt.Errorf("loading and assigning BPF objects: %w", err)
+	if cfg.EnableIngress {
+		programs["tc_ingress_flow_parse"] = &p.TcIngressFlowParse
+		programs["tcx_ingress_flow_parse"] = &p.TcxIngressFlowParse
+		if cfg.XDPIngress {
+			programs["xdp_ingress_flow_parse"] = &p.XdpIngressFlowParse
 		}
-		return nil
 	}
+	if cfg.EnablePktDrops && !oldKernel && !rtKernel {
+		programs[pktDropHook] = &p.KfreeSkb
+	}
+	if cfg.EnableNetworkEventsMonitoring && supportNetworkEvents && !oldKernel && !rtKernel {
+		programs["rh_network_events_monitoring"] = &p.RhNetworkEventsMonitoring
+	}
+	if cfg.EnableRTT {
+		// the kprobe is the fallback when the fentry hook can't be attached
+		if !oldKernel {
+			programs[tcpFentryHook] = &p.TcpRcvFentry
+		}
+		if !rtKernel {
+			programs[tcpRcvKprobe] = &p.TcpRcvKprobe
+		}
+	}
+	if cfg.EnablePktTranslation {
+		programs["track_nat_manip_pkt"] = &p.TrackNatManipPkt
+	}
+	for name := range spec.Programs {
+		if _, ok := programs[name]; !ok {
+			delete(spec.Programs, name)
+		}
+	}
+	_, fentry := programs[tcpFentryHook]
+	_, kprobe := programs[tcpRcvKprobe]
+	configureRTTSamplesMaps(spec, fentry, kprobe, cfg.RTTSamplingInterval)
 
-	// Configure BPF programs based on the kernel type
-	switch {
-	case oldKernel && rtKernel:
-		type newBpfPrograms struct {
-			TcEgressFlowParse   *cilium.Program `ebpf:"tc_egress_flow_parse"`
-			TcIngressFlowParse  *cilium.Program `ebpf:"tc_ingress_flow_parse"`
-			TcxEgressFlowParse  *cilium.Program `ebpf:"tcx_egress_flow_parse"`
-			TcxIngressFlowParse *cilium.Program `ebpf:"tcx_ingress_flow_parse"`
-			TcEgressPcaParse    *cilium.Program `ebpf:"tc_egress_pca_parse"`
-			TcIngressPcaParse   *cilium.Program `ebpf:"tc_ingress_pca_parse"`
-			TcxEgressPcaParse   *cilium.Program `ebpf:"tcx_egress_pca_parse"`
-			TcxIngressPcaParse  *cilium.Program `ebpf:"tcx_ingress_pca_parse"`
-			TrackNatManipPkt    *cilium.Program `ebpf:"track_nat_manip_pkt"`
-		}
-		type newBpfObjects struct {
-			newBpfPrograms
-			ebpf.BpfMaps
-		}
-		var newObjects newBpfObjects
-		removeCommonHooks()
-		delete(spec.Programs, tcpRcvKprobe)
-		delete(spec.Programs, tcpFentryHook)
-
-		if err := loadAndAssign(&newObjects); err != nil {
-			return objects, err
-		}
-
-		objects = ebpf.BpfObjects{
-			BpfPrograms: ebpf.BpfPrograms{
-				TcEgressFlowParse:         newObjects.TcEgressFlowParse,
-				TcIngressFlowParse:        newObjects.TcIngressFlowParse,
-				TcxEgressFlowParse:        newObjects.TcxEgressFlowParse,
-				TcxIngressFlowParse:       newObjects.TcxIngressFlowParse,
-				TcEgressPcaParse:          newObjects.TcEgressPcaParse,
-				TcIngressPcaParse:         newObjects.TcIngressPcaParse,
-				TcxEgressPcaParse:         newObjects.TcxEgressPcaParse,
-				TcxIngressPcaParse:        newObjects.TcxIngressPcaParse,
-				TrackNatManipPkt:          newObjects.TrackNatManipPkt,
-				TcpRcvKprobe:              nil,
-				TcpRcvFentry:              nil,
-				KfreeSkb:                  nil,
-				RhNetworkEventsMonitoring: nil,
-			},
-			BpfMaps: ebpf.BpfMaps{
-				DirectFlows:           newObjects.DirectFlows,
-				AggregatedFlows:       newObjects.AggregatedFlows,
-				AdditionalFlowMetrics: newObjects.AdditionalFlowMetrics,
-				DnsFlows:              newObjects.DnsFlows,
-				FilterMap:             newObjects.FilterMap,
-				PeerFilterMap:         newObjects.PeerFilterMap,
-				GlobalCounters:        newObjects.GlobalCounters,
-			},
-		}
-
-	case oldKernel:
-		type newBpfPrograms struct {
-			TcEgressFlowParse   *cilium.Program `ebpf:"tc_egress_flow_parse"`
-			TcIngressFlowParse  *cilium.Program `ebpf:"tc_ingress_flow_parse"`
-			TcxEgressFlowParse  *cilium.Program `ebpf:"tcx_egress_flow_parse"`
-			TcxIngressFlowParse *cilium.Program `ebpf:"tcx_ingress_flow_parse"`
-			TcEgressPcaParse    *cilium.Program `ebpf:"tc_egress_pca_parse"`
-			TcIngressPcaParse   *cilium.Program `ebpf:"tc_ingress_pca_parse"`
-			TcxEgressPcaParse   *cilium.Program `ebpf:"tcx_egress_pca_parse"`
-			TcxIngressPcaParse  *cilium.Program `ebpf:"tcx_ingress_pca_parse"`
-			TCPRcvKprobe        *cilium.Program `ebpf:"tcp_rcv_kprobe"`
-			TrackNatManipPkt    *cilium.Program `ebpf:"track_nat_manip_pkt"`
-		}
-		type newBpfObjects struct {
-			newBpfPrograms
-			ebpf.BpfMaps
-		}
-		var newObjects newBpfObjects
-		removeCommonHooks()
-		delete(spec.Programs, tcpFentryHook)
-
-		if err := loadAndAssign(&newObjects); err != nil {
-			return objects, err
-		}
-
-		objects = ebpf.BpfObjects{
-			BpfPrograms: ebpf.BpfPrograms{
-				TcEgressFlowParse:         newObjects.TcEgressFlowParse,
-				TcIngressFlowParse:        newObjects.TcIngressFlowParse,
-				TcxEgressFlowParse:        newObjects.TcxEgressFlowParse,
-				TcxIngressFlowParse:       newObjects.TcxIngressFlowParse,
-				TcEgressPcaParse:          newObjects.TcEgressPcaParse,
-				TcIngressPcaParse:         newObjects.TcIngressPcaParse,
-				TcxEgressPcaParse:         newObjects.TcxEgressPcaParse,
-				TcxIngressPcaParse:        newObjects.TcxIngressPcaParse,
-				TcpRcvKprobe:              newObjects.TCPRcvKprobe,
-				TrackNatManipPkt:          newObjects.TrackNatManipPkt,
-				TcpRcvFentry:              nil,
-				KfreeSkb:                  nil,
-				RhNetworkEventsMonitoring: nil,
-			},
-			BpfMaps: ebpf.BpfMaps{
-				DirectFlows:           newObjects.DirectFlows,
-				AggregatedFlows:       newObjects.AggregatedFlows,
-				AdditionalFlowMetrics: newObjects.AdditionalFlowMetrics,
-				DnsFlows:              newObjects.DnsFlows,
-				FilterMap:             newObjects.FilterMap,
-				PeerFilterMap:         newObjects.PeerFilterMap,
-				GlobalCounters:        newObjects.GlobalCounters,
-			},
-		}
-
-	case rtKernel:
-		type newBpfPrograms struct {
-			TcEgressFlowParse   *cilium.Program `ebpf:"tc_egress_flow_parse"`
-			TcIngressFlowParse  *cilium.Program `ebpf:"tc_ingress_flow_parse"`
-			TcxEgressFlowParse  *cilium.Program `ebpf:"tcx_egress_flow_parse"`
-			TcxIngressFlowParse *cilium.Program `ebpf:"tcx_ingress_flow_parse"`
-			TcEgressPcaParse    *cilium.Program `ebpf:"tc_egress_pca_parse"`
-			TcIngressPcaParse   *cilium.Program `ebpf:"tc_ingress_pca_parse"`
-			TcxEgressPcaParse   *cilium.Program `ebpf:"tcx_egress_pca_parse"`
-			TcxIngressPcaParse  *cilium.Program `ebpf:"tcx_ingress_pca_parse"`
-			TCPRcvFentry        *cilium.Program `ebpf:"tcp_rcv_fentry"`
-			TrackNatManipPkt    *cilium.Program `ebpf:"track_nat_manip_pkt"`
-		}
-		type newBpfObjects struct {
-			newBpfPrograms
-			ebpf.BpfMaps
-		}
-		var newObjects newBpfObjects
-		removeCommonHooks()
-		delete(spec.Programs, tcpRcvKprobe)
-
-		if err := loadAndAssign(&newObjects); err != nil {
-			return objects, err
-		}
-
-		objects = ebpf.BpfObjects{
-			BpfPrograms: ebpf.BpfPrograms{
-				TcEgressFlowParse:         newObjects.TcEgressFlowParse,
-				TcIngressFlowParse:        newObjects.TcIngressFlowParse,
-				TcxEgressFlowParse:        newObjects.TcxEgressFlowParse,
-				TcxIngressFlowParse:       newObjects.TcxIngressFlowParse,
-				TcEgressPcaParse:          newObjects.TcEgressPcaParse,
-				TcIngressPcaParse:         newObjects.TcIngressPcaParse,
-				TcxEgressPcaParse:         newObjects.TcxEgressPcaParse,
-				TcxIngressPcaParse:        newObjects.TcxIngressPcaParse,
-				TcpRcvFentry:              newObjects.TCPRcvFentry,
-				TrackNatManipPkt:          newObjects.TrackNatManipPkt,
-				TcpRcvKprobe:              nil,
-				KfreeSkb:                  nil,
-				RhNetworkEventsMonitoring: nil,
-			},
-			BpfMaps: ebpf.BpfMaps{
-				DirectFlows:           newObjects.DirectFlows,
-				AggregatedFlows:       newObjects.AggregatedFlows,
-				AdditionalFlowMetrics: newObjects.AdditionalFlowMetrics,
-				DnsFlows:              newObjects.DnsFlows,
-				FilterMap:             newObjects.FilterMap,
-				PeerFilterMap:         newObjects.PeerFilterMap,
-				GlobalCounters:        newObjects.GlobalCounters,
-			},
-		}
-
-	case !supportNetworkEvents:
-		type newBpfPrograms struct {
-			TcEgressFlowParse   *cilium.Program `ebpf:"tc_egress_flow_parse"`
-			TcIngressFlowParse  *cilium.Program `ebpf:"tc_ingress_flow_parse"`
-			TcxEgressFlowParse  *cilium.Program `ebpf:"tcx_egress_flow_parse"`
-			TcxIngressFlowParse *cilium.Program `ebpf:"tcx_ingress_flow_parse"`
-			TcEgressPcaParse    *cilium.Program `ebpf:"tc_egress_pca_parse"`
-			TcIngressPcaParse   *cilium.Program `ebpf:"tc_ingress_pca_parse"`
-			TcxEgressPcaParse   *cilium.Program `ebpf:"tcx_egress_pca_parse"`
-			TcxIngressPcaParse  *cilium.Program `ebpf:"tcx_ingress_pca_parse"`
-			TCPRcvFentry        *cilium.Program `ebpf:"tcp_rcv_fentry"`
-			TCPRcvKprobe        *cilium.Program `ebpf:"tcp_rcv_kprobe"`
-			KfreeSkb            *cilium.Program `ebpf:"kfree_skb"`
-			TrackNatManipPkt    *cilium.Program `ebpf:"track_nat_manip_pkt"`
-		}
-		type newBpfObjects struct {
-			newBpfPrograms
-			ebpf.BpfMaps
-		}
-		var newObjects newBpfObjects
-		delete(spec.Programs, rhNetworkEventsMonitoringHook)
-
-		if err := loadAndAssign(&newObjects); err != nil {
-			return objects, err
-		}
-
-		objects = ebpf.BpfObjects{
-			BpfPrograms: ebpf.BpfPrograms{
-				TcEgressFlowParse:         newObjects.TcEgressFlowParse,
-				TcIngressFlowParse:        newObjects.TcIngressFlowParse,
-				TcxEgressFlowParse:        newObjects.TcxEgressFlowParse,
-				TcxIngressFlowParse:       newObjects.TcxIngressFlowParse,
-				TcEgressPcaParse:          newObjects.TcEgressPcaParse,
-				TcIngressPcaParse:         newObjects.TcIngressPcaParse,
-				TcxEgressPcaParse:         newObjects.TcxEgressPcaParse,
-				TcxIngressPcaParse:        newObjects.TcxIngressPcaParse,
-				TcpRcvFentry:              newObjects.TCPRcvFentry,
-				TcpRcvKprobe:              newObjects.TCPRcvKprobe,
-				KfreeSkb:                  newObjects.KfreeSkb,
-				TrackNatManipPkt:          newObjects.TrackNatManipPkt,
-				RhNetworkEventsMonitoring: nil,
-			},
-			BpfMaps: ebpf.BpfMaps{
-				DirectFlows:           newObjects.DirectFlows,
-				AggregatedFlows:       newObjects.AggregatedFlows,
-				AdditionalFlowMetrics: newObjects.AdditionalFlowMetrics,
-				DnsFlows:              newObjects.DnsFlows,
-				FilterMap:             newObjects.FilterMap,
-				PeerFilterMap:         newObjects.PeerFilterMap,
-				GlobalCounters:        newObjects.GlobalCounters,
-			},
-		}
-
-	default:
-		if err := loadAndAssign(&objects); err != nil {
-			return objects, err
+	coll, err := cilium.NewCollectionWithOptions(spec, cilium.CollectionOptions{Maps: cilium.MapOptions{PinPath: pinDir}})
+	if err != nil {
+		var ve *cilium.VerifierError
+		if errors.As(err, &ve) {
+			log.Infof("Verifier error: %+v", ve)
 		}
+		return objects, fmt.Errorf("loading and assigning BPF objects: %w", err)
+	}
+	// the objects that have not been assigned are released
+	defer coll.Close()
+	if err := coll.Assign(&objects.BpfMaps); err != nil {
+		return objects, fmt.Errorf("loading and assigning BPF objects: %w", err)
+	}
+	for name, prog := range programs {
+		*prog = coll.DetachProgram(name)
 	}
 
 	// Release cached kernel BTF memory
@@ -1280,6 +1633,8 @@ type PacketFetcher struct {
 	egressFilters            map[ifaces.Interface]*netlink.BpfFilter
 	ingressFilters           map[ifaces.Interface]*netlink.BpfFilter
 	perfReader               *perf.Reader
+	ringbufReader            *ringbuf.Reader
+	ringbufFlushPeriod       time.Duration
 	cacheMaxSize             int
 	enableIngress            bool
 	enableEgress             bool
@@ -1303,9 +1658,24 @@ func NewPacketFetcher(cfg *FlowFetcherConfig) (*PacketFetcher, error) {
 	if cfg.EnablePCA {
 		pcaEnable = 1
 	}
+	pcaRingbuf := 0
+	ringbufWakeupThreshold := uint32(0)
+	flushPeriod := time.Duration(0)
+	if cfg.PCARingbuf {
+		pcaRingbuf = 1
+		if flushPeriod = ringbufFlushPeriod(cfg); flushPeriod > 0 {
+			ringbufWakeupThreshold = uint32(cfg.RingbufWakeupBatch) * pcaRecordSize(cfg.PCASnaplen)
+		}
+	} else {
+		spec.Maps[pcaRingbufMap].MaxEntries = uint32(os.Getpagesize())
+	}
+	spec.Maps[filterVerdictsMap].MaxEntries = uint32(cfg.CacheMaxSize)
 	variables := []variablesMapping{
 		{constSampling, uint32(cfg.Sampling)},
 		{constPcaEnable, uint8(pcaEnable)},
+		{constPcaRingbuf, uint8(pcaRingbuf)},
+		{constPcaSnaplen, uint32(max(cfg.PCASnaplen, 0))},
+		{constRingbufWakeupThreshold, ringbufWakeupThreshold},
 	}
 
 	for _, mapping := range variables {
@@ -1317,11 +1687,16 @@ func NewPacketFetcher(cfg *FlowFetcherConfig) (*PacketFetcher, error) {
 	// remove pinning from all maps
 	for _, m := range []string{
 		aggregatedFlowsMap,
+		aggregatedFlowsPerCPUMap,
+		aggregatedFlowsV4Map,
 		additionalFlowMetrics,
 		directFlowsMap,
 		dnsLatencyMap,
 		filterMap,
 		peerFilterMap,
+		filterMasksMap,
+		filterRulesMap,
+		filterGenerationMap,
 		globalCountersMap,
 		pcaRecordsMap} {
 		spec.Maps[m].Pinning = 0
@@ -1343,6 +1718,8 @@ func NewPacketFetcher(cfg *FlowFetcherConfig) (*PacketFetcher, error) {
 	delete(spec.Programs, tcpRcvKprobe)
 	delete(spec.Programs, tcpFentryHook)
 	delete(spec.Programs, aggregatedFlowsMap)
+	delete(spec.Programs, aggregatedFlowsPerCPUMap)
+	delete(spec.Programs, aggregatedFlowsV4Map)
 	delete(spec.Programs, additionalFlowMetrics)
 	delete(spec.Programs, constSampling)
 	delete(spec.Programs, constHasFilterSampling)
@@ -1353,6 +1730,19 @@ func NewPacketFetcher(cfg *FlowFetcherConfig) (*PacketFetcher, error) {
 	delete(spec.Programs, constEnableFlowFiltering)
 	delete(spec.Programs, constEnableNetworkEventsMonitoring)
 	delete(spec.Programs, constNetworkEventsMonitoringGroupID)
+	delete(spec.Programs, constEnablePerCPUAggregation)
+	delete(spec.Programs, constEnableFlowsExpiry)
+	delete(spec.Programs, constFlowsExpiryPeriod)
+	delete(spec.Programs, constFlowsIdleTimeout)
+	delete(spec.Programs, constDNSFlowsTimeout)
+	delete(spec.Programs, constTrackFlowsInserts)
+	delete(spec.Programs, constEnableCompactIPv4Keys)
+	delete(spec.Programs, constEnableFlowsSketch)
+	delete(spec.Programs, constFlowsSketchSlots)
+	delete(spec.Programs, constEnableAdaptiveSampling)
+	delete(spec.Programs, constEnableFlowLatencies)
+	delete(spec.Programs, constRTTSamplingInterval)
+	configureRTTSamplesMaps(spec, false, false, 0)
 
 	if err := spec.LoadAndAssign(&newObjects, &cilium.CollectionOptions{Maps: cilium.MapOptions{PinPath: ""}}); err != nil {
 		var ve *cilium.VerifierError
@@ -1374,15 +1764,22 @@ func NewPacketFetcher(cfg *FlowFetcherConfig) (*PacketFetcher, error) {
 			TcIngressFlowParse:        nil,
 			TcxEgressFlowParse:        nil,
 			TcxIngressFlowParse:       nil,
+			XdpIngressFlowParse:       nil,
 			TcpRcvFentry:              nil,
 			TcpRcvKprobe:              nil,
 			KfreeSkb:                  nil,
 			RhNetworkEventsMonitoring: nil,
 		},
 		BpfMaps: ebpf.BpfMaps{
-			PacketRecord:  newObjects.PacketRecord,
-			FilterMap:     newObjects.FilterMap,
-			PeerFilterMap: newObjects.PeerFilterMap,
+			PacketRecord:     newObjects.PacketRecord,
+			PacketRingbuf:    newObjects.PacketRingbuf,
+			PcaScratch:       newObjects.PcaScratch,
+			FilterMap:        newObjects.FilterMap,
+			FilterMasks:      newObjects.FilterMasks,
+			FilterRules:      newObjects.FilterRules,
+			PeerFilterMap:    newObjects.PeerFilterMap,
+			FilterGeneration: newObjects.FilterGeneration,
+			FilterVerdicts:   newObjects.FilterVerdicts,
 		},
 	}
 
@@ -1391,15 +1788,9 @@ func NewPacketFetcher(cfg *FlowFetcherConfig) (*PacketFetcher, error) {
 		return nil, fmt.Errorf("programming flow filter: %w", err)
 	}
 
-	// read packets from igress+egress perf array
-	packets, err := perf.NewReader(objects.PacketRecord, os.Getpagesize())
-	if err != nil {
-		return nil, fmt.Errorf("accessing to perf: %w", err)
-	}
-
-	return &PacketFetcher{
+	fetcher := &PacketFetcher{
 		objects:                  &objects,
-		perfReader:               packets,
+		ringbufFlushPeriod:       flushPeriod,
 		egressFilters:            map[ifaces.Interface]*netlink.BpfFilter{},
 		ingressFilters:           map[ifaces.Interface]*netlink.BpfFilter{},
 		qdiscs:                   map[ifaces.Interface]*netlink.GenericQdisc{},
@@ -1409,7 +1800,26 @@ func NewPacketFetcher(cfg *FlowFetcherConfig) (*PacketFetcher, error) {
 		egressTCXLink:            map[ifaces.Interface]link.Link{},
 		ingressTCXLink:           map[ifaces.Interface]link.Link{},
 		lookupAndDeleteSupported: true, // this will be turned off later if found to be not supported
-	}, nil
+	}
+	if cfg.PCARingbuf {
+		// read packets from the ingress+egress ring buffer, shared by all the CPUs
+		if fetcher.ringbufReader, err = ringbuf.NewReader(objects.PacketRingbuf); err != nil {
+			return nil, fmt.Errorf("accessing to ringbuffer: %w", err)
+		}
+	} else if fetcher.perfReader, err = perf.NewReader(objects.PacketRecord, os.Getpagesize()); err != nil {
+		// read packets from igress+egress perf array
+		return nil, fmt.Errorf("accessing to perf: %w", err)
+	}
+	return fetcher, nil
+}
+
+// pcaRecordSize returns the size of a packet record in the ring buffer, for packets of which
+// snaplen bytes are captured
+func pcaRecordSize(snaplen int) uint32 {
+	if snaplen <= 0 || snaplen > pcaMaxSnaplen {
+		snaplen = pcaMaxSnaplen
+	}
+	return uint32(model.PacketMetaSize+snaplen) + ringbufRecordHeaderSize
 }
 
 func registerInterface(iface ifaces.Interface) (*netlink.GenericQdisc, netlink.Link, error) {
@@ -1688,6 +2098,11 @@ func (p *PacketFetcher) Close() error {
 			errs = append(errs, err)
 		}
 	}
+	if p.ringbufReader != nil {
+		if err := p.ringbufReader.Close(); err != nil {
+			errs = append(errs, err)
+		}
+	}
 	if p.objects != nil {
 		if err := p.objects.TcEgressPcaParse.Close(); err != nil {
 			errs = append(errs, err)
@@ -1704,6 +2119,12 @@ func (p *PacketFetcher) Close() error {
 		if err := p.objects.PacketRecord.Close(); err != nil {
 			errs = append(errs, err)
 		}
+		if err := p.objects.PacketRingbuf.Close(); err != nil {
+			errs = append(errs, err)
+		}
+		if err := p.objects.PcaScratch.Close(); err != nil {
+			errs = append(errs, err)
+		}
 		p.objects = nil
 	}
 	for iface, ef := range p.egressFilters {
@@ -1752,8 +2173,26 @@ func (p *PacketFetcher) Close() error {
 	return errors.New(`errors: "` + strings.Join(errStrings, `", "`) + `"`)
 }
 
-func (p *PacketFetcher) ReadPerf() (perf.Record, error) {
-	return p.perfReader.Read()
+// ReadPacket returns the next packet captured by the kernel, as a raw sample to be decoded with
+// model.DecodeRawPacket. Each sample is read into its own buffer, so it can be retained.
+func (p *PacketFetcher) ReadPacket() ([]byte, error) {
+	if p.ringbufReader != nil {
+		if p.ringbufFlushPeriod > 0 {
+			p.ringbufReader.SetDeadline(time.Now().Add(p.ringbufFlushPeriod))
+		}
+		record, err := p.ringbufReader.Read()
+		return record.RawSample, err
+	}
+	for {
+		record, err := p.perfReader.Read()
+		if err != nil {
+			return nil, err
+		}
+		if record.LostSamples == 0 {
+			return record.RawSample, nil
+		}
+		plog.Debugf("%d packets lost: the perf buffer of CPU %d is full", record.LostSamples, record.CPU)
+	}
 }
 
 func (p *PacketFetcher) LookupAndDeleteMap(met *metrics.Metrics) map[int][]*byte {
@@ -1790,6 +2229,104 @@ func (p *PacketFetcher) LookupAndDeleteMap(met *metrics.Metrics) map[int][]*byte
 	return packets
 }
 
+// configureMapsAllocation sets how the memory of the flows maps is allocated. By default, entries
+// are allocated on insertion, from the packet path. Preallocated maps avoid these allocations and
+// their failures, at the cost of reserving all the memory upfront. LRU maps are also preallocated,
+// and evict the least recently used entries instead of failing insertions when full.
+func configureMapsAllocation(spec *cilium.CollectionSpec, cfg *FlowFetcherConfig) {
+	if !cfg.PreallocateMaps && !cfg.LRUMaps {
+		return
+	}
+	if spec.Maps[dnsLatencyMap].MaxEntries > uint32(cfg.CacheMaxSize) {
+		// avoid preallocating the large default size
+		spec.Maps[dnsLatencyMap].MaxEntries = uint32(cfg.CacheMaxSize)
+	}
+	for _, name := range []string{aggregatedFlowsMap, aggregatedFlowsPerCPUMap, aggregatedFlowsV4Map, additionalFlowMetrics, dnsLatencyMap} {
+		mapSpec := spec.Maps[name]
+		mapSpec.Flags &^= unix.BPF_F_NO_PREALLOC
+		if !cfg.LRUMaps {
+			continue
+		}
+		switch mapSpec.Type {
+		case cilium.Hash:
+			if name == aggregatedFlowsMap || name == aggregatedFlowsV4Map {
+				// bpf_spin_lock is not supported in LRU maps: keep it as a preallocated hash map
+				continue
+			}
+			mapSpec.Type = cilium.LRUHash
+		case cilium.PerCPUHash:
+			mapSpec.Type = cilium.LRUCPUHash
+		}
+	}
+}
+
+// dnsQueriesLRU returns whether the DNS queries are kept in a bounded LRU map, where the
+// queries without response are aged by the kernel instead of being swept from userspace
+func dnsQueriesLRU(cfg *FlowFetcherConfig) bool {
+	return cfg.EnableDNSTracker && cfg.DNSTrackingLRUSize > 0 && !cfg.UseEbpfManager
+}
+
+// configureDNSQueriesMap turns the DNS queries map into a preallocated LRU map of the configured
+// size, when enabled
+func configureDNSQueriesMap(spec *cilium.CollectionSpec, cfg *FlowFetcherConfig) {
+	if !dnsQueriesLRU(cfg) {
+		return
+	}
+	mapSpec := spec.Maps[dnsLatencyMap]
+	mapSpec.Type = cilium.LRUHash
+	mapSpec.Flags &^= unix.BPF_F_NO_PREALLOC
+	mapSpec.MaxEntries = uint32(cfg.DNSTrackingLRUSize)
+}
+
+// configureRTTSamplesMaps shrinks the maps of the last RTT sample of each socket that the loaded
+// RTT hooks don't use, either because they aren't loaded or because they don't rate-limit the
+// samples. The socket local storage of the fentry hook can't be shrunk: it is replaced by a single
+// entry array. The hooks only access the maps when rtt_sampling_interval is set.
+func configureRTTSamplesMaps(spec *cilium.CollectionSpec, fentry, kprobe bool, samplingInterval time.Duration) {
+	if !fentry || samplingInterval <= 0 {
+		mapSpec := spec.Maps[rttSkSamplesMap]
+		mapSpec.Type = cilium.Array
+		mapSpec.Flags = 0
+		mapSpec.MaxEntries = 1
+	}
+	if !kprobe || samplingInterval <= 0 {
+		spec.Maps[rttSamplesMap].MaxEntries = 1
+	}
+}
+
+// trackLRUEvictions returns whether the flows inserted by the kernel are counted to estimate the
+// LRU evictions. It requires all the flows to be read from userspace.
+func trackLRUEvictions(cfg *FlowFetcherConfig) bool {
+	return cfg.LRUMaps && cfg.EnablePerCPUAggregation && !cfg.EnableFlowsExpiry && !cfg.UseEbpfManager
+}
+
+// adaptiveSamplingEnabled returns whether the sampling rate is raised from userspace when the
+// flows map is under pressure
+func adaptiveSamplingEnabled(cfg *FlowFetcherConfig) bool {
+	return cfg.AdaptiveSamplingMax > max(cfg.Sampling, 1) && !cfg.UseEbpfManager
+}
+
+// flowsSketchEnabled returns whether the flows that can't be inserted in the flows map are
+// aggregated in the sketch tier, instead of being sent via ringbuffer
+func flowsSketchEnabled(cfg *FlowFetcherConfig) bool {
+	return cfg.FlowsSketchSlots > 0 && !cfg.UseEbpfManager
+}
+
+// ringbufFlushPeriod returns the period at which the direct flows ring buffer is read when the
+// kernel doesn't wake up userspace for each record, or zero if wakeups aren't batched
+func ringbufFlushPeriod(cfg *FlowFetcherConfig) time.Duration {
+	if cfg.RingbufWakeupBatch <= 1 || cfg.UseEbpfManager {
+		return 0
+	}
+	return cfg.RingbufFlushPeriod
+}
+
+// compactIPv4Keys returns whether the IPv4 flows are aggregated in the aggregated_flows_v4 map,
+// keyed by a compact flow identifier. It is not supported with the per-CPU aggregation.
+func compactIPv4Keys(cfg *FlowFetcherConfig) bool {
+	return cfg.EnableCompactIPv4Keys && !cfg.EnablePerCPUAggregation && !cfg.UseEbpfManager
+}
+
 func setVariable(spec *cilium.CollectionSpec, key string, value interface{}) error {
 	if err := spec.Variables[key].Set(value); err != nil {
 		return fmt.Errorf("setting %s: %w", key, err)
@@ -1803,8 +2340,10 @@ func configureFlowSpecVariables(spec *cilium.CollectionSpec, cfg *FlowFetcherCon
 		traceMsgs = 1
 	}
 	enableRtt := 0
+	rttSamplingInterval := time.Duration(0)
 	if cfg.EnableRTT {
 		enableRtt = 1
+		rttSamplingInterval = max(cfg.RTTSamplingInterval, 0)
 	}
 	enableDNSTracking := 0
 	dnsTrackerPort := uint16(dnsDefaultPort)
@@ -1825,6 +2364,8 @@ func configureFlowSpecVariables(spec *cilium.CollectionSpec, cfg *FlowFetcherCon
 	} else {
 		spec.Maps[filterMap].MaxEntries = 1
 		spec.Maps[peerFilterMap].MaxEntries = 1
+		spec.Maps[filterMasksMap].MaxEntries = 1
+		spec.Maps[filterVerdictsMap].MaxEntries = 1
 	}
 	enableNetworkEventsMonitoring := 0
 	if cfg.EnableNetworkEventsMonitoring {
@@ -1838,6 +2379,60 @@ func configureFlowSpecVariables(spec *cilium.CollectionSpec, cfg *FlowFetcherCon
 	if cfg.EnablePktTranslation {
 		enablePktTranslation = 1
 	}
+	enablePerCPUAggregation := 0
+	if cfg.EnablePerCPUAggregation {
+		enablePerCPUAggregation = 1
+		spec.Maps[aggregatedFlowsMap].MaxEntries = 1
+	} else {
+		spec.Maps[aggregatedFlowsPerCPUMap].MaxEntries = 1
+	}
+	enableAdaptiveSampling := 0
+	if adaptiveSamplingEnabled(cfg) {
+		enableAdaptiveSampling = 1
+	}
+	enableFlowsSketch := 0
+	flowsSketchSlots := uint32(1)
+	if flowsSketchEnabled(cfg) {
+		enableFlowsSketch = 1
+		flowsSketchSlots = uint32(cfg.FlowsSketchSlots)
+		// one half of the slots per epoch
+		spec.Maps[heavyHittersMap].MaxEntries = 2 * flowsSketchSlots
+	} else {
+		spec.Maps[flowsSketchMap].MaxEntries = 1
+		spec.Maps[heavyHittersMap].MaxEntries = 1
+	}
+	enableCompactIPv4Keys := 0
+	if compactIPv4Keys(cfg) {
+		enableCompactIPv4Keys = 1
+	} else {
+		spec.Maps[aggregatedFlowsV4Map].MaxEntries = 1
+	}
+	enableFlowLatencies := 0
+	if cfg.EnableBpfStats {
+		enableFlowLatencies = 1
+	} else {
+		spec.Maps[flowLatenciesMap].MaxEntries = 1
+	}
+	trackFlowsInserts := 0
+	if trackLRUEvictions(cfg) {
+		trackFlowsInserts = 1
+	}
+	enableFlowsExpiry := 0
+	flowsExpiryPeriod := cfg.FlowsIdleTimeout
+	if cfg.EnableFlowsExpiry {
+		enableFlowsExpiry = 1
+		if cfg.DNSFlowsTimeout < flowsExpiryPeriod {
+			flowsExpiryPeriod = cfg.DNSFlowsTimeout
+		}
+		if flowsExpiryPeriod <= 0 {
+			return fmt.Errorf("flows expiry requires positive idle and DNS timeouts")
+		}
+	}
+	ringbufWakeupThreshold := uint32(0)
+	if ringbufFlushPeriod(cfg) > 0 {
+		ringbufWakeupThreshold = uint32(cfg.RingbufWakeupBatch) *
+			(uint32(unsafe.Sizeof(ebpf.BpfFlowRecordT{})) + ringbufRecordHeaderSize)
+	}
 	// When adding constants here, remember to delete them in NewPacketFetcher
 	variables := []variablesMapping{
 		{constSampling, uint32(cfg.Sampling)},
@@ -1850,6 +2445,19 @@ func configureFlowSpecVariables(spec *cilium.CollectionSpec, cfg *FlowFetcherCon
 		{constEnableNetworkEventsMonitoring, uint8(enableNetworkEventsMonitoring)},
 		{constNetworkEventsMonitoringGroupID, uint8(networkEventsMonitoringGroupID)},
 		{constEnablePktTranslation, uint8(enablePktTranslation)},
+		{constEnablePerCPUAggregation, uint8(enablePerCPUAggregation)},
+		{constEnableFlowsExpiry, uint8(enableFlowsExpiry)},
+		{constFlowsExpiryPeriod, uint64(flowsExpiryPeriod)},
+		{constFlowsIdleTimeout, uint64(cfg.FlowsIdleTimeout)},
+		{constDNSFlowsTimeout, uint64(cfg.DNSFlowsTimeout)},
+		{constTrackFlowsInserts, uint8(trackFlowsInserts)},
+		{constEnableCompactIPv4Keys, uint8(enableCompactIPv4Keys)},
+		{constEnableFlowsSketch, uint8(enableFlowsSketch)},
+		{constFlowsSketchSlots, flowsSketchSlots},
+		{constEnableAdaptiveSampling, uint8(enableAdaptiveSampling)},
+		{constRingbufWakeupThreshold, ringbufWakeupThreshold},
+		{constEnableFlowLatencies, uint8(enableFlowLatencies)},
+		{constRTTSamplingInterval, uint64(rttSamplingInterval)},
 	}
 
 	for _, mapping := range variables {
@@ -0,0 +1,354 @@
+package tracer
+
+import (
+	"encoding/binary"
+	"errors"
+	"runtime"
+	"unsafe"
+
+	"github.com/netobserv/netobserv-ebpf-agent/pkg/ebpf"
+	"github.com/netobserv/netobserv-ebpf-agent/pkg/metrics"
+
+	cilium "github.com/cilium/ebpf"
+	"golang.org/x/sys/unix"
+)
+
+// This file contains the batched implementation of the maps eviction, used on kernels supporting
+// BPF_MAP_LOOKUP_AND_DELETE_BATCH (>=5.6)
+
+const (
+	// number of flows read and deleted by each batch syscall
+	batchLookupAndDeleteSize = 1024
+	// number of flows read and deleted by each batch syscall on per-CPU maps, where each flow
+	// has one value per CPU
+	perCPUBatchLookupAndDeleteSize = 256
+)
+
+// flowsBatch holds the preallocated keys and values buffers used for batch lookups,
+// so they are reused across evictions
+type flowsBatch struct {
+	ids        []ebpf.BpfFlowId
+	v4IDs      []ebpf.BpfFlowIdV4
+	metrics    []ebpf.BpfFlowMetrics
+	perCPU     perCPUBatch[ebpf.BpfFlowId, ebpf.BpfFlowMetrics]
+	additional perCPUBatch[ebpf.BpfFlowId, ebpf.BpfAdditionalMetrics]
+	nCPU       int
+}
+
+func newFlowsBatch(perCPUAggregation, compactIPv4Keys bool) (*flowsBatch, error) {
+	nCPU, err := cilium.PossibleCPU()
+	if err != nil {
+		return nil, err
+	}
+	b := &flowsBatch{
+		nCPU:       nCPU,
+		ids:        make([]ebpf.BpfFlowId, batchLookupAndDeleteSize),
+		metrics:    make([]ebpf.BpfFlowMetrics, batchLookupAndDeleteSize),
+		additional: newPerCPUBatch[ebpf.BpfFlowId, ebpf.BpfAdditionalMetrics](perCPUBatchLookupAndDeleteSize, nCPU),
+	}
+	if perCPUAggregation {
+		b.perCPU = newPerCPUBatch[ebpf.BpfFlowId, ebpf.BpfFlowMetrics](perCPUBatchLookupAndDeleteSize, nCPU)
+	}
+	if compactIPv4Keys {
+		b.v4IDs = make([]ebpf.BpfFlowIdV4, batchLookupAndDeleteSize)
+	}
+	return b, nil
+}
+
+// batchLookupAndDeleteMap reads and removes all the entries from the eBPF maps into m.flows, as
+// LookupAndDeleteMap, but reading many entries per syscall. It returns cilium.ErrNotSupported
+// if the kernel does not support batch operations.
+func (m *FlowFetcher) batchLookupAndDeleteMap(met *metrics.Metrics) error {
+	if m.batch == nil {
+		batch, err := newFlowsBatch(m.perCPUAggregation, m.compactIPv4Keys)
+		if err != nil {
+			return err
+		}
+		m.batch = batch
+		m.flows.allocations++
+	}
+	b := m.batch
+
+	// The aggregated_flows hash map is always drained first, even if it remains empty in per-CPU
+	// mode, as it verifies the kernel support of batch operations.
+	countMain, err := batchLookupAndDelete(m.objects.AggregatedFlows, b.ids, b.metrics, func(n int) {
+		for i := 0; i < n; i++ {
+			m.flows.addBase(&b.ids[i], &b.metrics[i])
+		}
+	})
+	if err == nil && m.perCPUAggregation {
+		var countPerCPU int
+		countPerCPU, err = b.perCPU.lookupAndDelete(m.objects.AggregatedFlowsPercpu, func(n int) {
+			for i := 0; i < n; i++ {
+				m.flows.addPerCPU(&b.perCPU.keys[i], b.perCPU.valuesOf(i))
+			}
+		})
+		countMain += countPerCPU
+	}
+	if err == nil && m.compactIPv4Keys {
+		var countV4 int
+		countV4, err = batchLookupAndDelete(m.objects.AggregatedFlowsV4, b.v4IDs, b.metrics, func(n int) {
+			for i := 0; i < n; i++ {
+				m.flows.addBaseV4(&b.v4IDs[i], &b.metrics[i])
+			}
+		})
+		countMain += countV4
+	}
+	if err != nil {
+		if countMain == 0 && errors.Is(err, cilium.ErrNotSupported) {
+			return err
+		}
+		log.WithError(err).Warnf("couldn't batch lookup/delete flow entries")
+		met.Errors.WithErrorName("flow-fetcher", "CannotDeleteFlows", metrics.HighSeverity).Inc()
+	}
+
+	countAdditional, err := b.additional.lookupAndDelete(m.objects.AdditionalFlowMetrics, func(n int) {
+		for i := 0; i < n; i++ {
+			flow := m.flows.addAdditional(&b.additional.keys[i], b.additional.valuesOf(i))
+			m.increaseEnrichmentStats(met, flow)
+		}
+	})
+	if err != nil {
+		log.WithError(err).Warnf("couldn't batch lookup/delete additional metrics entries")
+		met.Errors.WithErrorName("flow-fetcher", "CannotDeleteAdditionalMetric", metrics.HighSeverity).Inc()
+	}
+	met.BufferSizeGauge.WithBufferName("additionalmap").Set(float64(countAdditional))
+	met.BufferSizeGauge.WithBufferName("flowmap").Set(float64(countMain))
+	met.BufferSizeGauge.WithBufferName("merged-maps").Set(float64(len(m.flows.entries)))
+
+	m.ReadGlobalCounter(met)
+	return nil
+}
+
+// batchLookupAndDelete drains the provided map, invoking onBatch after each batch syscall with
+// the number of entries that have been read into the keys and values slices. The slices are
+// overwritten by the next batch. It must not be used for per-CPU maps: see perCPUBatch.
+func batchLookupAndDelete[K any, V any](bpfMap *cilium.Map, keys []K, values []V, onBatch func(n int)) (int, error) {
+	var cursor cilium.MapBatchCursor
+	return drainBatches(func() (int, error) {
+		return bpfMap.BatchLookupAndDelete(&cursor, keys, values, nil)
+	}, onBatch)
+}
+
+// batchLookupSlice reads, without deleting them, the entries of the provided map from the cursor
+// position, until at least maxEntries have been read. As batchLookupAndDelete, it invokes onBatch
+// after each batch syscall. It returns the number of entries read, and whether the end of
+// the map has been reached, in which case the cursor is reset to start a new walk.
+func batchLookupSlice[K any, V any](bpfMap *cilium.Map, cursor *cilium.MapBatchCursor, keys []K, values []V, maxEntries int, onBatch func(n int)) (int, bool, error) {
+	return walkBatches(func() (int, error) {
+		return bpfMap.BatchLookup(cursor, keys, values, nil)
+	}, func() {
+		*cursor = cilium.MapBatchCursor{}
+	}, maxEntries, onBatch)
+}
+
+// drainBatches invokes lookup, which reads and deletes the next batch of entries, until the end of
+// the map is reached.
+func drainBatches(lookup func() (int, error), onBatch func(n int)) (int, error) {
+	count := 0
+	for {
+		n, err := lookup()
+		if n > 0 {
+			count += n
+			onBatch(n)
+		}
+		if errors.Is(err, cilium.ErrKeyNotExist) {
+			// end of the map reached
+			return count, nil
+		}
+		if err != nil {
+			return count, err
+		}
+		if n == 0 {
+			return count, nil
+		}
+	}
+}
+
+// walkBatches invokes lookup, which reads the next batch of entries, until at least maxEntries have
+// been read or the end of the map is reached, in which case the walk is reset.
+func walkBatches(lookup func() (int, error), reset func(), maxEntries int, onBatch func(n int)) (int, bool, error) {
+	count := 0
+	for count < maxEntries {
+		n, err := lookup()
+		if n > 0 {
+			count += n
+			onBatch(n)
+		}
+		if errors.Is(err, cilium.ErrKeyNotExist) || (err == nil && n == 0) {
+			// end of the map reached
+			reset()
+			return count, true, nil
+		}
+		if err != nil {
+			return count, false, err
+		}
+	}
+	return count, false, nil
+}
+
+// perCPUBatch holds the reusable buffers of the batch operations on a per-CPU map. The syscalls
+// are issued directly, because cilium/ebpf allocates a values buffer on each per-CPU batch, and
+// drops its errors: an ENOSPC, returned when a hash bucket is larger than the batch, would end
+// the walk as if the end of the map had been reached.
+type perCPUBatch[K any, V any] struct {
+	keys []K
+	// values of the entries, by key then CPU
+	values []V
+	// raw values written by the kernel, where each per-CPU value is aligned to 8 bytes
+	valueBuf []byte
+	nCPU     int
+}
+
+func newPerCPUBatch[K any, V any](size, nCPU int) perCPUBatch[K, V] {
+	b := perCPUBatch[K, V]{nCPU: nCPU}
+	b.resize(size)
+	return b
+}
+
+func (b *perCPUBatch[K, V]) resize(size int) {
+	b.keys = make([]K, size)
+	b.values = make([]V, size*b.nCPU)
+	// the kernel aligns the values to 8 bytes
+	b.valueBuf = make([]byte, size*b.nCPU*perCPUValueStride[V]())
+}
+
+// valuesOf returns the per-CPU values of the i-th entry of the last batch
+func (b *perCPUBatch[K, V]) valuesOf(i int) []V {
+	return b.values[i*b.nCPU : (i+1)*b.nCPU]
+}
+
+// perCPUBatchCursor is the position of a batch walk through a per-CPU map
+type perCPUBatchCursor struct {
+	batch   []byte
+	started bool
+}
+
+// arrayBatchCursor returns the position of a batch walk through a per-CPU array that starts at
+// the provided index. The cursor of an array is the last index that has been read.
+func arrayBatchCursor(start uint32) perCPUBatchCursor {
+	if start == 0 {
+		return perCPUBatchCursor{}
+	}
+	cursor := perCPUBatchCursor{batch: make([]byte, 4), started: true}
+	binary.NativeEndian.PutUint32(cursor.batch, start-1)
+	return cursor
+}
+
+// batchAttr is the bpf_attr of the BPF_MAP_*_BATCH commands
+type batchAttr struct {
+	inBatch   uint64
+	outBatch  uint64
+	keys      uint64
+	values    uint64
+	count     uint32
+	mapFd     uint32
+	elemFlags uint64
+	flags     uint64
+}
+
+// lookupAndDelete drains the provided per-CPU map, as batchLookupAndDelete
+func (b *perCPUBatch[K, V]) lookupAndDelete(bpfMap *cilium.Map, onBatch func(n int)) (int, error) {
+	var cursor perCPUBatchCursor
+	return drainBatches(func() (int, error) {
+		return b.next(bpfMap, unix.BPF_MAP_LOOKUP_AND_DELETE_BATCH, &cursor)
+	}, onBatch)
+}
+
+// lookupSlice reads the next slice of entries of the provided per-CPU map, as batchLookupSlice
+func (b *perCPUBatch[K, V]) lookupSlice(bpfMap *cilium.Map, cursor *perCPUBatchCursor, maxEntries int, onBatch func(n int)) (int, bool, error) {
+	return walkBatches(func() (int, error) {
+		return b.next(bpfMap, unix.BPF_MAP_LOOKUP_BATCH, cursor)
+	}, func() {
+		*cursor = perCPUBatchCursor{}
+	}, maxEntries, onBatch)
+}
+
+// next reads into the buffers the next batch of entries from the cursor position, deleting them
+// if cmd is BPF_MAP_LOOKUP_AND_DELETE_BATCH. As the cilium/ebpf batch operations, it returns
+// cilium.ErrKeyNotExist along with the last entries of the map. When a hash bucket doesn't fit
+// in the batch, the buffers are grown and the batch is retried.
+func (b *perCPUBatch[K, V]) next(bpfMap *cilium.Map, cmd int, cursor *perCPUBatchCursor) (int, error) {
+	if cursor.batch == nil {
+		// hash maps require a u32 cursor, and arrays a key-sized one
+		cursor.batch = make([]byte, max(int(bpfMap.KeySize()), 4))
+	}
+	for {
+		attr := batchAttr{
+			outBatch: uint64(uintptr(unsafe.Pointer(&cursor.batch[0]))),
+			keys:     uint64(uintptr(unsafe.Pointer(&b.keys[0]))),
+			values:   uint64(uintptr(unsafe.Pointer(&b.valueBuf[0]))),
+			count:    uint32(len(b.keys)),
+			mapFd:    uint32(bpfMap.FD()),
+		}
+		if cursor.started {
+			attr.inBatch = attr.outBatch
+		}
+		_, _, errno := unix.Syscall(unix.SYS_BPF, uintptr(cmd), uintptr(unsafe.Pointer(&attr)), unsafe.Sizeof(attr))
+		runtime.KeepAlive(cursor.batch)
+		runtime.KeepAlive(b.keys)
+		runtime.KeepAlive(b.valueBuf)
+		if errno == unix.ENOSPC && attr.count == 0 && len(b.keys) < int(bpfMap.MaxEntries()) {
+			// a hash bucket is larger than the batch
+			b.resize(min(2*len(b.keys), int(bpfMap.MaxEntries())))
+			continue
+		}
+		if errno != 0 && errno != unix.ENOENT {
+			return 0, errno
+		}
+		n := int(attr.count)
+		cursor.started = true
+		decodePerCPUValues(b.values[:n*b.nCPU], b.valueBuf)
+		if errno == unix.ENOENT {
+			return n, cilium.ErrKeyNotExist
+		}
+		return n, nil
+	}
+}
+
+// update writes the first n entries of the buffers into the provided per-CPU map
+func (b *perCPUBatch[K, V]) update(bpfMap *cilium.Map, n int) error {
+	if n == 0 {
+		return nil
+	}
+	encodePerCPUValues(b.values[:n*b.nCPU], b.valueBuf)
+	attr := batchAttr{
+		keys:   uint64(uintptr(unsafe.Pointer(&b.keys[0]))),
+		values: uint64(uintptr(unsafe.Pointer(&b.valueBuf[0]))),
+		count:  uint32(n),
+		mapFd:  uint32(bpfMap.FD()),
+	}
+	_, _, errno := unix.Syscall(unix.SYS_BPF, unix.BPF_MAP_UPDATE_BATCH, uintptr(unsafe.Pointer(&attr)), unsafe.Sizeof(attr))
+	runtime.KeepAlive(b.keys)
+	runtime.KeepAlive(b.valueBuf)
+	if errno != 0 {
+		return errno
+	}
+	return nil
+}
+
+// perCPUValueStride returns the size of each per-CPU value written by the kernel
+func perCPUValueStride[V any]() int {
+	var v V
+	return (int(unsafe.Sizeof(v)) + 7) &^ 7
+}
+
+// decodePerCPUValues copies the values written by the kernel, each aligned to 8 bytes, into the
+// values slice
+func decodePerCPUValues[V any](values []V, buf []byte) {
+	stride := perCPUValueStride[V]()
+	for i := range values {
+		size := int(unsafe.Sizeof(values[i]))
+		copy(unsafe.Slice((*byte)(unsafe.Pointer(&values[i])), size), buf[i*stride:i*stride+size])
+	}
+}
+
+// encodePerCPUValues copies the values into the buffer, each aligned to 8 bytes, as expected by
+// the kernel
+func encodePerCPUValues[V any](values []V, buf []byte) {
+	stride := perCPUValueStride[V]()
+	for i := range values {
+		size := int(unsafe.Sizeof(values[i]))
+		copy(buf[i*stride:i*stride+size], unsafe.Slice((*byte)(unsafe.Pointer(&values[i])), size))
+	}
+}
@@ -0,0 +1,189 @@
+package tracer
+
+import (
+	"net"
+	"os"
+	"testing"
+	"time"
+
+	cilium "github.com/cilium/ebpf"
+	"github.com/gopacket/gopacket"
+	"github.com/gopacket/gopacket/layers"
+	"github.com/netobserv/netobserv-ebpf-agent/pkg/metrics"
+	"github.com/stretchr/testify/require"
+	"k8s.io/apimachinery/pkg/util/intstr"
+)
+
+// The datapath benchmarks run the eBPF programs on synthetic packets via BPF_PROG_TEST_RUN, and
+// report the time spent by the kernel per packet. They need the privileges to load eBPF
+// programs, and are skipped otherwise: see the bench-bpf Makefile target.
+
+const benchCacheMaxSize = 1 << 16
+
+// benchPacket is a synthetic packet, with the offset of the source port, changed to create new
+// flows
+type benchPacket struct {
+	name          string
+	data          []byte
+	srcPortOffset int
+}
+
+func newBenchPacket(b *testing.B, name string, ipv6 bool, proto layers.IPProtocol, l4 ...gopacket.SerializableLayer) benchPacket {
+	eth := &layers.Ethernet{
+		SrcMAC:       net.HardwareAddr{0x0a, 0x58, 0x0a, 0x80, 0x00, 0x01},
+		DstMAC:       net.HardwareAddr{0x0a, 0x58, 0x0a, 0x80, 0x00, 0x02},
+		EthernetType: layers.EthernetTypeIPv4,
+	}
+	pkt := benchPacket{name: name, srcPortOffset: 14 + 20}
+	var ip interface {
+		gopacket.NetworkLayer
+		gopacket.SerializableLayer
+	} = &layers.IPv4{Version: 4, IHL: 5, TTL: 64, Protocol: proto,
+		SrcIP: net.IPv4(10, 128, 0, 1), DstIP: net.IPv4(10, 128, 0, 2)}
+	if ipv6 {
+		eth.EthernetType = layers.EthernetTypeIPv6
+		ip = &layers.IPv6{Version: 6, HopLimit: 64, NextHeader: proto,
+			SrcIP: net.ParseIP("fd00::1"), DstIP: net.ParseIP("fd00::2")}
+		pkt.srcPortOffset = 14 + 40
+	}
+	switch l := l4[0].(type) {
+	case *layers.TCP:
+		require.NoError(b, l.SetNetworkLayerForChecksum(ip))
+	case *layers.UDP:
+		require.NoError(b, l.SetNetworkLayerForChecksum(ip))
+	}
+	buf := gopacket.NewSerializeBuffer()
+	require.NoError(b, gopacket.SerializeLayers(buf, gopacket.SerializeOptions{FixLengths: true, ComputeChecksums: true},
+		append([]gopacket.SerializableLayer{eth, ip}, l4...)...))
+	pkt.data = buf.Bytes()
+	return pkt
+}
+
+func benchPackets(b *testing.B) []benchPacket {
+	payload := gopacket.Payload(make([]byte, 100))
+	dns := &layers.DNS{ID: 0x1234, RD: true, QDCount: 1,
+		Questions: []layers.DNSQuestion{{Name: []byte("example.com"), Type: layers.DNSTypeA, Class: layers.DNSClassIN}}}
+	return []benchPacket{
+		newBenchPacket(b, "ipv4-tcp", false, layers.IPProtocolTCP,
+			&layers.TCP{SrcPort: 40000, DstPort: 80, ACK: true, Window: 1024}, payload),
+		newBenchPacket(b, "ipv4-udp", false, layers.IPProtocolUDP,
+			&layers.UDP{SrcPort: 40000, DstPort: 4789}, payload),
+		newBenchPacket(b, "ipv4-dns", false, layers.IPProtocolUDP,
+			&layers.UDP{SrcPort: 40000, DstPort: 53}, dns),
+		newBenchPacket(b, "ipv6-tcp", true, layers.IPProtocolTCP,
+			&layers.TCP{SrcPort: 40000, DstPort: 80, ACK: true, Window: 1024}, payload),
+		newBenchPacket(b, "ipv6-udp", true, layers.IPProtocolUDP,
+			&layers.UDP{SrcPort: 40000, DstPort: 4789}, payload),
+	}
+}
+
+func benchFilterRules() []*FilterConfig {
+	return []*FilterConfig{
+		{FilterIPCIDR: "10.0.0.0/8", FilterProtocol: "TCP", FilterPort: intstr.FromString("80-90"), FilterAction: "Accept"},
+		{FilterIPCIDR: "10.128.0.0/14", FilterProtocol: "UDP", FilterAction: "Accept"},
+		{FilterIPCIDR: "fd00::/8", FilterAction: "Accept"},
+		{FilterIPCIDR: "169.254.0.0/16", FilterAction: "Reject"},
+	}
+}
+
+func skipUnprivileged(tb testing.TB) {
+	if os.Geteuid() != 0 {
+		tb.Skip("the privileges to create eBPF maps and load eBPF programs are needed")
+	}
+}
+
+// runBenchPackets runs the program b.N times on the packet, and reports the time per packet.
+// With newFlows, each run changes the source port so that it creates a new flow, and the flows
+// are evicted via evict once all the ports have been used.
+func runBenchPackets(b *testing.B, prog *cilium.Program, pkt benchPacket, newFlows bool, evict func()) {
+	data := append([]byte{}, pkt.data...)
+	if !newFlows {
+		_, perRun, err := prog.Benchmark(data, b.N, b.ResetTimer)
+		require.NoError(b, err)
+		b.ReportMetric(float64(perRun.Nanoseconds()), "ns/packet")
+		return
+	}
+	var total time.Duration
+	for i := 0; i < b.N; i++ {
+		if i%benchCacheMaxSize == 0 && i > 0 && evict != nil {
+			b.StopTimer()
+			evict()
+			b.StartTimer()
+		}
+		flow := i % benchCacheMaxSize
+		data[pkt.srcPortOffset], data[pkt.srcPortOffset+1] = byte(flow>>8), byte(flow)
+		_, perRun, err := prog.Benchmark(data, 1, nil)
+		require.NoError(b, err)
+		total += perRun
+	}
+	b.ReportMetric(float64(total.Nanoseconds())/float64(b.N), "ns/packet")
+}
+
+func BenchmarkDatapathFlows(b *testing.B) {
+	skipUnprivileged(b)
+	base := FlowFetcherConfig{
+		EnableIngress: true,
+		EnableEgress:  true,
+		Sampling:      1,
+		CacheMaxSize:  benchCacheMaxSize,
+	}
+	configs := []struct {
+		name   string
+		config func(cfg *FlowFetcherConfig)
+	}{
+		{name: "default", config: func(_ *FlowFetcherConfig) {}},
+		{name: "sampling", config: func(cfg *FlowFetcherConfig) { cfg.Sampling = 50 }},
+		{name: "dns", config: func(cfg *FlowFetcherConfig) {
+			cfg.EnableDNSTracker = true
+			cfg.DNSTrackerPort = 53
+		}},
+		{name: "filter", config: func(cfg *FlowFetcherConfig) {
+			cfg.EnableFlowFilter = true
+			cfg.FilterConfig = benchFilterRules()
+		}},
+		{name: "percpu", config: func(cfg *FlowFetcherConfig) { cfg.EnablePerCPUAggregation = true }},
+		{name: "compact-ipv4", config: func(cfg *FlowFetcherConfig) { cfg.EnableCompactIPv4Keys = true }},
+	}
+	met := metrics.NewMetrics(&metrics.Settings{})
+	for _, c := range configs {
+		cfg := base
+		c.config(&cfg)
+		fetcher, err := NewFlowFetcher(&cfg)
+		require.NoError(b, err)
+		evict := func() { fetcher.LookupAndDeleteMap(met) }
+		for _, pkt := range benchPackets(b) {
+			b.Run(c.name+"/"+pkt.name+"/existing-flow", func(b *testing.B) {
+				runBenchPackets(b, fetcher.objects.TcIngressFlowParse, pkt, false, evict)
+			})
+			b.Run(c.name+"/"+pkt.name+"/new-flow", func(b *testing.B) {
+				runBenchPackets(b, fetcher.objects.TcIngressFlowParse, pkt, true, evict)
+				evict()
+			})
+		}
+		require.NoError(b, fetcher.Close())
+	}
+}
+
+func BenchmarkDatapathPCA(b *testing.B) {
+	skipUnprivileged(b)
+	for _, ringbuf := range []bool{false, true} {
+		fetcher, err := NewPacketFetcher(&FlowFetcherConfig{
+			EnableIngress: true,
+			EnableEgress:  true,
+			EnablePCA:     true,
+			PCARingbuf:    ringbuf,
+			FilterConfig:  benchFilterRules(),
+		})
+		require.NoError(b, err)
+		mode := "perf"
+		if ringbuf {
+			mode = "ringbuf"
+		}
+		for _, pkt := range benchPackets(b) {
+			b.Run(mode+"/"+pkt.name, func(b *testing.B) {
+				runBenchPackets(b, fetcher.objects.TcIngressPcaParse, pkt, false, nil)
+			})
+		}
+		require.NoError(b, fetcher.Close())
+	}
+}
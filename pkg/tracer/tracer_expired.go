@@ -0,0 +1,257 @@
+package tracer
+
+import (
+	"errors"
+	"time"
+
+	"github.com/netobserv/netobserv-ebpf-agent/pkg/ebpf"
+	"github.com/netobserv/netobserv-ebpf-agent/pkg/metrics"
+	"github.com/netobserv/netobserv-ebpf-agent/pkg/model"
+
+	cilium "github.com/cilium/ebpf"
+	"github.com/gavv/monotime"
+)
+
+// This file contains the incremental implementation of the maps eviction, which walks the maps
+// in slices and only evicts the expired flows. It relies on batch operations (Kernel>=5.6).
+
+// expiredFlowsWalk holds the state of the incremental walk through the eBPF maps, along with the
+// buffers that are reused across its steps
+type expiredFlowsWalk struct {
+	cursor            cilium.MapBatchCursor
+	perCPUCursor      perCPUBatchCursor
+	v4Cursor          cilium.MapBatchCursor
+	additionalCursor  perCPUBatchCursor
+	flowsWrapped      bool
+	walkedEntries     int
+	v4Wrapped         bool
+	expired           []ebpf.BpfFlowId
+	expiredV4         []ebpf.BpfFlowIdV4
+	metrics           ebpf.BpfFlowMetrics
+	perCPUMetrics     []ebpf.BpfFlowMetrics
+	additionalMetrics []ebpf.BpfAdditionalMetrics
+}
+
+// LookupAndDeleteExpired reads the next slice of at least maxEntries entries from the eBPF maps,
+// and removes from them the flows that have been idle for idleTimeout, or active for activeTimeout.
+// Successive invocations walk the whole maps: it returns the number of entries visited in the
+// slice, and whether the end of the flows map has been reached, so the next invocation starts a
+// new walk. The support of batch operations is verified by the first invocation, which evicts all
+// the flows as LookupAndDeleteMap: the caller must then check IncrementalEvictionSupported.
+// The returned slice is reused by the next invocation.
+func (m *FlowFetcher) LookupAndDeleteExpired(met *metrics.Metrics, maxEntries int, idleTimeout, activeTimeout time.Duration) ([]model.BpfFlowEntry, int, bool) {
+	if m.batch == nil || !m.batchLookupSupported {
+		// the support of batch operations is verified by the first full eviction. If they are not
+		// supported, the caller is expected to evict the whole map periodically instead.
+		flows := m.LookupAndDeleteMap(met)
+		return flows, len(flows), true
+	}
+	m.flows.reset()
+	defer func() {
+		met.LookupAndDeleteAllocations.Observe(float64(m.flows.allocations))
+	}()
+	// it's important that this monotonic timer reports same or approximate values as kernel-side bpf_ktime_get_ns()
+	now := uint64(monotime.Now())
+	isExpired := func(start, end uint64) bool {
+		// timestamps written after "now" was taken are not considered
+		return (end < now && time.Duration(now-end) >= idleTimeout) ||
+			(start < now && time.Duration(now-start) >= activeTimeout)
+	}
+	b := m.batch
+	w := &m.expiredWalk
+
+	// When compact IPv4 keys are enabled, the IPv4 flows map is walked once the main flows map
+	// has been walked entirely, and the walk ends when both have been.
+	w.expired = w.expired[:0]
+	var walked int
+	var err error
+	switch {
+	case w.flowsWrapped:
+		// skip the main flows map until the end of the walk
+	case m.perCPUAggregation:
+		walked, w.flowsWrapped, err = b.perCPU.lookupSlice(m.objects.AggregatedFlowsPercpu, &w.perCPUCursor, maxEntries, func(n int) {
+			for i := 0; i < n; i++ {
+				if isExpired(perCPUFlowTimes(b.perCPU.valuesOf(i))) {
+					w.expired = append(w.expired, b.perCPU.keys[i])
+				}
+			}
+		})
+	default:
+		walked, w.flowsWrapped, err = batchLookupSlice(m.objects.AggregatedFlows, &w.cursor, b.ids, b.metrics, maxEntries, func(n int) {
+			for i := 0; i < n; i++ {
+				if isExpired(b.metrics[i].StartMonoTimeTs, b.metrics[i].EndMonoTimeTs) {
+					w.expired = append(w.expired, b.ids[i])
+				}
+			}
+		})
+	}
+	if err != nil {
+		log.WithError(err).Warnf("couldn't batch lookup flow entries")
+		met.Errors.WithErrorName("flow-fetcher", "CannotLookupFlows", metrics.HighSeverity).Inc()
+		// start over on the next walk
+		w.cursor = cilium.MapBatchCursor{}
+		w.perCPUCursor = perCPUBatchCursor{}
+		w.flowsWrapped = true
+	}
+	for i := range w.expired {
+		m.lookupAndDeleteExpiredFlow(met, &w.expired[i])
+	}
+	if m.compactIPv4Keys && !w.v4Wrapped {
+		w.expiredV4 = w.expiredV4[:0]
+		var walkedV4 int
+		walkedV4, w.v4Wrapped, err = batchLookupSlice(m.objects.AggregatedFlowsV4, &w.v4Cursor, b.v4IDs, b.metrics, maxEntries-walked, func(n int) {
+			for i := 0; i < n; i++ {
+				if isExpired(b.metrics[i].StartMonoTimeTs, b.metrics[i].EndMonoTimeTs) {
+					w.expiredV4 = append(w.expiredV4, b.v4IDs[i])
+				}
+			}
+		})
+		if err != nil {
+			log.WithError(err).Warnf("couldn't batch lookup IPv4 flow entries")
+			met.Errors.WithErrorName("flow-fetcher", "CannotLookupFlows", metrics.HighSeverity).Inc()
+			w.v4Cursor = cilium.MapBatchCursor{}
+			w.v4Wrapped = true
+		}
+		walked += walkedV4
+		for i := range w.expiredV4 {
+			m.lookupAndDeleteExpiredFlowV4(met, &w.expiredV4[i])
+		}
+	}
+	w.walkedEntries += walked
+	wrapped := w.flowsWrapped && (w.v4Wrapped || !m.compactIPv4Keys)
+	if wrapped {
+		w.flowsWrapped, w.v4Wrapped = false, false
+	}
+
+	// The additional metrics of the evicted flows have been removed along with them. Also walk
+	// the additional metrics map to evict the expired entries without flow.
+	w.expired = w.expired[:0]
+	_, _, err = b.additional.lookupSlice(m.objects.AdditionalFlowMetrics, &w.additionalCursor, maxEntries, func(n int) {
+		for i := 0; i < n; i++ {
+			if isExpired(perCPUAdditionalTimes(b.additional.valuesOf(i))) {
+				w.expired = append(w.expired, b.additional.keys[i])
+			}
+		}
+	})
+	if err != nil {
+		log.WithError(err).Warnf("couldn't batch lookup additional metrics entries")
+		met.Errors.WithErrorName("flow-fetcher", "CannotLookupAdditionalMetric", metrics.HighSeverity).Inc()
+		w.additionalCursor = perCPUBatchCursor{}
+	}
+	for i := range w.expired {
+		if !m.hasFlow(&w.expired[i]) {
+			m.lookupAndDeleteExpiredAdditional(met, &w.expired[i])
+		}
+	}
+
+	m.flowsDrained += uint64(m.flows.nbFlows)
+	if wrapped {
+		if m.sketch != nil {
+			m.drainFlowsSketch(met)
+		}
+		m.ReadGlobalCounter(met)
+		if m.sampling != nil {
+			m.adaptSampling(met, w.walkedEntries)
+		}
+		if m.bpfStats != nil {
+			m.readBpfStats(met)
+		}
+		w.walkedEntries = 0
+	}
+	return m.flows.entries, walked, wrapped
+}
+
+// IncrementalEvictionSupported returns whether LookupAndDeleteExpired can walk the maps
+// incrementally, which requires batch operations (Kernel>=5.6). It is only known once
+// LookupAndDeleteExpired, or LookupAndDeleteMap, has been invoked.
+func (m *FlowFetcher) IncrementalEvictionSupported() bool {
+	return m.batchLookupSupported
+}
+
+// lookupAndDeleteExpiredFlow removes a flow, along with its additional metrics, from the eBPF maps
+func (m *FlowFetcher) lookupAndDeleteExpiredFlow(met *metrics.Metrics, id *ebpf.BpfFlowId) {
+	w := &m.expiredWalk
+	var err error
+	if m.perCPUAggregation {
+		if err = m.objects.AggregatedFlowsPercpu.LookupAndDelete(id, &w.perCPUMetrics); err == nil {
+			m.flows.addPerCPU(id, w.perCPUMetrics)
+		}
+	} else if err = m.objects.AggregatedFlows.LookupAndDelete(id, &w.metrics); err == nil {
+		m.flows.addBase(id, &w.metrics)
+	}
+	if err != nil && !errors.Is(err, cilium.ErrKeyNotExist) {
+		log.WithError(err).WithField("flowId", id).Warnf("couldn't lookup/delete flow entry")
+		met.Errors.WithErrorName("flow-fetcher", "CannotDeleteFlows", metrics.HighSeverity).Inc()
+	}
+	m.lookupAndDeleteExpiredAdditional(met, id)
+}
+
+// lookupAndDeleteExpiredFlowV4 removes a flow of the compact IPv4 flows map, along with its
+// additional metrics, from the eBPF maps
+func (m *FlowFetcher) lookupAndDeleteExpiredFlowV4(met *metrics.Metrics, key *ebpf.BpfFlowIdV4) {
+	w := &m.expiredWalk
+	id := model.NewFlowIDFromV4(key)
+	if err := m.objects.AggregatedFlowsV4.LookupAndDelete(key, &w.metrics); err == nil {
+		m.flows.addBase(&id, &w.metrics)
+	} else if !errors.Is(err, cilium.ErrKeyNotExist) {
+		log.WithError(err).WithField("flowId", key).Warnf("couldn't lookup/delete flow entry")
+		met.Errors.WithErrorName("flow-fetcher", "CannotDeleteFlows", metrics.HighSeverity).Inc()
+	}
+	m.lookupAndDeleteExpiredAdditional(met, &id)
+}
+
+// lookupAndDeleteExpiredAdditional removes the additional metrics of a flow, if any, from the eBPF map
+func (m *FlowFetcher) lookupAndDeleteExpiredAdditional(met *metrics.Metrics, id *ebpf.BpfFlowId) {
+	w := &m.expiredWalk
+	err := m.objects.AdditionalFlowMetrics.LookupAndDelete(id, &w.additionalMetrics)
+	if err == nil {
+		m.increaseEnrichmentStats(met, m.flows.addAdditional(id, w.additionalMetrics))
+	} else if !errors.Is(err, cilium.ErrKeyNotExist) {
+		log.WithError(err).WithField("flowId", id).Warnf("couldn't lookup/delete additional metrics entry")
+		met.Errors.WithErrorName("flow-fetcher", "CannotDeleteAdditionalMetric", metrics.HighSeverity).Inc()
+	}
+}
+
+// hasFlow returns whether the flow is in the aggregated flows map. On lookup errors, it is
+// considered present so its additional metrics are evicted along with it later.
+func (m *FlowFetcher) hasFlow(id *ebpf.BpfFlowId) bool {
+	w := &m.expiredWalk
+	var err error
+	if m.perCPUAggregation {
+		err = m.objects.AggregatedFlowsPercpu.Lookup(id, &w.perCPUMetrics)
+	} else if key, ok := model.FlowIDToV4(id); ok && m.compactIPv4Keys {
+		err = m.objects.AggregatedFlowsV4.Lookup(&key, &w.metrics)
+	} else {
+		err = m.objects.AggregatedFlows.Lookup(id, &w.metrics)
+	}
+	return !errors.Is(err, cilium.ErrKeyNotExist)
+}
+
+// perCPUFlowTimes returns the earliest start and latest end times of the per-CPU values of a flow
+func perCPUFlowTimes(values []ebpf.BpfFlowMetrics) (uint64, uint64) {
+	var start, end uint64
+	for i := range values {
+		if values[i].StartMonoTimeTs != 0 && (start == 0 || values[i].StartMonoTimeTs < start) {
+			start = values[i].StartMonoTimeTs
+		}
+		if values[i].EndMonoTimeTs > end {
+			end = values[i].EndMonoTimeTs
+		}
+	}
+	return start, end
+}
+
+// perCPUAdditionalTimes returns the earliest start and latest end times of the per-CPU additional
+// metrics of a flow
+func perCPUAdditionalTimes(values []ebpf.BpfAdditionalMetrics) (uint64, uint64) {
+	var start, end uint64
+	for i := range values {
+		if values[i].StartMonoTimeTs != 0 && (start == 0 || values[i].StartMonoTimeTs < start) {
+			start = values[i].StartMonoTimeTs
+		}
+		if values[i].EndMonoTimeTs > end {
+			end = values[i].EndMonoTimeTs
+		}
+	}
+	return start, end
+}
@@ -8,30 +8,63 @@ import (
 
 // This file contains legacy implementations kept for old kernels
 
-func (m *FlowFetcher) legacyLookupAndDeleteMap(met *metrics.Metrics) map[ebpf.BpfFlowId]model.BpfFlowContent {
+func (m *FlowFetcher) legacyLookupAndDeleteMap(met *metrics.Metrics) []model.BpfFlowEntry {
 	flowMap := m.objects.AggregatedFlows
+	var baseMetrics ebpf.BpfFlowMetrics
+	var perCPUMetrics []ebpf.BpfFlowMetrics
+	var flowValue interface{} = &baseMetrics
+	if m.perCPUAggregation {
+		flowMap = m.objects.AggregatedFlowsPercpu
+		flowValue = &perCPUMetrics
+	}
 
 	iterator := flowMap.Iterate()
-	var flows = make(map[ebpf.BpfFlowId]model.BpfFlowContent, m.cacheMaxSize)
 	var id ebpf.BpfFlowId
-	var baseMetrics ebpf.BpfFlowMetrics
 	count := 0
 
 	// Deleting while iterating is really bad for performance (like, really!) as it causes seeing multiple times the same key
 	// This is solved in >=4.20 kernels with LookupAndDelete
-	for iterator.Next(&id, &baseMetrics) {
+	for iterator.Next(&id, flowValue) {
 		count++
 		if err := flowMap.Delete(id); err != nil {
 			log.WithError(err).WithField("flowId", id).Warnf("couldn't delete flow entry")
 			met.Errors.WithErrorName("flow-fetcher-legacy", "CannotDeleteFlows", metrics.HighSeverity).Inc()
 		}
-		flows[id] = model.NewBpfFlowContent(baseMetrics)
+		// Deleting while iterating may return the same key multiple times: keep the last seen
+		m.flows.remove(&id)
+		if m.perCPUAggregation {
+			m.flows.addPerCPU(&id, perCPUMetrics)
+		} else {
+			m.flows.addBase(&id, &baseMetrics)
+		}
 	}
+	count += m.lookupAndDeleteV4Map(met)
 	met.BufferSizeGauge.WithBufferName("hashmap-legacy-total").Set(float64(count))
-	met.BufferSizeGauge.WithBufferName("hashmap-legacy-unique").Set(float64(len(flows)))
+	met.BufferSizeGauge.WithBufferName("hashmap-legacy-unique").Set(float64(len(m.flows.entries)))
 
 	m.ReadGlobalCounter(met)
-	return flows
+	return m.flows.entries
+}
+
+// legacyLookupAndDeleteV4Map reads and removes all the entries from the compact IPv4 flows map,
+// deleting them while iterating
+func (m *FlowFetcher) legacyLookupAndDeleteV4Map(met *metrics.Metrics) int {
+	flowMap := m.objects.AggregatedFlowsV4
+	iterator := flowMap.Iterate()
+	var key ebpf.BpfFlowIdV4
+	var baseMetrics ebpf.BpfFlowMetrics
+	count := 0
+	for iterator.Next(&key, &baseMetrics) {
+		count++
+		if err := flowMap.Delete(key); err != nil {
+			log.WithError(err).WithField("flowId", key).Warnf("couldn't delete flow entry")
+			met.Errors.WithErrorName("flow-fetcher-legacy", "CannotDeleteFlows", metrics.HighSeverity).Inc()
+		}
+		id := model.NewFlowIDFromV4(&key)
+		m.flows.remove(&id)
+		m.flows.addBase(&id, &baseMetrics)
+	}
+	return count
 }
 
 func (p *PacketFetcher) legacyLookupAndDeleteMap(met *metrics.Metrics) map[int][]*byte {
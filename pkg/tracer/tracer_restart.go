@@ -0,0 +1,249 @@
+package tracer
+
+import (
+	"crypto/sha256"
+	"fmt"
+	"os"
+	"path"
+	"strings"
+
+	"github.com/netobserv/netobserv-ebpf-agent/pkg/ifaces"
+
+	cilium "github.com/cilium/ebpf"
+	"github.com/cilium/ebpf/btf"
+	"github.com/cilium/ebpf/link"
+)
+
+// This file contains the hot restart mode, where the flows state survives the agent restarts: the
+// flows maps are pinned and adopted by the next agent, and so are the TCX links, of which the
+// programs are atomically replaced. Meanwhile, the programs of the previous agent keep accounting
+// the flows in the pinned maps. The maps are pinned in a directory named after the layout of their
+// keys and values, so that an agent only adopts the maps of an agent with the same layout.
+
+const (
+	// directory of the TCX links pins, in the hot restart pin path
+	tcxLinksPinDir = "links"
+	// prefix of the directories of the flows maps pins, in the hot restart pin path
+	mapsPinDirPrefix = "maps-"
+	tcxEgress        = "egress"
+	tcxIngress       = "ingress"
+)
+
+// hotRestartMaps are the maps holding the flows state, kept pinned across the agent restarts
+var hotRestartMaps = []string{
+	aggregatedFlowsMap,
+	aggregatedFlowsPerCPUMap,
+	aggregatedFlowsV4Map,
+	additionalFlowMetrics,
+	dnsLatencyMap,
+}
+
+func isHotRestartMap(name string) bool {
+	for _, m := range hotRestartMaps {
+		if m == name {
+			return true
+		}
+	}
+	return false
+}
+
+// hotRestartEnabled returns whether the flows state is kept pinned across the agent restarts
+func hotRestartEnabled(cfg *FlowFetcherConfig) bool {
+	return cfg.HotRestart && !cfg.UseEbpfManager
+}
+
+// prepareHotRestartPins creates the pins directories, and removes the pins of the TCX links of
+// which the interface has been deleted
+func prepareHotRestartPins(pinDir string) error {
+	linksDir := path.Join(pinDir, tcxLinksPinDir)
+	if err := os.MkdirAll(linksDir, 0o700); err != nil {
+		return fmt.Errorf("creating the pins directory: %w", err)
+	}
+	files, err := os.ReadDir(linksDir)
+	if err != nil {
+		return fmt.Errorf("listing the TCX links pins: %w", err)
+	}
+	for _, file := range files {
+		pin := path.Join(linksDir, file.Name())
+		l, err := link.LoadPinnedLink(pin, nil)
+		if err != nil {
+			log.WithError(err).WithField("pin", pin).Debug("removing unreadable TCX link pin")
+			_ = os.Remove(pin)
+			continue
+		}
+		if info, err := l.Info(); err == nil && info.TCX() != nil && info.TCX().Ifindex == 0 {
+			// the link is defunct: its interface has been deleted
+			_ = l.Unpin()
+		}
+		l.Close()
+	}
+	return nil
+}
+
+// hotRestartMapsPinDir returns the directory where the flows maps are pinned, named after the
+// layout of their keys and values. It removes the directories of the other layouts, of which the
+// maps can't be adopted.
+func hotRestartMapsPinDir(pinDir string, spec *cilium.CollectionSpec) (string, error) {
+	digest := sha256.New()
+	for _, name := range hotRestartMaps {
+		m := spec.Maps[name]
+		fmt.Fprintf(digest, "%s %d %d %s %s\n", name, m.KeySize, m.ValueSize, typeLayout(m.Key), typeLayout(m.Value))
+	}
+	mapsDir := fmt.Sprintf("%s%x", mapsPinDirPrefix, digest.Sum(nil)[:8])
+	files, err := os.ReadDir(pinDir)
+	if err != nil {
+		return "", fmt.Errorf("listing the pins: %w", err)
+	}
+	for _, file := range files {
+		if file.IsDir() && strings.HasPrefix(file.Name(), mapsPinDirPrefix) && file.Name() != mapsDir {
+			log.WithField("dir", file.Name()).Info("removing the flows maps pinned with another layout")
+			if err := os.RemoveAll(path.Join(pinDir, file.Name())); err != nil {
+				return "", fmt.Errorf("removing the flows maps pinned with another layout: %w", err)
+			}
+		}
+	}
+	mapsDir = path.Join(pinDir, mapsDir)
+	if err := os.MkdirAll(mapsDir, 0o700); err != nil {
+		return "", fmt.Errorf("creating the maps pins directory: %w", err)
+	}
+	return mapsDir, nil
+}
+
+// typeLayout describes the memory layout of a BTF type: the names, offsets and types of the
+// members of the structs and unions, recursively
+func typeLayout(typ btf.Type) string {
+	var layout strings.Builder
+	writeTypeLayout(&layout, typ)
+	return layout.String()
+}
+
+func writeTypeLayout(layout *strings.Builder, typ btf.Type) {
+	switch t := btf.UnderlyingType(typ).(type) {
+	case nil:
+		layout.WriteString("?")
+	case *btf.Struct:
+		writeMembersLayout(layout, "struct", t.Size, t.Members)
+	case *btf.Union:
+		writeMembersLayout(layout, "union", t.Size, t.Members)
+	case *btf.Array:
+		fmt.Fprintf(layout, "[%d]", t.Nelems)
+		writeTypeLayout(layout, t.Type)
+	case *btf.Int:
+		fmt.Fprintf(layout, "int%d%s", t.Size*8, t.Encoding)
+	case *btf.Enum:
+		fmt.Fprintf(layout, "enum%d", t.Size*8)
+	default:
+		fmt.Fprintf(layout, "%T", t)
+	}
+}
+
+func writeMembersLayout(layout *strings.Builder, kind string, size uint32, members []btf.Member) {
+	fmt.Fprintf(layout, "%s%d{", kind, size)
+	for _, m := range members {
+		fmt.Fprintf(layout, "%s@%d:%d:", m.Name, m.Offset, m.BitfieldSize)
+		writeTypeLayout(layout, m.Type)
+		layout.WriteString(";")
+	}
+	layout.WriteString("}")
+}
+
+// removeHotRestartMapsPins removes the pins of the flows maps, so that new maps are created
+func removeHotRestartMapsPins(mapsDir string) {
+	for _, name := range hotRestartMaps {
+		if err := os.Remove(path.Join(mapsDir, name)); err != nil && !os.IsNotExist(err) {
+			log.WithError(err).WithField("map", name).Warn("couldn't remove the map pin")
+		}
+	}
+}
+
+// tcxLinkPin returns the pin path of the TCX link of an interface, identified by the inode of its
+// network namespace, which unlike the namespace handle is the same for all the processes
+func (m *FlowFetcher) tcxLinkPin(iface ifaces.Interface, direction string) (string, error) {
+	ino, err := iface.NetNSInode()
+	if err != nil {
+		return "", err
+	}
+	return path.Join(m.pinDir, tcxLinksPinDir, fmt.Sprintf("tcx_%d_%d_%s", ino, iface.Index, direction)), nil
+}
+
+// adoptTCXLink replaces the program of the TCX link pinned by a previous agent for the interface,
+// if any. The replacement is atomic, so that no packet is missed. It returns nil when the link
+// must be attached instead.
+func (m *FlowFetcher) adoptTCXLink(iface ifaces.Interface, direction string, prog *cilium.Program) link.Link {
+	if !m.hotRestart {
+		return nil
+	}
+	ilog := log.WithField("iface", iface).WithField("direction", direction)
+	pin, err := m.tcxLinkPin(iface, direction)
+	if err != nil {
+		ilog.WithError(err).Debug("can't get the TCX link pin path")
+		return nil
+	}
+	l, err := link.LoadPinnedLink(pin, nil)
+	if err != nil {
+		if !os.IsNotExist(err) {
+			ilog.WithError(err).Debug("can't load the pinned TCX link")
+		}
+		return nil
+	}
+	if err := l.Update(prog); err != nil {
+		// e.g. the interface index has been reused by a new interface
+		ilog.WithError(err).Debug("can't update the pinned TCX link. Attaching a new one")
+		_ = l.Unpin()
+		l.Close()
+		return nil
+	}
+	ilog.Debug("adopted the pinned TCX link")
+	m.addTCXLinkPin(pin)
+	return l
+}
+
+// pinTCXLink pins an attached TCX link, so that it is adopted by the next agent
+func (m *FlowFetcher) pinTCXLink(iface ifaces.Interface, direction string, l link.Link) {
+	if !m.hotRestart {
+		return
+	}
+	ilog := log.WithField("iface", iface).WithField("direction", direction)
+	pin, err := m.tcxLinkPin(iface, direction)
+	if err == nil {
+		err = l.Pin(pin)
+	}
+	if err != nil {
+		ilog.WithError(err).Warn("can't pin the TCX link: it won't be kept on restart")
+		return
+	}
+	m.addTCXLinkPin(pin)
+}
+
+func (m *FlowFetcher) addTCXLinkPin(pin string) {
+	m.linksMutex.Lock()
+	m.tcxLinkPins[pin] = struct{}{}
+	m.linksMutex.Unlock()
+}
+
+// UnpinStaleTCXLinks removes the pins of the TCX links pinned by a previous agent that haven't
+// been adopted, e.g. because their interface isn't selected anymore, so that their programs are
+// detached. It must be invoked once the existing interfaces have been attached.
+func (m *FlowFetcher) UnpinStaleTCXLinks() {
+	if !m.hotRestart {
+		return
+	}
+	linksDir := path.Join(m.pinDir, tcxLinksPinDir)
+	files, err := os.ReadDir(linksDir)
+	if err != nil {
+		log.WithError(err).Warn("can't list the TCX links pins")
+		return
+	}
+	m.linksMutex.Lock()
+	defer m.linksMutex.Unlock()
+	for _, file := range files {
+		pin := path.Join(linksDir, file.Name())
+		if _, ok := m.tcxLinkPins[pin]; ok {
+			continue
+		}
+		log.WithField("pin", pin).Debug("removing the pin of a TCX link that hasn't been adopted")
+		if err := os.Remove(pin); err != nil && !os.IsNotExist(err) {
+			log.WithError(err).WithField("pin", pin).Warn("couldn't remove the TCX link pin")
+		}
+	}
+}
@@ -0,0 +1,64 @@
+package tracer
+
+import (
+	"github.com/netobserv/netobserv-ebpf-agent/pkg/metrics"
+)
+
+// This file contains the adaptive sampling controller, which raises the sampling rate applied
+// by the kernel when the flows map is under pressure
+
+const (
+	// fill ratios of the flows map or of the ringbuffer above which the sampling rate is raised
+	samplingHighWatermark = 0.8
+	// fill ratios of the flows map and of the ringbuffer below which the sampling rate is lowered
+	samplingLowWatermark = 0.4
+)
+
+// adaptiveSampling computes the sampling rate from the pressure observed on each eviction. The
+// rate is doubled, up to max, while flows are dropped or the flows map or ringbuffer fill ratios
+// are above samplingHighWatermark. It is halved, down to the configured rate, when both ratios
+// are below samplingLowWatermark.
+type adaptiveSampling struct {
+	base    uint32
+	max     uint32
+	current uint32
+}
+
+func newAdaptiveSampling(base, maxSampling int) *adaptiveSampling {
+	b := uint32(max(base, 1))
+	return &adaptiveSampling{base: b, max: max(uint32(maxSampling), b), current: b}
+}
+
+// next returns the sampling rate to apply, given the number of flows dropped since the previous
+// invocation, and the current fill ratios
+func (a *adaptiveSampling) next(dropped uint64, mapFill, ringbufFill float64) uint32 {
+	switch {
+	case dropped > 0 || mapFill >= samplingHighWatermark || ringbufFill >= samplingHighWatermark:
+		a.current = min(a.current*2, a.max)
+	case mapFill < samplingLowWatermark && ringbufFill < samplingLowWatermark:
+		a.current = max(a.current/2, a.base)
+	}
+	return a.current
+}
+
+// adaptSampling updates the sampling rate applied by the kernel, given the number of entries
+// found in the flows map by the last complete eviction
+func (m *FlowFetcher) adaptSampling(met *metrics.Metrics, mapEntries int) {
+	ringbufFill := 0.0
+	if size := m.ringbufReader.BufferSize(); size > 0 {
+		ringbufFill = float64(m.ringbufReader.AvailableBytes()) / float64(size)
+	}
+	previous := m.sampling.current
+	rate := m.sampling.next(m.flowsDropped, float64(mapEntries)/float64(m.cacheMaxSize), ringbufFill)
+	m.flowsDropped = 0
+	if rate != previous {
+		if err := m.objects.AdaptiveSampling.Put(uint32(0), rate); err != nil {
+			log.WithError(err).Warnf("couldn't update the adaptive sampling rate")
+			met.Errors.WithErrorName("flow-fetcher", "CannotUpdateSampling", metrics.HighSeverity).Inc()
+			m.sampling.current = previous
+		} else {
+			log.WithField("sampling", rate).Debug("adaptive sampling rate updated")
+		}
+	}
+	met.AdaptiveSamplingRate.Set(float64(m.sampling.current))
+}
@@ -0,0 +1,30 @@
+package tracer
+
+import (
+	"testing"
+
+	"github.com/stretchr/testify/assert"
+)
+
+func TestAdaptiveSampling(t *testing.T) {
+	a := newAdaptiveSampling(50, 400)
+
+	// raised while flows are dropped, or the maps are filling up, up to the max rate
+	assert.Equal(t, uint32(100), a.next(10, 0.1, 0))
+	assert.Equal(t, uint32(200), a.next(0, 0.9, 0))
+	assert.Equal(t, uint32(400), a.next(0, 0.1, 0.95))
+	assert.Equal(t, uint32(400), a.next(5, 0.1, 0))
+
+	// kept between the watermarks
+	assert.Equal(t, uint32(400), a.next(0, 0.5, 0))
+
+	// lowered when the load eases, down to the configured rate
+	assert.Equal(t, uint32(200), a.next(0, 0.1, 0))
+	assert.Equal(t, uint32(100), a.next(0, 0.1, 0))
+	assert.Equal(t, uint32(50), a.next(0, 0.1, 0))
+	assert.Equal(t, uint32(50), a.next(0, 0.1, 0))
+
+	// sampling disabled (0) is handled as a rate of 1
+	a = newAdaptiveSampling(0, 8)
+	assert.Equal(t, uint32(2), a.next(1, 0, 0))
+}
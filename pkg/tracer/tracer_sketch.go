@@ -0,0 +1,140 @@
+package tracer
+
+import (
+	"errors"
+
+	"github.com/netobserv/netobserv-ebpf-agent/pkg/ebpf"
+	"github.com/netobserv/netobserv-ebpf-agent/pkg/metrics"
+
+	cilium "github.com/cilium/ebpf"
+	"golang.org/x/sys/unix"
+)
+
+// This file contains the userspace side of the sketch-based aggregation tier, which holds the
+// flows that can't be inserted in the flows map (see bpf/flows_sketch.h)
+
+const (
+	// as defined in bpf/types.h
+	sketchDepth = 4
+	sketchWidth = 512
+)
+
+// heavyHitter mirrors heavy_hitter in bpf/types.h. Its per-CPU metrics are decoded with the
+// flow_metrics layout, which flow_metrics_percpu shares.
+type heavyHitter struct {
+	ID       ebpf.BpfFlowId
+	Metrics  ebpf.BpfFlowMetrics
+	Estimate uint32
+	_        [4]byte
+}
+
+// flowsSketch holds the state of the sketch tier reader: the current epoch, and the buffers
+// reused to read and reset the heavy hitters and the count-min sketches
+type flowsSketch struct {
+	slots      uint32
+	epoch      uint32
+	batch      perCPUBatch[uint32, heavyHitter]
+	zeroSketch [][sketchDepth * sketchWidth]uint32
+}
+
+func newFlowsSketch(slots uint32) (*flowsSketch, error) {
+	nCPU, err := cilium.PossibleCPU()
+	if err != nil {
+		return nil, err
+	}
+	return &flowsSketch{
+		slots:      slots,
+		batch:      newPerCPUBatch[uint32, heavyHitter](int(slots), nCPU),
+		zeroSketch: make([][sketchDepth * sketchWidth]uint32, nCPU),
+	}, nil
+}
+
+// drainFlowsSketch flips the epoch of the sketch tier, so that the kernel switches to the other
+// half of its maps, then reads the heavy hitters of the previous half into m.flows and resets it.
+// Packets accounted by programs still running with the previous epoch when it is reset are lost.
+func (m *FlowFetcher) drainFlowsSketch(met *metrics.Metrics) {
+	s := m.sketch
+	half := s.epoch & 1
+	if err := m.objects.FlowsSketchEpoch.Put(uint32(0), s.epoch+1); err != nil {
+		log.WithError(err).Warnf("couldn't update the flows sketch epoch")
+		met.Errors.WithErrorName("flow-fetcher", "CannotUpdateSketchEpoch", metrics.HighSeverity).Inc()
+		return
+	}
+	s.epoch++
+
+	var count int
+	if !m.batchLookupSupported || !m.drainHeavyHittersBatch(met, half, &count) {
+		m.drainHeavyHitters(met, half, &count)
+	}
+	if err := m.objects.FlowsSketch.Put(half, s.zeroSketch); err != nil {
+		log.WithError(err).Warnf("couldn't reset the flows sketch")
+		met.Errors.WithErrorName("flow-fetcher", "CannotResetSketch", metrics.HighSeverity).Inc()
+	}
+	met.BufferSizeGauge.WithBufferName("heavy-hitters").Set(float64(count))
+}
+
+// drainHeavyHittersBatch reads the heavy hitters of a half with a single batch lookup, and resets
+// the used slots with a single batch update. It returns false if the heavy hitters couldn't be
+// read, so that they are read slot by slot instead.
+func (m *FlowFetcher) drainHeavyHittersBatch(met *metrics.Metrics, half uint32, count *int) bool {
+	s := m.sketch
+	b := &s.batch
+	cursor := arrayBatchCursor(half * s.slots)
+	n, err := b.next(m.objects.HeavyHitters, unix.BPF_MAP_LOOKUP_BATCH, &cursor)
+	if n != int(s.slots) || (err != nil && !errors.Is(err, cilium.ErrKeyNotExist)) {
+		log.WithError(err).Debug("couldn't batch lookup heavy hitters, reading them one by one")
+		return false
+	}
+	// the used slots are moved to the head of the buffers, to be reset
+	used := 0
+	for slot := 0; slot < n; slot++ {
+		values := b.valuesOf(slot)
+		hasFlows := false
+		for i := range values {
+			if values[i].Metrics.Packets != 0 {
+				m.flows.merge(&values[i].ID, &values[i].Metrics)
+				hasFlows = true
+				*count++
+			}
+		}
+		if hasFlows {
+			b.keys[used] = b.keys[slot]
+			used++
+		}
+	}
+	clear(b.values[:used*b.nCPU])
+	if err := b.update(m.objects.HeavyHitters, used); err != nil {
+		log.WithError(err).Warnf("couldn't reset heavy hitters")
+		met.Errors.WithErrorName("flow-fetcher", "CannotResetHeavyHitter", metrics.HighSeverity).Inc()
+	}
+	return true
+}
+
+// drainHeavyHitters reads the heavy hitters of a half slot by slot, when batch operations are
+// not supported, and resets the used slots
+func (m *FlowFetcher) drainHeavyHitters(met *metrics.Metrics, half uint32, count *int) {
+	s := m.sketch
+	values := s.batch.valuesOf(0)
+	for slot := half * s.slots; slot < (half+1)*s.slots; slot++ {
+		if err := m.objects.HeavyHitters.Lookup(slot, &values); err != nil {
+			log.WithError(err).WithField("slot", slot).Warnf("couldn't lookup heavy hitter")
+			met.Errors.WithErrorName("flow-fetcher", "CannotLookupHeavyHitter", metrics.HighSeverity).Inc()
+			continue
+		}
+		used := false
+		for i := range values {
+			if values[i].Metrics.Packets != 0 {
+				m.flows.merge(&values[i].ID, &values[i].Metrics)
+				used = true
+				*count++
+			}
+		}
+		if used {
+			clear(values)
+			if err := m.objects.HeavyHitters.Put(slot, values); err != nil {
+				log.WithError(err).WithField("slot", slot).Warnf("couldn't reset heavy hitter")
+				met.Errors.WithErrorName("flow-fetcher", "CannotResetHeavyHitter", metrics.HighSeverity).Inc()
+			}
+		}
+	}
+}
@@ -0,0 +1,138 @@
+package tracer
+
+import (
+	"io"
+	"math"
+	"reflect"
+	"time"
+
+	"github.com/netobserv/netobserv-ebpf-agent/pkg/ebpf"
+	"github.com/netobserv/netobserv-ebpf-agent/pkg/metrics"
+
+	cilium "github.com/cilium/ebpf"
+	"golang.org/x/sys/unix"
+)
+
+// This file contains the export of the eBPF programs runtime statistics: the run count and run
+// time accounted by the kernel for each program, and the histograms of the time spent by the
+// eBPF programs per packet, for the new flows and the existing flows paths (see bpf/flows.c)
+
+const (
+	// as FLOW_LATENCY_BUCKETS in bpf/types.h
+	flowLatencyBuckets = 16
+)
+
+var flowPathNames = map[ebpf.BpfFlowPathT]string{
+	ebpf.BpfFlowPathTFLOW_PATH_NEW:      "new",
+	ebpf.BpfFlowPathTFLOW_PATH_EXISTING: "existing",
+}
+
+// programStats holds the kernel statistics of a program at the previous read
+type programStats struct {
+	runs    uint64
+	runtime time.Duration
+}
+
+// bpfStats holds the state of the runtime statistics reader
+type bpfStats struct {
+	// closer disables the kernel statistics when closed, nil if they couldn't be enabled
+	closer    io.Closer
+	programs  map[string]programStats
+	latencies []ebpf.BpfFlowLatency
+}
+
+// newBpfStats enables the kernel statistics of the eBPF programs, which are system-wide and
+// slightly increase the cost of every program run, until Close is invoked
+func newBpfStats() (*bpfStats, error) {
+	nCPU, err := cilium.PossibleCPU()
+	if err != nil {
+		return nil, err
+	}
+	s := &bpfStats{
+		programs:  map[string]programStats{},
+		latencies: make([]ebpf.BpfFlowLatency, nCPU),
+	}
+	if s.closer, err = cilium.EnableStats(uint32(unix.BPF_STATS_RUN_TIME)); err != nil {
+		log.WithError(err).Warn("can't enable the BPF stats: only the flows processing time will be reported")
+	}
+	return s, nil
+}
+
+func (s *bpfStats) Close() error {
+	if s.closer == nil {
+		return nil
+	}
+	return s.closer.Close()
+}
+
+// readBpfStats updates the metrics with the runtime statistics of the eBPF programs
+func (m *FlowFetcher) readBpfStats(met *metrics.Metrics) {
+	if m.bpfStats.closer != nil {
+		m.readProgramStats(met)
+	}
+	if m.objects.FlowLatencies == nil {
+		return
+	}
+	for path, name := range flowPathNames {
+		// the entries are cumulative since the programs were loaded
+		if err := m.objects.FlowLatencies.Lookup(uint32(path), &m.bpfStats.latencies); err != nil {
+			log.WithError(err).WithField("path", name).Debug("couldn't read the flows processing time")
+			met.Errors.WithErrorName("flow-fetcher", "CannotReadFlowLatencies", metrics.LowSeverity).Inc()
+			continue
+		}
+		count, sum, buckets := flowLatencyHistogram(m.bpfStats.latencies)
+		met.BpfFlowLatency.Set(count, sum, buckets, name)
+	}
+}
+
+// readProgramStats adds to the counters the runs of each loaded program since the previous read
+func (m *FlowFetcher) readProgramStats(met *metrics.Metrics) {
+	programs := reflect.ValueOf(&m.objects.BpfPrograms).Elem()
+	for i := 0; i < programs.NumField(); i++ {
+		prog, ok := programs.Field(i).Interface().(*cilium.Program)
+		if !ok || prog == nil {
+			continue
+		}
+		name := programs.Type().Field(i).Tag.Get("ebpf")
+		info, err := prog.Info()
+		if err != nil {
+			log.WithError(err).WithField("program", name).Debug("couldn't read the program info")
+			continue
+		}
+		runs, okRuns := info.RunCount()
+		runtime, okRuntime := info.Runtime()
+		if !okRuns || !okRuntime {
+			continue
+		}
+		prev := m.bpfStats.programs[name]
+		// the statistics are reset when the program is reloaded
+		if runs >= prev.runs && runtime >= prev.runtime {
+			met.BpfProgramRuns.WithProgram(name).Add(float64(runs - prev.runs))
+			met.BpfProgramRunTime.WithProgram(name).Add((runtime - prev.runtime).Seconds())
+		}
+		m.bpfStats.programs[name] = programStats{runs: runs, runtime: runtime}
+	}
+}
+
+// flowLatencyHistogram sums the per-CPU histograms into cumulative buckets, in seconds. The last
+// bucket holds the longer times, so it only accounts in the total count.
+func flowLatencyHistogram(perCPU []ebpf.BpfFlowLatency) (uint64, float64, map[float64]uint64) {
+	var counts [flowLatencyBuckets]uint64
+	var sumNs uint64
+	for i := range perCPU {
+		for b, c := range perCPU[i].Buckets {
+			counts[b] += c
+		}
+		sumNs += perCPU[i].SumNs
+	}
+	buckets := make(map[float64]uint64, flowLatencyBuckets-1)
+	var count uint64
+	for b, c := range counts {
+		count += c
+		if b < flowLatencyBuckets-1 {
+			// bucket b holds the times below 2^(b+1) ns
+			buckets[math.Ldexp(1, b+1)/float64(time.Second)] = count
+		}
+	}
+	return count, float64(sumNs) / float64(time.Second), buckets
+}
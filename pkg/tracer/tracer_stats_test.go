@@ -0,0 +1,28 @@
+package tracer
+
+import (
+	"testing"
+
+	"github.com/netobserv/netobserv-ebpf-agent/pkg/ebpf"
+	"github.com/stretchr/testify/assert"
+)
+
+func TestFlowLatencyHistogram(t *testing.T) {
+	perCPU := make([]ebpf.BpfFlowLatency, 2)
+	// CPU 0: 3 packets in [1us, 2us), 1 above the last bound
+	perCPU[0].Buckets[10] = 3
+	perCPU[0].Buckets[flowLatencyBuckets-1] = 1
+	perCPU[0].SumNs = 3*1500 + 100000
+	// CPU 1: 2 packets below 2ns
+	perCPU[1].Buckets[0] = 2
+	perCPU[1].SumNs = 2
+
+	count, sum, buckets := flowLatencyHistogram(perCPU)
+	assert.Equal(t, uint64(6), count)
+	assert.InDelta(t, 104502e-9, sum, 1e-12)
+	assert.Len(t, buckets, flowLatencyBuckets-1)
+	assert.Equal(t, uint64(2), buckets[2e-9])
+	assert.Equal(t, uint64(2), buckets[1024e-9])
+	assert.Equal(t, uint64(5), buckets[2048e-9])
+	assert.Equal(t, uint64(5), buckets[32768e-9])
+}
@@ -0,0 +1,267 @@
+package tracer
+
+import (
+	"os"
+	"path"
+	"testing"
+	"time"
+	"unsafe"
+
+	"github.com/netobserv/netobserv-ebpf-agent/pkg/ebpf"
+	"github.com/netobserv/netobserv-ebpf-agent/pkg/ifaces"
+	"github.com/netobserv/netobserv-ebpf-agent/pkg/metrics"
+
+	cilium "github.com/cilium/ebpf"
+	"github.com/cilium/ebpf/btf"
+	"github.com/cilium/ebpf/link"
+	"github.com/stretchr/testify/assert"
+	"github.com/stretchr/testify/require"
+	"github.com/vishvananda/netns"
+	"golang.org/x/sys/unix"
+)
+
+func testFlowsMapsSpec() *cilium.CollectionSpec {
+	return &cilium.CollectionSpec{Maps: map[string]*cilium.MapSpec{
+		aggregatedFlowsMap:       {Type: cilium.Hash, Flags: unix.BPF_F_NO_PREALLOC, MaxEntries: 100},
+		aggregatedFlowsPerCPUMap: {Type: cilium.PerCPUHash, Flags: unix.BPF_F_NO_PREALLOC, MaxEntries: 100},
+		aggregatedFlowsV4Map:     {Type: cilium.Hash, Flags: unix.BPF_F_NO_PREALLOC, MaxEntries: 100},
+		additionalFlowMetrics:    {Type: cilium.PerCPUHash, Flags: unix.BPF_F_NO_PREALLOC, MaxEntries: 100},
+		dnsLatencyMap:            {Type: cilium.Hash, Flags: unix.BPF_F_NO_PREALLOC, MaxEntries: 1 << 20},
+	}}
+}
+
+func TestConfigureMapsAllocation(t *testing.T) {
+	// dynamic allocation keeps the maps as defined
+	spec := testFlowsMapsSpec()
+	configureMapsAllocation(spec, &FlowFetcherConfig{CacheMaxSize: 100})
+	assert.Equal(t, testFlowsMapsSpec(), spec)
+
+	// preallocated maps
+	spec = testFlowsMapsSpec()
+	configureMapsAllocation(spec, &FlowFetcherConfig{CacheMaxSize: 100, PreallocateMaps: true})
+	for name, m := range spec.Maps {
+		assert.Zero(t, m.Flags&unix.BPF_F_NO_PREALLOC, name)
+	}
+	assert.Equal(t, cilium.Hash, spec.Maps[aggregatedFlowsMap].Type)
+	assert.Equal(t, cilium.PerCPUHash, spec.Maps[additionalFlowMetrics].Type)
+	assert.Equal(t, uint32(100), spec.Maps[dnsLatencyMap].MaxEntries)
+
+	// LRU maps, except the spin-locked flows maps
+	spec = testFlowsMapsSpec()
+	configureMapsAllocation(spec, &FlowFetcherConfig{CacheMaxSize: 100, LRUMaps: true})
+	for name, m := range spec.Maps {
+		assert.Zero(t, m.Flags&unix.BPF_F_NO_PREALLOC, name)
+	}
+	assert.Equal(t, cilium.Hash, spec.Maps[aggregatedFlowsMap].Type)
+	assert.Equal(t, cilium.Hash, spec.Maps[aggregatedFlowsV4Map].Type)
+	assert.Equal(t, cilium.LRUCPUHash, spec.Maps[aggregatedFlowsPerCPUMap].Type)
+	assert.Equal(t, cilium.LRUCPUHash, spec.Maps[additionalFlowMetrics].Type)
+	assert.Equal(t, cilium.LRUHash, spec.Maps[dnsLatencyMap].Type)
+}
+
+func TestShrinkMapValue(t *testing.T) {
+	spec := &cilium.MapSpec{Type: cilium.PerCPUArray, KeySize: 4, ValueSize: 16400, MaxEntries: 1, Key: &btf.Int{Size: 4}, Value: &btf.Struct{Size: 16400}}
+	shrinkMapValue(spec)
+	assert.Equal(t, &cilium.MapSpec{Type: cilium.PerCPUArray, KeySize: 4, ValueSize: 8, MaxEntries: 1}, spec)
+}
+
+func TestXDPAttachFlags(t *testing.T) {
+	for _, tc := range []struct {
+		name     string
+		cfg      FlowFetcherConfig
+		expected link.XDPAttachFlags
+	}{
+		{name: "driver mode when supported", cfg: FlowFetcherConfig{XDPIngress: true}, expected: 0},
+		{name: "generic mode", cfg: FlowFetcherConfig{XDPIngress: true, XDPGenericMode: true}, expected: link.XDPGenericMode},
+	} {
+		t.Run(tc.name, func(t *testing.T) {
+			assert.Equal(t, tc.expected, xdpAttachFlags(&tc.cfg))
+		})
+	}
+}
+
+func TestHeavyHitterLayout(t *testing.T) {
+	// must match sizeof(heavy_hitter) in bpf/types.h
+	assert.Equal(t, uintptr(144), unsafe.Sizeof(heavyHitter{}))
+}
+
+func TestConfigureDNSQueriesMap(t *testing.T) {
+	// disabled by default
+	spec := testFlowsMapsSpec()
+	configureDNSQueriesMap(spec, &FlowFetcherConfig{EnableDNSTracker: true})
+	assert.Equal(t, testFlowsMapsSpec(), spec)
+
+	// bounded LRU map
+	spec = testFlowsMapsSpec()
+	configureDNSQueriesMap(spec, &FlowFetcherConfig{EnableDNSTracker: true, DNSTrackingLRUSize: 4096})
+	assert.Equal(t, cilium.LRUHash, spec.Maps[dnsLatencyMap].Type)
+	assert.Zero(t, spec.Maps[dnsLatencyMap].Flags&unix.BPF_F_NO_PREALLOC)
+	assert.Equal(t, uint32(4096), spec.Maps[dnsLatencyMap].MaxEntries)
+
+	// not applied to the maps loaded by bpfman
+	spec = testFlowsMapsSpec()
+	configureDNSQueriesMap(spec, &FlowFetcherConfig{EnableDNSTracker: true, DNSTrackingLRUSize: 4096, UseEbpfManager: true})
+	assert.Equal(t, testFlowsMapsSpec(), spec)
+}
+
+func TestConfigureRTTSamplesMaps(t *testing.T) {
+	testSpec := func() *cilium.CollectionSpec {
+		return &cilium.CollectionSpec{Maps: map[string]*cilium.MapSpec{
+			rttSkSamplesMap: {Type: cilium.SkStorage, Flags: unix.BPF_F_NO_PREALLOC},
+			rttSamplesMap:   {Type: cilium.LRUHash, MaxEntries: 1 << 16},
+		}}
+	}
+	// both hooks rate-limit the samples
+	spec := testSpec()
+	configureRTTSamplesMaps(spec, true, true, time.Second)
+	assert.Equal(t, testSpec(), spec)
+
+	// the sockets samples aren't used without a sampling interval
+	spec = testSpec()
+	configureRTTSamplesMaps(spec, true, true, 0)
+	assert.Equal(t, &cilium.MapSpec{Type: cilium.Array, MaxEntries: 1}, spec.Maps[rttSkSamplesMap])
+	assert.Equal(t, uint32(1), spec.Maps[rttSamplesMap].MaxEntries)
+
+	// nor by the hooks that aren't loaded, e.g. when RTT is disabled or on old kernels
+	spec = testSpec()
+	configureRTTSamplesMaps(spec, false, true, time.Second)
+	assert.Equal(t, cilium.Array, spec.Maps[rttSkSamplesMap].Type)
+	assert.Equal(t, uint32(1<<16), spec.Maps[rttSamplesMap].MaxEntries)
+	spec = testSpec()
+	configureRTTSamplesMaps(spec, true, false, time.Second)
+	assert.Equal(t, cilium.SkStorage, spec.Maps[rttSkSamplesMap].Type)
+	assert.Equal(t, uint32(1), spec.Maps[rttSamplesMap].MaxEntries)
+}
+
+func TestTCXLinkPin(t *testing.T) {
+	m := &FlowFetcher{pinDir: "/sys/fs/bpf/netobserv", hotRestart: true}
+	iface := ifaces.Interface{Name: "veth0", Index: 12, NetNS: netns.None()}
+	egress, err := m.tcxLinkPin(iface, tcxEgress)
+	assert.NoError(t, err)
+	assert.Regexp(t, `^/sys/fs/bpf/netobserv/links/tcx_[0-9]+_12_egress$`, egress)
+
+	// the pin of an interface only depends on its namespace, index and direction
+	again, err := m.tcxLinkPin(ifaces.Interface{Name: "renamed", Index: 12, NetNS: netns.None()}, tcxEgress)
+	assert.NoError(t, err)
+	assert.Equal(t, egress, again)
+	ingress, err := m.tcxLinkPin(iface, tcxIngress)
+	assert.NoError(t, err)
+	assert.NotEqual(t, egress, ingress)
+}
+
+func TestDecodePerCPUValues(t *testing.T) {
+	// a 12 bytes value is written by the kernel every 16 bytes
+	type value struct{ A, B, C uint32 }
+	assert.Equal(t, 16, perCPUValueStride[value]())
+	buf := make([]byte, 3*16)
+	for i := 0; i < 3; i++ {
+		v := value{A: uint32(i), B: uint32(10 + i), C: uint32(20 + i)}
+		copy(buf[i*16:], unsafe.Slice((*byte)(unsafe.Pointer(&v)), unsafe.Sizeof(v)))
+	}
+	values := make([]value, 3)
+	decodePerCPUValues(values, buf)
+	assert.Equal(t, []value{{0, 10, 20}, {1, 11, 21}, {2, 12, 22}}, values)
+	encoded := make([]byte, len(buf))
+	encodePerCPUValues(values, encoded)
+	assert.Equal(t, buf, encoded)
+
+	// an array walk starting at an index resumes after the previous one
+	assert.Equal(t, perCPUBatchCursor{}, arrayBatchCursor(0))
+	cursor := arrayBatchCursor(8)
+	assert.True(t, cursor.started)
+	assert.Equal(t, uint32(7), *(*uint32)(unsafe.Pointer(&cursor.batch[0])))
+
+	// the buffers of a per-CPU batch hold all the per-CPU values of each entry
+	b := newPerCPUBatch[uint32, value](4, 2)
+	assert.Len(t, b.keys, 4)
+	assert.Len(t, b.values, 8)
+	assert.Len(t, b.valueBuf, 8*16)
+	assert.Equal(t, b.values[2:4], b.valuesOf(1))
+}
+
+func TestReadGlobalCounter(t *testing.T) {
+	skipUnprivileged(t)
+	counters, err := cilium.NewMap(&cilium.MapSpec{
+		Type:       cilium.PerCPUArray,
+		KeySize:    4,
+		ValueSize:  8,
+		MaxEntries: uint32(ebpf.BpfGlobalCountersKeyTMAX_COUNTERS),
+	})
+	require.NoError(t, err)
+	defer counters.Close()
+	nCPU, err := cilium.PossibleCPU()
+	require.NoError(t, err)
+	add := func(key ebpf.BpfGlobalCountersKeyT, perCPU uint64) {
+		values := make([]uint64, nCPU)
+		require.NoError(t, counters.Lookup(uint32(key), values))
+		for i := range values {
+			values[i] += perCPU
+		}
+		require.NoError(t, counters.Put(uint32(key), values))
+	}
+	met := metrics.NewMetrics(&metrics.Settings{})
+	add(ebpf.BpfGlobalCountersKeyTHASHMAP_FLOWS_INSERTED, 3)
+	add(ebpf.BpfGlobalCountersKeyTHASHMAP_FLOWS_DROPPED, 2)
+
+	// the first read reports the values of the counters
+	m := &FlowFetcher{objects: &ebpf.BpfObjects{BpfMaps: ebpf.BpfMaps{GlobalCounters: counters}}, batchLookupSupported: true}
+	m.ReadGlobalCounter(met)
+	assert.EqualValues(t, 3*nCPU, m.flowsInserted)
+	assert.EqualValues(t, 2*nCPU, m.flowsDropped)
+
+	// the next reads report the increments
+	add(ebpf.BpfGlobalCountersKeyTHASHMAP_FLOWS_DROPPED, 1)
+	m.ReadGlobalCounter(met)
+	assert.EqualValues(t, 3*nCPU, m.flowsInserted)
+	assert.EqualValues(t, 3*nCPU, m.flowsDropped)
+
+	// once seeded, e.g. with the bpfman pinned maps, only the increments after the seeding are reported
+	m = &FlowFetcher{objects: &ebpf.BpfObjects{BpfMaps: ebpf.BpfMaps{GlobalCounters: counters}}, batchLookupSupported: true}
+	m.seedGlobalCounters()
+	add(ebpf.BpfGlobalCountersKeyTHASHMAP_FLOWS_DROPPED, 1)
+	m.ReadGlobalCounter(met)
+	assert.Zero(t, m.flowsInserted)
+	assert.EqualValues(t, nCPU, m.flowsDropped)
+}
+
+func TestHotRestartMapsPinDir(t *testing.T) {
+	pinDir := t.TempDir()
+	require.NoError(t, os.Mkdir(path.Join(pinDir, tcxLinksPinDir), 0o700))
+	spec, err := ebpf.LoadBpf()
+	require.NoError(t, err)
+
+	// the maps are pinned in the same directory while their layout doesn't change
+	mapsDir, err := hotRestartMapsPinDir(pinDir, spec)
+	require.NoError(t, err)
+	assert.DirExists(t, mapsDir)
+	again, err := hotRestartMapsPinDir(pinDir, spec)
+	require.NoError(t, err)
+	assert.Equal(t, mapsDir, again)
+
+	// swapping two members of the same size changes the directory, and the previous one is removed
+	value := btf.UnderlyingType(btf.Copy(spec.Maps[aggregatedFlowsMap].Value)).(*btf.Struct)
+	value.Members[0].Offset, value.Members[1].Offset = value.Members[1].Offset, value.Members[0].Offset
+	spec.Maps[aggregatedFlowsMap].Value = value
+	reordered, err := hotRestartMapsPinDir(pinDir, spec)
+	require.NoError(t, err)
+	assert.NotEqual(t, mapsDir, reordered)
+	assert.NoDirExists(t, mapsDir)
+	assert.DirExists(t, reordered)
+	assert.DirExists(t, path.Join(pinDir, tcxLinksPinDir))
+}
+
+func TestUnpinStaleTCXLinks(t *testing.T) {
+	pinDir := t.TempDir()
+	linksDir := path.Join(pinDir, tcxLinksPinDir)
+	require.NoError(t, os.Mkdir(linksDir, 0o700))
+	for _, pin := range []string{"tcx_1_2_egress", "tcx_1_3_egress"} {
+		require.NoError(t, os.WriteFile(path.Join(linksDir, pin), nil, 0o600))
+	}
+	m := &FlowFetcher{pinDir: pinDir, hotRestart: true, tcxLinkPins: map[string]struct{}{}}
+	m.addTCXLinkPin(path.Join(linksDir, "tcx_1_2_egress"))
+
+	// only the pins of the links that have been adopted or attached are kept
+	m.UnpinStaleTCXLinks()
+	assert.FileExists(t, path.Join(linksDir, "tcx_1_2_egress"))
+	assert.NoFileExists(t, path.Join(linksDir, "tcx_1_3_egress"))
+}
@@ -41,21 +41,22 @@ func GetPacketHeader(ci gopacket.CaptureInfo) ([]byte, error) {
 }
 
 func GetPacketBytesWithHeader(time time.Time, data []byte) ([]byte, error) {
+	return AppendPacketWithHeader(nil, time, data, len(data))
+}
+
+// AppendPacketWithHeader appends the 16 byte packet header and the data to the buffer. The
+// length of the packet is greater than the length of the data when it has been truncated.
+func AppendPacketWithHeader(buf []byte, time time.Time, data []byte, length int) ([]byte, error) {
 	ci := gopacket.CaptureInfo{
 		Timestamp:     time,
 		CaptureLength: len(data),
-		Length:        len(data),
-	}
-	if ci.CaptureLength != len(data) {
-		return nil, fmt.Errorf("capture length %d does not match data length %d", ci.CaptureLength, len(data))
-	}
-	if ci.CaptureLength > ci.Length {
-		return nil, fmt.Errorf("invalid capture info %+v:  capture length > length", ci)
+		Length:        max(length, len(data)),
 	}
 	b, err := GetPacketHeader(ci)
 	if err != nil {
 		return nil, fmt.Errorf("error writing packet header: %w", err)
 	}
 	// append 16 byte packet header & data all at once
-	return append(b, data...), nil
+	buf = append(buf, b...)
+	return append(buf, data...), nil
 }